@@ -1,11 +1,56 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
 
 namespace qpp {
+// Encoding of amplitude pages written to disk (see runtime/page_codec.h).
+// Raw keeps plain doubles; Lossless never changes a bit; the other three
+// quantize every component to 16 bits relative to the largest one in its
+// page.
+enum class PageCodec : std::uint8_t { Raw, Lossless, Half, BFloat16, Fixed16 };
+
+// Placement of dense amplitude arrays across NUMA nodes (see runtime/numa.h).
+// FirstTouch leaves each page on the node of the thread that first writes
+// it; Interleave spreads pages round-robin over all nodes; Partition gives
+// node k the k-th contiguous slice, matching a static OpenMP schedule whose
+// threads are pinned in node order.
+enum class NumaPolicy : std::uint8_t { FirstTouch, Interleave, Partition };
+
+// Backing of large amplitude buffers (see runtime/state_allocator.h). Off
+// uses base pages; Transparent aligns the block and asks for transparent
+// huge pages; Explicit maps hugetlbfs pages and falls back to Transparent
+// when the pool is empty.
+enum class HugePages : std::uint8_t { Off, Transparent, Explicit };
+
 struct RuntimeConfig {
   std::size_t disk_limit_mb = 0; // 0 disables disk paging
+  std::size_t disk_page_kb = 1024;   // page size of disk-backed states
+  std::size_t disk_cache_mb = 256;   // pages of a disk-backed state kept in memory
+  bool disk_mmap = false;            // map the page file and let the kernel cache it
+  std::size_t disk_chunk_mb = 64;    // chunk held in memory by out-of-core gate phases
+  bool disk_async = true;            // prefetch and write back pages in the background
+  bool disk_io_uring = true;         // use io_uring for that where the kernel allows it
+  PageCodec disk_codec = PageCodec::Raw;       // page encoding of disk-backed states
+  PageCodec checkpoint_codec = PageCodec::Raw; // encoding of saved states and checkpoints
+  std::size_t fusion_max_qubits = 3; // widest fused gate, 0 disables fusion
+  std::size_t cache_block_kb = 256;  // chunk size for cache-blocked gate runs
+  bool qubit_remap = true;           // move high-qubit clusters into the cache block
+  bool soa_storage = false;          // new wavefunctions start in SoA mode
+  bool lazy_collapse = false;        // defer measurement collapse to the next sweep
+  double sparse_threshold = 0.0;     // non-zero fraction below which states go sparse, 0 disables
+  NumaPolicy numa_policy = NumaPolicy::FirstTouch; // node placement of dense amplitude arrays
+  bool pin_threads = false;          // bind OpenMP threads to CPUs in node order
+  HugePages huge_pages = HugePages::Off; // page size behind state, sparse and pager buffers
+  std::size_t state_pool_mb = 0;     // freed amplitude buffers kept for reuse, 0 disables
+  std::size_t memory_budget_mb = 0;  // cap on register memory, 0 disables
+  std::size_t resonance_cache_mb = 256; // saved resonance zones kept in memory
+  bool resonance_spill = true;       // evicted zones go to compressed files, not away
+  std::size_t checkpoint_max_deltas = 8; // deltas in a checkpoint chain before a new base
+  std::size_t checkpoint_buffer_mb = 1024; // changed pages copied for a background write
 };
 
 extern RuntimeConfig runtime_config;
 void set_disk_limit_mb(std::size_t mb);
+// Accepts 2-5; values outside that range are clamped and 0 disables fusion.
+void set_fusion_max_qubits(std::size_t k);
 } // namespace qpp
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace qpp {
+// Minimal allocator returning `Alignment`-byte aligned storage, so vector
+// kernels can use aligned loads on the start of every array.
+template<typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() noexcept = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        std::size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void* p = std::aligned_alloc(Alignment, bytes ? bytes : Alignment);
+        if (!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) noexcept { std::free(p); }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+} // namespace qpp
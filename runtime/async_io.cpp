@@ -0,0 +1,127 @@
+#include "async_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <unistd.h>
+
+namespace qpp {
+void transfer(int fd, bool write, off_t offset, std::vector<iovec> iov) {
+    std::size_t first = 0;
+    while (first < iov.size()) {
+        int count = static_cast<int>(std::min<std::size_t>(iov.size() - first, IOV_MAX));
+        ssize_t n = write ? pwritev(fd, iov.data() + first, count, offset)
+                          : preadv(fd, iov.data() + first, count, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw std::runtime_error(write ? "DiskPager write failed" : "DiskPager read failed");
+        offset += n;
+        std::size_t left = static_cast<std::size_t>(n);
+        while (left > 0) {
+            if (left >= iov[first].iov_len) {
+                left -= iov[first].iov_len;
+                ++first;
+            } else {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+                iov[first].iov_len -= left;
+                left = 0;
+            }
+        }
+    }
+}
+
+namespace {
+// Workers take requests in submission order and run them with transfer().
+class ThreadIo : public AsyncIo {
+public:
+    ThreadIo(int fd, std::size_t threads) : fd(fd) {
+        for (std::size_t t = 0; t < std::max<std::size_t>(threads, 1); ++t)
+            workers.emplace_back([this] { run(); });
+    }
+    ~ThreadIo() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+
+    const char* name() const override { return "threads"; }
+
+    void submit(Request req) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(req));
+        }
+        work_ready.notify_one();
+    }
+
+    std::size_t wait() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_ready.wait(lock, [this] { return !done.empty(); });
+        auto result = done.front();
+        done.pop_front();
+        if (!result.second)
+            throw std::runtime_error("DiskPager background I/O failed");
+        return result.first;
+    }
+
+private:
+    void run() {
+        for (;;) {
+            Request req;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                req = std::move(queue.front());
+                queue.pop_front();
+            }
+            bool ok = true;
+            try {
+                transfer(fd, req.write, req.offset, req.iov);
+            } catch (const std::runtime_error&) {
+                ok = false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.emplace_back(req.tag, ok);
+            }
+            done_ready.notify_one();
+        }
+    }
+
+    int fd;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable done_ready;
+    std::deque<Request> queue;
+    std::deque<std::pair<std::size_t, bool>> done;
+    bool stopping{false};
+};
+} // namespace
+
+std::unique_ptr<AsyncIo> make_async_io(int fd, bool prefer_uring, std::size_t depth,
+                                       std::size_t threads) {
+#ifdef QPP_HAVE_IO_URING
+    if (prefer_uring) {
+        if (auto io = make_uring_io(fd, depth))
+            return io;
+    }
+#else
+    (void)prefer_uring;
+    (void)depth;
+#endif
+    return std::make_unique<ThreadIo>(fd, threads);
+}
+} // namespace qpp
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace qpp {
+// preadv/pwritev on `fd` until every byte has moved, resuming after short
+// transfers. Throws std::runtime_error on failure.
+void transfer(int fd, bool write, off_t offset, std::vector<iovec> iov);
+
+// Positioned reads and writes on one file, completed in the background.
+// There are two backends: io_uring, when the runtime was built with its
+// header and the kernel lets the process create a ring, and a small pool of
+// threads doing blocking preadv/pwritev.
+class AsyncIo {
+public:
+    struct Request {
+        bool write;
+        off_t offset;
+        std::vector<iovec> iov;
+        // Returned by wait() once the request has finished.
+        std::size_t tag;
+    };
+
+    virtual ~AsyncIo() = default;
+    virtual const char* name() const = 0;
+    // Queue `req`. Its buffers must stay untouched until wait() returns its
+    // tag.
+    virtual void submit(Request req) = 0;
+    // Block until a request has finished and return its tag. Throws
+    // std::runtime_error if that request failed.
+    virtual std::size_t wait() = 0;
+};
+
+// Background I/O on `fd`: io_uring with up to `depth` requests in flight if
+// `prefer_uring` and the kernel allows it, otherwise `threads` workers.
+std::unique_ptr<AsyncIo> make_async_io(int fd, bool prefer_uring, std::size_t depth,
+                                       std::size_t threads = 2);
+
+#ifdef QPP_HAVE_IO_URING
+// nullptr when the kernel refuses to set up a ring.
+std::unique_ptr<AsyncIo> make_uring_io(int fd, std::size_t depth);
+#endif
+} // namespace qpp
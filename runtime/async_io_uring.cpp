@@ -0,0 +1,190 @@
+#include "async_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace qpp {
+namespace {
+// The ring is driven with the raw system calls so the runtime does not
+// depend on liburing; only the kernel header is needed to build.
+int ring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ring_enter(int ring, unsigned submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_enter, ring, submit, min_complete, flags, nullptr, 0));
+}
+
+class UringIo : public AsyncIo {
+public:
+    UringIo(int fd, int ring, const io_uring_params& params) : fd(fd), ring(ring) {
+        entries = params.sq_entries;
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+        sq_base = mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+                       IORING_OFF_SQ_RING);
+        cq_base = single ? sq_base
+                         : mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqe_base = mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sq_base == MAP_FAILED || cq_base == MAP_FAILED || sqe_base == MAP_FAILED) {
+            unmap();
+            if (sqe_base != MAP_FAILED)
+                munmap(sqe_base, sqe_bytes);
+            throw std::runtime_error("io_uring ring mapping failed");
+        }
+        sqes = static_cast<io_uring_sqe*>(sqe_base);
+        char* sq = static_cast<char*>(sq_base);
+        char* cq = static_cast<char*>(cq_base);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~UringIo() override {
+        // The kernel may still be writing into our buffers.
+        while (!in_flight.empty()) {
+            try {
+                reap();
+            } catch (const std::runtime_error&) {
+            }
+        }
+        munmap(sqes, sqe_bytes);
+        unmap();
+        close(ring);
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+    void submit(Request req) override {
+        // Never hold more requests than the submission ring has slots, so the
+        // completion ring (twice as large) cannot overflow.
+        while (in_flight.size() >= entries)
+            finished.push_back(reap());
+        const std::size_t tag = req.tag;
+        Request& held = in_flight.emplace(tag, std::move(req)).first->second;
+        const unsigned tail = *sq_tail;
+        const unsigned slot = tail & sq_mask;
+        io_uring_sqe& sqe = sqes[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = held.write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe.fd = fd;
+        sqe.off = static_cast<__u64>(held.offset);
+        sqe.addr = reinterpret_cast<__u64>(held.iov.data());
+        sqe.len = static_cast<__u32>(held.iov.size());
+        sqe.user_data = tag;
+        sq_array[slot] = slot;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        int ret;
+        do {
+            ret = ring_enter(ring, 1, 0, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            in_flight.erase(tag);
+            throw std::runtime_error("io_uring submit failed");
+        }
+    }
+
+    std::size_t wait() override {
+        if (!finished.empty()) {
+            std::size_t tag = finished.front();
+            finished.pop_front();
+            return tag;
+        }
+        return reap();
+    }
+
+private:
+    void unmap() {
+        if (sq_base != MAP_FAILED && sq_base != nullptr)
+            munmap(sq_base, sq_bytes);
+        if (cq_base != sq_base && cq_base != MAP_FAILED && cq_base != nullptr)
+            munmap(cq_base, cq_bytes);
+    }
+
+    // Take one completion, waiting for it if the ring is empty.
+    std::size_t reap() {
+        for (;;) {
+            const unsigned head = *cq_head;
+            if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe cqe = cqes[head & cq_mask];
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+                auto it = in_flight.find(cqe.user_data);
+                Request req = std::move(it->second);
+                in_flight.erase(it);
+                if (cqe.res < 0)
+                    throw std::runtime_error("DiskPager background I/O failed");
+                // A short transfer is finished in place.
+                std::size_t left = static_cast<std::size_t>(cqe.res);
+                std::size_t first = 0;
+                while (first < req.iov.size() && left >= req.iov[first].iov_len)
+                    left -= req.iov[first++].iov_len;
+                if (first < req.iov.size()) {
+                    req.iov[first].iov_base = static_cast<char*>(req.iov[first].iov_base) + left;
+                    req.iov[first].iov_len -= left;
+                    transfer(fd, req.write, req.offset + cqe.res,
+                             std::vector<iovec>(req.iov.begin() + first, req.iov.end()));
+                }
+                return req.tag;
+            }
+            int ret = ring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+            if (ret < 0 && errno != EINTR)
+                throw std::runtime_error("io_uring wait failed");
+        }
+    }
+
+    int fd;
+    int ring;
+    unsigned entries{0};
+    std::size_t sq_bytes{0}, cq_bytes{0}, sqe_bytes{0};
+    void* sq_base{nullptr};
+    void* cq_base{nullptr};
+    io_uring_sqe* sqes{nullptr};
+    unsigned* sq_tail{nullptr};
+    unsigned sq_mask{0};
+    unsigned* sq_array{nullptr};
+    unsigned* cq_head{nullptr};
+    unsigned* cq_tail{nullptr};
+    unsigned cq_mask{0};
+    io_uring_cqe* cqes{nullptr};
+    std::unordered_map<std::size_t, Request> in_flight;
+    // Completions taken by submit() to make room, not yet handed out.
+    std::deque<std::size_t> finished;
+};
+} // namespace
+
+std::unique_ptr<AsyncIo> make_uring_io(int fd, std::size_t depth) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    unsigned entries = 1;
+    while (entries < depth && entries < 4096)
+        entries *= 2;
+    int ring = ring_setup(entries, &params);
+    if (ring < 0)
+        return nullptr; // no io_uring in this kernel, or blocked by seccomp
+    try {
+        return std::make_unique<UringIo>(fd, ring, params);
+    } catch (const std::runtime_error&) {
+        close(ring);
+        return nullptr;
+    }
+}
+} // namespace qpp
@@ -0,0 +1,373 @@
+#include "checkpoint.h"
+#include "../include/runtime_config.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+
+namespace qpp {
+namespace {
+using Amp = std::complex<double>;
+
+constexpr char kCheckpointMagic[8] = {'Q', 'P', 'P', 'C', 'K', 'P', '1', '\0'};
+constexpr std::uint64_t kMul = 0x9fb21c651e98df25ULL;
+
+// 64-bit hash of `bytes` bytes. Four independent lanes of 64-bit words keep
+// it at memory speed; it only has to tell pages apart, not resist attack.
+std::uint64_t hash_bytes(const void* data, std::size_t bytes) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    std::uint64_t lane[4] = {0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL,
+                             0xa4093822299f31d0ULL, 0x082efa98ec4e6c89ULL};
+    std::size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            std::uint64_t w;
+            std::memcpy(&w, p + i + 8 * k, sizeof(w));
+            lane[k] = (lane[k] ^ w) * kMul;
+            lane[k] ^= lane[k] >> 29;
+        }
+    }
+    std::uint64_t h = bytes;
+    for (int k = 0; k < 4; ++k) {
+        h = (h ^ lane[k]) * kMul;
+        h ^= h >> 32;
+    }
+    for (; i < bytes; ++i) h = (h ^ p[i]) * kMul;
+    return h ^ (h >> 29);
+}
+
+// Stored hash of a page that is all zero, and so has no bytes.
+const std::uint64_t kZeroPageHash = hash_bytes(nullptr, 0);
+
+std::uint64_t fold(std::uint64_t sum, std::uint64_t page) {
+    sum = (sum ^ page) * kMul;
+    return sum ^ (sum >> 31);
+}
+
+std::uint64_t fold_all(const std::vector<std::uint64_t>& hashes) {
+    std::uint64_t sum = 0;
+    for (std::uint64_t h : hashes) sum = fold(sum, h);
+    return sum;
+}
+
+// Hash of a page's amplitudes. Zero pages all hash alike, so a gate that
+// only flips the sign of their zeros does not count as a change; they are
+// stored as zero records either way.
+std::uint64_t page_hash(const Amp* data, std::size_t n) {
+    return page_is_zero(data, n) ? 0 : hash_bytes(data, n * sizeof(Amp));
+}
+
+std::string delta_path(const std::string& base, std::uint64_t sequence) {
+    return base + "." + std::to_string(sequence);
+}
+
+std::uint64_t new_chain_id() {
+    std::random_device rd;
+    std::uint64_t id = (std::uint64_t(rd()) << 32) ^ rd();
+    id ^= static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    return id ? id : 1;
+}
+} // namespace
+
+namespace detail {
+// One file of a chain, written under a temporary name until close().
+class ChainFile {
+public:
+    ChainFile(std::string path, const CheckpointHeader& header, bool base)
+        : path(std::move(path)), header(header), base(base) {
+        ofs.open(this->path + ".tmp", std::ios::binary | std::ios::trunc);
+        // The header is rewritten with the record count and checksum at
+        // the end.
+        ofs.write(reinterpret_cast<const char*>(&this->header), sizeof(this->header));
+    }
+
+    // Store page `index`, setting `stored` to the hash of what was written.
+    void add(std::size_t index, const Amp* data, std::size_t n, std::uint64_t& stored) {
+        if (page_is_zero(data, n)) {
+            stored = kZeroPageHash;
+            // A base leaves zero pages out; a delta records that the page
+            // went to zero.
+            if (base) return;
+            encoded.clear();
+        } else {
+            encode_page(static_cast<PageCodec>(header.codec), data, n, encoded);
+            stored = hash_bytes(encoded.data(), encoded.size());
+        }
+        const std::uint64_t page = index;
+        const std::uint32_t size = static_cast<std::uint32_t>(encoded.size());
+        ofs.write(reinterpret_cast<const char*>(&page), sizeof(page));
+        ofs.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        ofs.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+        ++header.records;
+        written += sizeof(page) + sizeof(size) + encoded.size();
+    }
+
+    bool close(std::uint64_t checksum) {
+        header.checksum = checksum;
+        ofs.seekp(0);
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.close();
+        const std::string tmp = path + ".tmp";
+        if (!ofs || std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    std::size_t bytes() const { return written + sizeof(header); }
+    std::size_t records() const { return header.records; }
+
+private:
+    std::string path;
+    CheckpointHeader header;
+    bool base;
+    std::ofstream ofs;
+    std::vector<std::uint8_t> encoded;
+    std::size_t written{0};
+};
+} // namespace detail
+
+using detail::ChainFile;
+
+bool is_checkpoint_magic(const char* magic) {
+    return std::memcmp(magic, kCheckpointMagic, sizeof(kCheckpointMagic)) == 0;
+}
+
+// What one checkpoint writes: the pages in ascending order and, when the
+// write runs in the background, a packed copy of their amplitudes.
+struct IncrementalCheckpoint::Job {
+    bool base = false;
+    CheckpointHeader header{};
+    std::vector<std::size_t> pages;
+    StateVector<double> data;   // copies of the pages, when written in the background
+};
+
+IncrementalCheckpoint::IncrementalCheckpoint(std::string path) : base_path(std::move(path)) {}
+
+IncrementalCheckpoint::~IncrementalCheckpoint() { wait(); }
+
+bool IncrementalCheckpoint::wait() {
+    if (io.joinable()) io.join();
+    return io_ok;
+}
+
+CheckpointStats IncrementalCheckpoint::stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return counters;
+}
+
+void IncrementalCheckpoint::begin(std::size_t qubits, Job& job) {
+    const bool last_ok = wait();
+    const std::size_t n = std::size_t(1) << qubits;
+    job.base = chain == 0 || !last_ok || count != n ||
+               sequence >= runtime_config.checkpoint_max_deltas;
+    if (count != n) {
+        count = n;
+        page_elems = std::min(kStateFilePage, n);
+        state_hashes.assign(n / page_elems, 0);
+        stored_hashes.assign(n / page_elems, kZeroPageHash);
+    }
+    std::memcpy(job.header.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+    job.header.count = count;
+    job.header.page_elems = page_elems;
+    job.header.qubits = static_cast<std::uint32_t>(qubits);
+    job.header.precision = 8 * sizeof(double);
+    job.header.codec = static_cast<std::uint8_t>(runtime_config.checkpoint_codec);
+}
+
+void IncrementalCheckpoint::claim(Job& job) {
+    if (job.base) {
+        chain = new_chain_id();
+        sequence = 0;
+    } else {
+        ++sequence;
+    }
+    job.header.chain = chain;
+    job.header.sequence = sequence;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    ++(job.base ? counters.bases : counters.deltas);
+}
+
+bool IncrementalCheckpoint::run(Job& job, const Amp* state) {
+    ChainFile file(job.base ? base_path : delta_path(base_path, job.header.sequence), job.header,
+                   job.base);
+    for (std::size_t i = 0; i < job.pages.size(); ++i) {
+        const std::size_t p = job.pages[i];
+        const Amp* data = state ? state + p * page_elems : job.data.data() + i * page_elems;
+        file.add(p, data, page_elems, stored_hashes[p]);
+    }
+    return close_file(job, file);
+}
+
+bool IncrementalCheckpoint::close_file(Job& job, ChainFile& file) {
+    const bool ok = file.close(fold_all(stored_hashes));
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    if (!ok) {
+        ++counters.failures;
+        return false;
+    }
+    counters.pages_written += file.records();
+    counters.pages_skipped += state_hashes.size() - job.pages.size();
+    counters.bytes_written += file.bytes();
+    if (job.base) {
+        // The deltas of the old chain no longer apply.
+        for (std::uint64_t k = 1; std::remove(delta_path(base_path, k).c_str()) == 0; ++k) {}
+    }
+    return true;
+}
+
+bool IncrementalCheckpoint::write(std::size_t qubits, const Amp* state) {
+    Job job;
+    begin(qubits, job);
+    const std::size_t pages = state_hashes.size();
+    std::vector<std::uint64_t> hashes(pages);
+#pragma omp parallel for schedule(static) if (pages > 1)
+    for (std::size_t p = 0; p < pages; ++p)
+        hashes[p] = page_hash(state + p * page_elems, page_elems);
+    for (std::size_t p = 0; p < pages; ++p)
+        if (job.base || hashes[p] != state_hashes[p]) job.pages.push_back(p);
+    if (!job.base && job.pages.size() * 2 > pages) {
+        job.base = true;
+        job.pages.resize(pages);
+        for (std::size_t p = 0; p < pages; ++p) job.pages[p] = p;
+    }
+    state_hashes = std::move(hashes);
+    claim(job);
+
+    if (job.pages.size() * page_elems * sizeof(Amp) > runtime_config.checkpoint_buffer_mb << 20) {
+        // Too much to copy: write straight from the state before returning.
+        return io_ok = run(job, state);
+    }
+    job.data.resize(job.pages.size() * page_elems);
+#pragma omp parallel for schedule(static) if (job.pages.size() > 1)
+    for (std::size_t i = 0; i < job.pages.size(); ++i)
+        std::copy(state + job.pages[i] * page_elems, state + (job.pages[i] + 1) * page_elems,
+                  job.data.data() + i * page_elems);
+    io = std::thread([this, job = std::move(job)]() mutable { io_ok = run(job, nullptr); });
+    return true;
+}
+
+bool IncrementalCheckpoint::write(std::size_t qubits, const StateSource& source) {
+    Job job;
+    begin(qubits, job);
+    claim(job);
+    const std::size_t limit = runtime_config.checkpoint_buffer_mb << 20;
+    std::vector<Amp> page(page_elems);
+    // Opened once the changed pages outgrow the buffer; from then on they
+    // are written as they stream past.
+    std::unique_ptr<ChainFile> file;
+    for (std::size_t p = 0; p < state_hashes.size(); ++p) {
+        for (std::size_t got = 0; got < page_elems;) {
+            const std::size_t n = source(page.data() + got, page_elems - got);
+            if (n == 0) {
+                // The hashes no longer describe what is on disk.
+                return io_ok = false;
+            }
+            got += n;
+        }
+        const std::uint64_t h = page_hash(page.data(), page_elems);
+        if (!job.base && h == state_hashes[p]) continue;
+        state_hashes[p] = h;
+        if (!file && (job.data.size() + page_elems) * sizeof(Amp) > limit) {
+            file = std::make_unique<ChainFile>(
+                job.base ? base_path : delta_path(base_path, job.header.sequence), job.header,
+                job.base);
+            for (std::size_t i = 0; i < job.pages.size(); ++i)
+                file->add(job.pages[i], job.data.data() + i * page_elems, page_elems,
+                          stored_hashes[job.pages[i]]);
+            StateVector<double>().swap(job.data);
+        }
+        job.pages.push_back(p);
+        if (file)
+            file->add(p, page.data(), page_elems, stored_hashes[p]);
+        else
+            job.data.insert(job.data.end(), page.begin(), page.end());
+    }
+    if (file) return io_ok = close_file(job, *file);
+    io = std::thread([this, job = std::move(job)]() mutable { io_ok = run(job, nullptr); });
+    return true;
+}
+
+CheckpointReader::CheckpointReader(const std::string& path) {
+    // The base, then each delta of the same chain in turn.
+    for (std::uint64_t k = 0;; ++k) {
+        File f;
+        f.in.open(k ? delta_path(path, k) : path, std::ios::binary);
+        const CheckpointHeader& h = f.header;
+        if (!f.in || !f.in.read(reinterpret_cast<char*>(&f.header), sizeof(f.header)) ||
+            !is_checkpoint_magic(h.magic) || h.sequence != k || h.precision != 8 * sizeof(double) ||
+            h.codec > static_cast<std::uint8_t>(PageCodec::Fixed16) || h.page_elems == 0 ||
+            h.count % h.page_elems != 0)
+            break;
+        if (k > 0 && (h.chain != files[0].header.chain || h.count != files[0].header.count ||
+                      h.page_elems != files[0].header.page_elems))
+            break;
+        f.left = h.records;
+        if (!advance(f)) break;
+        files.push_back(std::move(f));
+    }
+    if (files.empty()) return;
+    count = files[0].header.count;
+    page_elems = files[0].header.page_elems;
+    good = true;
+}
+
+bool CheckpointReader::advance(File& f) {
+    if (f.left == 0) {
+        f.next_page = UINT64_MAX;
+        return true;
+    }
+    --f.left;
+    return static_cast<bool>(f.in.read(reinterpret_cast<char*>(&f.next_page), sizeof(f.next_page)) &&
+                             f.in.read(reinterpret_cast<char*>(&f.next_size), sizeof(f.next_size)));
+}
+
+bool CheckpointReader::next_page() {
+    current.resize(page_elems);
+    used = 0;
+    // The newest file holding the page wins; older copies are skipped.
+    const File* newest = nullptr;
+    bytes.clear();
+    for (std::size_t i = files.size(); i-- > 0;) {
+        File& f = files[i];
+        if (f.next_page < page) return false;
+        if (f.next_page != page) continue;
+        if (!newest) {
+            newest = &f;
+            bytes.resize(f.next_size);
+            f.in.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        } else {
+            f.in.seekg(f.next_size, std::ios::cur);
+        }
+        if (!f.in || !advance(f)) return false;
+    }
+    std::uint64_t stored = kZeroPageHash;
+    if (bytes.empty()) {
+        std::fill(current.begin(), current.end(), Amp(0.0, 0.0));
+    } else {
+        if (!decode_page(static_cast<PageCodec>(newest->header.codec), bytes.data(), bytes.size(),
+                         current.data(), page_elems))
+            return false;
+        stored = hash_bytes(bytes.data(), bytes.size());
+    }
+    checksum = fold(checksum, stored);
+    ++page;
+    return page * page_elems < count || checksum == files.back().header.checksum;
+}
+
+std::size_t CheckpointReader::read(Amp* out, std::size_t max) {
+    if (!good || delivered == count) return 0;
+    if (used == current.size() && !next_page()) {
+        good = false;
+        return 0;
+    }
+    const std::size_t n = std::min({max, count - delivered, current.size() - used});
+    std::copy(current.begin() + used, current.begin() + used + n, out);
+    used += n;
+    delivered += n;
+    return n;
+}
+} // namespace qpp
@@ -0,0 +1,142 @@
+#pragma once
+#include "page_codec.h"
+#include "state_allocator.h"
+#include "state_file.h"
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace qpp {
+namespace detail { class ChainFile; }
+
+// Incremental checkpoints. A chain is a base file at `path` holding every
+// non-zero page of a state, and deltas `path.1`, `path.2`, ... holding the
+// pages that changed since the file before. Each file is a CheckpointHeader
+// followed by page records in index order: the page index (64 bits), its
+// encoded size (32 bits, 0 for a page that is now all zero) and the bytes in
+// the header's codec. Files are written under a temporary name and renamed
+// once complete, so a chain never ends in a torn file; deltas left over from
+// an older chain do not match its id and are ignored.
+//
+// The checksum in each header covers the whole state the chain holds once
+// that file is applied: a hash of every page's encoded bytes, folded in
+// index order. StateFileReader, and so load_state_file(), reads a chain as
+// one state and fails if the checksum does not match.
+struct CheckpointHeader {
+    char magic[8];
+    std::uint64_t chain;      // shared by a base and its deltas
+    std::uint64_t sequence;   // 0 for the base
+    std::uint64_t count;      // amplitudes
+    std::uint64_t page_elems;
+    std::uint64_t records;
+    std::uint64_t checksum;
+    std::uint32_t qubits;
+    std::uint8_t precision;   // bits per real component
+    std::uint8_t codec;
+    std::uint8_t reserved[2];
+};
+
+// True if `magic` starts a checkpoint chain file.
+bool is_checkpoint_magic(const char* magic);
+
+struct CheckpointStats {
+    std::size_t bases = 0;
+    std::size_t deltas = 0;
+    std::size_t pages_written = 0;
+    std::size_t pages_skipped = 0;   // unchanged since the previous checkpoint
+    std::size_t bytes_written = 0;
+    std::size_t failures = 0;
+};
+
+// Writes a chain for one register. Each write() hashes every page and
+// compares it with the previous checkpoint; the changed pages are copied
+// and written by a background thread, so the caller holds the state only
+// for a pass over memory. If they exceed runtime_config.checkpoint_buffer_mb
+// they are written before write() returns instead of being copied.
+//
+// A new base replaces the chain when there is none yet, the state size
+// changed, the previous write failed, the chain already has
+// runtime_config.checkpoint_max_deltas deltas, or more than half the pages
+// changed (a delta that large saves little over a base, and the old files
+// can then go).
+class IncrementalCheckpoint {
+public:
+    explicit IncrementalCheckpoint(std::string path);
+    ~IncrementalCheckpoint();
+    IncrementalCheckpoint(const IncrementalCheckpoint&) = delete;
+    IncrementalCheckpoint& operator=(const IncrementalCheckpoint&) = delete;
+
+    // Checkpoint the 2^qubits amplitudes at `state`, or streamed from
+    // `source`. The state need not stay unchanged once this returns. False
+    // if the write failed before returning.
+    bool write(std::size_t qubits, const std::complex<double>* state);
+    bool write(std::size_t qubits, const StateSource& source);
+    // Block until the background write has finished; false if it failed.
+    bool wait();
+
+    const std::string& path() const { return base_path; }
+    CheckpointStats stats();
+
+private:
+    struct Job;
+    // Wait for the last write and set up the next one for a state of
+    // `qubits` qubits.
+    void begin(std::size_t qubits, Job& job);
+    // Give the job its place in the chain.
+    void claim(Job& job);
+    // Write the pages of `job`, taking them from `state`, or from the job's
+    // own copy if that is null.
+    bool run(Job& job, const std::complex<double>* state);
+    bool close_file(Job& job, detail::ChainFile& file);
+
+    std::string base_path;
+    std::uint64_t chain{0};
+    std::uint64_t sequence{0};
+    std::size_t count{0};
+    std::size_t page_elems{0};
+    // Per page as of the last checkpoint: the hash of its amplitudes, to
+    // spot changes, and of its encoded bytes, for the checksum.
+    std::vector<std::uint64_t> state_hashes;
+    std::vector<std::uint64_t> stored_hashes;
+    std::thread io;
+    bool io_ok{true};
+    std::mutex stats_mutex;
+    CheckpointStats counters;
+};
+
+// Streams the state a checkpoint chain holds, newest page first.
+class CheckpointReader {
+public:
+    explicit CheckpointReader(const std::string& path);
+    bool ok() const { return good; }
+    std::size_t size() const { return count; }
+    std::size_t read(std::complex<double>* out, std::size_t max);
+
+private:
+    struct File {
+        std::ifstream in;
+        CheckpointHeader header;
+        std::uint64_t left;       // records not yet read
+        std::uint64_t next_page;  // index of the next record
+        std::uint32_t next_size;
+    };
+    bool advance(File& f);
+    bool next_page();
+
+    std::vector<File> files;
+    bool good{false};
+    std::size_t count{0};
+    std::size_t page_elems{0};
+    std::size_t page{0};
+    std::uint64_t checksum{0};
+    std::vector<std::uint8_t> bytes;
+    std::vector<std::complex<double>> current;
+    std::size_t used{0};
+    std::size_t delivered{0};
+};
+} // namespace qpp
@@ -1,92 +1,468 @@
 #include "disk_pager.h"
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace qpp {
-DiskPager::DiskPager(std::size_t size, std::size_t page_elems)
-    : total_size(size), page_size(page_elems),
-      current_page(static_cast<std::size_t>(-1)), dirty(false) {
+namespace {
+// Pages read in one call when a miss continues a sequential scan.
+constexpr std::size_t kReadAhead = 8;
+// Most pages coalesced into one write-back call.
+constexpr std::size_t kWriteBatch = 32;
+
+// Adds the time until it goes out of scope to `total`.
+class StallTimer {
+public:
+  explicit StallTimer(double &total)
+      : total(total), start(std::chrono::steady_clock::now()) {}
+  ~StallTimer() {
+    total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+private:
+  double &total;
+  std::chrono::steady_clock::time_point start;
+};
+} // namespace
+
+DiskPager::DiskPager(std::size_t size, std::size_t page_elems,
+                     std::size_t resident_pages, bool use_mmap, bool async_io,
+                     bool prefer_uring, PageCodec codec)
+    : total_size(size), page_size(std::max<std::size_t>(page_elems, 1)),
+      pages((size + page_size - 1) / page_size), page_codec(codec) {
   char tmpl[] = "/tmp/qpp_pagerXXXXXX";
-  int fd = mkstemp(tmpl);
+  fd = mkstemp(tmpl);
   if (fd == -1) {
     throw std::runtime_error("Failed to create temp file for DiskPager");
   }
-  close(fd);
   path = tmpl;
-  file.open(path,
-            std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open temp file for DiskPager");
+  // The file starts sparse: unwritten pages read back as zeros without
+  // ever touching the disk.
+  const off_t bytes = static_cast<off_t>(size * sizeof(std::complex<double>));
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    std::remove(path.c_str());
+    throw std::runtime_error("Failed to size temp file for DiskPager");
   }
-  buffer.resize(page_size, {0.0, 0.0});
-  // initialize file with zeros
-  std::vector<std::complex<double>> zeros(page_size, {0.0, 0.0});
-  for (std::size_t off = 0; off < size; off += page_size) {
-    std::size_t count = std::min(page_size, size - off);
-    file.write(reinterpret_cast<char *>(zeros.data()),
-               count * sizeof(std::complex<double>));
+  if (use_mmap && bytes > 0) {
+    void *base = mmap(nullptr, static_cast<std::size_t>(bytes),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base != MAP_FAILED) {
+      map_base = base;
+      page_codec = PageCodec::Raw;
+      return;
+    }
+    // Fall back to the frame pool if the mapping is refused.
   }
-  file.flush();
+  const std::size_t count =
+      std::min(std::max<std::size_t>(resident_pages, 2), std::max<std::size_t>(pages, 1));
+  // Frames come from the state allocator: zero, untouched until loaded,
+  // and huge-page backed when runtime_config.huge_pages asks for it.
+  buffer.resize(count * page_size);
+  frames.assign(count, Frame{kNoFrame});
+  page_frame.assign(pages, kNoFrame);
+  stored.assign(pages, 0);
+  if (async_io)
+    io = make_async_io(fd, prefer_uring, count);
 }
 
 DiskPager::~DiskPager() {
-  flush();
-  file.close();
+  // Finish background requests while the file and the frames still exist.
+  io.reset();
+  if (map_base)
+    munmap(map_base, total_size * sizeof(std::complex<double>));
+  close(fd);
   std::remove(path.c_str());
 }
 
-void DiskPager::load_page(std::size_t page_idx) {
-  if (current_page == page_idx)
+std::size_t DiskPager::page_bytes(std::size_t page) const {
+  return std::min(page_size, total_size - page * page_size) * sizeof(std::complex<double>);
+}
+
+std::vector<iovec> DiskPager::dirty_run(std::size_t frame, std::size_t &first) {
+  // Extend the run over resident, dirty, idle neighbours so adjacent pages
+  // go out in a single call.
+  auto eligible = [&](std::size_t page) {
+    std::size_t f = page_frame[page];
+    return f != kNoFrame && frames[f].dirty && frames[f].pins == 0 && !frames[f].busy;
+  };
+  first = frames[frame].page;
+  std::size_t last = first;
+  while (first > 0 && last - first + 1 < kWriteBatch && eligible(first - 1))
+    --first;
+  while (last + 1 < pages && last - first + 1 < kWriteBatch && eligible(last + 1))
+    ++last;
+  std::vector<iovec> iov;
+  for (std::size_t p = first; p <= last; ++p) {
+    std::size_t f = page_frame[p];
+    iov.push_back({frame_data(f), page_bytes(p)});
+    counters.bytes_written += page_bytes(p);
+    // Zero pages are still written, to keep the run whole, but reading
+    // them back can be skipped.
+    const std::size_t count = page_bytes(p) / sizeof(std::complex<double>);
+    stored[p] = page_is_zero(frame_data(f), count) ? 0 : static_cast<std::uint32_t>(page_bytes(p));
+    frames[f].dirty = false;
+  }
+  counters.pages_written += iov.size();
+  return iov;
+}
+
+bool DiskPager::encode_frame(std::size_t frame, std::vector<std::uint8_t> &out) {
+  const std::size_t page = frames[frame].page;
+  const std::size_t count = page_bytes(page) / sizeof(std::complex<double>);
+  frames[frame].dirty = false;
+  ++counters.pages_written;
+  if (page_is_zero(frame_data(frame), count)) {
+    ++counters.zero_pages;
+    return false;
+  }
+  encode_page(page_codec, frame_data(frame), count, out);
+  counters.bytes_written += out.size();
+  return true;
+}
+
+void DiskPager::set_stored(std::size_t page, std::size_t bytes) {
+  if (bytes < stored[page]) {
+    // Best effort: a file system without hole punching keeps the blocks.
+    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              page_offset(page) + static_cast<off_t>(bytes),
+              static_cast<off_t>(stored[page] - bytes));
+  }
+  stored[page] = static_cast<std::uint32_t>(bytes);
+}
+
+void DiskPager::load_page(std::size_t page, std::size_t frame) {
+  const std::size_t count = page_bytes(page) / sizeof(std::complex<double>);
+  if (stored[page] == 0) {
+    std::fill(frame_data(frame), frame_data(frame) + count, std::complex<double>(0.0, 0.0));
     return;
-  flush();
-  current_page = page_idx;
-  file.seekg(page_idx * page_size * sizeof(std::complex<double>));
-  std::size_t count = std::min(page_size, total_size - page_idx * page_size);
-  file.read(reinterpret_cast<char *>(buffer.data()),
-            count * sizeof(std::complex<double>));
+  }
+  scratch.resize(stored[page]);
+  {
+    StallTimer timer(counters.stall_seconds);
+    transfer(fd, false, page_offset(page), {{scratch.data(), scratch.size()}});
+  }
+  counters.bytes_read += scratch.size();
+  if (!decode_page(page_codec, scratch.data(), scratch.size(), frame_data(frame), count))
+    throw std::runtime_error("DiskPager page failed to decode");
 }
 
-void DiskPager::flush() {
-  if (current_page == static_cast<std::size_t>(-1) || !dirty)
+void DiskPager::write_back(std::size_t frame) {
+  if (coded()) {
+    const std::size_t page = frames[frame].page;
+    if (!encode_frame(frame, scratch)) {
+      set_stored(page, 0);
+      return;
+    }
+    {
+      StallTimer timer(counters.stall_seconds);
+      transfer(fd, true, page_offset(page), {{scratch.data(), scratch.size()}});
+    }
+    set_stored(page, scratch.size());
     return;
-  file.seekp(current_page * page_size * sizeof(std::complex<double>));
-  std::size_t count =
-      std::min(page_size, total_size - current_page * page_size);
-  file.write(reinterpret_cast<char *>(buffer.data()),
-             count * sizeof(std::complex<double>));
-  file.flush();
-  dirty = false;
+  }
+  std::size_t first;
+  std::vector<iovec> iov = dirty_run(frame, first);
+  StallTimer timer(counters.stall_seconds);
+  transfer(fd, true, static_cast<off_t>(first * page_size * sizeof(std::complex<double>)), iov);
+}
+
+std::size_t DiskPager::evict_one(bool try_only) {
+  for (;;) {
+    for (std::size_t step = 0; step < 2 * frames.size() + 1; ++step) {
+      std::size_t f = clock_hand;
+      clock_hand = (clock_hand + 1) % frames.size();
+      Frame &fr = frames[f];
+      if (fr.pins > 0 || fr.busy || (try_only && fr.dirty))
+        continue;
+      if (fr.page != kNoFrame && fr.referenced) {
+        fr.referenced = false;
+        continue;
+      }
+      if (fr.page != kNoFrame) {
+        if (fr.dirty)
+          write_back(f);
+        page_frame[fr.page] = kNoFrame;
+        if (last_frame == f)
+          last_page = kNoFrame;
+        fr.page = kNoFrame;
+      }
+      return f;
+    }
+    if (try_only)
+      return kNoFrame;
+    if (in_flight.empty())
+      throw std::runtime_error("DiskPager has no unpinned frame to evict");
+    // Every free frame is waiting on the disk; the next completion frees one.
+    complete_one();
+  }
+}
+
+void DiskPager::complete_one() {
+  StallTimer timer(counters.stall_seconds);
+  auto it = in_flight.find(io->wait());
+  Pending &done = it->second;
+  for (std::size_t f : done.frames)
+    frames[f].busy = false;
+  if (done.decode) {
+    const std::size_t f = done.frames[0];
+    const std::size_t count = page_bytes(frames[f].page) / sizeof(std::complex<double>);
+    if (!decode_page(page_codec, done.encoded.data(), done.encoded.size(), frame_data(f), count)) {
+      in_flight.erase(it);
+      throw std::runtime_error("DiskPager page failed to decode");
+    }
+  }
+  in_flight.erase(it);
+}
+
+void DiskPager::wait_idle() {
+  while (!in_flight.empty())
+    complete_one();
+}
+
+void DiskPager::read_pages(std::size_t first, const std::vector<std::size_t> &targets) {
+  bool any_stored = false;
+  for (std::size_t k = 0; k < targets.size(); ++k)
+    any_stored = any_stored || stored[first + k] != 0;
+  if (coded() || !any_stored) {
+    for (std::size_t k = 0; k < targets.size(); ++k)
+      load_page(first + k, targets[k]);
+  } else {
+    std::vector<iovec> iov;
+    for (std::size_t k = 0; k < targets.size(); ++k) {
+      iov.push_back({frame_data(targets[k]), page_bytes(first + k)});
+      counters.bytes_read += page_bytes(first + k);
+    }
+    StallTimer timer(counters.stall_seconds);
+    transfer(fd, false, page_offset(first), iov);
+  }
+  for (std::size_t k = 0; k < targets.size(); ++k) {
+    Frame &fr = frames[targets[k]];
+    fr.page = first + k;
+    fr.dirty = false;
+    fr.referenced = k == 0;
+    page_frame[first + k] = targets[k];
+  }
+  counters.pages_read += targets.size();
+  counters.read_ahead += targets.size() - 1;
+}
+
+std::size_t DiskPager::find_frame(std::size_t page) {
+  if (page_frame[page] != kNoFrame) {
+    const std::size_t f = page_frame[page];
+    // A prefetched page may still be on its way in, and a page being
+    // written behind must not change under the write.
+    while (frames[f].busy)
+      complete_one();
+    ++counters.hits;
+    frames[f].referenced = true;
+    return f;
+  }
+  ++counters.misses;
+  std::size_t count = 1;
+  if (last_miss != kNoFrame && page == last_miss + 1) {
+    std::size_t limit = std::min({kReadAhead, frames.size() / 2, pages - page});
+    while (count < limit && page_frame[page + count] == kNoFrame)
+      ++count;
+  }
+  std::vector<std::size_t> targets;
+  for (std::size_t k = 0; k < count; ++k) {
+    targets.push_back(evict_one());
+    ++frames[targets.back()].pins; // keep it out of the next eviction
+  }
+  for (std::size_t f : targets)
+    --frames[f].pins;
+  read_pages(page, targets);
+  last_miss = page + count - 1;
+  return targets[0];
 }
 
 std::complex<double> DiskPager::read(std::size_t idx) {
-  std::size_t page_idx = idx / page_size;
-  load_page(page_idx);
-  std::size_t local = idx % page_size;
-  return buffer[local];
+  std::size_t page = idx / page_size;
+  if (map_base)
+    return static_cast<std::complex<double> *>(map_base)[idx];
+  if (page != last_page) {
+    last_frame = find_frame(page);
+    last_page = page;
+  }
+  return frame_data(last_frame)[idx % page_size];
 }
 
 void DiskPager::write(std::size_t idx, const std::complex<double> &v) {
-  std::size_t page_idx = idx / page_size;
-  load_page(page_idx);
-  std::size_t local = idx % page_size;
-  buffer[local] = v;
-  dirty = true;
+  std::size_t page = idx / page_size;
+  if (map_base) {
+    static_cast<std::complex<double> *>(map_base)[idx] = v;
+    return;
+  }
+  if (page != last_page) {
+    last_frame = find_frame(page);
+    last_page = page;
+  }
+  frames[last_frame].dirty = true;
+  frame_data(last_frame)[idx % page_size] = v;
+}
+
+std::complex<double> *DiskPager::acquire(std::size_t page, bool dirty) {
+  if (map_base) {
+    // Ask the kernel for the next page while this one is being worked on.
+    if (page + 1 < pages) {
+      std::size_t bytes = page_size * sizeof(std::complex<double>);
+      madvise(static_cast<char *>(map_base) + (page + 1) * bytes, page_bytes(page + 1),
+              MADV_WILLNEED);
+    }
+    return static_cast<std::complex<double> *>(map_base) + page * page_size;
+  }
+  std::size_t f = find_frame(page);
+  ++frames[f].pins;
+  if (dirty)
+    frames[f].dirty = true;
+  return frame_data(f);
+}
+
+std::complex<double> *DiskPager::overwrite(std::size_t page) {
+  if (map_base || page_frame[page] != kNoFrame)
+    return acquire(page, true);
+  std::size_t f = evict_one();
+  Frame &fr = frames[f];
+  fr.page = page;
+  fr.pins = 1;
+  fr.referenced = true;
+  fr.dirty = true;
+  page_frame[page] = f;
+  return frame_data(f);
+}
+
+void DiskPager::prefetch(std::size_t page) {
+  if (page >= pages)
+    return;
+  if (map_base) {
+    madvise(static_cast<char *>(map_base) + page * page_size * sizeof(std::complex<double>),
+            page_bytes(page), MADV_WILLNEED);
+    return;
+  }
+  // A page with nothing stored is zero-filled on demand without I/O.
+  if (!io || page_frame[page] != kNoFrame || stored[page] == 0)
+    return;
+  // Only take a clean frame: writing one back first would stall the caller
+  // the prefetch is meant to help.
+  std::size_t f = evict_one(true);
+  if (f == kNoFrame)
+    return;
+  Frame &fr = frames[f];
+  fr.page = page;
+  fr.busy = true;
+  fr.dirty = false;
+  fr.referenced = true;
+  page_frame[page] = f;
+  ++counters.pages_read;
+  const std::size_t tag = next_tag++;
+  Pending &req = in_flight[tag];
+  req.frames = {f};
+  iovec target{frame_data(f), page_bytes(page)};
+  if (coded()) {
+    req.encoded.resize(stored[page]);
+    req.decode = true;
+    target = {req.encoded.data(), req.encoded.size()};
+  }
+  counters.bytes_read += target.iov_len;
+  io->submit({false, page_offset(page), {target}, tag});
+  ++counters.prefetched;
+}
+
+void DiskPager::write_behind(std::size_t page) {
+  if (page >= pages)
+    return;
+  const off_t offset = static_cast<off_t>(page * page_size * sizeof(std::complex<double>));
+  if (map_base) {
+    sync_file_range(fd, offset, static_cast<off_t>(page_bytes(page)), SYNC_FILE_RANGE_WRITE);
+    return;
+  }
+  const std::size_t f = page_frame[page];
+  if (!io || f == kNoFrame || !frames[f].dirty || frames[f].pins > 0 || frames[f].busy)
+    return;
+  if (coded()) {
+    std::vector<std::uint8_t> encoded;
+    if (!encode_frame(f, encoded)) {
+      set_stored(page, 0);
+      return;
+    }
+    set_stored(page, encoded.size());
+    frames[f].busy = true;
+    last_page = kNoFrame;
+    const std::size_t tag = next_tag++;
+    Pending &req = in_flight[tag];
+    req.frames = {f};
+    req.encoded = std::move(encoded);
+    io->submit({true, offset, {{req.encoded.data(), req.encoded.size()}}, tag});
+    return;
+  }
+  std::size_t first;
+  std::vector<iovec> iov = dirty_run(f, first);
+  std::vector<std::size_t> covered;
+  for (std::size_t p = first; p < first + iov.size(); ++p) {
+    covered.push_back(page_frame[p]);
+    frames[page_frame[p]].busy = true;
+  }
+  // read()/write() must look the page up again rather than touch it while
+  // it is being written.
+  last_page = kNoFrame;
+  const std::size_t tag = next_tag++;
+  in_flight[tag].frames = std::move(covered);
+  io->submit({true, static_cast<off_t>(first * page_size * sizeof(std::complex<double>)),
+              std::move(iov), tag});
+}
+
+void DiskPager::release(std::size_t page) {
+  if (map_base)
+    return;
+  std::size_t f = page_frame[page];
+  if (f != kNoFrame && frames[f].pins > 0)
+    --frames[f].pins;
+}
+
+std::size_t DiskPager::file_bytes() const {
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    return 0;
+  return static_cast<std::size_t>(st.st_blocks) * 512;
+}
+
+void DiskPager::flush() {
+  if (map_base) {
+    msync(map_base, total_size * sizeof(std::complex<double>), MS_ASYNC);
+    return;
+  }
+  wait_idle();
+  std::vector<std::size_t> dirty;
+  for (std::size_t f = 0; f < frames.size(); ++f)
+    if (frames[f].page != kNoFrame && frames[f].dirty && frames[f].pins == 0)
+      dirty.push_back(f);
+  std::sort(dirty.begin(), dirty.end(),
+            [&](std::size_t a, std::size_t b) { return frames[a].page < frames[b].page; });
+  for (std::size_t f : dirty)
+    if (frames[f].dirty)
+      write_back(f);
 }
 
 void DiskPager::reset() {
-  flush();
-  file.seekp(0);
-  std::vector<std::complex<double>> zeros(page_size, {0.0, 0.0});
-  for (std::size_t off = 0; off < total_size; off += page_size) {
-    std::size_t count = std::min(page_size, total_size - off);
-    file.write(reinterpret_cast<char *>(zeros.data()),
-               count * sizeof(std::complex<double>));
-  }
-  file.flush();
-  current_page = static_cast<std::size_t>(-1);
-  dirty = false;
+  wait_idle();
+  for (auto &fr : frames) {
+    if (fr.page != kNoFrame)
+      page_frame[fr.page] = kNoFrame;
+    fr = Frame{kNoFrame};
+  }
+  std::fill(stored.begin(), stored.end(), 0);
+  last_page = last_miss = kNoFrame;
+  // Truncating drops every block, so the file is sparse and all zero again.
+  const off_t bytes = static_cast<off_t>(total_size * sizeof(std::complex<double>));
+  if (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0)
+    throw std::runtime_error("Failed to reset DiskPager file");
 }
 
 } // namespace qpp
@@ -1,31 +1,182 @@
 #pragma once
+#include "async_io.h"
+#include "page_codec.h"
+#include "state_allocator.h"
 #include <complex>
 #include <cstddef>
-#include <fstream>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace qpp {
+// Amplitude array kept in a temporary file and cached page by page. Two
+// modes:
+//  - buffered (default): a fixed pool of `resident_pages` frames replaced
+//    with CLOCK. Dirty pages are written back on eviction together with
+//    their dirty neighbours. A miss that continues a sequential scan reads
+//    the following pages in the same call.
+//  - mapped: the file is mmap'ed and the kernel does the caching, guided by
+//    madvise for sequential access and read-ahead.
+// With `async_io`, prefetch() and write_behind() move pages in the
+// background (see AsyncIo), so a caller streaming through the state computes
+// on one page while the next is read and the previous one written.
+// The pager tracks which pages hold data on disk: one that was never
+// written, or last written all zero, gets a zero-filled frame without any
+// I/O, and passes over the state can skip it (known_zero()).
+// A `codec` other than Raw stores every page encoded (see page_codec.h) in
+// the buffered mode: pages move one at a time, all-zero pages are only
+// marked in a table and their blocks given back to the file system, and
+// lossy codecs perturb each page as it is written. The mapped mode ignores
+// the codec.
 class DiskPager {
 public:
-  DiskPager(std::size_t size, std::size_t page_elems = 1024);
+  struct Stats {
+    std::size_t hits{0};
+    std::size_t misses{0};
+    std::size_t pages_read{0};    // including read-ahead
+    std::size_t pages_written{0};
+    std::size_t read_ahead{0};    // pages read before they were asked for
+    std::size_t prefetched{0};    // pages read in the background
+    std::size_t bytes_read{0};    // from the file, after encoding
+    std::size_t bytes_written{0};
+    std::size_t zero_pages{0};    // written as all zero, taking no space
+    double stall_seconds{0.0};    // caller blocked on page I/O
+    double compute_seconds{0.0};  // reported through add_compute()
+  };
+
+  DiskPager(std::size_t size, std::size_t page_elems = 1024,
+            std::size_t resident_pages = 64, bool use_mmap = false,
+            bool async_io = false, bool prefer_uring = true,
+            PageCodec codec = PageCodec::Raw);
   ~DiskPager();
+  DiskPager(const DiskPager &) = delete;
+  DiskPager &operator=(const DiskPager &) = delete;
 
   std::size_t size() const { return total_size; }
+  std::size_t page_elems() const { return page_size; }
+  std::size_t page_count() const { return pages; }
+  bool mapped() const { return map_base != nullptr; }
+  // Frames in the pool; 0 when mapped.
+  std::size_t frame_count() const { return frames.size(); }
+  // "io_uring", "threads" or "sync".
+  const char *io_backend() const { return io ? io->name() : "sync"; }
+  PageCodec codec() const { return page_codec; }
+  const Stats &stats() const { return counters; }
+  // Memory held by the frame pool; mapped pages are owned by the kernel.
+  std::size_t resident_bytes() const {
+    return buffer.size() * sizeof(std::complex<double>);
+  }
+  // Disk space taken by the page file; holes left by zero or shrunk pages
+  // are not counted.
+  std::size_t file_bytes() const;
+
+  // True if `page` holds only zeros and the pager knows it without looking:
+  // it was never written, or its last write-back was all zero, and no
+  // resident copy has changed since. Always false when mapped.
+  bool known_zero(std::size_t page) const {
+    if (map_base)
+      return false;
+    const std::size_t f = page_frame[page];
+    return stored[page] == 0 && (f == kNoFrame || !frames[f].dirty);
+  }
 
   std::complex<double> read(std::size_t idx);
   void write(std::size_t idx, const std::complex<double> &v);
+
+  // Pin page `page` in memory and return its first amplitude. The pointer
+  // stays valid until the matching release(); `dirty` schedules the page for
+  // write-back. At most resident_pages - 1 pages may be pinned at once.
+  std::complex<double> *acquire(std::size_t page, bool dirty);
+  // acquire() for a page the caller is about to overwrite completely: a
+  // page that is not resident gets a frame without being read first.
+  std::complex<double> *overwrite(std::size_t page);
+  void release(std::size_t page);
+
+  // Start reading `page` in the background if it is not resident and a
+  // frame is free to take it. Without async I/O this is a no-op for the
+  // buffered mode and an madvise for the mapped one.
+  void prefetch(std::size_t page);
+  // Start writing `page` back in the background if it is dirty and
+  // unpinned, together with dirty neighbours. It stays resident.
+  void write_behind(std::size_t page);
+  // Record time the caller spent computing on pages, for stats().
+  void add_compute(double seconds) { counters.compute_seconds += seconds; }
+
+  // Write every dirty page back, adjacent pages in one call.
   void flush();
+  // Zero the whole array.
   void reset();
 
 private:
-  void load_page(std::size_t page_idx);
-  std::fstream file;
+  struct Frame {
+    std::size_t page;
+    std::size_t pins{0};
+    bool referenced{false};
+    bool dirty{false};
+    bool busy{false}; // background read or write in flight
+  };
+  static constexpr std::size_t kNoFrame = static_cast<std::size_t>(-1);
+
+  std::size_t page_bytes(std::size_t page) const;
+  off_t page_offset(std::size_t page) const {
+    return static_cast<off_t>(page * page_size * sizeof(std::complex<double>));
+  }
+  bool coded() const { return page_codec != PageCodec::Raw; }
+  std::complex<double> *frame_data(std::size_t frame) {
+    return buffer.data() + frame * page_size;
+  }
+  std::size_t find_frame(std::size_t page);
+  // Free a frame, writing it back first if dirty. Returns kNoFrame instead
+  // of waiting or throwing when `try_only` and every frame is in use.
+  std::size_t evict_one(bool try_only = false);
+  std::vector<iovec> dirty_run(std::size_t frame, std::size_t &first);
+  void write_back(std::size_t frame);
+  // Take one background completion; wait_idle() takes all of them.
+  void complete_one();
+  void wait_idle();
+  void read_pages(std::size_t first, const std::vector<std::size_t> &frames);
+  // Decode page `page` into `frame`, zero-filling it if nothing is stored,
+  // and encode `frame` into `out`, returning false instead if the page is
+  // all zero. Only the latter needs a codec.
+  void load_page(std::size_t page, std::size_t frame);
+  bool encode_frame(std::size_t frame, std::vector<std::uint8_t> &out);
+  // Record the new stored size of `page`, giving back the blocks past it.
+  void set_stored(std::size_t page, std::size_t bytes);
+
+  int fd{-1};
   std::string path;
   std::size_t total_size;
   std::size_t page_size;
-  std::size_t current_page;
-  std::vector<std::complex<double>> buffer;
-  bool dirty;
+  std::size_t pages;
+  void *map_base{nullptr};
+
+  StateVector<double> buffer;
+  std::vector<Frame> frames;
+  std::vector<std::size_t> page_frame;  // kNoFrame when not resident
+  std::size_t clock_hand{0};
+  std::size_t last_miss{kNoFrame};
+  std::size_t last_page{kNoFrame};      // page of the last read()/write()
+  std::size_t last_frame{kNoFrame};
+  Stats counters;
+
+  PageCodec page_codec;
+  // Bytes of each page in its slot: the page size for raw pages, the
+  // encoded size for coded ones, and 0 if it is all zero.
+  std::vector<std::uint32_t> stored;
+  std::vector<std::uint8_t> scratch;
+
+  std::unique_ptr<AsyncIo> io;
+  struct Pending {
+    std::vector<std::size_t> frames;
+    // Coded pages: the encoded bytes, decoded into the frame on completion
+    // of a read.
+    std::vector<std::uint8_t> encoded;
+    bool decode{false};
+  };
+  // Background requests by tag.
+  std::unordered_map<std::size_t, Pending> in_flight;
+  std::size_t next_tag{0};
 };
 } // namespace qpp
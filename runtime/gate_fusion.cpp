@@ -0,0 +1,259 @@
+#include "gate_fusion.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace qpp {
+
+static bool is_diagonal_op(const std::vector<std::string>& ins) {
+    if (ins.size() == 3 && (ins[0] == "Z" || ins[0] == "S" || ins[0] == "T"))
+        return true;
+    return ins.size() == 5 && ins[0] == "CZ" && ins[1] == ins[3];
+}
+
+void fuse_diagonal_runs(std::vector<std::vector<std::string>>& ops) {
+    std::vector<std::vector<std::string>> out;
+    for (std::size_t i = 0; i < ops.size();) {
+        std::size_t end = i;
+        while (end < ops.size() && is_diagonal_op(ops[end]) &&
+               ops[end][1] == ops[i][1])
+            ++end;
+        if (end - i >= 2)
+            out.push_back({"DIAG", std::to_string(end - i)});
+        if (end == i) end = i + 1;
+        for (; i < end; ++i) out.push_back(ops[i]);
+    }
+    ops.swap(out);
+}
+
+// Qubit operands of a fusable gate on a single register, empty otherwise.
+static std::vector<std::size_t> gate_qubits(const std::vector<std::string>& ins) {
+    static const std::vector<std::string> single = {"H", "X", "Y", "Z", "S", "T"};
+    if (ins.size() == 3 && std::find(single.begin(), single.end(), ins[0]) != single.end())
+        return {std::stoul(ins[2])};
+    if (ins.size() == 5 && (ins[0] == "CNOT" || ins[0] == "CZ" || ins[0] == "SWAP") &&
+        ins[1] == ins[3])
+        return {std::stoul(ins[2]), std::stoul(ins[4])};
+    if (ins.size() == 7 && ins[0] == "CCX" && ins[1] == ins[3] && ins[1] == ins[5])
+        return {std::stoul(ins[2]), std::stoul(ins[4]), std::stoul(ins[6])};
+    return {};
+}
+
+void fuse_gates(std::vector<std::vector<std::string>>& ops, std::size_t max_qubits) {
+    if (max_qubits < 2) return;
+    std::vector<std::vector<std::string>> out;
+    std::vector<std::vector<std::string>> block;
+    std::vector<std::size_t> block_qubits;
+    auto flush = [&]() {
+        if (block.size() >= 2)
+            out.push_back({"FUSE", std::to_string(block.size())});
+        for (auto& ins : block) out.push_back(std::move(ins));
+        block.clear();
+        block_qubits.clear();
+    };
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const auto& ins = ops[i];
+        if (!ins.empty() && ins[0] == "DIAG" && ins.size() == 2) {
+            flush();
+            std::size_t count = std::min<std::size_t>(std::stoul(ins[1]), ops.size() - i - 1);
+            for (std::size_t j = 0; j <= count; ++j) out.push_back(ops[i + j]);
+            i += count;
+            continue;
+        }
+        auto qs = gate_qubits(ins);
+        if (qs.empty()) {
+            flush();
+            out.push_back(ins);
+            continue;
+        }
+        if (!block.empty() && block.front()[1] != ins[1]) flush();
+        std::vector<std::size_t> merged = block_qubits;
+        for (auto q : qs)
+            if (std::find(merged.begin(), merged.end(), q) == merged.end()) merged.push_back(q);
+        if (merged.size() > max_qubits) {
+            flush();
+            merged = qs;
+        }
+        block.push_back(ins);
+        block_qubits = std::move(merged);
+    }
+    flush();
+    ops.swap(out);
+}
+
+static void apply_local_gate(Wavefunction<>& wf, const std::string& g,
+                             const std::vector<std::size_t>& q) {
+    if (g == "H") wf.apply_h(q[0]);
+    else if (g == "X") wf.apply_x(q[0]);
+    else if (g == "Y") wf.apply_y(q[0]);
+    else if (g == "Z") wf.apply_z(q[0]);
+    else if (g == "S") wf.apply_s(q[0]);
+    else if (g == "T") wf.apply_t(q[0]);
+    else if (g == "CNOT") wf.apply_cnot(q[0], q[1]);
+    else if (g == "CZ") wf.apply_cz(q[0], q[1]);
+    else if (g == "SWAP") wf.apply_swap(q[0], q[1]);
+    else if (g == "CCX") wf.apply_ccnot(q[0], q[1], q[2]);
+}
+
+// Fused blocks kept by fused_matrix. Loops repeat the same few blocks, so a
+// small cache catches them; a long straight-line circuit would otherwise fill
+// memory with matrices that are never used again.
+constexpr std::size_t kFusedCacheEntries = 256;
+
+GateMatrix<double> fused_matrix(const std::vector<std::vector<std::string>>& ops) {
+    struct Entry {
+        GateMatrix<double> gate;
+        std::list<std::string>::iterator lru;
+    };
+    static std::unordered_map<std::string, Entry> cache;
+    static std::list<std::string> lru;
+    static std::mutex cache_mtx;
+    std::string key;
+    for (const auto& ins : ops) {
+        for (const auto& tok : ins) {
+            key += tok;
+            key += ' ';
+        }
+        key += ';';
+    }
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return it->second.gate;
+        }
+    }
+
+    GateMatrix<double> fused;
+    std::vector<std::vector<std::size_t>> local;
+    for (const auto& ins : ops) {
+        std::vector<std::size_t> lq;
+        for (auto q : gate_qubits(ins)) {
+            auto it = std::find(fused.qubits.begin(), fused.qubits.end(), q);
+            if (it == fused.qubits.end()) {
+                fused.qubits.push_back(q);
+                it = fused.qubits.end() - 1;
+            }
+            lq.push_back(static_cast<std::size_t>(it - fused.qubits.begin()));
+        }
+        local.push_back(std::move(lq));
+    }
+    // Column c of the block unitary is the image of basis state |c>.
+    std::size_t dim = std::size_t(1) << fused.qubits.size();
+    fused.matrix.assign(dim * dim, 0.0);
+    Wavefunction<> col(fused.qubits.size());
+    for (std::size_t c = 0; c < dim; ++c) {
+        col.state.assign(dim, 0.0);
+        col.state[c] = 1.0;
+        for (std::size_t g = 0; g < ops.size(); ++g)
+            if (!local[g].empty()) apply_local_gate(col, ops[g][0], local[g]);
+        for (std::size_t r = 0; r < dim; ++r) fused.matrix[r * dim + c] = col.state[r];
+    }
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    if (cache.count(key)) return fused; // built by another thread meanwhile
+    while (cache.size() >= kFusedCacheEntries) {
+        cache.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(key);
+    cache.emplace(key, Entry{fused, lru.begin()});
+    return fused;
+}
+
+// Length of the unit starting at ops[i]: a marker plus its run, or one op.
+static std::size_t unit_length(const std::vector<std::vector<std::string>>& ops,
+                               std::size_t i) {
+    const auto& ins = ops[i];
+    if (ins.size() == 2 && (ins[0] == "FUSE" || ins[0] == "DIAG"))
+        return 1 + std::min<std::size_t>(std::stoul(ins[1]), ops.size() - i - 1);
+    return 1;
+}
+
+void block_low_qubit_runs(std::vector<std::vector<std::string>>& ops,
+                          std::size_t block_qubits) {
+    std::vector<std::vector<std::string>> out;
+    std::size_t i = 0;
+    while (i < ops.size()) {
+        // Extend the run while every unit is a gate on the same register
+        // with all of its qubits below the block boundary or, when qubit
+        // remapping may move them there, while the run touches no more
+        // qubits than the block holds.
+        std::size_t end = i, units = 0;
+        std::string reg;
+        std::vector<std::size_t> used;
+        while (end < ops.size()) {
+            std::size_t len = unit_length(ops, end);
+            std::size_t first = len > 1 ? end + 1 : end;
+            bool ok = true;
+            for (std::size_t j = first; ok && j < end + len; ++j) {
+                auto qs = gate_qubits(ops[j]);
+                ok = !qs.empty() && (reg.empty() || ops[j][1] == reg);
+                for (auto q : qs) {
+                    if (std::find(used.begin(), used.end(), q) == used.end()) used.push_back(q);
+                    ok = ok && (q < block_qubits || runtime_config.qubit_remap);
+                }
+                ok = ok && used.size() <= block_qubits;
+                if (ok) reg = ops[j][1];
+            }
+            if (!ok) break;
+            end += len;
+            ++units;
+        }
+        if (units >= 2) {
+            out.push_back({"BLOCK", std::to_string(end - i)});
+        } else {
+            end = i + unit_length(ops, i);
+        }
+        for (; i < end; ++i) out.push_back(ops[i]);
+    }
+    ops.swap(out);
+}
+
+std::vector<GateMatrix<double>> block_matrices(
+    const std::vector<std::vector<std::string>>& ops) {
+    std::vector<GateMatrix<double>> gates;
+    for (std::size_t i = 0; i < ops.size();) {
+        std::size_t len = unit_length(ops, i);
+        if (ops[i][0] == "FUSE" && len > 1) {
+            gates.push_back(fused_matrix({ops.begin() + i + 1, ops.begin() + i + len}));
+        } else {
+            // Diagonal gates, inside a DIAG run or not, keep their phases so
+            // apply_blocked multiplies them in instead of running a dense
+            // matrix over every amplitude pair.
+            for (std::size_t j = (len > 1 ? i + 1 : i); j < i + len; ++j) {
+                if (is_diagonal_op(ops[j])) {
+                    auto d = diagonal_gates({ops[j]});
+                    gates.push_back({d[0].qubits, {}, d[0].phases});
+                } else {
+                    gates.push_back(fused_matrix({ops[j]}));
+                }
+            }
+        }
+        i += len;
+    }
+    return gates;
+}
+
+std::vector<DiagonalGate<double>> diagonal_gates(
+    const std::vector<std::vector<std::string>>& ops) {
+    std::vector<DiagonalGate<double>> gates;
+    for (const auto& ins : ops) {
+        if (!is_diagonal_op(ins)) continue;
+        if (ins[0] == "CZ") {
+            gates.push_back({{std::stoul(ins[2]), std::stoul(ins[4])},
+                             {1.0, 1.0, 1.0, -1.0}});
+            continue;
+        }
+        std::complex<double> phase = -1.0;
+        if (ins[0] == "S") phase = {0.0, 1.0};
+        else if (ins[0] == "T") phase = std::exp(std::complex<double>(0, M_PI / 4));
+        gates.push_back({{std::stoul(ins[2])}, {1.0, phase}});
+    }
+    return gates;
+}
+
+} // namespace qpp
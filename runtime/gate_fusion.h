@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "wavefunction.h"
+
+namespace qpp {
+// Prefix every run of two or more consecutive diagonal gates (Z, S, T, CZ)
+// on the same register with a `DIAG n` marker so the interpreter can apply
+// the whole run in a single pass over the state.
+void fuse_diagonal_runs(std::vector<std::vector<std::string>>& ops);
+
+// Greedily merge neighbouring gates on the same register, including CNOT,
+// CZ, SWAP and CCX, into blocks touching at most `max_qubits` qubits. Each
+// block of two or more gates is prefixed with a `FUSE n` marker. Existing
+// DIAG runs are left untouched.
+void fuse_gates(std::vector<std::vector<std::string>>& ops, std::size_t max_qubits);
+
+// Multiply a run of IR gate instructions into one dense unitary over the
+// qubits they touch, in order of first use. The most recently used blocks
+// are cached by instruction text, so blocks repeated in loops are only built
+// once. Safe to call from several threads.
+GateMatrix<double> fused_matrix(const std::vector<std::vector<std::string>>& ops);
+
+// Prefix runs of two or more gates, FUSE blocks or DIAG runs on one register
+// whose qubits all lie below `block_qubits` (or, with
+// runtime_config.qubit_remap, that touch at most `block_qubits` distinct
+// qubits) with a `BLOCK n` marker (n counts
+// every instruction in the run, nested markers included) so they execute
+// through Wavefunction::apply_blocked.
+void block_low_qubit_runs(std::vector<std::vector<std::string>>& ops,
+                          std::size_t block_qubits);
+
+// Gate matrices for the instructions covered by a BLOCK marker. Diagonal
+// instructions come back with their phases only (see GateMatrix).
+std::vector<GateMatrix<double>> block_matrices(
+    const std::vector<std::vector<std::string>>& ops);
+
+// Build diagonal gate descriptors for a run of IR diagonal instructions.
+std::vector<DiagonalGate<double>> diagonal_gates(
+    const std::vector<std::vector<std::string>>& ops);
+}
@@ -21,7 +21,7 @@ __global__ void single_qubit_kernel(cuDoubleComplex* state, std::size_t step, st
     }
 }
 
-void gpu_apply_single_qubit_gate(std::vector<std::complex<double>>& st,
+void gpu_apply_single_qubit_gate(StateVector<double>& st,
                                  std::size_t target,
                                  const std::complex<double> mat[2][2]) {
     std::size_t size = st.size();
@@ -51,7 +51,7 @@ __global__ void cnot_kernel(cuDoubleComplex* state, std::size_t size, std::size_
     }
 }
 
-void gpu_apply_cnot(std::vector<std::complex<double>>& st,
+void gpu_apply_cnot(StateVector<double>& st,
                     std::size_t control, std::size_t target) {
     std::size_t size = st.size();
     cuDoubleComplex* d_state;
@@ -1,20 +1,21 @@
 #pragma once
+#include "state_allocator.h"
 #include <complex>
 #include <vector>
 #include <cstddef>
 
 namespace qpp {
 #ifdef USE_CUDA
-void gpu_apply_single_qubit_gate(std::vector<std::complex<double>>& st,
+void gpu_apply_single_qubit_gate(StateVector<double>& st,
                                  std::size_t target,
                                  const std::complex<double> mat[2][2]);
-void gpu_apply_cnot(std::vector<std::complex<double>>& st,
+void gpu_apply_cnot(StateVector<double>& st,
                     std::size_t control, std::size_t target);
 #else
-inline void gpu_apply_single_qubit_gate(std::vector<std::complex<double>>& st,
+inline void gpu_apply_single_qubit_gate(StateVector<double>& st,
                                         std::size_t target,
                                         const std::complex<double> mat[2][2]) {}
-inline void gpu_apply_cnot(std::vector<std::complex<double>>& st,
+inline void gpu_apply_cnot(StateVector<double>& st,
                            std::size_t control, std::size_t target) {}
 #endif
 } // namespace qpp
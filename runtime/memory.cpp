@@ -1,38 +1,64 @@
 #include "memory.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdint>
 #include <stdexcept>
 #include <mutex>
-#include <fstream>
 
 namespace qpp {
-int MemoryManager::create_qregister(size_t n) {
+MemoryManager::~MemoryManager() {
+    for (const auto& r : retired_qregs) delete r.second;
+    for (const auto& r : retired_cregs) delete r.second;
+}
+
+void MemoryManager::reclaim() {
+    auto sweep = [](auto& retired, auto& table, std::vector<int>& free_ids) {
+        for (std::size_t i = 0; i < retired.size();) {
+            if (table.pinned(retired[i].first)) {
+                ++i;
+                continue;
+            }
+            delete retired[i].second;
+            free_ids.push_back(retired[i].first);
+            retired[i] = retired.back();
+            retired.pop_back();
+        }
+    };
+    sweep(retired_qregs, qregs, free_qids);
+    sweep(retired_cregs, cregs, free_cids);
+}
+
+int MemoryManager::create_qregister(size_t n, RegisterForm form) {
     std::lock_guard<std::mutex> lock(mtx);
+    reclaim();
+    auto reg = std::make_unique<QRegister>(n);
+    if (form == RegisterForm::Stabilizer) reg->use_stabilizer();
+    else if (form == RegisterForm::QuIDD) reg->use_quidd();
+    admit(*reg);
     int id;
     if (!free_qids.empty()) {
         id = free_qids.back();
         free_qids.pop_back();
-        if (id >= static_cast<int>(qregs.size())) {
-            qregs.resize(id + 1);
-        }
-        qregs[id] = std::make_unique<QRegister>(n);
         if (id >= static_cast<int>(qalloc_count.size()))
             qalloc_count.resize(id + 1, 0);
         ++qalloc_count[id];
     } else {
-        id = static_cast<int>(qregs.size());
-        qregs.push_back(std::make_unique<QRegister>(n));
+        id = qreg_slots++;
         qalloc_count.push_back(1);
     }
+    qregs.insert(id, std::move(reg));
     return id;
 }
 
 bool MemoryManager::release_qregister(int id) {
     std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    QRegister* q = qregs.detach(id);
+    if (!q)
         return false;
-    qregs[id].reset();
     if (id < static_cast<int>(qalloc_count.size()))
         ++qalloc_count[id];
-    free_qids.push_back(id);
+    retired_qregs.emplace_back(id, q);
+    reclaim();
     return true;
 }
 
@@ -49,32 +75,31 @@ void MemoryManager::release_qregisters(const std::vector<int>& ids) {
 
 int MemoryManager::create_cregister(size_t n) {
     std::lock_guard<std::mutex> lock(mtx);
+    reclaim();
     int id;
     if (!free_cids.empty()) {
         id = free_cids.back();
         free_cids.pop_back();
-        if (id >= static_cast<int>(cregs.size()))
-            cregs.resize(id + 1);
-        cregs[id] = std::make_unique<CRegister>(n);
         if (id >= static_cast<int>(calloc_count.size()))
             calloc_count.resize(id + 1, 0);
         ++calloc_count[id];
     } else {
-        id = static_cast<int>(cregs.size());
-        cregs.push_back(std::make_unique<CRegister>(n));
+        id = creg_slots++;
         calloc_count.push_back(1);
     }
+    cregs.insert(id, std::make_unique<CRegister>(n));
     return id;
 }
 
 bool MemoryManager::release_cregister(int id) {
     std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(cregs.size()) || !cregs[id])
+    CRegister* c = cregs.detach(id);
+    if (!c)
         return false;
-    cregs[id].reset();
     if (id < static_cast<int>(calloc_count.size()))
         ++calloc_count[id];
-    free_cids.push_back(id);
+    retired_cregs.emplace_back(id, c);
+    reclaim();
     return true;
 }
 
@@ -90,17 +115,31 @@ void MemoryManager::release_cregisters(const std::vector<int>& ids) {
 }
 
 QRegister& MemoryManager::qreg(int id) {
-    std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    QRegister* q = qregs.get(id);
+    if (!q)
         throw std::out_of_range("invalid qregister id");
-    return *qregs[id];
+    return *q;
 }
 
 CRegister& MemoryManager::creg(int id) {
-    std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(cregs.size()) || !cregs[id])
+    CRegister* c = cregs.get(id);
+    if (!c)
         throw std::out_of_range("invalid cregister id");
-    return *cregs[id];
+    return *c;
+}
+
+QRegHandle MemoryManager::qreg_handle(int id) {
+    QRegister* q = qregs.pin(id);
+    if (!q)
+        throw std::out_of_range("invalid qregister id");
+    return QRegHandle(&qregs, id, q);
+}
+
+CRegHandle MemoryManager::creg_handle(int id) {
+    CRegister* c = cregs.pin(id);
+    if (!c)
+        throw std::out_of_range("invalid cregister id");
+    return CRegHandle(&cregs, id, c);
 }
 
 size_t MemoryManager::qreg_allocs(int id) {
@@ -115,88 +154,238 @@ size_t MemoryManager::creg_allocs(int id) {
     return calloc_count[id];
 }
 
-size_t MemoryManager::memory_usage() {
-    std::lock_guard<std::mutex> lock(mtx);
-    size_t bytes = 0;
-    for (const auto& q : qregs) {
-        if (q && q->wf)
-            bytes += q->wf->state.size() * sizeof(std::complex<double>);
-    }
-    for (const auto& c : cregs) {
-        if (c) bytes += c->bits.size() * sizeof(int);
+// Bytes of a dense state of `n` qubits, saturating for states that could
+// never be allocated.
+static std::size_t dense_bytes(std::size_t n) {
+    if (n + 5 >= 8 * sizeof(std::size_t)) return SIZE_MAX;
+    return (std::size_t(1) << n) * sizeof(std::complex<double>);
+}
+
+// Frame pool of a disk-backed state of `n` qubits given `cache` bytes,
+// rounded as the pager rounds it.
+static std::size_t disk_cache_reservation(std::size_t n, std::size_t cache) {
+    const std::size_t page = disk_page_amplitudes<double>(n) * sizeof(std::complex<double>);
+    const std::size_t frames = std::min(std::max<std::size_t>(cache / page, 8),
+                                        std::max<std::size_t>(dense_bytes(n) / page, 1));
+    return frames * page;
+}
+
+void QRegister::account(MemoryBreakdown& m) const {
+    if (stab) m.stabilizer += stab->memory_bytes();
+    if (dd) m.quidd += dd->memory_bytes();
+    if (!wf) return;
+    m.dense += wf->state.capacity() * sizeof(std::complex<double>) +
+               (wf->soa_re.capacity() + wf->soa_im.capacity()) * sizeof(double);
+    m.sparse += wf->sparse_state.memory_bytes();
+    if (wf->pager) {
+        m.pager += wf->pager->resident_bytes();
+        m.disk += wf->pager->file_bytes();
     }
+}
+
+std::size_t QRegister::reserved_bytes() const {
+    MemoryBreakdown m;
+    account(m);
+    if (stab || dd || (wf && wf->uses_disk())) return m.total();
+    if (!wf && disk_cache_bytes) return disk_cache_reservation(num_qubits, disk_cache_bytes);
+    if (!wf && disk_backed_size<double>(num_qubits))
+        return disk_cache_reservation(num_qubits, runtime_config.disk_cache_mb << 20);
+    // Sparse and lazily built states may still grow to the full array.
+    return std::max(m.total(), dense_bytes(num_qubits));
+}
+
+MemoryBreakdown MemoryManager::breakdown_locked() const {
+    MemoryBreakdown m;
+    for (int id = 0; id < qreg_slots; ++id)
+        if (const QRegister* q = qregs.get(id)) q->account(m);
+    for (const auto& r : retired_qregs) r.second->account(m);
+    for (int id = 0; id < creg_slots; ++id)
+        if (const CRegister* c = cregs.get(id)) m.classical += c->bits.capacity() * sizeof(int);
+    for (const auto& r : retired_cregs) m.classical += r.second->bits.capacity() * sizeof(int);
+    m.resonance_cache = resonance_cache.memory_bytes();
+    m.disk += resonance_cache.disk_bytes();
+    m.pooled = state_pool_stats().held_bytes;
+    return m;
+}
+
+size_t MemoryManager::reserved_locked() const {
+    MemoryBreakdown rest = breakdown_locked();
+    // Registers count by reservation, everything else as it stands.
+    size_t bytes = rest.classical + rest.resonance_cache;
+    auto add = [&bytes](std::size_t b) { bytes = b > SIZE_MAX - bytes ? SIZE_MAX : bytes + b; };
+    for (int id = 0; id < qreg_slots; ++id)
+        if (const QRegister* q = qregs.get(id)) add(q->reserved_bytes());
+    for (const auto& r : retired_qregs) add(r.second->reserved_bytes());
     return bytes;
 }
 
+void MemoryManager::admit(QRegister& reg) const {
+    const std::size_t budget = runtime_config.memory_budget_mb << 20;
+    if (budget == 0) return;
+    const std::size_t used = reserved_locked();
+    const std::size_t room = used < budget ? budget - used : 0;
+    if (reg.reserved_bytes() <= room) return;
+    // The state does not fit in memory: keep it on disk with the page cache
+    // that does, if that is at least the pager's minimum.
+    if (!reg.stab && !reg.dd && room > 0) {
+        reg.disk_cache_bytes = std::min(room, runtime_config.disk_cache_mb << 20);
+        if (reg.reserved_bytes() <= room) {
+            LOG_INFO("qregister of ", reg.num_qubits, " qubits exceeds the memory budget; ",
+                     "keeping it on disk with ", reg.disk_cache_bytes >> 20, " MB of cache");
+            return;
+        }
+        reg.disk_cache_bytes = 0;
+    }
+    throw MemoryBudgetExceeded("qregister of " + std::to_string(reg.num_qubits) +
+                               " qubits does not fit in the memory budget: " +
+                               std::to_string(used) + " of " + std::to_string(budget) +
+                               " bytes are reserved");
+}
+
+size_t MemoryManager::memory_usage() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return breakdown_locked().total();
+}
+
+MemoryBreakdown MemoryManager::memory_breakdown() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return breakdown_locked();
+}
+
+size_t MemoryManager::memory_reserved() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return reserved_locked();
+}
+
 std::vector<std::complex<double>> MemoryManager::export_state(int id) {
     std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    QRegister* q = qregs.get(id);
+    if (!q || q->stab)
         return {};
-    qregs[id]->wave().decompress();
-    return qregs[id]->wave().state;
+    if (q->dd)
+        return q->dd->to_vector();
+    q->wave().decompress();
+    q->wave().to_aos();
+    q->wave().apply_collapse();
+    q->wave().restore_layout();
+    const StateVector<double>& st = q->wave().state;
+    return {st.begin(), st.end()};
 }
 
 bool MemoryManager::import_state(int id, const std::vector<std::complex<double>>& st) {
     std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    QRegister* q = qregs.get(id);
+    if (!q || q->stab)
         return false;
-    qregs[id]->wave().decompress();
-    if (st.size() != qregs[id]->wave().state.size()) return false;
-    qregs[id]->wave().state = st;
+    if (q->dd) {
+        if (q->num_qubits >= 64 || st.size() != (std::size_t(1) << q->num_qubits))
+            return false;
+        *q->dd = QuIDD(st);
+        return true;
+    }
+    q->wave().decompress();
+    q->wave().to_aos();
+    q->wave().apply_collapse();
+    if (st.size() != q->wave().state.size()) return false;
+    q->wave().layout.clear();
+    q->wave().state.assign(st.begin(), st.end());
     return true;
 }
   
 bool MemoryManager::save_resonance_zone(int id, const std::string& key) {
     std::lock_guard<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    QRegister* q = qregs.get(id);
+    if (!q || q->stab || q->dd || q->wave().uses_disk())
         return false;
-    resonance_cache[key] = qregs[id]->wave().state;
-    return true;
+    Wavefunction<>& wf = q->wave();
+    wf.decompress();
+    wf.to_aos();
+    wf.apply_collapse();
+    wf.restore_layout();
+    return resonance_cache.put(key, wf.state);
 }
 
 bool MemoryManager::load_resonance_zone(int id, const std::string& key) {
     std::lock_guard<std::mutex> lock(mtx);
-    auto it = resonance_cache.find(key);
-    if (it == resonance_cache.end() || id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    QRegister* q = qregs.get(id);
+    if (!q || q->stab || q->dd || q->wave().uses_disk())
         return false;
-    if (it->second.size() != qregs[id]->wave().state.size()) return false;
-    qregs[id]->wave().state = it->second;
+    Wavefunction<>& wf = q->wave();
+    wf.decompress();
+    wf.to_aos();
+    wf.apply_collapse();
+    if (!resonance_cache.get(key, wf.state)) return false;
+    wf.layout.clear();
     return true;
 }
 
+bool MemoryManager::drop_resonance_zone(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return resonance_cache.erase(key);
+}
+
+ResonanceCacheStats MemoryManager::resonance_stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return resonance_cache.stats();
+}
+
 bool MemoryManager::save_state_to_file(int id, const std::string& path) {
-    std::vector<std::complex<double>> st;
+    StateVector<double> st;
     {
         std::lock_guard<std::mutex> lock(mtx);
-        if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+        QRegister* q = qregs.get(id);
+        if (!q || q->stab)
             return false;
-        st = qregs[id]->wave().state;
+        if (q->dd)
+            return q->save_to_file(path);
+        Wavefunction<>& wf = q->wave();
+        // A disk-backed state is streamed from its pages under the lock
+        // rather than copied into memory. Others are copied out in logical
+        // order, whatever their storage, and written after the lock is
+        // released.
+        if (wf.uses_disk())
+            return save_state_file(path, wf, runtime_config.checkpoint_codec);
+        st.resize(std::size_t(1) << wf.num_qubits);
+        StateSource source = state_source(wf);
+        for (std::size_t i = 0; i < st.size();) {
+            const std::size_t got = source(st.data() + i, st.size() - i);
+            if (got == 0) return false;
+            i += got;
+        }
     }
-    std::ofstream ofs(path, std::ios::binary);
-    if (!ofs) return false;
-    size_t n = st.size();
-    ofs.write(reinterpret_cast<const char*>(&n), sizeof(size_t));
-    ofs.write(reinterpret_cast<const char*>(st.data()), n * sizeof(std::complex<double>));
-    return true;
+    return save_state_file(path, st, runtime_config.checkpoint_codec);
 }
 
 bool MemoryManager::load_state_from_file(int id, const std::string& path) {
-    std::ifstream ifs(path, std::ios::binary);
-    if (!ifs) return false;
-    size_t n;
-    ifs.read(reinterpret_cast<char*>(&n), sizeof(size_t));
-    std::vector<std::complex<double>> st(n);
-    ifs.read(reinterpret_cast<char*>(st.data()), n * sizeof(std::complex<double>));
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (int other = 0; other < qreg_slots; ++other) {
+            QRegister* q = qregs.get(other);
+            if (q && q->checkpoint && q->checkpoint->path() == path) q->checkpoint->wait();
+        }
+        // A diagram, or a disk-backed state's pages, is loaded under the
+        // lock rather than read into memory first.
+        QRegister* q = qregs.get(id);
+        if (!q || q->stab)
+            return false;
+        if (q->dd)
+            return q->load_from_file(path);
+        if (q->wave().uses_disk())
+            return load_state_file(path, q->wave());
+    }
+    std::vector<std::complex<double>> st;
+    if (!load_state_file(path, st)) return false;
     return import_state(id, st);
 }
 
 bool MemoryManager::checkpoint_if_needed(int id, std::size_t op_threshold,
                                          double time_threshold_sec,
                                          const std::string& file) {
-    std::unique_lock<std::mutex> lock(mtx);
-    if (id < 0 || id >= static_cast<int>(qregs.size()) || !qregs[id])
+    std::lock_guard<std::mutex> lock(mtx);
+    QRegister* q = qregs.get(id);
+    if (!q || q->stab)
         return false;
-    QRegister& qr = *qregs[id];
+    QRegister& qr = *q;
     bool should = false;
     if (op_threshold > 0 && qr.op_count >= op_threshold)
         should = true;
@@ -204,15 +393,32 @@ bool MemoryManager::checkpoint_if_needed(int id, std::size_t op_threshold,
         qr.elapsed_seconds() >= time_threshold_sec)
         should = true;
     if (!should) return false;
-    std::vector<std::complex<double>> st = qr.wave().state;
     qr.reset_metrics();
-    lock.unlock();
-    std::ofstream ofs(file, std::ios::binary);
-    if (!ofs) return false;
-    size_t n = st.size();
-    ofs.write(reinterpret_cast<const char*>(&n), sizeof(size_t));
-    ofs.write(reinterpret_cast<const char*>(st.data()), n * sizeof(std::complex<double>));
-    return true;
+    if (!qr.checkpoint || qr.checkpoint->path() != file)
+        qr.checkpoint = std::make_unique<IncrementalCheckpoint>(file);
+    if (qr.dd)
+        return qr.checkpoint->write(qr.num_qubits, qr.dd->stream());
+    const Wavefunction<>& wf = qr.wave();
+    // The state is only hashed and its changed pages copied under the
+    // lock; the file is written in the background. Anything but a plain
+    // dense array in logical order is streamed through state_source(), so
+    // the register keeps its sparse, SoA or remapped form.
+    if (!wf.uses_disk() && !wf.using_sparse() && !wf.is_soa && wf.layout.empty() &&
+        !wf.collapse_pending)
+        return qr.checkpoint->write(qr.num_qubits, wf.state.data());
+    return qr.checkpoint->write(qr.num_qubits, state_source(wf));
+}
+
+bool MemoryManager::wait_checkpoint(int id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    QRegister* q = qregs.get(id);
+    return q && (!q->checkpoint || q->checkpoint->wait());
+}
+
+CheckpointStats MemoryManager::checkpoint_stats(int id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    QRegister* q = qregs.get(id);
+    return q && q->checkpoint ? q->checkpoint->stats() : CheckpointStats{};
 }
 
 MemoryManager memory;
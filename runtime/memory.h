@@ -4,18 +4,54 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <map>
 #include <chrono>
 #include <string>
 #include <fstream>
+#include <stdexcept>
 #include "wavefunction.h"
+#include "stabilizer.h"
+#include "quidd.h"
+#include "state_file.h"
+#include "slot_table.h"
+#include "resonance_cache.h"
+#include "checkpoint.h"
 
 namespace qpp {
+// Bytes held by registers and caches, by representation. total() is what
+// runtime_config.memory_budget_mb limits; the page files of disk-backed
+// states and the reclaimable buffer pool are reported beside it.
+struct MemoryBreakdown {
+    std::size_t dense = 0;           // dense and SoA amplitude arrays
+    std::size_t sparse = 0;          // sparse engine entries
+    std::size_t pager = 0;           // cached pages of disk-backed states
+    std::size_t quidd = 0;           // decision diagram nodes
+    std::size_t stabilizer = 0;      // stabilizer tableaux
+    std::size_t classical = 0;       // classical register bits
+    std::size_t resonance_cache = 0; // saved resonance zones
+    std::size_t disk = 0;            // page and zone spill files on disk
+    std::size_t pooled = 0;          // freed buffers kept for reuse
+    std::size_t total() const {
+        return dense + sparse + pager + quidd + stabilizer + classical + resonance_cache;
+    }
+};
+
+// Thrown by create_qregister when a register does not fit in
+// runtime_config.memory_budget_mb, not even disk-backed.
+class MemoryBudgetExceeded : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Representation a register starts in.
+enum class RegisterForm { Dense, Stabilizer, QuIDD };
+
 struct QRegister {
     explicit QRegister(size_t n)
         : num_qubits(n), start_time(std::chrono::steady_clock::now()) {}
 
     void ensure_allocated() const {
-        if (!wf) wf = std::make_unique<Wavefunction<>>(num_qubits);
+        if (!wf) wf = make_wave(num_qubits);
     }
 
     Wavefunction<> &wave() const {
@@ -28,60 +64,162 @@ struct QRegister {
         return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
     }
 
-    void h(std::size_t q) { ++op_count; wave().apply_h(q); }
-    void x(std::size_t q) { ++op_count; wave().apply_x(q); }
-    void y(std::size_t q) { ++op_count; wave().apply_y(q); }
-    void z(std::size_t q) { ++op_count; wave().apply_z(q); }
-    void rx(std::size_t q, double theta) { ++op_count; wave().apply_rx(q, theta); }
-    void ry(std::size_t q, double theta) { ++op_count; wave().apply_ry(q, theta); }
-    void rz(std::size_t q, double theta) { ++op_count; wave().apply_rz(q, theta); }
-    void cnot(std::size_t c, std::size_t t) { ++op_count; wave().apply_cnot(c, t); }
-    void cz(std::size_t c, std::size_t t) { ++op_count; wave().apply_cz(c, t); }
-    void ccnot(std::size_t c1, std::size_t c2, std::size_t t) { ++op_count; wave().apply_ccnot(c1, c2, t); }
-    void s(std::size_t q) { ++op_count; wave().apply_s(q); }
-    void t(std::size_t q) { ++op_count; wave().apply_t(q); }
-    void swap(std::size_t a, std::size_t b) { ++op_count; wave().apply_swap(a, b); }
-    int measure(std::size_t q) { ++op_count; return wave().measure(q); }
-    std::size_t measure(const std::vector<std::size_t>& qs) { op_count += qs.size(); return wave().measure(qs); }
-    void reset() { wave().reset(); reset_metrics(); }
-
-    std::complex<double> amp(std::size_t idx) const { return wave().amplitude(idx); }
-    void resize(std::size_t n) { wf = std::make_unique<Wavefunction<>>(n); }
-    void compress() { wave().compress(); }
-    void decompress() { wave().decompress(); }
-    std::size_t nnz() const { return wave().nnz(); }
-    bool using_sparse() const { return wave().using_sparse(); }
+    // Switch the register to the stabilizer tableau. Only Clifford gates and
+    // measurements are accepted afterwards; the dense state is never built.
+    void use_stabilizer() {
+        wf.reset();
+        dd.reset();
+        stab = std::make_unique<StabilizerState>(num_qubits);
+    }
+    bool is_stabilizer() const { return static_cast<bool>(stab); }
+    // Switch the register to a decision diagram. Every single gate is
+    // accepted; fused, blocked and diagonal runs are not.
+    void use_quidd() {
+        wf.reset();
+        stab.reset();
+        dd = std::make_unique<QuIDD>(num_qubits);
+    }
+    bool is_quidd() const { return static_cast<bool>(dd); }
+
+    void h(std::size_t q) { ++op_count; if (stab) stab->apply_h(q); else if (dd) dd->apply_h(q); else wave().apply_h(q); }
+    void x(std::size_t q) { ++op_count; if (stab) stab->apply_x(q); else if (dd) dd->apply_x(q); else wave().apply_x(q); }
+    void y(std::size_t q) { ++op_count; if (stab) stab->apply_y(q); else if (dd) dd->apply_y(q); else wave().apply_y(q); }
+    void z(std::size_t q) { ++op_count; if (stab) stab->apply_z(q); else if (dd) dd->apply_z(q); else wave().apply_z(q); }
+    void rx(std::size_t q, double theta) { ++op_count; if (dd) dd->apply_rx(q, theta); else dense_only("RX").apply_rx(q, theta); }
+    void ry(std::size_t q, double theta) { ++op_count; if (dd) dd->apply_ry(q, theta); else dense_only("RY").apply_ry(q, theta); }
+    void rz(std::size_t q, double theta) { ++op_count; if (dd) dd->apply_rz(q, theta); else dense_only("RZ").apply_rz(q, theta); }
+    void cnot(std::size_t c, std::size_t t) { ++op_count; if (stab) stab->apply_cnot(c, t); else if (dd) dd->apply_cnot(c, t); else wave().apply_cnot(c, t); }
+    void cz(std::size_t c, std::size_t t) { ++op_count; if (stab) stab->apply_cz(c, t); else if (dd) dd->apply_cz(c, t); else wave().apply_cz(c, t); }
+    void ccnot(std::size_t c1, std::size_t c2, std::size_t t) { ++op_count; if (dd) dd->apply_ccnot(c1, c2, t); else dense_only("CCX").apply_ccnot(c1, c2, t); }
+    void s(std::size_t q) { ++op_count; if (stab) stab->apply_s(q); else if (dd) dd->apply_s(q); else wave().apply_s(q); }
+    void t(std::size_t q) { ++op_count; if (dd) dd->apply_t(q); else dense_only("T").apply_t(q); }
+    // Apply a fused block standing in for `gates` individual operations.
+    void matrix(const GateMatrix<double>& m, std::size_t gates = 1) {
+        op_count += gates;
+        dense_only("FUSE").apply_matrix_k(m.qubits, m.matrix);
+    }
+    // Apply a cache-blocked cluster standing in for `gates` operations.
+    void blocked(const std::vector<GateMatrix<double>>& m, std::size_t gates) {
+        op_count += gates;
+        dense_only("BLOCK").apply_blocked(m);
+    }
+    void diagonal(const std::vector<DiagonalGate<double>>& gates) {
+        op_count += gates.size();
+        dense_only("DIAG").apply_diagonal(gates);
+    }
+    void swap(std::size_t a, std::size_t b) { ++op_count; if (stab) stab->apply_swap(a, b); else if (dd) dd->apply_swap(a, b); else wave().apply_swap(a, b); }
+    int measure(std::size_t q) {
+        ++op_count;
+        return stab ? stab->measure(q) : dd ? dd->measure(q) : wave().measure(q);
+    }
+    std::size_t measure(const std::vector<std::size_t>& qs) {
+        op_count += qs.size();
+        if (!stab && !dd) return wave().measure(qs);
+        std::size_t result = 0;
+        for (std::size_t j = 0; j < qs.size(); ++j)
+            if (stab ? stab->measure(qs[j]) : dd->measure(qs[j])) result |= 1ULL << j;
+        return result;
+    }
+    // Sample `shots` outcomes of `qs` without collapsing the register.
+    std::map<std::size_t, std::size_t> sample(const std::vector<std::size_t>& qs,
+                                              std::size_t shots) const {
+        if (dd) return dd->sample(qs, shots);
+        if (!stab) return wave().sample(qs, shots);
+        // A tableau copy is cheap next to re-running the circuit.
+        std::map<std::size_t, std::size_t> histogram;
+        for (std::size_t s = 0; s < shots; ++s) {
+            StabilizerState copy = *stab;
+            std::size_t outcome = 0;
+            for (std::size_t j = 0; j < qs.size(); ++j)
+                if (copy.measure(qs[j])) outcome |= 1ULL << j;
+            histogram[outcome]++;
+        }
+        return histogram;
+    }
+    void reset() {
+        if (stab) stab->reset();
+        else if (dd) dd->reset();
+        else wave().reset();
+        reset_metrics();
+    }
+
+    std::complex<double> amp(std::size_t idx) const {
+        if (stab) throw std::logic_error("stabilizer register has no amplitudes");
+        if (dd) return dd->amplitude(idx);
+        return wave().amplitude(idx);
+    }
+    void resize(std::size_t n) {
+        num_qubits = n;
+        if (stab) stab = std::make_unique<StabilizerState>(n);
+        else if (dd) dd = std::make_unique<QuIDD>(n);
+        else wf = make_wave(n);
+    }
+    // Stabilizer and decision-diagram registers have no amplitudes to
+    // store sparsely; their non-zero count comes from the tableau or the
+    // diagram's nodes rather than a dense state.
+    void compress() { if (!stab && !dd) wave().compress(); }
+    void decompress() { if (!stab && !dd) wave().decompress(); }
+    std::size_t nnz() const { return stab ? stab->nnz() : dd ? dd->nnz() : wave().nnz(); }
+    bool using_sparse() const { return !stab && !dd && wave().using_sparse(); }
     std::size_t ops() const { return op_count; }
   
   
+    // Add what the register holds to `m`.
+    void account(MemoryBreakdown& m) const;
+    // Memory the register holds, or will hold once its state is built: the
+    // whole dense array for an in-memory state, the page cache for a
+    // disk-backed one. Admission control counts this.
+    std::size_t reserved_bytes() const;
+
     mutable std::unique_ptr<Wavefunction<>> wf;
+    std::unique_ptr<StabilizerState> stab;
+    std::unique_ptr<QuIDD> dd;
     std::size_t num_qubits;
+    // Set by admission control when the dense state did not fit in the
+    // memory budget: the state is disk-backed with this much page cache.
+    std::size_t disk_cache_bytes{0};
+    // Chain written by MemoryManager::checkpoint_if_needed.
+    std::unique_ptr<IncrementalCheckpoint> checkpoint;
 
+    // Decision-diagram registers save in the compact diagram format and load
+    // either that or a dense checkpoint, without expanding the state. Dense
+    // registers save in runtime_config.checkpoint_codec (see state_file.h)
+    // and load any state file.
     bool save_to_file(const std::string& path) {
-        wave().decompress();
-        std::ofstream ofs(path, std::ios::binary);
-        if (!ofs) return false;
-        size_t n = wave().state.size();
-        ofs.write(reinterpret_cast<const char*>(&n), sizeof(size_t));
-        ofs.write(reinterpret_cast<const char*>(wave().state.data()),
-                  n * sizeof(std::complex<double>));
-        return true;
+        if (dd) return dd->save(path);
+        if (stab) return false;
+        return save_state_file(path, wave(), runtime_config.checkpoint_codec);
     }
 
     bool load_from_file(const std::string& path) {
-        std::ifstream ifs(path, std::ios::binary);
-        if (!ifs) return false;
-        size_t n;
-        ifs.read(reinterpret_cast<char*>(&n), sizeof(size_t));
-        std::vector<std::complex<double>> st(n);
-        ifs.read(reinterpret_cast<char*>(st.data()), n * sizeof(std::complex<double>));
-        wave().decompress();
-        if (st.size() != wave().state.size()) return false;
-        wave().state = std::move(st);
-        return true;
+        if (dd) {
+            QuIDD loaded(std::size_t(0));
+            if (!loaded.load(path) || loaded.num_qubits() != num_qubits) return false;
+            *dd = std::move(loaded);
+            return true;
+        }
+        if (stab) return false;
+        return load_state_file(path, wave());
     }
     std::chrono::steady_clock::time_point start_time;
     std::size_t op_count{0};
+
+private:
+    std::unique_ptr<Wavefunction<>> make_wave(std::size_t n) const {
+        if (disk_cache_bytes)
+            return std::make_unique<Wavefunction<>>(n, Wavefunction<>::DiskBacked{disk_cache_bytes});
+        return std::make_unique<Wavefunction<>>(n);
+    }
+
+    Wavefunction<>& dense_only(const char* gate) {
+        if (stab)
+            throw std::logic_error(std::string("non-Clifford gate ") + gate +
+                                   " on stabilizer register");
+        if (dd)
+            throw std::logic_error(std::string("gate run ") + gate +
+                                   " on decision-diagram register");
+        return wave();
+    }
 };
 
 // TODO(good-first-issue): enhance QRegister with save/load helpers
@@ -91,9 +229,20 @@ struct CRegister {
     explicit CRegister(size_t n) : bits(n, 0) {}
 };
 
+using QRegHandle = SlotHandle<QRegister>;
+using CRegHandle = SlotHandle<CRegister>;
+
+// Registers live in append-only slot tables, so qreg() and creg() resolve
+// an id without taking the manager's lock. Creating and releasing
+// registers, and the state helpers below, still serialize on it.
 class MemoryManager {
 public:
-    int create_qregister(size_t n);
+    MemoryManager() = default;
+    ~MemoryManager();
+    // With runtime_config.memory_budget_mb set, a register whose dense
+    // state would not fit is made disk-backed with the page cache that does
+    // fit; if not even that fits, MemoryBudgetExceeded is thrown.
+    int create_qregister(size_t n, RegisterForm form = RegisterForm::Dense);
     bool release_qregister(int id);
     int create_cregister(size_t n);
     bool release_cregister(int id);
@@ -101,37 +250,79 @@ public:
     void release_qregisters(const std::vector<int>& ids);
     std::vector<int> create_cregisters(const std::vector<size_t>& sizes);
     void release_cregisters(const std::vector<int>& ids);
+    // Lock-free lookups. The reference must not outlive a concurrent
+    // release of the register; a task that may race with one holds a handle.
     QRegister& qreg(int id);
     CRegister& creg(int id);
+    // Pin the register for as long as the handle lives. A register released
+    // meanwhile is reclaimed, and its id reused, only after the last of its
+    // handles is gone.
+    QRegHandle qreg_handle(int id);
+    CRegHandle creg_handle(int id);
     // statistics helpers
     size_t qreg_allocs(int id);
     size_t creg_allocs(int id);
 
     // live memory statistics
     size_t memory_usage();
+    MemoryBreakdown memory_breakdown();
+    // Bytes admission control counts as taken (see QRegister::reserved_bytes).
+    size_t memory_reserved();
 
-    // state import/export
+    // state import/export. A stabilizer register has no amplitudes to
+    // move: export_state() is empty and the other state helpers, down to
+    // checkpoint_if_needed(), return false. A decision-diagram register
+    // goes through its diagram and never builds a dense state beside it;
+    // its state files are in the diagram format (see QRegister::save_to_file).
     std::vector<std::complex<double>> export_state(int id);
     bool import_state(int id, const std::vector<std::complex<double>>& st);
   
-    // resonance zone cache helpers
+    // Resonance zone cache helpers (see ResonanceCache). Dense in-memory
+    // registers only; a loaded zone shares the cached pages until the
+    // register writes them.
     bool save_resonance_zone(int id, const std::string& key);
     bool load_resonance_zone(int id, const std::string& key);
+    bool drop_resonance_zone(const std::string& key);
+    ResonanceCacheStats resonance_stats();
   
     bool save_state_to_file(int id, const std::string& path);
+    // Loading waits for a checkpoint still being written to `path`.
     bool load_state_from_file(int id, const std::string& path);
+    // Once the register has run `op_threshold` operations or
+    // `time_threshold_sec` seconds since the last checkpoint, add one to the
+    // incremental chain at `file` (see IncrementalCheckpoint): only pages
+    // changed since then are written, on a background thread. A different
+    // `file` starts a new chain.
     bool checkpoint_if_needed(int id, std::size_t op_threshold,
                               double time_threshold_sec,
                               const std::string& file);
+    // Wait for the register's checkpoint write; false if it failed.
+    bool wait_checkpoint(int id);
+    CheckpointStats checkpoint_stats(int id);
 
 private:
-    std::vector<std::unique_ptr<QRegister>> qregs;
-    std::vector<std::unique_ptr<CRegister>> cregs;
+    // Delete released registers that nobody pins any more and free their
+    // ids. Called with mtx held.
+    void reclaim();
+    // Both with mtx held.
+    MemoryBreakdown breakdown_locked() const;
+    size_t reserved_locked() const;
+    // Fit `reg` into the memory budget or throw MemoryBudgetExceeded.
+    void admit(QRegister& reg) const;
+
+    SlotTable<QRegister> qregs;
+    SlotTable<CRegister> cregs;
+    // Ids handed out so far; slots past these have never been used.
+    int qreg_slots{0};
+    int creg_slots{0};
+    // Released registers still pinned by a handle.
+    std::vector<std::pair<int, QRegister*>> retired_qregs;
+    std::vector<std::pair<int, CRegister*>> retired_cregs;
     std::vector<size_t> qalloc_count;
     std::vector<size_t> calloc_count;
     std::vector<int> free_qids;
     std::vector<int> free_cids;
-    std::unordered_map<std::string, std::vector<std::complex<double>>> resonance_cache;
+    ResonanceCache resonance_cache;
     std::mutex mtx;
 };
 
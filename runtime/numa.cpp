@@ -0,0 +1,148 @@
+#include "numa.h"
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef QPP_HAVE_MEMPOLICY
+#include <linux/mempolicy.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace qpp {
+namespace {
+
+std::string read_sysfs(const std::string& path) {
+    std::ifstream ifs(path);
+    std::string text;
+    std::getline(ifs, text);
+    return text;
+}
+
+// CPUs the process could use before any pinning narrowed the mask.
+const std::vector<int>& allowed_cpus() {
+    static const std::vector<int> cpus = [] {
+        std::vector<int> out;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; ++c)
+                if (CPU_ISSET(c, &set)) out.push_back(c);
+        }
+        return out;
+    }();
+    return cpus;
+}
+
+#ifdef QPP_HAVE_MEMPOLICY
+bool set_policy(void* data, std::size_t bytes, int mode, const std::vector<int>& nodes) {
+    constexpr std::size_t kBits = 8 * sizeof(unsigned long);
+    const int top = *std::max_element(nodes.begin(), nodes.end());
+    std::vector<unsigned long> mask(top / kBits + 1, 0);
+    for (int n : nodes) mask[n / kBits] |= 1UL << (n % kBits);
+    // The kernel reads one bit fewer than it is told.
+    return syscall(SYS_mbind, data, bytes, mode, mask.data(),
+                   static_cast<unsigned long>(top + 2), 0U) == 0;
+}
+#endif
+} // namespace
+
+std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> out;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty() || item.find_first_not_of(" \n") == std::string::npos) continue;
+        const auto dash = item.find('-');
+        try {
+            const int lo = std::stoi(item.substr(0, dash));
+            const int hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+            for (int c = lo; c <= hi; ++c) out.push_back(c);
+        } catch (...) {
+            return {};
+        }
+    }
+    return out;
+}
+
+const std::vector<int>& numa_nodes() {
+    static const std::vector<int> nodes = [] {
+        auto list = parse_cpu_list(read_sysfs("/sys/devices/system/node/has_memory"));
+        if (list.empty()) list = parse_cpu_list(read_sysfs("/sys/devices/system/node/online"));
+        if (list.empty()) list.push_back(0);
+        return list;
+    }();
+    return nodes;
+}
+
+std::vector<int> numa_node_cpus(int node) {
+    const auto& allowed = allowed_cpus();
+    std::vector<int> out;
+    for (int c : parse_cpu_list(read_sysfs("/sys/devices/system/node/node" +
+                                           std::to_string(node) + "/cpulist")))
+        if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) out.push_back(c);
+    return out;
+}
+
+bool place_state_pages(void* data, std::size_t bytes, NumaPolicy policy) {
+#ifdef QPP_HAVE_MEMPOLICY
+    if (policy == NumaPolicy::FirstTouch || bytes == 0) return false;
+    const auto& nodes = numa_nodes();
+    if (policy == NumaPolicy::Interleave) return set_policy(data, bytes, MPOL_INTERLEAVE, nodes);
+    // Partition: node k prefers the k-th slice. Slices are whole pages, so
+    // they line up with a static schedule up to a page at each boundary.
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t pages = (bytes + page - 1) / page;
+    char* base = static_cast<char*>(data);
+    bool ok = true;
+    for (std::size_t k = 0; k < nodes.size(); ++k) {
+        const std::size_t first = pages * k / nodes.size();
+        const std::size_t last = pages * (k + 1) / nodes.size();
+        if (last > first)
+            ok = set_policy(base + first * page, (last - first) * page, MPOL_PREFERRED,
+                            {nodes[k]}) && ok;
+    }
+    return ok;
+#else
+    (void)data;
+    (void)bytes;
+    (void)policy;
+    return false;
+#endif
+}
+
+std::size_t pin_omp_threads() {
+#ifdef _OPENMP
+    static std::mutex mutex;
+    static int pinned_team = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pinned_team == omp_get_max_threads()) return 0;
+    std::vector<int> cpus;
+    for (int node : numa_nodes()) {
+        const auto node_cpus = numa_node_cpus(node);
+        cpus.insert(cpus.end(), node_cpus.begin(), node_cpus.end());
+    }
+    if (cpus.empty()) cpus = allowed_cpus();
+    if (cpus.empty()) return 0;
+    std::size_t pinned = 0;
+#pragma omp parallel reduction(+ : pinned)
+    {
+        const std::size_t t = static_cast<std::size_t>(omp_get_thread_num());
+        const std::size_t n = static_cast<std::size_t>(omp_get_num_threads());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[t * cpus.size() / n], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) ++pinned;
+    }
+    pinned_team = omp_get_max_threads();
+    return pinned;
+#else
+    return 0;
+#endif
+}
+} // namespace qpp
@@ -0,0 +1,35 @@
+#pragma once
+#include "../include/runtime_config.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace qpp {
+// NUMA placement of amplitude arrays and pinning of OpenMP threads. The
+// node layout comes from sysfs and placement uses mbind(2) directly, so
+// there is no libnuma dependency; on a kernel without NUMA support every
+// call here quietly does nothing.
+
+// Nodes that have memory, ascending; {0} if the system reports none.
+const std::vector<int>& numa_nodes();
+// CPUs of `node` that the process was allowed to run on at startup.
+std::vector<int> numa_node_cpus(int node);
+// Parse a sysfs list such as "0-3,8,10-11".
+std::vector<int> parse_cpu_list(const std::string& text);
+
+// Set the memory policy of the page-aligned block at `data` before any of
+// it is touched (FirstTouch sets none). Pages still fault in lazily, but
+// on the node the policy picks rather than the faulting thread's. Returns
+// true if a policy was set.
+bool place_state_pages(void* data, std::size_t bytes, NumaPolicy policy);
+inline bool place_state_pages(void* data, std::size_t bytes) {
+    return place_state_pages(data, bytes, runtime_config.numa_policy);
+}
+
+// Bind OpenMP thread t of n to one CPU, walking the CPUs of each node in
+// turn, so the t-th slice of a static schedule runs on the node Partition
+// put it on. Thread 0 is the calling thread, and threads it starts later
+// (such as the pager's I/O threads) inherit its CPU. Does nothing if the
+// team size is unchanged since the last call. Returns the threads pinned.
+std::size_t pin_omp_threads();
+} // namespace qpp
@@ -0,0 +1,316 @@
+#include "page_codec.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace qpp {
+namespace {
+// First byte of every encoded page that is not Raw.
+enum Packing : std::uint8_t { kStored = 0, kLz = 1 };
+
+// Block format in the style of LZ4: a token holds the literal count in its
+// high nibble and the match length minus kMinMatch in its low one, a nibble
+// of 15 is continued with bytes of 255 and a final smaller byte, and every
+// sequence but the last ends in a little-endian 16-bit match offset.
+constexpr std::size_t kMinMatch = 4;
+constexpr std::size_t kHashBits = 14;
+constexpr std::size_t kMaxOffset = 65535;
+// The last match must end this far before the input does, and no match
+// starts in the final kMatchLimit bytes; both keep the coder simple.
+constexpr std::size_t kLastLiterals = 5;
+constexpr std::size_t kMatchLimit = 12;
+
+std::uint32_t load32(const std::uint8_t* p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void put_length(std::vector<std::uint8_t>& out, std::size_t len) {
+    for (; len >= 255; len -= 255)
+        out.push_back(255);
+    out.push_back(static_cast<std::uint8_t>(len));
+}
+
+void put_sequence(std::vector<std::uint8_t>& out, const std::uint8_t* literals,
+                  std::size_t lit, std::size_t offset, std::size_t match) {
+    const std::size_t ml = match ? match - kMinMatch : 0;
+    out.push_back(static_cast<std::uint8_t>((std::min<std::size_t>(lit, 15) << 4) |
+                                            std::min<std::size_t>(ml, 15)));
+    if (lit >= 15)
+        put_length(out, lit - 15);
+    out.insert(out.end(), literals, literals + lit);
+    if (!match)
+        return;
+    out.push_back(static_cast<std::uint8_t>(offset & 0xff));
+    out.push_back(static_cast<std::uint8_t>(offset >> 8));
+    if (ml >= 15)
+        put_length(out, ml - 15);
+}
+
+// Append the compressed form of `in` to `out`.
+void lz_compress(const std::uint8_t* in, std::size_t n, std::vector<std::uint8_t>& out) {
+    // Positions plus one, so zero means empty.
+    std::vector<std::uint32_t> table(std::size_t(1) << kHashBits, 0);
+    std::size_t anchor = 0;
+    std::size_t ip = 0;
+    if (n > kMatchLimit) {
+        const std::size_t limit = n - kMatchLimit;
+        while (ip < limit) {
+            const std::uint32_t seq = load32(in + ip);
+            const std::size_t h = (seq * 2654435761u) >> (32 - kHashBits);
+            const std::size_t ref = table[h];
+            table[h] = static_cast<std::uint32_t>(ip + 1);
+            if (ref == 0 || ip + 1 - ref > kMaxOffset || load32(in + ref - 1) != seq) {
+                // Skip faster through data that does not match.
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            const std::size_t from = ref - 1;
+            std::size_t len = kMinMatch;
+            while (ip + len < n - kLastLiterals && in[from + len] == in[ip + len])
+                ++len;
+            put_sequence(out, in + anchor, ip - anchor, ip - from, len);
+            ip += len;
+            anchor = ip;
+        }
+    }
+    put_sequence(out, in + anchor, n - anchor, 0, 0);
+}
+
+// Decompress exactly `n` bytes into `out`; false on malformed input.
+bool lz_decompress(const std::uint8_t* in, std::size_t bytes, std::uint8_t* out, std::size_t n) {
+    std::size_t sp = 0, dp = 0;
+    auto get_length = [&](std::size_t& len) {
+        std::uint8_t b;
+        do {
+            if (sp >= bytes)
+                return false;
+            b = in[sp++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (sp < bytes) {
+        const std::uint8_t token = in[sp++];
+        std::size_t lit = token >> 4;
+        if (lit == 15 && !get_length(lit))
+            return false;
+        if (lit > bytes - sp || lit > n - dp)
+            return false;
+        std::memcpy(out + dp, in + sp, lit);
+        sp += lit;
+        dp += lit;
+        if (sp == bytes)
+            break;
+        if (bytes - sp < 2)
+            return false;
+        const std::size_t offset = in[sp] | (std::size_t(in[sp + 1]) << 8);
+        sp += 2;
+        std::size_t match = (token & 15) + kMinMatch;
+        if ((token & 15) == 15 && !get_length(match))
+            return false;
+        if (offset == 0 || offset > dp || match > n - dp)
+            return false;
+        // Byte by byte: the match may overlap the bytes it produces.
+        for (std::size_t k = 0; k < match; ++k, ++dp)
+            out[dp] = out[dp - offset];
+    }
+    return dp == n;
+}
+
+// Group byte b of every `elem`-byte element together.
+void shuffle(const std::uint8_t* in, std::size_t bytes, std::size_t elem, std::uint8_t* out) {
+    const std::size_t count = bytes / elem;
+    for (std::size_t i = 0; i < count; ++i)
+        for (std::size_t b = 0; b < elem; ++b)
+            out[b * count + i] = in[i * elem + b];
+}
+
+void unshuffle(const std::uint8_t* in, std::size_t bytes, std::size_t elem, std::uint8_t* out) {
+    const std::size_t count = bytes / elem;
+    for (std::size_t i = 0; i < count; ++i)
+        for (std::size_t b = 0; b < elem; ++b)
+            out[i * elem + b] = in[b * count + i];
+}
+
+// Round |v| <= 1 to a binary float with `mant` fraction bits, `bias` and
+// the smallest normal exponent `min_exp`, returning its bit pattern. The
+// rounding is to nearest even, computed directly from the double so no
+// second rounding adds to the error.
+std::uint16_t to_float16(double v, int mant, int bias, int min_exp) {
+    const std::uint16_t sign = std::signbit(v) ? 0x8000 : 0;
+    const double a = std::fabs(v);
+    if (a == 0.0)
+        return sign;
+    int e;
+    std::frexp(a, &e); // a = m * 2^e with m in [0.5, 1)
+    const int exp = std::max(e - 1, min_exp);
+    const double q = std::nearbyint(std::ldexp(a, mant - exp));
+    // q lies in [2^mant, 2^(mant+1)] for normals; for subnormals below that
+    // it is the fraction, and the rounding may carry into the exponent.
+    const int biased = e - 1 < min_exp ? 0 : exp + bias;
+    std::uint32_t bits = (static_cast<std::uint32_t>(biased) << mant) +
+                         static_cast<std::uint32_t>(q) - (biased ? (1u << mant) : 0);
+    return static_cast<std::uint16_t>(sign | bits);
+}
+
+double from_float16(std::uint16_t h, int mant, int bias, int min_exp) {
+    const bool neg = h & 0x8000;
+    const int biased = (h & 0x7fff) >> mant;
+    const std::uint32_t frac = h & ((1u << mant) - 1);
+    const double a = biased ? std::ldexp(double(frac | (1u << mant)), biased - bias - mant)
+                            : std::ldexp(double(frac), min_exp - mant);
+    return neg ? -a : a;
+}
+
+std::uint16_t quantize(PageCodec codec, double v) {
+    switch (codec) {
+    case PageCodec::Half:
+        return to_float16(v, 10, 15, -14);
+    case PageCodec::BFloat16:
+        return to_float16(v, 7, 127, -126);
+    default: {
+        const long q = std::lround(v * 32767.0);
+        return static_cast<std::uint16_t>(static_cast<std::int16_t>(q));
+    }
+    }
+}
+
+double dequantize(PageCodec codec, std::uint16_t q) {
+    switch (codec) {
+    case PageCodec::Half:
+        return from_float16(q, 10, 15, -14);
+    case PageCodec::BFloat16:
+        return from_float16(q, 7, 127, -126);
+    default:
+        return static_cast<std::int16_t>(q) / 32767.0;
+    }
+}
+
+bool lossy(PageCodec codec) {
+    return codec == PageCodec::Half || codec == PageCodec::BFloat16 ||
+           codec == PageCodec::Fixed16;
+}
+
+// Bytes of a page before the LZ stage: the shuffled doubles, or the scale
+// followed by the shuffled 16-bit parts.
+std::size_t plain_bytes(PageCodec codec, std::size_t count) {
+    return lossy(codec) ? sizeof(double) + count * 2 * sizeof(std::uint16_t)
+                        : count * sizeof(std::complex<double>);
+}
+} // namespace
+
+void encode_page(PageCodec codec, const std::complex<double>* in, std::size_t count,
+                 std::vector<std::uint8_t>& out) {
+    const std::size_t raw = count * sizeof(std::complex<double>);
+    out.clear();
+    if (codec == PageCodec::Raw) {
+        const auto* bytes = reinterpret_cast<const std::uint8_t*>(in);
+        out.assign(bytes, bytes + raw);
+        return;
+    }
+    std::vector<std::uint8_t> plain(plain_bytes(codec, count));
+    if (lossy(codec)) {
+        const double* parts = reinterpret_cast<const double*>(in);
+        double peak = 0.0;
+        for (std::size_t i = 0; i < 2 * count; ++i)
+            peak = std::max(peak, std::fabs(parts[i]));
+        std::memcpy(plain.data(), &peak, sizeof(peak));
+        std::vector<std::uint16_t> q(2 * count, 0);
+        if (peak > 0.0)
+            for (std::size_t i = 0; i < 2 * count; ++i)
+                q[i] = quantize(codec, parts[i] / peak);
+        shuffle(reinterpret_cast<const std::uint8_t*>(q.data()), q.size() * sizeof(std::uint16_t),
+                sizeof(std::uint16_t), plain.data() + sizeof(double));
+    } else {
+        shuffle(reinterpret_cast<const std::uint8_t*>(in), raw, sizeof(double), plain.data());
+    }
+    out.push_back(kLz);
+    lz_compress(plain.data(), plain.size(), out);
+    if (out.size() > plain.size()) {
+        out.assign(1, kStored);
+        out.insert(out.end(), plain.begin(), plain.end());
+    }
+}
+
+bool decode_page(PageCodec codec, const std::uint8_t* in, std::size_t bytes,
+                 std::complex<double>* out, std::size_t count) {
+    const std::size_t raw = count * sizeof(std::complex<double>);
+    if (codec == PageCodec::Raw) {
+        if (bytes != raw)
+            return false;
+        std::memcpy(out, in, raw);
+        return true;
+    }
+    if (bytes == 0 || (in[0] != kStored && in[0] != kLz))
+        return false;
+    std::vector<std::uint8_t> plain(plain_bytes(codec, count));
+    if (in[0] == kStored) {
+        if (bytes - 1 != plain.size())
+            return false;
+        std::memcpy(plain.data(), in + 1, plain.size());
+    } else if (!lz_decompress(in + 1, bytes - 1, plain.data(), plain.size())) {
+        return false;
+    }
+    if (!lossy(codec)) {
+        unshuffle(plain.data(), raw, sizeof(double), reinterpret_cast<std::uint8_t*>(out));
+        return true;
+    }
+    double peak;
+    std::memcpy(&peak, plain.data(), sizeof(peak));
+    std::vector<std::uint16_t> q(2 * count);
+    unshuffle(plain.data() + sizeof(double), q.size() * sizeof(std::uint16_t),
+              sizeof(std::uint16_t), reinterpret_cast<std::uint8_t*>(q.data()));
+    double* parts = reinterpret_cast<double*>(out);
+    for (std::size_t i = 0; i < 2 * count; ++i)
+        parts[i] = dequantize(codec, q[i]) * peak;
+    return true;
+}
+
+bool page_is_zero(const std::complex<double>* in, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i)
+        if (in[i] != std::complex<double>(0.0, 0.0))
+            return false;
+    return true;
+}
+
+double page_codec_error(PageCodec codec) {
+    switch (codec) {
+    case PageCodec::Half:
+        return std::ldexp(1.0, -11);
+    case PageCodec::BFloat16:
+        return std::ldexp(1.0, -8);
+    case PageCodec::Fixed16:
+        return 0.5 / 32767.0;
+    default:
+        return 0.0;
+    }
+}
+
+const char* page_codec_name(PageCodec codec) {
+    switch (codec) {
+    case PageCodec::Lossless:
+        return "lossless";
+    case PageCodec::Half:
+        return "fp16";
+    case PageCodec::BFloat16:
+        return "bf16";
+    case PageCodec::Fixed16:
+        return "fixed16";
+    default:
+        return "raw";
+    }
+}
+
+bool parse_page_codec(const std::string& name, PageCodec& codec) {
+    for (PageCodec c : {PageCodec::Raw, PageCodec::Lossless, PageCodec::Half,
+                        PageCodec::BFloat16, PageCodec::Fixed16}) {
+        if (name == page_codec_name(c)) {
+            codec = c;
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace qpp
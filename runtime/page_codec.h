@@ -0,0 +1,41 @@
+#pragma once
+#include "../include/runtime_config.h"
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace qpp {
+// Per-page encodings of amplitude arrays on disk, shared by the disk pager
+// and the state files.
+//  - Lossless: the bytes of every double are regrouped by significance (all
+//    sign/exponent bytes first, then each mantissa byte) and the result is
+//    LZ-coded. States with repeated magnitudes or runs of zeros shrink by
+//    several times; random phases barely shrink and are stored as they are.
+//  - Half, BFloat16, Fixed16: every real and imaginary part is divided by
+//    the largest one in its page and rounded to 16 bits, then LZ-coded the
+//    same way. page_codec_error() bounds the error of each component
+//    relative to that largest one.
+// Raw pages are the plain doubles and carry no framing, so a Raw file is
+// byte for byte the old layout.
+
+// Encode `count` amplitudes into `out` (replacing its contents).
+void encode_page(PageCodec codec, const std::complex<double>* in, std::size_t count,
+                 std::vector<std::uint8_t>& out);
+// Decode `bytes` bytes written by encode_page() into `count` amplitudes.
+// Returns false if the data is malformed.
+bool decode_page(PageCodec codec, const std::uint8_t* in, std::size_t bytes,
+                 std::complex<double>* out, std::size_t count);
+
+// True if every amplitude is exactly zero; such pages are not stored.
+bool page_is_zero(const std::complex<double>* in, std::size_t count);
+
+// Largest |decoded - original| of a real or imaginary part divided by the
+// largest magnitude of one in the page; 0 for Raw and Lossless.
+double page_codec_error(PageCodec codec);
+
+// "raw", "lossless", "fp16", "bf16" or "fixed16".
+const char* page_codec_name(PageCodec codec);
+bool parse_page_codec(const std::string& name, PageCodec& codec);
+} // namespace qpp
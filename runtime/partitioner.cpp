@@ -13,9 +13,9 @@ struct DSU {
     void unite(int a, int b) { a = find(a); b = find(b); if (a != b) parent[b] = a; }
 };
 
-std::vector<std::complex<double>> tensor_product(const std::vector<std::complex<double>>& a,
-                                                 const std::vector<std::complex<double>>& b) {
-    std::vector<std::complex<double>> res(a.size()*b.size());
+StateVector<double> tensor_product(const StateVector<double>& a,
+                                   const StateVector<double>& b) {
+    StateVector<double> res(a.size()*b.size());
     for (std::size_t i=0;i<a.size();++i)
         for (std::size_t j=0;j<b.size();++j)
             res[i*b.size()+j] = a[i]*b[j];
@@ -1,75 +1,580 @@
 #include "quidd.h"
+#include "random.h"
+#include <algorithm>
 #include <cmath>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
 
 namespace qpp {
 
-QuIDD::Node* QuIDD::make_terminal(const std::complex<double>& val) {
-    TermKey key{val.real(), val.imag()};
-    auto it = term_table.find(key);
-    if (it != term_table.end()) return it->second;
-    auto n = std::make_unique<Node>();
-    n->low = n->high = nullptr;
-    n->var = 0;
-    n->is_terminal = true;
-    n->value = val;
-    Node* ptr = n.get();
-    nodes.push_back(std::move(n));
-    term_table[key] = ptr;
-    return ptr;
-}
-
-QuIDD::Node* QuIDD::make_node(std::size_t var, Node* low, Node* high) {
-    NodeKey key{var, low, high};
-    auto it = unique_table.find(key);
-    if (it != unique_table.end()) return it->second;
-    auto n = std::make_unique<Node>();
-    n->low = low;
-    n->high = high;
-    n->var = var;
-    n->is_terminal = false;
-    Node* ptr = n.get();
-    nodes.push_back(std::move(n));
-    unique_table[key] = ptr;
-    return ptr;
-}
-
-QuIDD::Node* QuIDD::build(const std::vector<std::complex<double>>& st,
-                          std::size_t start, std::size_t end, std::size_t var) {
+// Weights closer than this to zero are zero, and weights within this of an
+// interned weight in both parts reuse it.
+static constexpr double kTolerance = 1e-13;
+static constexpr std::size_t kComputeTableSize = std::size_t(1) << 16;
+// Gates collect once this many nodes are allocated and the arena has
+// doubled since the last collection.
+static constexpr std::size_t kMinCollect = std::size_t(1) << 14;
+static constexpr std::uint32_t kFreeVar = std::numeric_limits<std::uint32_t>::max();
+
+static bool is_zero(const std::complex<double>& w) {
+    return std::norm(w) < kTolerance * kTolerance;
+}
+
+static std::complex<double> snap(std::complex<double> w) {
+    double re = std::abs(w.real()) < kTolerance ? 0.0 : w.real();
+    double im = std::abs(w.imag()) < kTolerance ? 0.0 : w.imag();
+    return {re, im};
+}
+
+static bool close(const std::complex<double>& a, const std::complex<double>& b) {
+    return std::abs(a.real() - b.real()) <= kTolerance &&
+           std::abs(a.imag() - b.imag()) <= kTolerance;
+}
+
+// splitmix64 finalizer: every input bit reaches every output bit.
+static std::uint64_t mix(std::uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static std::uint64_t pack(std::uint32_t hi, std::uint32_t lo) {
+    return (std::uint64_t(hi) << 32) | lo;
+}
+
+static std::uint64_t hash_edges(std::uint32_t var, const QuIDD::Edge* e, std::size_t n) {
+    std::uint64_t h = mix(var + 0x9e3779b97f4a7c15ULL);
+    for (std::size_t k = 0; k < n; ++k) h = mix(h ^ pack(e[k].node, e[k].weight));
+    return h;
+}
+
+static bool same(const QuIDD::Edge& a, const QuIDD::Edge& b) {
+    return a.node == b.node && a.weight == b.weight;
+}
+
+static std::uint64_t bits(double d) {
+    std::uint64_t b;
+    std::memcpy(&b, &d, sizeof(b));
+    return b;
+}
+
+// Weights are bucketed on a grid much coarser than the tolerance, so a value
+// within the tolerance of an interned one falls in its cell or, rarely, a
+// neighbour, and most lookups probe a single chain.
+static constexpr double kCell = 1024 * kTolerance;
+
+static std::int64_t cell(double x) {
+    return static_cast<std::int64_t>(std::floor(x / kCell));
+}
+
+static std::uint64_t hash_cell(std::int64_t re, std::int64_t im) {
+    return mix(mix(static_cast<std::uint64_t>(re)) ^ static_cast<std::uint64_t>(im));
+}
+
+static std::uint64_t hash_weight(const std::complex<double>& w) {
+    return hash_cell(cell(w.real()), cell(w.imag()));
+}
+
+QuIDD::Index QuIDD::intern(std::complex<double> w) {
+    w = snap(w);
+    if (is_zero(w)) return 0;
+    if (close(w, 1.0)) return 1;
+    const std::size_t mask = weight_slots.size() - 1;
+    const std::int64_t re[2] = {cell(w.real() - kTolerance), cell(w.real() + kTolerance)};
+    const std::int64_t im[2] = {cell(w.imag() - kTolerance), cell(w.imag() + kTolerance)};
+    for (int a = 0; a < (re[1] == re[0] ? 1 : 2); ++a)
+        for (int b = 0; b < (im[1] == im[0] ? 1 : 2); ++b)
+            for (std::size_t s = hash_cell(re[a], im[b]) & mask; weight_slots[s]; s = (s + 1) & mask)
+                if (close(weights[weight_slots[s]], w)) return weight_slots[s];
+    Index idx;
+    if (!free_weights.empty()) {
+        idx = free_weights.back();
+        free_weights.pop_back();
+        weights[idx] = w;
+    } else {
+        if (weights.size() > std::numeric_limits<Index>::max())
+            throw std::length_error("QuIDD weight arena exhausted");
+        idx = static_cast<Index>(weights.size());
+        weights.push_back(w);
+    }
+    std::size_t s = hash_weight(w) & mask;
+    while (weight_slots[s]) s = (s + 1) & mask;
+    weight_slots[s] = idx;
+    if (2 * ++weight_used > weight_slots.size()) rebuild_weight_table();
+    return idx;
+}
+
+void QuIDD::rebuild_weight_table() {
+    std::size_t size = 64;
+    while (size < 4 * (weights.size() - free_weights.size())) size <<= 1;
+    weight_slots.assign(size, 0);
+    weight_used = 0;
+    for (std::size_t i = 2; i < weights.size(); ++i) {
+        if (std::isnan(weights[i].real())) continue;
+        std::size_t s = hash_weight(weights[i]) & (size - 1);
+        while (weight_slots[s]) s = (s + 1) & (size - 1);
+        weight_slots[s] = static_cast<Index>(i);
+        ++weight_used;
+    }
+}
+
+void QuIDD::rebuild_unique_table() {
+    std::size_t size = 64;
+    while (size < 4 * node_count()) size <<= 1;
+    unique_slots.assign(size, 0);
+    unique_used = 0;
+    for (std::size_t i = 1; i < nodes.size(); ++i) {
+        if (nodes[i].var == kFreeVar) continue;
+        std::size_t s = hash_edges(nodes[i].var, &nodes[i].low, 2) & (size - 1);
+        while (unique_slots[s]) s = (s + 1) & (size - 1);
+        unique_slots[s] = static_cast<Index>(i);
+        ++unique_used;
+    }
+}
+
+QuIDD::RawEdge QuIDD::make_node(std::uint32_t var, RawEdge low, RawEdge high) {
+    if (is_zero(low.weight)) low = {kTerminal, 0.0};
+    if (is_zero(high.weight)) high = {kTerminal, 0.0};
+    if (low.weight == 0.0 && high.weight == 0.0) return {kTerminal, 0.0};
+    // Factor out the norm and the phase of the first non-zero weight.
+    double norm = std::sqrt(std::norm(low.weight) + std::norm(high.weight));
+    std::complex<double> lead = low.weight != 0.0 ? low.weight : high.weight;
+    std::complex<double> factor = norm * (lead / std::abs(lead));
+    low.weight /= factor;
+    high.weight /= factor;
+    if (low.weight != 0.0) low.weight.imag(0.0);
+    else high.weight.imag(0.0);
+
+    const Edge e[2] = {{low.node, intern(low.weight)}, {high.node, intern(high.weight)}};
+    const std::size_t mask = unique_slots.size() - 1;
+    std::size_t s = hash_edges(var, e, 2) & mask;
+    for (; unique_slots[s]; s = (s + 1) & mask) {
+        const Node& n = nodes[unique_slots[s]];
+        if (n.var == var && same(n.low, e[0]) && same(n.high, e[1])) return {unique_slots[s], factor};
+    }
+    Index idx;
+    if (!free_nodes.empty()) {
+        idx = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[idx] = {e[0], e[1], var};
+    } else {
+        if (nodes.size() > std::numeric_limits<Index>::max())
+            throw std::length_error("QuIDD node arena exhausted");
+        idx = static_cast<Index>(nodes.size());
+        nodes.push_back({e[0], e[1], var});
+    }
+    unique_slots[s] = idx;
+    if (2 * ++unique_used > unique_slots.size()) rebuild_unique_table();
+    return {idx, factor};
+}
+
+QuIDD::RawEdge QuIDD::make_matrix_node(std::uint32_t var, const RawEdge (&in)[4]) {
+    RawEdge r[4];
+    std::size_t lead = 4;
+    double best = 0.0;
+    for (std::size_t k = 0; k < 4; ++k) {
+        r[k] = is_zero(in[k].weight) ? RawEdge{kTerminal, 0.0} : in[k];
+        if (r[k].weight != 0.0 && std::abs(r[k].weight) > best + kTolerance) {
+            best = std::abs(r[k].weight);
+            lead = k;
+        }
+    }
+    if (lead == 4) return {kTerminal, 0.0};
+    const std::complex<double> factor = r[lead].weight;
+    Edge e[4];
+    for (std::size_t k = 0; k < 4; ++k)
+        e[k] = {r[k].node, k == lead ? Index(1) : intern(r[k].weight / factor)};
+
+    std::size_t mask = matrix_slots.size() - 1;
+    std::size_t s = hash_edges(var, e, 4) & mask;
+    for (; matrix_slots[s]; s = (s + 1) & mask) {
+        const MatrixNode& n = matrix_nodes[matrix_slots[s]];
+        if (n.var == var && same(n.e[0], e[0]) && same(n.e[1], e[1]) &&
+            same(n.e[2], e[2]) && same(n.e[3], e[3]))
+            return {matrix_slots[s], factor};
+    }
+    MatrixNode n{{e[0], e[1], e[2], e[3]}, var, false};
+    n.identity = e[0].weight == 1 && matrix_nodes[e[0].node].identity && same(e[3], e[0]) &&
+                 e[1].weight == 0 && e[2].weight == 0;
+    const auto idx = static_cast<Index>(matrix_nodes.size());
+    matrix_nodes.push_back(n);
+    matrix_slots[s] = idx;
+    if (2 * ++matrix_used > matrix_slots.size()) {
+        matrix_slots.assign(2 * matrix_slots.size(), 0);
+        mask = matrix_slots.size() - 1;
+        for (std::size_t i = 1; i < matrix_nodes.size(); ++i) {
+            std::size_t t = hash_edges(matrix_nodes[i].var, matrix_nodes[i].e, 4) & mask;
+            while (matrix_slots[t]) t = (t + 1) & mask;
+            matrix_slots[t] = static_cast<Index>(i);
+        }
+    }
+    return {idx, factor};
+}
+
+// Controlled 2x2 gate as a matrix diagram, built bottom-up. Below the
+// target, a diagonal block of m is the identity where some control below is
+// 0 and m[r][r] where they are all 1; an off-diagonal block is zero and
+// m[r][c] respectively. Above the target, a control selects the gate on its
+// 1 branch and the identity on its 0 branch.
+QuIDD::RawEdge QuIDD::gate_diagram(std::size_t controls, std::size_t target,
+                                   const std::complex<double> m[2][2]) {
+    const RawEdge zero{kTerminal, 0.0};
+    RawEdge id{kTerminal, 1.0};
+    RawEdge block[2][2];
+    for (int r = 0; r < 2; ++r)
+        for (int c = 0; c < 2; ++c) block[r][c] = {kTerminal, m[r][c]};
+    for (std::uint32_t v = 0; v < target; ++v) {
+        const bool control = (controls >> v) & 1ULL;
+        for (int r = 0; r < 2; ++r) {
+            for (int c = 0; c < 2; ++c) {
+                RawEdge sub = block[r][c];
+                RawEdge off = control ? (r == c ? id : zero) : sub;
+                block[r][c] = make_matrix_node(v, {off, zero, zero, sub});
+            }
+        }
+        id = make_matrix_node(v, {id, zero, zero, id});
+    }
+    const auto t = static_cast<std::uint32_t>(target);
+    RawEdge e = make_matrix_node(t, {block[0][0], block[0][1], block[1][0], block[1][1]});
+    id = make_matrix_node(t, {id, zero, zero, id});
+    for (std::uint32_t v = t + 1; v < qubits; ++v) {
+        if ((controls >> v) & 1ULL)
+            e = make_matrix_node(v, {id, zero, zero, e});
+        else
+            e = make_matrix_node(v, {e, zero, zero, e});
+        id = make_matrix_node(v, {id, zero, zero, id});
+    }
+    return e;
+}
+
+QuIDD::RawEdge QuIDD::add(RawEdge a, RawEdge b, std::ptrdiff_t var) {
+    if (is_zero(a.weight)) return b;
+    if (is_zero(b.weight)) return a;
+    if (var < 0 || a.node == b.node) {
+        std::complex<double> w = a.weight + b.weight;
+        if (is_zero(w)) return {kTerminal, 0.0};
+        return {a.node, w};
+    }
+    if (b.node < a.node) std::swap(a, b);
+    const std::complex<double> ratio = b.weight / a.weight;
+    const std::size_t slot = mix(mix(pack(a.node, b.node)) ^ bits(ratio.real()) ^
+                                 mix(bits(ratio.imag()))) & (add_cache.size() - 1);
+    const AddEntry& hit = add_cache[slot];
+    if (hit.a == a.node && hit.b == b.node && hit.ratio == ratio)
+        return {hit.result.node, hit.result.weight * a.weight};
+    // Copies: the arena may grow while recursing.
+    const Node na = nodes[a.node], nb = nodes[b.node];
+    RawEdge low = add(raw(na.low), {nb.low.node, weights[nb.low.weight] * ratio}, var - 1);
+    RawEdge high = add(raw(na.high), {nb.high.node, weights[nb.high.weight] * ratio}, var - 1);
+    RawEdge r = make_node(static_cast<std::uint32_t>(var), low, high);
+    add_cache[slot] = {a.node, b.node, ratio, r};
+    return {r.node, r.weight * a.weight};
+}
+
+QuIDD::RawEdge QuIDD::multiply(const RawEdge& m, const RawEdge& x, std::ptrdiff_t var) {
+    if (is_zero(m.weight) || is_zero(x.weight)) return {kTerminal, 0.0};
+    const std::complex<double> w = m.weight * x.weight;
+    if (var < 0) return {kTerminal, w};
+    if (matrix_nodes[m.node].identity) return {x.node, w};
+    const std::size_t slot = mix(pack(m.node, x.node)) & (multiply_cache.size() - 1);
+    const MultiplyEntry& hit = multiply_cache[slot];
+    if (hit.m == m.node && hit.x == x.node) return {hit.result.node, hit.result.weight * w};
+    const MatrixNode mn = matrix_nodes[m.node];
+    const Node xn = nodes[x.node];
+    RawEdge rows[2];
+    for (int r = 0; r < 2; ++r) {
+        RawEdge a = multiply(raw(mn.e[2 * r]), raw(xn.low), var - 1);
+        RawEdge b = multiply(raw(mn.e[2 * r + 1]), raw(xn.high), var - 1);
+        rows[r] = add(a, b, var - 1);
+    }
+    RawEdge r = make_node(static_cast<std::uint32_t>(var), rows[0], rows[1]);
+    multiply_cache[slot] = {m.node, x.node, r};
+    return {r.node, r.weight * w};
+}
+
+void QuIDD::apply_controlled(std::size_t controls, std::size_t target,
+                             const std::complex<double> m[2][2]) {
+    if (target >= qubits || (controls >> target) & 1ULL) return;
+    if (qubits < 64 && (controls >> qubits) != 0) return;
+    RawEdge gate = gate_diagram(controls, target, m);
+    root = multiply(gate, root, static_cast<std::ptrdiff_t>(qubits) - 1);
+    if (node_count() >= collect_threshold) collect();
+}
+
+void QuIDD::collect() {
+    std::vector<char> live(nodes.size(), 0);
+    std::vector<char> used(weights.size(), 0);
+    used[0] = used[1] = 1;
+    std::vector<Index> stack;
+    if (root.node != kTerminal) stack.push_back(root.node);
+    while (!stack.empty()) {
+        Index i = stack.back();
+        stack.pop_back();
+        if (live[i]) continue;
+        live[i] = 1;
+        for (const Edge& e : {nodes[i].low, nodes[i].high}) {
+            used[e.weight] = 1;
+            if (e.node != kTerminal && !live[e.node]) stack.push_back(e.node);
+        }
+    }
+    for (std::size_t i = 1; i < nodes.size(); ++i) {
+        if (live[i] || nodes[i].var == kFreeVar) continue;
+        nodes[i].var = kFreeVar;
+        free_nodes.push_back(static_cast<Index>(i));
+    }
+    for (std::size_t i = 2; i < weights.size(); ++i) {
+        if (used[i] || std::isnan(weights[i].real())) continue;
+        weights[i] = std::numeric_limits<double>::quiet_NaN();
+        free_weights.push_back(static_cast<Index>(i));
+    }
+    rebuild_unique_table();
+    rebuild_weight_table();
+    // Gate diagrams and cached results refer to the old arenas.
+    matrix_nodes.resize(1);
+    matrix_slots.assign(64, 0);
+    matrix_used = 0;
+    std::fill(multiply_cache.begin(), multiply_cache.end(), MultiplyEntry{0, 0, {0, 0.0}});
+    std::fill(add_cache.begin(), add_cache.end(), AddEntry{0, 0, 0.0, {0, 0.0}});
+    collect_threshold = std::max(kMinCollect, 2 * node_count());
+}
+
+void QuIDD::apply_h(std::size_t qubit) {
+    const double f = 1.0 / std::sqrt(2.0);
+    const std::complex<double> mat[2][2] = {{f, f}, {f, -f}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_x(std::size_t qubit) {
+    const std::complex<double> mat[2][2] = {{0, 1}, {1, 0}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_y(std::size_t qubit) {
+    const std::complex<double> mat[2][2] = {{0.0, std::complex<double>(0, -1)},
+                                            {std::complex<double>(0, 1), 0.0}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_z(std::size_t qubit) {
+    const std::complex<double> mat[2][2] = {{1, 0}, {0, -1}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_s(std::size_t qubit) {
+    const std::complex<double> mat[2][2] = {{1, 0}, {0, std::complex<double>(0, 1)}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_t(std::size_t qubit) {
+    const std::complex<double> mat[2][2] = {{1, 0}, {0, std::exp(std::complex<double>(0, M_PI / 4))}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_rx(std::size_t qubit, double theta) {
+    double c = std::cos(theta / 2.0), s = std::sin(theta / 2.0);
+    const std::complex<double> mat[2][2] = {{c, std::complex<double>(0, -s)},
+                                            {std::complex<double>(0, -s), c}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_ry(std::size_t qubit, double theta) {
+    double c = std::cos(theta / 2.0), s = std::sin(theta / 2.0);
+    const std::complex<double> mat[2][2] = {{c, -s}, {s, c}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_rz(std::size_t qubit, double theta) {
+    const std::complex<double> mat[2][2] = {{std::exp(std::complex<double>(0, -theta / 2.0)), 0},
+                                            {0, std::exp(std::complex<double>(0, theta / 2.0))}};
+    apply_controlled(0, qubit, mat);
+}
+
+void QuIDD::apply_cnot(std::size_t control, std::size_t target) {
+    if (control >= qubits || control == target) return;
+    const std::complex<double> mat[2][2] = {{0, 1}, {1, 0}};
+    apply_controlled(1ULL << control, target, mat);
+}
+
+void QuIDD::apply_cz(std::size_t control, std::size_t target) {
+    if (control >= qubits || control == target) return;
+    const std::complex<double> mat[2][2] = {{1, 0}, {0, -1}};
+    apply_controlled(1ULL << control, target, mat);
+}
+
+void QuIDD::apply_ccnot(std::size_t c1, std::size_t c2, std::size_t target) {
+    if (c1 >= qubits || c2 >= qubits || c1 == c2 || c1 == target || c2 == target) return;
+    const std::complex<double> mat[2][2] = {{0, 1}, {1, 0}};
+    apply_controlled((1ULL << c1) | (1ULL << c2), target, mat);
+}
+
+void QuIDD::apply_swap(std::size_t q1, std::size_t q2) {
+    if (q1 == q2 || q1 >= qubits || q2 >= qubits) return;
+    apply_cnot(q1, q2);
+    apply_cnot(q2, q1);
+    apply_cnot(q1, q2);
+}
+
+// Probability that `qubit` reads 1 in the unit-norm sub-vector of `node`;
+// memo holds -1 for nodes not visited yet.
+double QuIDD::probability_one(Index node, std::size_t qubit, std::vector<double>& memo) const {
+    if (node == kTerminal) return 0.0;
+    const Node& n = nodes[node];
+    if (n.var == qubit) return std::norm(weights[n.high.weight]);
+    if (memo[node] >= 0.0) return memo[node];
+    double p = std::norm(weights[n.low.weight]) * probability_one(n.low.node, qubit, memo) +
+               std::norm(weights[n.high.weight]) * probability_one(n.high.node, qubit, memo);
+    memo[node] = p;
+    return p;
+}
+
+int QuIDD::measure(std::size_t qubit) {
+    if (qubit >= qubits || root.node == kTerminal) return 0;
+    std::vector<double> memo(nodes.size(), -1.0);
+    double total = std::norm(root.weight);
+    double p1 = total * probability_one(root.node, qubit, memo);
+    std::bernoulli_distribution dist(std::min(1.0, std::max(0.0, p1 / total)));
+    int result = dist(global_rng());
+    const std::complex<double> proj[2][2] = {{result ? 0.0 : 1.0, 0.0},
+                                             {0.0, result ? 1.0 : 0.0}};
+    apply_controlled(0, qubit, proj);
+    double p = result ? p1 : total - p1;
+    root.weight /= std::sqrt(p / total);
+    return result;
+}
+
+std::map<std::size_t, std::size_t> QuIDD::sample(const std::vector<std::size_t>& measured,
+                                                 std::size_t shots) const {
+    std::map<std::size_t, std::size_t> histogram;
+    if (root.node == kTerminal || is_zero(root.weight)) return histogram;
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    auto& rng = global_rng();
+    for (std::size_t s = 0; s < shots; ++s) {
+        std::size_t index = 0;
+        for (Index i = root.node; i != kTerminal;) {
+            const Node& n = nodes[i];
+            bool one = dist(rng) < std::norm(weights[n.high.weight]);
+            if (one) index |= 1ULL << n.var;
+            i = one ? n.high.node : n.low.node;
+        }
+        std::size_t outcome = 0;
+        for (std::size_t j = 0; j < measured.size(); ++j)
+            if ((index >> measured[j]) & 1ULL) outcome |= 1ULL << j;
+        histogram[outcome]++;
+    }
+    return histogram;
+}
+
+QuIDD::RawEdge QuIDD::build(const std::complex<double>* st,
+                            std::size_t start, std::size_t end, std::size_t var) {
     if (var == 0) {
         assert(end - start == 1);
-        return make_terminal(st[start]);
+        if (is_zero(st[start])) return {kTerminal, 0.0};
+        return {kTerminal, st[start]};
     }
     std::size_t mid = start + ((end - start) >> 1);
-    Node* low = build(st, start, mid, var - 1);
-    Node* high = build(st, mid, end, var - 1);
-    if (low == high) return low;
-    return make_node(var - 1, low, high);
+    RawEdge low = build(st, start, mid, var - 1);
+    RawEdge high = build(st, mid, end, var - 1);
+    return make_node(static_cast<std::uint32_t>(var - 1), low, high);
+}
+
+QuIDD::QuIDD(const std::vector<std::complex<double>>& state) : QuIDD(std::size_t(0)) {
+    while ((1ULL << qubits) < state.size()) ++qubits;
+    root = build(state.data(), 0, state.size(), qubits);
 }
 
-QuIDD::QuIDD(const std::vector<std::complex<double>>& state) {
-    qubits = 0;
-    std::size_t size = state.size();
-    while ((1ULL << qubits) < size) ++qubits;
-    root = build(state, 0, size, qubits);
+QuIDD::QuIDD(const StateVector<double>& state) : QuIDD(std::size_t(0)) {
+    while ((1ULL << qubits) < state.size()) ++qubits;
+    root = build(state.data(), 0, state.size(), qubits);
 }
 
-void QuIDD::fill(Node* node, std::size_t start, std::size_t end,
-                 std::vector<std::complex<double>>& out) const {
-    if (!node) return;
-    if (node->is_terminal) {
-        for (std::size_t i = start; i < end; ++i) out[i] = node->value;
+QuIDD::QuIDD(std::size_t n) : qubits(n) { reset(); }
+
+void QuIDD::reset() {
+    nodes.assign(1, Node{{kTerminal, 0}, {kTerminal, 0}, kFreeVar});
+    free_nodes.clear();
+    weights.assign({std::complex<double>(0.0), std::complex<double>(1.0)});
+    free_weights.clear();
+    matrix_nodes.assign(1, MatrixNode{{}, kFreeVar, true});
+    unique_slots.assign(64, 0);
+    unique_used = 0;
+    weight_slots.assign(64, 0);
+    weight_used = 0;
+    matrix_slots.assign(64, 0);
+    matrix_used = 0;
+    multiply_cache.assign(kComputeTableSize, MultiplyEntry{0, 0, {0, 0.0}});
+    add_cache.assign(kComputeTableSize, AddEntry{0, 0, 0.0, {0, 0.0}});
+    collect_threshold = kMinCollect;
+    RawEdge e{kTerminal, 1.0};
+    for (std::uint32_t v = 0; v < qubits; ++v) e = make_node(v, e, {kTerminal, 0.0});
+    root = e;
+}
+
+std::complex<double> QuIDD::amplitude(std::size_t index) const {
+    std::complex<double> w = root.weight;
+    for (Index i = root.node; i != kTerminal && w != 0.0;) {
+        const Node& n = nodes[i];
+        const Edge& e = (index >> n.var) & 1ULL ? n.high : n.low;
+        w *= weights[e.weight];
+        i = e.node;
+    }
+    return w;
+}
+
+void QuIDD::fill(const RawEdge& e, std::ptrdiff_t var, std::size_t start,
+                 std::complex<double> w, std::size_t first, std::size_t end,
+                 std::complex<double>* out) const {
+    w *= e.weight;
+    if (w == 0.0) return;
+    if (var < 0) {
+        out[start - first] = w;
         return;
     }
-    std::size_t mid = start + ((end - start) >> 1);
-    fill(node->low, start, mid, out);
-    fill(node->high, mid, end, out);
+    const Node& n = nodes[e.node];
+    const std::size_t half = std::size_t(1) << var;
+    if (start + half > first) fill(raw(n.low), var - 1, start, w, first, end, out);
+    if (start + half < end) fill(raw(n.high), var - 1, start + half, w, first, end, out);
 }
 
 std::vector<std::complex<double>> QuIDD::to_vector() const {
     std::vector<std::complex<double>> out(1ULL << qubits, {0.0,0.0});
-    fill(root, 0, out.size(), out);
+    fill(root, static_cast<std::ptrdiff_t>(qubits) - 1, 0, 1.0, 0, out.size(), out.data());
     return out;
 }
 
+QuIDD::AmplitudeSource QuIDD::stream() const {
+    std::size_t next = 0;
+    return [this, next](std::complex<double>* out, std::size_t max) mutable {
+        const std::size_t count = std::min(max, (std::size_t(1) << qubits) - next);
+        std::fill(out, out + count, std::complex<double>(0.0));
+        if (count > 0)
+            fill(root, static_cast<std::ptrdiff_t>(qubits) - 1, 0, 1.0, next, next + count, out);
+        next += count;
+        return count;
+    };
+}
+
+std::size_t QuIDD::nnz(Index node, std::vector<std::size_t>& memo) const {
+    if (node == kTerminal) return 1;
+    // Every live node reaches the terminal with a non-zero weight, so 0
+    // marks a node not counted yet.
+    if (memo[node] != 0) return memo[node];
+    const Node& n = nodes[node];
+    const std::size_t low = n.low.weight == 0 ? 0 : nnz(n.low.node, memo);
+    const std::size_t high = n.high.weight == 0 ? 0 : nnz(n.high.node, memo);
+    memo[node] = low > SIZE_MAX - high ? SIZE_MAX : low + high;
+    return memo[node];
+}
+
+std::size_t QuIDD::nnz() const {
+    if (is_zero(root.weight)) return 0;
+    std::vector<std::size_t> memo(nodes.size(), 0);
+    return nnz(root.node, memo);
+}
+
 } // namespace qpp
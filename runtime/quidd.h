@@ -1,61 +1,209 @@
 #pragma once
+#include "state_allocator.h"
 #include <complex>
-#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
 #include <vector>
-#include <memory>
 
 namespace qpp {
+class DiskPager;
+
+// Edge-weighted decision diagram over the basis index, qubit num_qubits()-1
+// at the root down to qubit 0. Every path visits every qubit; an edge with
+// weight zero ends the path early. Gates are applied as matrix diagrams
+// multiplied into the state, so a circuit with structured amplitudes never
+// needs the dense 2^n vector.
 class QuIDD {
 public:
+    // Nodes and edge weights live in arenas addressed by 32-bit indices.
+    // Node 0 is the terminal; weight 0 is zero and weight 1 is one.
+    using Index = std::uint32_t;
+    static constexpr Index kTerminal = 0;
+
+    struct Edge {
+        Index node;
+        Index weight;
+    };
+    // `low` covers the indices with bit `var` clear, `high` those with it
+    // set. The two weights have unit total norm and the first non-zero one
+    // is real and positive, so equal sub-vectors share one node and the
+    // squared weights are the branch probabilities.
     struct Node {
-        Node* low;
-        Node* high;
-        std::size_t var;
-        bool is_terminal;
-        std::complex<double> value;
+        Edge low;
+        Edge high;
+        std::uint32_t var;
+    };
+    // e[2 * row + col] is the block selected by the row and column bit of
+    // `var`. `identity` marks nodes equal to the identity on var and below.
+    struct MatrixNode {
+        Edge e[4];
+        std::uint32_t var;
+        bool identity;
     };
 
+    // Fills `out` with up to `max` amplitudes, continuing in index order, and
+    // returns how many it wrote; 0 means the stream ended.
+    using AmplitudeSource = std::function<std::size_t(std::complex<double>* out, std::size_t max)>;
+
     explicit QuIDD(const std::vector<std::complex<double>>& state);
+    explicit QuIDD(const StateVector<double>& state);
+    // |0...0> on `qubits` qubits.
+    explicit QuIDD(std::size_t qubits);
+    // Build from 2^qubits streamed amplitudes, holding one chunk and one
+    // pending edge per level rather than the dense vector. Throws
+    // std::runtime_error if the stream ends early.
+    QuIDD(std::size_t qubits, const AmplitudeSource& source);
+    // Stream the contents of a pager, whose size must be a power of two.
+    explicit QuIDD(DiskPager& pager);
+
+    // Write the live diagram in the compact format MappedQuIDD reads.
+    bool save(const std::string& path) const;
+    // Replace the diagram with one read from `path`: either a file written by
+    // save() or a dense checkpoint (size_t count, then the amplitudes) as
+    // written by save_state_to_file, which is streamed in chunks.
+    bool load(const std::string& path);
 
     std::vector<std::complex<double>> to_vector() const;
+    // Stream the amplitudes in index order. Each chunk descends only into
+    // the paths that reach it, so the dense vector is never built. The
+    // diagram must outlive the source and stay unchanged while it is read.
+    AmplitudeSource stream() const;
+    // Basis states with a non-zero amplitude, counted once per node rather
+    // than per index, saturating at SIZE_MAX.
+    std::size_t nnz() const;
+    // One root-to-terminal walk, O(num_qubits()).
+    std::complex<double> amplitude(std::size_t index) const;
+
+    void apply_h(std::size_t qubit);
+    void apply_x(std::size_t qubit);
+    void apply_y(std::size_t qubit);
+    void apply_z(std::size_t qubit);
+    void apply_s(std::size_t qubit);
+    void apply_t(std::size_t qubit);
+    void apply_rx(std::size_t qubit, double theta);
+    void apply_ry(std::size_t qubit, double theta);
+    void apply_rz(std::size_t qubit, double theta);
+    void apply_cnot(std::size_t control, std::size_t target);
+    void apply_cz(std::size_t control, std::size_t target);
+    void apply_ccnot(std::size_t c1, std::size_t c2, std::size_t target);
+    void apply_swap(std::size_t q1, std::size_t q2);
+    // 2x2 matrix `m` on `target` where every bit of `controls` is set.
+    void apply_controlled(std::size_t controls, std::size_t target,
+                          const std::complex<double> m[2][2]);
 
-    std::size_t node_count() const { return nodes.size(); }
-    std::size_t memory_bytes() const { return nodes.size() * sizeof(Node); }
+    int measure(std::size_t qubit);
+    // Draw `shots` outcomes of `qubits` without collapsing, one root-to-
+    // terminal walk per shot. Bit j of an outcome is the value of qubits[j].
+    std::map<std::size_t, std::size_t> sample(const std::vector<std::size_t>& qubits,
+                                              std::size_t shots) const;
+    void reset();
+
+    // Mark the nodes reachable from the root and put the rest, with the
+    // weights only they used, on the free lists. Gates call this on their
+    // own once the arena has doubled since the last collection.
+    void collect();
+
+    std::size_t num_qubits() const { return qubits; }
+    // Allocated nodes, excluding the terminal; dead nodes count until the
+    // next collection.
+    std::size_t node_count() const { return nodes.size() - 1 - free_nodes.size(); }
+    std::size_t memory_bytes() const {
+        return node_count() * sizeof(Node) +
+               (weights.size() - free_weights.size()) * sizeof(std::complex<double>);
+    }
 
 private:
-    Node* make_terminal(const std::complex<double>& val);
-    Node* make_node(std::size_t var, Node* low, Node* high);
-    Node* build(const std::vector<std::complex<double>>& st,
-                std::size_t start, std::size_t end, std::size_t var);
-    void fill(Node* node, std::size_t start, std::size_t end,
-              std::vector<std::complex<double>>& out) const;
-
-    Node* root;
-    std::size_t qubits;
-    std::vector<std::unique_ptr<Node>> nodes;
-    struct NodeKey {
-        std::size_t var; Node* low; Node* high;
-        bool operator==(const NodeKey& other) const {
-            return var==other.var && low==other.low && high==other.high;
-        }
+    // Edge whose weight is not interned yet, used while computing.
+    struct RawEdge {
+        Index node;
+        std::complex<double> weight;
     };
-    struct NodeKeyHash {
-        std::size_t operator()(const NodeKey& k) const {
-            return std::hash<std::size_t>()(k.var) ^
-                   (std::hash<Node*>()(k.low) << 1) ^
-                   (std::hash<Node*>()(k.high) << 2);
-        }
-    };
-    std::unordered_map<NodeKey, Node*, NodeKeyHash> unique_table;
-    struct TermKey {
-        double r, i;
-        bool operator==(const TermKey& o) const { return r==o.r && i==o.i; }
+
+    Index intern(std::complex<double> w);
+    RawEdge make_node(std::uint32_t var, RawEdge low, RawEdge high);
+    RawEdge make_matrix_node(std::uint32_t var, const RawEdge (&e)[4]);
+    RawEdge gate_diagram(std::size_t controls, std::size_t target,
+                         const std::complex<double> m[2][2]);
+    RawEdge multiply(const RawEdge& m, const RawEdge& x, std::ptrdiff_t var);
+    RawEdge add(RawEdge a, RawEdge b, std::ptrdiff_t var);
+    RawEdge raw(const Edge& e) const { return {e.node, weights[e.weight]}; }
+    double probability_one(Index node, std::size_t qubit, std::vector<double>& memo) const;
+    RawEdge build(const std::complex<double>* st,
+                  std::size_t start, std::size_t end, std::size_t var);
+    // Write the amplitudes of `e`, which covers [start, start + 2^(var+1))
+    // and overlaps [first, end), that fall in that range to out[i - first].
+    void fill(const RawEdge& e, std::ptrdiff_t var, std::size_t start,
+              std::complex<double> w, std::size_t first, std::size_t end,
+              std::complex<double>* out) const;
+    std::size_t nnz(Index node, std::vector<std::size_t>& memo) const;
+    void rebuild_unique_table();
+    void rebuild_weight_table();
+
+    RawEdge root;
+    std::size_t qubits;
+
+    std::vector<Node> nodes;
+    std::vector<Index> free_nodes;
+    // Open-addressing unique table of node indices, 0 marking an empty slot.
+    std::vector<Index> unique_slots;
+    std::size_t unique_used{0};
+
+    // Interned weights: values within the tolerance of an existing entry
+    // reuse it, so near-equal sub-vectors still share a node.
+    std::vector<std::complex<double>> weights;
+    std::vector<Index> free_weights;
+    std::vector<Index> weight_slots;
+    std::size_t weight_used{0};
+
+    // Gate diagrams only live until the next collection.
+    std::vector<MatrixNode> matrix_nodes;
+    std::vector<Index> matrix_slots;
+    std::size_t matrix_used{0};
+
+    // Lossy direct-mapped compute tables for unit-weight operands.
+    struct MultiplyEntry {
+        Index m, x;
+        RawEdge result;
     };
-    struct TermKeyHash {
-        std::size_t operator()(const TermKey& k) const {
-            return std::hash<double>()(k.r) ^ (std::hash<double>()(k.i) << 1);
-        }
+    struct AddEntry {
+        Index a, b;
+        std::complex<double> ratio;
+        RawEdge result;
     };
-    std::unordered_map<TermKey, Node*, TermKeyHash> term_table;
+    std::vector<MultiplyEntry> multiply_cache;
+    std::vector<AddEntry> add_cache;
+
+    std::size_t collect_threshold;
+};
+
+// Read-only view of a file written by QuIDD::save(). The file is mapped
+// rather than read: opening checks every node once, without copying, and
+// amplitude() then only touches the pages on its root-to-terminal path.
+class MappedQuIDD {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a
+    // well-formed diagram file.
+    explicit MappedQuIDD(const std::string& path);
+    ~MappedQuIDD();
+    MappedQuIDD(const MappedQuIDD&) = delete;
+    MappedQuIDD& operator=(const MappedQuIDD&) = delete;
+
+    std::complex<double> amplitude(std::size_t index) const;
+    std::size_t num_qubits() const { return qubits; }
+    // Nodes in the file, excluding the terminal.
+    std::size_t node_count() const { return nodes_in_file - 1; }
+
+private:
+    void* base{nullptr};
+    std::size_t length{0};
+    std::size_t qubits{0};
+    std::size_t nodes_in_file{0};
+    QuIDD::Index root_node{QuIDD::kTerminal};
+    std::complex<double> root_weight;
+    const std::complex<double>* weights{nullptr};
+    const QuIDD::Node* nodes{nullptr};
 };
 } // namespace qpp
@@ -0,0 +1,266 @@
+#include "quidd.h"
+#include "disk_pager.h"
+#include "state_file.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace qpp {
+
+namespace {
+// Amplitudes read per call to the source while streaming.
+constexpr std::size_t kStreamChunk = std::size_t(1) << 16;
+constexpr char kMagic[8] = {'Q', 'P', 'P', 'Q', 'D', 'D', '1', '\0'};
+
+// File layout: this header, `weights` complex doubles (0 is zero, 1 is one)
+// and `nodes` Node records (0 is the terminal). Children always precede
+// their parents, and every index in the file refers to these arrays.
+struct FileHeader {
+    char magic[8];
+    std::uint32_t qubits;
+    std::uint32_t nodes;
+    std::uint32_t weights;
+    std::uint32_t root_node;
+    double root_re;
+    double root_im;
+};
+static_assert(sizeof(FileHeader) == 40, "diagram file header is packed");
+static_assert(sizeof(QuIDD::Node) == 20, "diagram file nodes are packed");
+static_assert(sizeof(FileHeader) % alignof(std::complex<double>) == 0,
+              "weights follow the header aligned");
+
+// Header fields every reader relies on: a root among the nodes, the zero
+// and one weights, and variables that fit in an index.
+bool valid_header(const FileHeader& header) {
+    return header.nodes != 0 && header.weights >= 2 && header.root_node < header.nodes &&
+           header.qubits <= 64;
+}
+
+// Size of a file holding the nodes and weights `header` counts.
+std::size_t file_bytes(const FileHeader& header) {
+    return sizeof(FileHeader) + std::size_t(header.weights) * sizeof(std::complex<double>) +
+           std::size_t(header.nodes) * sizeof(QuIDD::Node);
+}
+
+// Node `i` may only refer to earlier nodes, which also rules out cycles, and
+// to weights in the file, and must test a qubit of the register.
+bool valid_node(const QuIDD::Node& n, std::size_t i, const FileHeader& header) {
+    return n.low.node < i && n.high.node < i && n.low.weight < header.weights &&
+           n.high.weight < header.weights && n.var < header.qubits;
+}
+
+std::size_t log2_exact(std::size_t n) {
+    std::size_t q = 0;
+    while ((std::size_t(1) << q) < n) ++q;
+    return (std::size_t(1) << q) == n ? q : std::numeric_limits<std::size_t>::max();
+}
+
+std::size_t pager_qubits(const DiskPager& pager) {
+    std::size_t n = log2_exact(pager.size());
+    if (n >= 64) throw std::runtime_error("pager size is not a power of two");
+    return n;
+}
+} // namespace
+
+// Amplitudes arrive in index order, so the diagram is completed bottom-up
+// like a binary counter: pending[v] holds the finished low half at level v
+// until its high half arrives.
+QuIDD::QuIDD(std::size_t n, const AmplitudeSource& source) : QuIDD(std::size_t(0)) {
+    qubits = n;
+    std::vector<RawEdge> pending(n + 1);
+    std::vector<char> waiting(n + 1, 0);
+    std::vector<std::complex<double>> chunk(std::min(kStreamChunk, std::size_t(1) << n));
+    const std::size_t total = std::size_t(1) << n;
+    for (std::size_t index = 0; index < total;) {
+        std::size_t got = source(chunk.data(), std::min(chunk.size(), total - index));
+        if (got == 0) throw std::runtime_error("amplitude stream ended early");
+        for (std::size_t k = 0; k < got; ++k) {
+            RawEdge e{kTerminal, chunk[k]};
+            std::size_t level = 0;
+            for (; waiting[level]; ++level) {
+                e = make_node(static_cast<std::uint32_t>(level), pending[level], e);
+                waiting[level] = 0;
+            }
+            pending[level] = e;
+            waiting[level] = 1;
+        }
+        index += got;
+    }
+    root = pending[n];
+    if (std::norm(root.weight) < 1e-26) root = {kTerminal, 0.0};
+}
+
+QuIDD::QuIDD(DiskPager& pager)
+    : QuIDD(pager_qubits(pager), [&pager, next = std::size_t(0)](
+                                          std::complex<double>* out, std::size_t max) mutable {
+          std::size_t count = std::min(max, pager.size() - next);
+          for (std::size_t k = 0; k < count; ++k) out[k] = pager.read(next + k);
+          next += count;
+          return count;
+      }) {}
+
+bool QuIDD::save(const std::string& path) const {
+    // Renumber the live nodes in post-order and their weights densely.
+    std::vector<Index> node_map(nodes.size(), 0);
+    std::vector<Index> weight_map(weights.size(), 0);
+    std::vector<Node> out_nodes(1, nodes[kTerminal]);
+    std::vector<std::complex<double>> out_weights{0.0, 1.0};
+    weight_map[1] = 1;
+    auto map_weight = [&](Index w) {
+        if (w > 1 && !weight_map[w]) {
+            weight_map[w] = static_cast<Index>(out_weights.size());
+            out_weights.push_back(weights[w]);
+        }
+        return weight_map[w];
+    };
+    std::vector<std::pair<Index, bool>> stack;
+    if (root.node != kTerminal) stack.push_back({root.node, false});
+    while (!stack.empty()) {
+        auto [i, expanded] = stack.back();
+        stack.pop_back();
+        if (node_map[i]) continue;
+        const Node& n = nodes[i];
+        if (!expanded) {
+            stack.push_back({i, true});
+            for (Index child : {n.high.node, n.low.node})
+                if (child != kTerminal && !node_map[child]) stack.push_back({child, false});
+            continue;
+        }
+        node_map[i] = static_cast<Index>(out_nodes.size());
+        out_nodes.push_back({{node_map[n.low.node], map_weight(n.low.weight)},
+                             {node_map[n.high.node], map_weight(n.high.weight)},
+                             n.var});
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.qubits = static_cast<std::uint32_t>(qubits);
+    header.nodes = static_cast<std::uint32_t>(out_nodes.size());
+    header.weights = static_cast<std::uint32_t>(out_weights.size());
+    header.root_node = node_map[root.node];
+    header.root_re = root.weight.real();
+    header.root_im = root.weight.imag();
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) return false;
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(out_weights.data()),
+              out_weights.size() * sizeof(std::complex<double>));
+    ofs.write(reinterpret_cast<const char*>(out_nodes.data()), out_nodes.size() * sizeof(Node));
+    return static_cast<bool>(ofs);
+}
+
+bool QuIDD::load(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) return false;
+    char magic[sizeof(kMagic)];
+    if (!ifs.read(magic, sizeof(magic))) return false;
+
+    if (std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+        // Dense checkpoint in either state file layout.
+        StateFileReader reader(path);
+        if (!reader.ok()) return false;
+        std::size_t n = log2_exact(reader.size());
+        if (n >= 64) return false;
+        try {
+            *this = QuIDD(n, [&reader](std::complex<double>* out, std::size_t max) {
+                return reader.read(out, max);
+            });
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        return true;
+    }
+
+    FileHeader header;
+    ifs.seekg(0, std::ios::end);
+    const std::streamoff length = ifs.tellg();
+    ifs.seekg(0);
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) || !valid_header(header))
+        return false;
+    // The counts come from the file, so they are held against its length
+    // before anything is allocated for them.
+    if (length < 0 || static_cast<std::size_t>(length) != file_bytes(header)) return false;
+    std::vector<std::complex<double>> file_weights(header.weights);
+    std::vector<Node> file_nodes(header.nodes);
+    if (!ifs.read(reinterpret_cast<char*>(file_weights.data()), header.weights * sizeof(std::complex<double>)) ||
+        !ifs.read(reinterpret_cast<char*>(file_nodes.data()), header.nodes * sizeof(Node)))
+        return false;
+
+    QuIDD loaded(std::size_t(0));
+    loaded.qubits = header.qubits;
+    // make_node renormalizes; carry its factor (1 up to rounding) upwards.
+    std::vector<RawEdge> edge(header.nodes, RawEdge{kTerminal, 1.0});
+    for (std::size_t i = 1; i < file_nodes.size(); ++i) {
+        const Node& n = file_nodes[i];
+        if (!valid_node(n, i, header)) return false;
+        RawEdge low{edge[n.low.node].node, edge[n.low.node].weight * file_weights[n.low.weight]};
+        RawEdge high{edge[n.high.node].node, edge[n.high.node].weight * file_weights[n.high.weight]};
+        edge[i] = loaded.make_node(n.var, low, high);
+    }
+    const RawEdge& r = edge[header.root_node];
+    loaded.root = {r.node, r.weight * std::complex<double>(header.root_re, header.root_im)};
+    *this = std::move(loaded);
+    return true;
+}
+
+MappedQuIDD::MappedQuIDD(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) throw std::runtime_error("Failed to open diagram file " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(FileHeader)) {
+        close(fd);
+        throw std::runtime_error("Not a diagram file: " + path);
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        base = nullptr;
+        throw std::runtime_error("Failed to map diagram file " + path);
+    }
+    const auto* header = static_cast<const FileHeader*>(base);
+    bool valid = std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+                 valid_header(*header) && length == file_bytes(*header);
+    if (valid) {
+        const char* bytes = static_cast<const char*>(base);
+        weights = reinterpret_cast<const std::complex<double>*>(bytes + sizeof(FileHeader));
+        nodes = reinterpret_cast<const QuIDD::Node*>(
+            bytes + sizeof(FileHeader) + header->weights * sizeof(std::complex<double>));
+        // amplitude() follows edges unchecked, so every node is checked once
+        // here rather than on each lookup.
+        for (std::size_t i = 1; valid && i < header->nodes; ++i)
+            valid = valid_node(nodes[i], i, *header);
+    }
+    if (!valid) {
+        munmap(base, length);
+        base = nullptr;
+        throw std::runtime_error("Not a diagram file: " + path);
+    }
+    qubits = header->qubits;
+    nodes_in_file = header->nodes;
+    root_node = header->root_node;
+    root_weight = {header->root_re, header->root_im};
+}
+
+MappedQuIDD::~MappedQuIDD() {
+    if (base) munmap(base, length);
+}
+
+std::complex<double> MappedQuIDD::amplitude(std::size_t index) const {
+    std::complex<double> w = root_weight;
+    for (QuIDD::Index i = root_node; i != QuIDD::kTerminal && w != 0.0;) {
+        const QuIDD::Node& n = nodes[i];
+        const QuIDD::Edge& e = (index >> n.var) & 1ULL ? n.high : n.low;
+        w *= weights[e.weight];
+        i = e.node;
+    }
+    return w;
+}
+
+} // namespace qpp
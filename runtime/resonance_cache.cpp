@@ -0,0 +1,244 @@
+#include "resonance_cache.h"
+#include "state_file.h"
+#include "../include/runtime_config.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace qpp {
+namespace {
+using Amp = std::complex<double>;
+
+// An unlinked file in memory of `bytes` bytes, mapped shared at `base`:
+// memfd where the kernel has it, otherwise a temporary file unlinked at
+// once. With `huge` set it must be a hugetlb memfd. Returns -1 on failure.
+int open_anonymous(std::size_t bytes, bool huge, void*& base) {
+    int fd = -1;
+#ifdef MFD_CLOEXEC
+#ifdef MFD_HUGETLB
+    if (huge) fd = memfd_create("qpp_zone", MFD_CLOEXEC | MFD_HUGETLB);
+#endif
+    if (!huge) fd = memfd_create("qpp_zone", MFD_CLOEXEC);
+#endif
+    if (fd == -1 && !huge) {
+        char tmpl[] = "/tmp/qpp_zoneXXXXXX";
+        fd = mkstemp(tmpl);
+        if (fd != -1) unlink(tmpl);
+    }
+    if (fd == -1) return -1;
+    // A hugetlb mapping reserves its pages here, so a short pool fails now
+    // rather than at a fault.
+    base = ftruncate(fd, static_cast<off_t>(bytes)) == 0
+               ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+               : MAP_FAILED;
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Fill `out` with the `count` amplitudes of the state file at `path`.
+bool read_spill(const std::string& path, Amp* out, std::size_t count) {
+    StateFileReader reader(path);
+    if (!reader.ok() || reader.size() != count) return false;
+    for (std::size_t i = 0; i < count;) {
+        std::size_t got = reader.read(out + i, count - i);
+        if (got == 0) return false;
+        i += got;
+    }
+    return true;
+}
+
+// Write `count` amplitudes from `source` to a new temporary file in
+// PageCodec::Lossless. Returns its path, or an empty string on failure.
+std::string write_spill(std::size_t count, const StateSource& source, std::size_t& file_bytes) {
+    char tmpl[] = "/tmp/qpp_zoneXXXXXX";
+    int fd = mkstemp(tmpl);
+    if (fd == -1) return {};
+    close(fd);
+    if (!save_state_file(tmpl, count, source, PageCodec::Lossless)) {
+        std::remove(tmpl);
+        return {};
+    }
+    struct stat st;
+    file_bytes = stat(tmpl, &st) == 0 ? static_cast<std::size_t>(st.st_size) : 0;
+    return tmpl;
+}
+
+// Hands out `count` amplitudes from `data` in order.
+StateSource read_from(const Amp* data, std::size_t count) {
+    auto next = std::make_shared<std::size_t>(0);
+    return [data, count, next](Amp* out, std::size_t max) {
+        const std::size_t n = std::min(max, count - *next);
+        std::copy(data + *next, data + *next + n, out);
+        *next += n;
+        return n;
+    };
+}
+} // namespace
+
+ResonanceCache::~ResonanceCache() { clear(); }
+
+template<typename Fill>
+bool ResonanceCache::make_zone(Entry& e, Fill fill) {
+    const std::size_t bytes = e.count * sizeof(Amp);
+    void* base = nullptr;
+    e.huge = runtime_config.huge_pages == HugePages::Explicit && bytes % huge_page_size() == 0;
+    e.fd = e.huge ? open_anonymous(bytes, true, base) : -1;
+    if (e.fd == -1) {
+        e.huge = false;
+        e.fd = open_anonymous(bytes, false, base);
+    }
+    if (e.fd == -1) return false;
+    e.view = static_cast<Amp*>(base);
+    if (fill(e.view)) return true;
+    close_zone(e);
+    return false;
+}
+
+void ResonanceCache::close_zone(Entry& e) {
+    munmap(e.view, e.count * sizeof(Amp));
+    close(e.fd);
+    e.view = nullptr;
+    e.fd = -1;
+}
+
+bool ResonanceCache::put(const std::string& key, const StateVector<double>& state) {
+    erase(key);
+    const std::size_t count = state.size();
+    const std::size_t bytes = count * sizeof(Amp);
+    if (bytes > runtime_config.resonance_cache_mb << 20) {
+        // Too big to keep in memory at all: straight to disk.
+        if (!runtime_config.resonance_spill) return false;
+        std::size_t file_bytes = 0;
+        std::string path = write_spill(count, read_from(state.data(), count), file_bytes);
+        if (path.empty()) return false;
+        Entry& e = entries[key];
+        e.count = count;
+        e.path = path;
+        e.file_bytes = file_bytes;
+        on_disk += file_bytes;
+        ++counters.spills;
+        return true;
+    }
+    make_room(bytes);
+    Entry zone;
+    zone.count = count;
+    if (!make_zone(zone, [&](Amp* out) {
+            std::copy(state.begin(), state.end(), out);
+            return true;
+        }))
+        return false;
+    Entry& e = entries[key] = zone;
+    lru.push_front(key);
+    e.lru = lru.begin();
+    resident += bytes;
+    return true;
+}
+
+bool ResonanceCache::get(const std::string& key, StateVector<double>& state) {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        ++counters.misses;
+        return false;
+    }
+    Entry& e = it->second;
+    if (e.count != state.size()) return false;
+    const std::size_t bytes = e.count * sizeof(Amp);
+    if (!e.view) {
+        ++counters.disk_hits;
+        // A zone over the memory limit is read straight from its file.
+        if (bytes > runtime_config.resonance_cache_mb << 20)
+            return read_spill(e.path, state.data(), e.count);
+        if (!unspill(key, e)) return false;
+    } else {
+        ++counters.hits;
+        lru.splice(lru.begin(), lru, e.lru);
+    }
+    char* data = reinterpret_cast<char*>(state.data());
+    std::size_t shared = 0;
+    if (e.huge && state.capacity() * sizeof(Amp) >= StateAllocator<Amp>::kMapBytes)
+        shared = share_state_pages(data, bytes, e.fd);
+    std::memcpy(data + shared, reinterpret_cast<const char*>(e.view) + shared, bytes - shared);
+    return true;
+}
+
+bool ResonanceCache::erase(const std::string& key) {
+    auto it = entries.find(key);
+    if (it == entries.end()) return false;
+    drop(it->second);
+    entries.erase(it);
+    return true;
+}
+
+void ResonanceCache::clear() {
+    for (auto& entry : entries) drop(entry.second);
+    entries.clear();
+}
+
+ResonanceCacheStats ResonanceCache::stats() const {
+    ResonanceCacheStats s = counters;
+    s.memory_bytes = resident;
+    s.disk_bytes = on_disk;
+    s.entries = entries.size();
+    return s;
+}
+
+void ResonanceCache::make_room(std::size_t bytes) {
+    const std::size_t limit = runtime_config.resonance_cache_mb << 20;
+    while (!lru.empty() && resident + bytes > limit) {
+        auto it = entries.find(lru.back());
+        Entry& e = it->second;
+        lru.pop_back();
+        resident -= e.count * sizeof(Amp);
+        ++counters.evictions;
+        if (runtime_config.resonance_spill && spill(e)) continue;
+        close_zone(e);
+        entries.erase(it);
+    }
+}
+
+bool ResonanceCache::spill(Entry& e) {
+    e.path = write_spill(e.count, read_from(e.view, e.count), e.file_bytes);
+    if (e.path.empty()) return false;
+    close_zone(e);
+    on_disk += e.file_bytes;
+    ++counters.spills;
+    return true;
+}
+
+bool ResonanceCache::unspill(const std::string& key, Entry& e) {
+    const std::size_t bytes = e.count * sizeof(Amp);
+    make_room(bytes);
+    if (!make_zone(e, [&](Amp* out) { return read_spill(e.path, out, e.count); }))
+        return false;
+    std::remove(e.path.c_str());
+    e.path.clear();
+    on_disk -= e.file_bytes;
+    e.file_bytes = 0;
+    lru.push_front(key);
+    e.lru = lru.begin();
+    resident += bytes;
+    return true;
+}
+
+void ResonanceCache::drop(Entry& e) {
+    if (e.view) {
+        close_zone(e);
+        lru.erase(e.lru);
+        resident -= e.count * sizeof(Amp);
+    }
+    if (!e.path.empty()) {
+        std::remove(e.path.c_str());
+        on_disk -= e.file_bytes;
+    }
+    e.path.clear();
+}
+} // namespace qpp
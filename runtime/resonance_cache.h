@@ -0,0 +1,84 @@
+#pragma once
+#include "state_allocator.h"
+#include <complex>
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace qpp {
+struct ResonanceCacheStats {
+    std::size_t hits = 0;        // loads served from memory
+    std::size_t disk_hits = 0;   // loads read back from a spill file
+    std::size_t misses = 0;      // loads of a key that is not cached
+    std::size_t evictions = 0;   // zones pushed out of memory
+    std::size_t spills = 0;      // evicted zones written to disk
+    std::size_t memory_bytes = 0;
+    std::size_t disk_bytes = 0;
+    std::size_t entries = 0;
+};
+
+// Saved dense states by key, for variational loops that store and restore
+// reference states every iteration. A zone in memory lives in an anonymous
+// file that saving copies the state into once. Under HugePages::Explicit
+// the file is on huge pages, and loading maps them privately into the
+// register's buffer, so a page is copied only when a gate first writes it;
+// otherwise loading copies the zone out, since copy-on-write faults on base
+// pages cost more than the copy once a gate writes every page.
+//
+// Zones past runtime_config.resonance_cache_mb are evicted least recently
+// used first. With runtime_config.resonance_spill they go to temporary
+// files in PageCodec::Lossless and come back into memory the next time
+// they are loaded; otherwise they are dropped.
+//
+// Not thread-safe; MemoryManager calls it under its lock.
+class ResonanceCache {
+public:
+    ResonanceCache() = default;
+    ~ResonanceCache();
+    ResonanceCache(const ResonanceCache&) = delete;
+    ResonanceCache& operator=(const ResonanceCache&) = delete;
+
+    // Store `state` under `key`, replacing what was there. False if it
+    // could not be kept, in memory or on disk.
+    bool put(const std::string& key, const StateVector<double>& state);
+    // Fill `state`, which must already have the zone's size, from `key`.
+    bool get(const std::string& key, StateVector<double>& state);
+    bool erase(const std::string& key);
+    void clear();
+
+    ResonanceCacheStats stats() const;
+    std::size_t memory_bytes() const { return resident; }
+    std::size_t disk_bytes() const { return on_disk; }
+
+private:
+    struct Entry {
+        std::size_t count = 0;
+        int fd = -1;           // in memory while open, mapped at `view`
+        std::complex<double>* view = nullptr;
+        std::string path;      // spill file otherwise
+        std::size_t file_bytes = 0;
+        bool huge = false;     // the file is on huge pages
+        std::list<std::string>::iterator lru;
+    };
+
+    // Open an anonymous file for the e.count amplitudes of `e`, map it and
+    // fill it from `fill`.
+    template<typename Fill>
+    static bool make_zone(Entry& e, Fill fill);
+    static void close_zone(Entry& e);
+    // Evict zones, least recently used first, until `bytes` more fit.
+    void make_room(std::size_t bytes);
+    bool spill(Entry& e);
+    // Read a spilled zone back into memory as the most recently used.
+    bool unspill(const std::string& key, Entry& e);
+    void drop(Entry& e);
+
+    std::unordered_map<std::string, Entry> entries;
+    // Keys of zones in memory, most recently used first.
+    std::list<std::string> lru;
+    std::size_t resident = 0;
+    std::size_t on_disk = 0;
+    ResonanceCacheStats counters;
+};
+} // namespace qpp
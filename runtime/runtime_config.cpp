@@ -1,7 +1,15 @@
 #include "runtime_config.h"
+#include <algorithm>
 
 namespace qpp {
 RuntimeConfig runtime_config;
 
 void set_disk_limit_mb(std::size_t mb) { runtime_config.disk_limit_mb = mb; }
+
+void set_fusion_max_qubits(std::size_t k) {
+  if (k == 0)
+    runtime_config.fusion_max_qubits = 0;
+  else
+    runtime_config.fusion_max_qubits = std::min<std::size_t>(std::max<std::size_t>(k, 2), 5);
+}
 } // namespace qpp
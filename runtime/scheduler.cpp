@@ -3,6 +3,7 @@
 #include "memory_tracker.h"
 #include "hardware_api.h"
 #include "logger.h"
+#include <limits>
 #include <mutex>
 
 namespace qpp {
@@ -15,6 +16,27 @@ void Scheduler::add_task(const Task& t) {
     cv.notify_one();
 }
 
+bool Scheduler::dispatch(Task& t) {
+    if (!t.handler)
+        return true;
+    try {
+        t.handler();
+        return true;
+    } catch (const MemoryBudgetExceeded& e) {
+        if (!t.deferred) {
+            LOG_WARN("Task '", t.name, "' deferred: ", e.what());
+            t.deferred = true;
+            t.priority = std::numeric_limits<int>::min();
+            add_task(t);
+            return false;
+        }
+        LOG_ERROR("Task '", t.name, "' dropped: ", e.what());
+    } catch (const std::exception& e) {
+        LOG_ERROR("Task '", t.name, "' failed: ", e.what());
+    }
+    return false;
+}
+
 void Scheduler::run() {
     running = true;
     for (;;) {
@@ -46,8 +68,8 @@ void Scheduler::run() {
         else if (t.hint == ExecHint::DENSE)
             msg += " [DENSE]";
         LOG_INFO(msg);
-        if (t.handler)
-            t.handler();
+        if (!dispatch(t))
+            continue;
         if (t.target == Target::QPU && qpu_backend())
             qpu_backend()->execute_qir("; scheduler dispatch\n");
         auto mem = memory.memory_usage();
@@ -95,8 +117,8 @@ void Scheduler::run_async() {
             else if (t.hint == ExecHint::DENSE)
                 msg += " [DENSE]";
             LOG_INFO(msg);
-            if (t.handler)
-                t.handler();
+            if (!dispatch(t))
+                continue;
             if (t.target == Target::QPU && qpu_backend())
                 qpu_backend()->execute_qir("; scheduler dispatch\n");
             auto mem = memory.memory_usage();
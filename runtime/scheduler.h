@@ -17,6 +17,8 @@ struct Task {
     ExecHint hint{ExecHint::NONE};
     int priority{0};
     std::function<void()> handler;
+    // Set once the task has been put back for lack of memory.
+    bool deferred{false};
 };
 
 class Scheduler {
@@ -29,6 +31,15 @@ public:
     void pause();
     void resume();
 private:
+    // Run the handler of `t`. A task turned away by the memory budget is put
+    // back once, behind everything queued, in case the tasks ahead of it
+    // free enough memory; other failures are logged and the task dropped,
+    // so one task cannot take down the rest. Returns false if the task did
+    // not complete. A task put back runs its handler again from the start,
+    // so handlers should hold back output and other side effects until they
+    // finish, as qpp-run's do.
+    bool dispatch(Task& t);
+
     struct Compare {
         bool operator()(const Task& a, const Task& b) const {
             return a.priority < b.priority; // higher priority first
@@ -0,0 +1,140 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+namespace qpp {
+// Objects indexed by small integer ids, for registers looked up once per
+// gate. Slots live in fixed chunks that are allocated on first use and
+// never move or shrink, so get() and pin() are a couple of atomic loads and
+// take no lock. insert() and detach() must be serialized by the owner.
+//
+// A detached object may still be in use by a reader that pinned it. The
+// owner keeps it until pinned() turns false and only then deletes it and
+// hands the id out again; a reader that pins after the detach sees an empty
+// slot.
+template<typename T>
+class SlotTable {
+public:
+    static constexpr std::size_t kChunkBits = 10;
+    static constexpr std::size_t kChunkSize = std::size_t(1) << kChunkBits;
+    static constexpr std::size_t kMaxChunks = 1024;
+    static constexpr std::size_t kCapacity = kChunkSize * kMaxChunks;
+
+    SlotTable() = default;
+    SlotTable(const SlotTable&) = delete;
+    SlotTable& operator=(const SlotTable&) = delete;
+    ~SlotTable() {
+        for (auto& c : chunks) {
+            Chunk* chunk = c.load(std::memory_order_relaxed);
+            if (!chunk) continue;
+            for (auto& s : chunk->slots) delete s.object.load(std::memory_order_relaxed);
+            delete chunk;
+        }
+    }
+
+    // The object in slot `id`, or nullptr. The caller must know that it is
+    // not detached while in use; otherwise use pin().
+    T* get(int id) const {
+        const Slot* s = slot(id);
+        return s ? s->object.load(std::memory_order_acquire) : nullptr;
+    }
+    // Like get(), but the object is kept alive until unpin(id).
+    T* pin(int id) const {
+        const Slot* s = slot(id);
+        if (!s) return nullptr;
+        // Both sequentially consistent: either detach() sees this pin or
+        // the load below sees the emptied slot.
+        s->pins.fetch_add(1);
+        T* object = s->object.load();
+        if (!object) s->pins.fetch_sub(1, std::memory_order_release);
+        return object;
+    }
+    void unpin(int id) const { slot(id)->pins.fetch_sub(1, std::memory_order_release); }
+    bool pinned(int id) const {
+        const Slot* s = slot(id);
+        return s && s->pins.load(std::memory_order_acquire) != 0;
+    }
+
+    // Store `object` in the empty slot `id`.
+    void insert(int id, std::unique_ptr<T> object) {
+        if (id < 0 || static_cast<std::size_t>(id) >= kCapacity)
+            throw std::length_error("slot table is full");
+        auto& c = chunks[static_cast<std::size_t>(id) >> kChunkBits];
+        Chunk* chunk = c.load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new Chunk();
+            c.store(chunk, std::memory_order_release);
+        }
+        chunk->slots[id & (kChunkSize - 1)].object.store(object.release(),
+                                                         std::memory_order_release);
+    }
+    // Empty slot `id` and return what it held (nullptr if nothing). The
+    // object is only safe to delete once pinned(id) is false.
+    T* detach(int id) {
+        Slot* s = const_cast<Slot*>(slot(id));
+        return s ? s->object.exchange(nullptr) : nullptr;
+    }
+
+private:
+    struct Slot {
+        std::atomic<T*> object{nullptr};
+        mutable std::atomic<std::uint32_t> pins{0};
+    };
+    struct Chunk {
+        std::array<Slot, kChunkSize> slots;
+    };
+
+    const Slot* slot(int id) const {
+        if (id < 0 || static_cast<std::size_t>(id) >= kCapacity) return nullptr;
+        const Chunk* chunk =
+            chunks[static_cast<std::size_t>(id) >> kChunkBits].load(std::memory_order_acquire);
+        return chunk ? &chunk->slots[id & (kChunkSize - 1)] : nullptr;
+    }
+
+    std::array<std::atomic<Chunk*>, kMaxChunks> chunks{};
+};
+
+// A pinned object of a SlotTable, released when the handle goes away.
+template<typename T>
+class SlotHandle {
+public:
+    SlotHandle() = default;
+    SlotHandle(const SlotTable<T>* table, int id, T* object)
+        : table(table), id(id), object(object) {}
+    SlotHandle(SlotHandle&& other) noexcept
+        : table(other.table), id(other.id), object(other.object) {
+        other.object = nullptr;
+    }
+    SlotHandle& operator=(SlotHandle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            table = other.table;
+            id = other.id;
+            object = other.object;
+            other.object = nullptr;
+        }
+        return *this;
+    }
+    SlotHandle(const SlotHandle&) = delete;
+    SlotHandle& operator=(const SlotHandle&) = delete;
+    ~SlotHandle() { reset(); }
+
+    void reset() {
+        if (object) table->unpin(id);
+        object = nullptr;
+    }
+    T* get() const { return object; }
+    T& operator*() const { return *object; }
+    T* operator->() const { return object; }
+    explicit operator bool() const { return object != nullptr; }
+
+private:
+    const SlotTable<T>* table{nullptr};
+    int id{-1};
+    T* object{nullptr};
+};
+} // namespace qpp
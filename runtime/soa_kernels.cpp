@@ -0,0 +1,42 @@
+#include "soa_kernels.h"
+#include "soa_kernels_impl.h"
+
+namespace qpp {
+
+#ifdef QPP_HAVE_AVX2
+template<typename Real> const SoaKernels<Real>& soa_kernels_avx2();
+#endif
+#ifdef QPP_HAVE_AVX512
+template<typename Real> const SoaKernels<Real>& soa_kernels_avx512();
+#endif
+
+template<typename Real>
+std::vector<const SoaKernels<Real>*> soa_kernel_variants() {
+    static const SoaKernels<Real> scalar = soa_kernel_table<ScalarV<Real>>("scalar");
+    std::vector<const SoaKernels<Real>*> out{&scalar};
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+#ifdef QPP_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        out.push_back(&soa_kernels_avx2<Real>());
+#endif
+#ifdef QPP_HAVE_AVX512
+    if (__builtin_cpu_supports("avx512f"))
+        out.push_back(&soa_kernels_avx512<Real>());
+#endif
+#endif
+    return out;
+}
+
+template<typename Real>
+const SoaKernels<Real>& soa_kernels() {
+    static const SoaKernels<Real>* best = soa_kernel_variants<Real>().back();
+    return *best;
+}
+
+template const SoaKernels<double>& soa_kernels<double>();
+template const SoaKernels<float>& soa_kernels<float>();
+template std::vector<const SoaKernels<double>*> soa_kernel_variants<double>();
+template std::vector<const SoaKernels<float>*> soa_kernel_variants<float>();
+
+} // namespace qpp
@@ -0,0 +1,35 @@
+#pragma once
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace qpp {
+// Gate kernels over structure-of-arrays amplitude storage: `re` and `im`
+// hold the real and imaginary parts of `size` amplitudes, both 64-byte
+// aligned. There is one table per instruction set; soa_kernels() returns the
+// widest one the running CPU supports.
+template<typename Real>
+struct SoaKernels {
+    const char* isa;
+    // 2x2 unitary `m` on `target`.
+    void (*single_qubit)(Real* re, Real* im, std::size_t size, std::size_t target,
+                         const std::complex<Real> (*m)[2]);
+    // diag(d0, d1) on `target`.
+    void (*diagonal_1q)(Real* re, Real* im, std::size_t size, std::size_t target,
+                        std::complex<Real> d0, std::complex<Real> d1);
+    // Multiply every amplitude whose index has all bits of `mask` set.
+    void (*phase)(Real* re, Real* im, std::size_t size, std::size_t mask,
+                  std::complex<Real> phase);
+    // Swap amplitude `i | on` with `i | off` for every index i with the bits
+    // of `fixed` clear; `on` and `off` are subsets of `fixed`.
+    void (*swap_pairs)(Real* re, Real* im, std::size_t size, std::size_t fixed,
+                       std::size_t on, std::size_t off);
+};
+
+template<typename Real>
+const SoaKernels<Real>& soa_kernels();
+
+// Every kernel table usable on this CPU, scalar first.
+template<typename Real>
+std::vector<const SoaKernels<Real>*> soa_kernel_variants();
+} // namespace qpp
@@ -0,0 +1,85 @@
+// AVX2 + FMA kernels; built with -mavx2 -mfma and only called after the
+// dispatcher in soa_kernels.cpp has checked CPU support.
+#include "soa_kernels_impl.h"
+#include <immintrin.h>
+
+namespace qpp {
+namespace {
+
+struct Avx2Double {
+    using T = double;
+    using reg = __m256d;
+    using mask = __m256d;
+    using perm = int;
+    static constexpr std::size_t lanes = 4;
+    static reg load(const T* p) { return _mm256_load_pd(p); }
+    static void store(T* p, reg a) { _mm256_store_pd(p, a); }
+    static reg set1(T v) { return _mm256_set1_pd(v); }
+    static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+    static reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_pd(a, b, c); }
+    static mask make_mask(unsigned bits) {
+        return _mm256_castsi256_pd(_mm256_setr_epi64x(
+            -static_cast<long long>(bits & 1), -static_cast<long long>((bits >> 1) & 1),
+            -static_cast<long long>((bits >> 2) & 1), -static_cast<long long>((bits >> 3) & 1)));
+    }
+    static reg blend(mask m, reg a, reg b) { return _mm256_blendv_pd(a, b, m); }
+    static perm make_perm(std::size_t x) { return static_cast<int>(x); }
+    static reg permute(perm p, reg a) {
+        switch (p) {
+        case 1: return _mm256_permute4x64_pd(a, 0xB1);
+        case 2: return _mm256_permute4x64_pd(a, 0x4E);
+        case 3: return _mm256_permute4x64_pd(a, 0x1B);
+        default: return a;
+        }
+    }
+};
+
+struct Avx2Float {
+    using T = float;
+    using reg = __m256;
+    using mask = __m256;
+    using perm = __m256i;
+    static constexpr std::size_t lanes = 8;
+    static reg load(const T* p) { return _mm256_load_ps(p); }
+    static void store(T* p, reg a) { _mm256_store_ps(p, a); }
+    static reg set1(T v) { return _mm256_set1_ps(v); }
+    static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_ps(a, b, c); }
+    static mask make_mask(unsigned bits) {
+        alignas(32) int m[8];
+        for (int l = 0; l < 8; ++l) m[l] = -static_cast<int>((bits >> l) & 1);
+        return _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(m)));
+    }
+    static reg blend(mask m, reg a, reg b) { return _mm256_blendv_ps(a, b, m); }
+    static perm make_perm(std::size_t x) {
+        alignas(32) int idx[8];
+        for (int l = 0; l < 8; ++l) idx[l] = l ^ static_cast<int>(x);
+        return _mm256_load_si256(reinterpret_cast<const __m256i*>(idx));
+    }
+    static reg permute(perm p, reg a) { return _mm256_permutevar8x32_ps(a, p); }
+};
+
+} // namespace
+
+template<typename Real>
+const SoaKernels<Real>& soa_kernels_avx2();
+
+template<>
+const SoaKernels<double>& soa_kernels_avx2<double>() {
+    static const SoaKernels<double> table = soa_kernel_table<Avx2Double>("avx2");
+    return table;
+}
+
+template<>
+const SoaKernels<float>& soa_kernels_avx2<float>() {
+    static const SoaKernels<float> table = soa_kernel_table<Avx2Float>("avx2");
+    return table;
+}
+
+} // namespace qpp
@@ -0,0 +1,74 @@
+// AVX-512F kernels: 8 double or 16 float lanes. Built with -mavx512f and
+// only called after the dispatcher in soa_kernels.cpp has checked CPU support.
+#include "soa_kernels_impl.h"
+#include <immintrin.h>
+
+namespace qpp {
+namespace {
+
+struct Avx512Double {
+    using T = double;
+    using reg = __m512d;
+    using mask = __mmask8;
+    using perm = __m512i;
+    static constexpr std::size_t lanes = 8;
+    static reg load(const T* p) { return _mm512_load_pd(p); }
+    static void store(T* p, reg a) { _mm512_store_pd(p, a); }
+    static reg set1(T v) { return _mm512_set1_pd(v); }
+    static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+    static reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_pd(a, b, c); }
+    static mask make_mask(unsigned bits) { return static_cast<mask>(bits); }
+    static reg blend(mask m, reg a, reg b) { return _mm512_mask_blend_pd(m, a, b); }
+    static perm make_perm(std::size_t x) {
+        alignas(64) long long idx[8];
+        for (int l = 0; l < 8; ++l) idx[l] = l ^ static_cast<long long>(x);
+        return _mm512_load_si512(idx);
+    }
+    static reg permute(perm p, reg a) { return _mm512_permutexvar_pd(p, a); }
+};
+
+struct Avx512Float {
+    using T = float;
+    using reg = __m512;
+    using mask = __mmask16;
+    using perm = __m512i;
+    static constexpr std::size_t lanes = 16;
+    static reg load(const T* p) { return _mm512_load_ps(p); }
+    static void store(T* p, reg a) { _mm512_store_ps(p, a); }
+    static reg set1(T v) { return _mm512_set1_ps(v); }
+    static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+    static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+    static reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_ps(a, b, c); }
+    static mask make_mask(unsigned bits) { return static_cast<mask>(bits); }
+    static reg blend(mask m, reg a, reg b) { return _mm512_mask_blend_ps(m, a, b); }
+    static perm make_perm(std::size_t x) {
+        alignas(64) int idx[16];
+        for (int l = 0; l < 16; ++l) idx[l] = l ^ static_cast<int>(x);
+        return _mm512_load_si512(idx);
+    }
+    static reg permute(perm p, reg a) { return _mm512_permutexvar_ps(p, a); }
+};
+
+} // namespace
+
+template<typename Real>
+const SoaKernels<Real>& soa_kernels_avx512();
+
+template<>
+const SoaKernels<double>& soa_kernels_avx512<double>() {
+    static const SoaKernels<double> table = soa_kernel_table<Avx512Double>("avx512");
+    return table;
+}
+
+template<>
+const SoaKernels<float>& soa_kernels_avx512<float>() {
+    static const SoaKernels<float> table = soa_kernel_table<Avx512Float>("avx512");
+    return table;
+}
+
+} // namespace qpp
@@ -0,0 +1,254 @@
+#pragma once
+// Kernel bodies shared by every instruction set. Each soa_kernels*.cpp
+// translation unit defines a vector type V and instantiates these templates
+// with it, compiled for the matching -m flags. V provides:
+//   T, lanes, reg, mask, perm
+//   load/store (aligned), set1, add, sub, mul
+//   fmadd(a, b, c) = a * b + c, fnmadd(a, b, c) = c - a * b
+//   make_mask(bits): lane l selected when bit l is set
+//   blend(m, a, b): b in the selected lanes, a elsewhere
+//   make_perm(x), permute(p, a): lane l receives lane l ^ x
+#include "soa_kernels.h"
+#include <cstdint>
+
+namespace qpp {
+namespace {
+
+template<typename Real>
+struct ScalarV {
+    using T = Real;
+    using reg = Real;
+    using mask = bool;
+    using perm = int;
+    static constexpr std::size_t lanes = 1;
+    static reg load(const T* p) { return *p; }
+    static void store(T* p, reg a) { *p = a; }
+    static reg set1(T v) { return v; }
+    static reg add(reg a, reg b) { return a + b; }
+    static reg sub(reg a, reg b) { return a - b; }
+    static reg mul(reg a, reg b) { return a * b; }
+    static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+    static reg fnmadd(reg a, reg b, reg c) { return c - a * b; }
+    static mask make_mask(unsigned bits) { return bits & 1u; }
+    static reg blend(mask m, reg a, reg b) { return m ? b : a; }
+    static perm make_perm(std::size_t) { return 0; }
+    static reg permute(perm, reg a) { return a; }
+};
+
+inline std::size_t soa_insert_zero_bit(std::size_t i, std::size_t pos) {
+    std::size_t low = i & ((std::size_t(1) << pos) - 1);
+    return ((i >> pos) << (pos + 1)) | low;
+}
+
+// Index of the k-th vector chunk whose bits in `high` equal `value`.
+inline std::size_t soa_chunk_index(std::size_t k, std::size_t lanes,
+                                   std::size_t high, std::size_t value) {
+    std::size_t idx = k * lanes;
+    for (std::size_t m = high; m; m &= m - 1)
+        idx = soa_insert_zero_bit(idx, static_cast<std::size_t>(__builtin_ctzll(m)));
+    return idx | value;
+}
+
+// (ar + i ai) * (cr + i ci) + (br + i bi) * (dr + i di), lane-wise.
+template<class V>
+inline void soa_cmul2(typename V::reg cr, typename V::reg ci, typename V::reg ar,
+                      typename V::reg ai, typename V::reg dr, typename V::reg di,
+                      typename V::reg br, typename V::reg bi,
+                      typename V::reg& outr, typename V::reg& outi) {
+    outr = V::fnmadd(ci, ai, V::mul(cr, ar));
+    outr = V::fnmadd(di, bi, V::fmadd(dr, br, outr));
+    outi = V::fmadd(ci, ar, V::mul(cr, ai));
+    outi = V::fmadd(di, br, V::fmadd(dr, bi, outi));
+}
+
+template<class V>
+void soa_single_qubit(typename V::T* re, typename V::T* im, std::size_t size,
+                      std::size_t target, const std::complex<typename V::T> (*m)[2]) {
+    using T = typename V::T;
+    using R = typename V::reg;
+    constexpr std::size_t L = V::lanes;
+    if (size < 2 * L) {
+        soa_single_qubit<ScalarV<T>>(re, im, size, target, m);
+        return;
+    }
+    const std::size_t step = std::size_t(1) << target;
+    if ((size >> target) < 2) return;
+    if (step >= L) {
+        // Both halves of every pair are whole vectors.
+        const R m00r = V::set1(m[0][0].real()), m00i = V::set1(m[0][0].imag());
+        const R m01r = V::set1(m[0][1].real()), m01i = V::set1(m[0][1].imag());
+        const R m10r = V::set1(m[1][0].real()), m10i = V::set1(m[1][0].imag());
+        const R m11r = V::set1(m[1][1].real()), m11i = V::set1(m[1][1].imag());
+        const std::size_t chunks = size / (2 * L);
+#pragma omp parallel for schedule(static)
+        for (std::size_t k = 0; k < chunks; ++k) {
+            std::size_t i0 = soa_insert_zero_bit(k * L, target);
+            std::size_t i1 = i0 | step;
+            R ar = V::load(re + i0), ai = V::load(im + i0);
+            R br = V::load(re + i1), bi = V::load(im + i1);
+            R outr, outi;
+            soa_cmul2<V>(m00r, m00i, ar, ai, m01r, m01i, br, bi, outr, outi);
+            V::store(re + i0, outr);
+            V::store(im + i0, outi);
+            soa_cmul2<V>(m11r, m11i, br, bi, m10r, m10i, ar, ai, outr, outi);
+            V::store(re + i1, outr);
+            V::store(im + i1, outi);
+        }
+        return;
+    }
+    // The pair partner lives in the same vector: combine each vector with
+    // its lane permutation using per-lane coefficients.
+    alignas(64) T c0r[L], c0i[L], c1r[L], c1i[L];
+    for (std::size_t l = 0; l < L; ++l) {
+        bool one = (l >> target) & 1;
+        c0r[l] = (one ? m[1][1] : m[0][0]).real();
+        c0i[l] = (one ? m[1][1] : m[0][0]).imag();
+        c1r[l] = (one ? m[1][0] : m[0][1]).real();
+        c1i[l] = (one ? m[1][0] : m[0][1]).imag();
+    }
+    const R vc0r = V::load(c0r), vc0i = V::load(c0i);
+    const R vc1r = V::load(c1r), vc1i = V::load(c1i);
+    const auto p = V::make_perm(step);
+    const std::size_t chunks = size / L;
+#pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < chunks; ++k) {
+        std::size_t i = k * L;
+        R ar = V::load(re + i), ai = V::load(im + i);
+        R br = V::permute(p, ar), bi = V::permute(p, ai);
+        R outr, outi;
+        soa_cmul2<V>(vc0r, vc0i, ar, ai, vc1r, vc1i, br, bi, outr, outi);
+        V::store(re + i, outr);
+        V::store(im + i, outi);
+    }
+}
+
+template<class V>
+inline void soa_scale(typename V::T* re, typename V::T* im, std::size_t i,
+                      typename V::reg pr, typename V::reg pi) {
+    auto ar = V::load(re + i), ai = V::load(im + i);
+    V::store(re + i, V::fnmadd(pi, ai, V::mul(pr, ar)));
+    V::store(im + i, V::fmadd(pi, ar, V::mul(pr, ai)));
+}
+
+template<class V>
+void soa_phase(typename V::T* re, typename V::T* im, std::size_t size,
+               std::size_t mask, std::complex<typename V::T> phase) {
+    using T = typename V::T;
+    using R = typename V::reg;
+    constexpr std::size_t L = V::lanes;
+    if (size < L) {
+        soa_phase<ScalarV<T>>(re, im, size, mask, phase);
+        return;
+    }
+    if (mask >= size) return;
+    // Bits inside a vector become a lane pattern of phase / 1, bits above
+    // select which vectors are touched at all.
+    const std::size_t low = mask & (L - 1), high = mask & ~(L - 1);
+    alignas(64) T pr[L], pi[L];
+    for (std::size_t l = 0; l < L; ++l) {
+        bool hit = (l & low) == low;
+        pr[l] = hit ? phase.real() : T(1);
+        pi[l] = hit ? phase.imag() : T(0);
+    }
+    const R vpr = V::load(pr), vpi = V::load(pi);
+    const std::size_t chunks = (size / L) >> __builtin_popcountll(high);
+#pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < chunks; ++k)
+        soa_scale<V>(re, im, soa_chunk_index(k, L, high, high), vpr, vpi);
+}
+
+template<class V>
+void soa_diagonal_1q(typename V::T* re, typename V::T* im, std::size_t size,
+                     std::size_t target, std::complex<typename V::T> d0,
+                     std::complex<typename V::T> d1) {
+    using T = typename V::T;
+    using R = typename V::reg;
+    constexpr std::size_t L = V::lanes;
+    if (size < 2 * L) {
+        soa_diagonal_1q<ScalarV<T>>(re, im, size, target, d0, d1);
+        return;
+    }
+    const std::size_t step = std::size_t(1) << target;
+    if ((size >> target) < 2) return;
+    if (step >= L) {
+        const R d0r = V::set1(d0.real()), d0i = V::set1(d0.imag());
+        const R d1r = V::set1(d1.real()), d1i = V::set1(d1.imag());
+        const std::size_t chunks = size / (2 * L);
+#pragma omp parallel for schedule(static)
+        for (std::size_t k = 0; k < chunks; ++k) {
+            std::size_t i0 = soa_insert_zero_bit(k * L, target);
+            soa_scale<V>(re, im, i0, d0r, d0i);
+            soa_scale<V>(re, im, i0 | step, d1r, d1i);
+        }
+        return;
+    }
+    alignas(64) T pr[L], pi[L];
+    for (std::size_t l = 0; l < L; ++l) {
+        const auto& d = ((l >> target) & 1) ? d1 : d0;
+        pr[l] = d.real();
+        pi[l] = d.imag();
+    }
+    const R vpr = V::load(pr), vpi = V::load(pi);
+    const std::size_t chunks = size / L;
+#pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < chunks; ++k) soa_scale<V>(re, im, k * L, vpr, vpi);
+}
+
+template<class V>
+void soa_swap_pairs(typename V::T* re, typename V::T* im, std::size_t size,
+                    std::size_t fixed, std::size_t on, std::size_t off) {
+    using T = typename V::T;
+    using R = typename V::reg;
+    constexpr std::size_t L = V::lanes;
+    if (size < 2 * L) {
+        soa_swap_pairs<ScalarV<T>>(re, im, size, fixed, on, off);
+        return;
+    }
+    if (fixed >= size) return;
+    // Pairs differ in `diff`. Its bits above the vector width pick a partner
+    // vector, the bits inside it a lane permutation, and the fixed bits
+    // inside the vector decide per lane whether the amplitude moves.
+    const std::size_t lowbits = L - 1;
+    const std::size_t diff = on ^ off;
+    const std::size_t fl = fixed & lowbits, fh = fixed & ~lowbits;
+    const std::size_t dh = diff & ~lowbits;
+    const auto p = V::make_perm(diff & lowbits);
+    unsigned off_lanes = 0, on_lanes = 0;
+    for (std::size_t l = 0; l < L; ++l) {
+        if ((l & fl) == (off & fl)) off_lanes |= 1u << l;
+        if ((l & fl) == (on & fl)) on_lanes |= 1u << l;
+    }
+    const std::size_t chunks = (size / L) >> __builtin_popcountll(fh);
+    if (dh == 0) {
+        const auto m = V::make_mask(off_lanes | on_lanes);
+#pragma omp parallel for schedule(static)
+        for (std::size_t k = 0; k < chunks; ++k) {
+            std::size_t i = soa_chunk_index(k, L, fh, off & fh);
+            R ar = V::load(re + i), ai = V::load(im + i);
+            V::store(re + i, V::blend(m, ar, V::permute(p, ar)));
+            V::store(im + i, V::blend(m, ai, V::permute(p, ai)));
+        }
+        return;
+    }
+    const auto moff = V::make_mask(off_lanes), mon = V::make_mask(on_lanes);
+#pragma omp parallel for schedule(static)
+    for (std::size_t k = 0; k < chunks; ++k) {
+        std::size_t i = soa_chunk_index(k, L, fh, off & fh);
+        std::size_t j = i ^ dh;
+        R ar = V::load(re + i), ai = V::load(im + i);
+        R br = V::load(re + j), bi = V::load(im + j);
+        V::store(re + i, V::blend(moff, ar, V::permute(p, br)));
+        V::store(im + i, V::blend(moff, ai, V::permute(p, bi)));
+        V::store(re + j, V::blend(mon, br, V::permute(p, ar)));
+        V::store(im + j, V::blend(mon, bi, V::permute(p, ai)));
+    }
+}
+
+template<class V>
+SoaKernels<typename V::T> soa_kernel_table(const char* isa) {
+    return {isa, &soa_single_qubit<V>, &soa_diagonal_1q<V>, &soa_phase<V>,
+            &soa_swap_pairs<V>};
+}
+
+} // namespace
+} // namespace qpp
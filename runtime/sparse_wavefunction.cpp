@@ -1,93 +1,366 @@
 #include "sparse_wavefunction.h"
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <random>
+#include <utility>
 #include "random.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace qpp {
 
-SparseWavefunction::SparseWavefunction(std::size_t qubits)
-    : num_qubits(qubits) {
-    state[0] = {1.0, 0.0};
-}
+// Below this many entries a gate runs on one thread.
+static constexpr std::size_t kParallelEntries = std::size_t(1) << 14;
 
-void SparseWavefunction::reset() {
-    state.clear();
-    state[0] = {1.0, 0.0};
+// Amplitudes whose norm falls to rounding level after a gate are dropped, so
+// interference that cancels a branch also shrinks the support.
+template<typename Real>
+static Real prune_tolerance() {
+    return std::numeric_limits<Real>::epsilon() * std::numeric_limits<Real>::epsilon();
 }
 
-std::complex<double> SparseWavefunction::amplitude(std::size_t index) const {
-    auto it = state.find(index);
-    if (it != state.end()) return it->second;
-    return {0.0, 0.0};
+static std::size_t piece_count(std::size_t n) {
+#ifdef _OPENMP
+    if (n >= kParallelEntries) return static_cast<std::size_t>(omp_get_max_threads()) * 4;
+#endif
+    (void)n;
+    return 1;
 }
 
-void SparseWavefunction::apply_x(std::size_t qubit) {
-    std::unordered_map<std::size_t, std::complex<double>> out;
-    std::size_t bit = 1ULL << qubit;
-    for (const auto& kv : state) {
-        std::size_t flipped = kv.first ^ bit;
-        out[flipped] += kv.second;
+// Split the sorted indices into pieces for the threads. Each boundary is
+// moved forward until the bits above `shift` change, so a group of entries
+// sharing those bits never straddles two pieces.
+static std::vector<std::size_t> split_groups(const IndexVector& idx,
+                                             std::size_t shift) {
+    const std::size_t n = idx.size();
+    const std::size_t pieces = piece_count(n);
+    std::vector<std::size_t> bounds(pieces + 1, n);
+    bounds[0] = 0;
+    for (std::size_t p = 1; p < pieces; ++p) {
+        std::size_t b = std::max(bounds[p - 1], n * p / pieces);
+        while (b > 0 && b < n && (idx[b] >> shift) == (idx[b - 1] >> shift)) ++b;
+        bounds[p] = b;
     }
-    state.swap(out);
+    return bounds;
 }
 
-void SparseWavefunction::apply_z(std::size_t qubit) {
-    std::size_t bit = 1ULL << qubit;
-    for (auto& kv : state) {
-        if (kv.first & bit)
-            kv.second = -kv.second;
-    }
+template<typename Real>
+SparseWavefunction<Real>::SparseWavefunction(std::size_t qubits)
+    : indices{0}, amplitudes{{Real(1.0), Real(0.0)}}, num_qubits(qubits) {}
+
+template<typename Real>
+void SparseWavefunction<Real>::reset() {
+    indices.assign(1, 0);
+    amplitudes.assign(1, {Real(1.0), Real(0.0)});
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::clear() {
+    indices.clear();
+    amplitudes.clear();
+}
+
+template<typename Real>
+std::complex<Real> SparseWavefunction<Real>::amplitude(std::size_t index) const {
+    auto it = std::lower_bound(indices.begin(), indices.end(), index);
+    if (it == indices.end() || *it != index) return {Real(0.0), Real(0.0)};
+    return amplitudes[it - indices.begin()];
 }
 
-void SparseWavefunction::apply_h(std::size_t qubit) {
-    std::unordered_map<std::size_t, std::complex<double>> out;
-    std::size_t bit = 1ULL << qubit;
-    const double f = 1.0 / std::sqrt(2.0);
-    for (const auto& kv : state) {
-        if (kv.first & bit) {
-            std::size_t base = kv.first ^ bit;
-            out[base] += f * kv.second;
-            out[kv.first] += -f * kv.second;
-        } else {
-            out[kv.first] += f * kv.second;
-            out[kv.first | bit] += f * kv.second;
+template<typename Real>
+std::size_t SparseWavefunction<Real>::memory_bytes() const {
+    return (indices.capacity() + next_indices.capacity()) * sizeof(std::size_t) +
+           (amplitudes.capacity() + next_amplitudes.capacity()) * sizeof(std::complex<Real>);
+}
+
+// A target qubit pairs index i (bit clear) with i | bit (bit set). Within a
+// group of entries sharing the bits above the target, the sorted order puts
+// every bit-clear entry before every bit-set one, each half ordered by the
+// bits below the target, so one merge of the two halves visits every pair.
+// Each piece writes its output to twice its input offset in the scratch
+// buffers, then the pieces are packed back into `indices` / `amplitudes`.
+template<typename Real>
+void SparseWavefunction<Real>::apply_controlled(std::size_t controls, std::size_t target,
+                                                const std::complex<Real> m[2][2]) {
+    if (target >= num_qubits || (controls >> num_qubits) != 0) return;
+    const std::size_t bit = std::size_t(1) << target;
+    if (controls & bit) return;
+    const std::size_t low = bit - 1;
+    const std::size_t shift = target + 1;
+    const std::size_t n = indices.size();
+    const Real tol = prune_tolerance<Real>();
+    const auto bounds = split_groups(indices, shift);
+    const std::size_t pieces = bounds.size() - 1;
+    next_indices.resize(2 * n);
+    next_amplitudes.resize(2 * n);
+    std::vector<std::size_t> written(pieces);
+#pragma omp parallel for schedule(dynamic)
+    for (std::size_t p = 0; p < pieces; ++p) {
+        std::size_t* oi = next_indices.data();
+        std::complex<Real>* oa = next_amplitudes.data();
+        const std::size_t end = bounds[p + 1];
+        std::size_t w = 2 * bounds[p];
+        std::size_t s = bounds[p];
+        while (s < end) {
+            const std::size_t high = indices[s] >> shift;
+            std::size_t e = s;
+            while (e < end && (indices[e] >> shift) == high) ++e;
+            std::size_t mid = s;
+            while (mid < e && !(indices[mid] & bit)) ++mid;
+            // Bit-clear results go to w.., bit-set results are parked after
+            // room for the whole group and moved down once it is done.
+            const std::size_t park = w + (e - s);
+            std::size_t lo = w, hi = park;
+            std::size_t i = s, j = mid;
+            while (i < mid || j < e) {
+                std::size_t key;
+                std::complex<Real> a0{}, a1{};
+                if (j == e || (i < mid && (indices[i] & low) <= (indices[j] & low))) {
+                    key = indices[i];
+                    a0 = amplitudes[i++];
+                    if (j < e && indices[j] == (key | bit)) a1 = amplitudes[j++];
+                } else {
+                    key = indices[j] & ~bit;
+                    a1 = amplitudes[j++];
+                }
+                std::complex<Real> b0 = a0, b1 = a1;
+                if ((key & controls) == controls) {
+                    b0 = m[0][0] * a0 + m[0][1] * a1;
+                    b1 = m[1][0] * a0 + m[1][1] * a1;
+                }
+                if (std::norm(b0) > tol) {
+                    oi[lo] = key;
+                    oa[lo++] = b0;
+                }
+                if (std::norm(b1) > tol) {
+                    oi[hi] = key | bit;
+                    oa[hi++] = b1;
+                }
+            }
+            if (lo != park) {
+                std::copy(oi + park, oi + hi, oi + lo);
+                std::copy(oa + park, oa + hi, oa + lo);
+            }
+            w = lo + (hi - park);
+            s = e;
         }
+        written[p] = w - 2 * bounds[p];
     }
-    state.swap(out);
-}
-
-void SparseWavefunction::apply_cnot(std::size_t control, std::size_t target) {
-    std::unordered_map<std::size_t, std::complex<double>> out;
-    std::size_t cbit = 1ULL << control;
-    std::size_t tbit = 1ULL << target;
-    for (const auto& kv : state) {
-        if (kv.first & cbit)
-            out[kv.first ^ tbit] += kv.second;
-        else
-            out[kv.first] += kv.second;
+    std::vector<std::size_t> offset(pieces + 1, 0);
+    for (std::size_t p = 0; p < pieces; ++p) offset[p + 1] = offset[p] + written[p];
+    indices.resize(offset[pieces]);
+    amplitudes.resize(offset[pieces]);
+#pragma omp parallel for schedule(static)
+    for (std::size_t p = 0; p < pieces; ++p) {
+        std::copy_n(next_indices.begin() + 2 * bounds[p], written[p], indices.begin() + offset[p]);
+        std::copy_n(next_amplitudes.begin() + 2 * bounds[p], written[p],
+                    amplitudes.begin() + offset[p]);
     }
-    state.swap(out);
 }
 
-int SparseWavefunction::measure(std::size_t qubit) {
-    std::size_t bit = 1ULL << qubit;
-    double p1 = 0.0;
-    for (const auto& kv : state) {
-        if (kv.first & bit) p1 += std::norm(kv.second);
+template<typename Real>
+void SparseWavefunction<Real>::apply_phase(std::size_t mask, std::complex<Real> phase) {
+    if ((mask >> num_qubits) != 0) return;
+    const std::size_t n = indices.size();
+#pragma omp parallel for schedule(static) if (n >= kParallelEntries)
+    for (std::size_t i = 0; i < n; ++i)
+        if ((indices[i] & mask) == mask) amplitudes[i] *= phase;
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_diagonal(const std::vector<std::size_t>& qubits,
+                                              const std::vector<std::complex<Real>>& phases) {
+    for (auto q : qubits)
+        if (q >= num_qubits) return;
+    if (phases.size() < (std::size_t(1) << qubits.size())) return;
+    const std::size_t n = indices.size();
+#pragma omp parallel for schedule(static) if (n >= kParallelEntries)
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t local = 0;
+        for (std::size_t j = 0; j < qubits.size(); ++j)
+            local |= ((indices[i] >> qubits[j]) & 1ULL) << j;
+        amplitudes[i] *= phases[local];
     }
-    std::bernoulli_distribution dist(p1);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_h(std::size_t qubit) {
+    const Real f = Real(1.0) / std::sqrt(Real(2.0));
+    const std::complex<Real> mat[2][2] = {{f, f}, {f, -f}};
+    apply_controlled(0, qubit, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_x(std::size_t qubit) {
+    const std::complex<Real> mat[2][2] = {{0, 1}, {1, 0}};
+    apply_controlled(0, qubit, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_y(std::size_t qubit) {
+    const std::complex<Real> mat[2][2] = {
+        {Real(0.0), std::complex<Real>(0, -1)},
+        {std::complex<Real>(0, 1), Real(0.0)}
+    };
+    apply_controlled(0, qubit, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_z(std::size_t qubit) {
+    if (qubit >= num_qubits) return;
+    apply_phase(1ULL << qubit, {Real(-1.0), Real(0.0)});
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_s(std::size_t qubit) {
+    if (qubit >= num_qubits) return;
+    apply_phase(1ULL << qubit, {Real(0.0), Real(1.0)});
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_t(std::size_t qubit) {
+    if (qubit >= num_qubits) return;
+    apply_phase(1ULL << qubit, std::exp(std::complex<Real>(0, M_PI / 4)));
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_rx(std::size_t qubit, Real theta) {
+    Real c = std::cos(theta / Real(2.0));
+    Real s = std::sin(theta / Real(2.0));
+    const std::complex<Real> mat[2][2] = {
+        {c, std::complex<Real>(0, -s)},
+        {std::complex<Real>(0, -s), c}
+    };
+    apply_controlled(0, qubit, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_ry(std::size_t qubit, Real theta) {
+    Real c = std::cos(theta / Real(2.0));
+    Real s = std::sin(theta / Real(2.0));
+    const std::complex<Real> mat[2][2] = {
+        {c, -s},
+        {s,  c}
+    };
+    apply_controlled(0, qubit, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_rz(std::size_t qubit, Real theta) {
+    apply_diagonal({qubit}, {std::exp(std::complex<Real>(0, -theta / Real(2.0))),
+                             std::exp(std::complex<Real>(0, theta / Real(2.0)))});
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_cnot(std::size_t control, std::size_t target) {
+    if (control >= num_qubits) return;
+    const std::complex<Real> mat[2][2] = {{0, 1}, {1, 0}};
+    apply_controlled(1ULL << control, target, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_cz(std::size_t control, std::size_t target) {
+    if (control == target || control >= num_qubits || target >= num_qubits) return;
+    apply_phase((1ULL << control) | (1ULL << target), {Real(-1.0), Real(0.0)});
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_ccnot(std::size_t c1, std::size_t c2, std::size_t target) {
+    if (c1 == c2 || c1 >= num_qubits || c2 >= num_qubits) return;
+    const std::complex<Real> mat[2][2] = {{0, 1}, {1, 0}};
+    apply_controlled((1ULL << c1) | (1ULL << c2), target, mat);
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::apply_swap(std::size_t q1, std::size_t q2) {
+    if (q1 == q2 || q1 >= num_qubits || q2 >= num_qubits) return;
+    apply_cnot(q1, q2);
+    apply_cnot(q2, q1);
+    apply_cnot(q1, q2);
+}
+
+template<typename Real>
+int SparseWavefunction<Real>::measure(std::size_t qubit) {
+    const std::size_t bit = 1ULL << qubit;
+    const std::size_t n = indices.size();
+    double p1 = 0.0;
+#pragma omp parallel for reduction(+:p1) schedule(static) if (n >= kParallelEntries)
+    for (std::size_t i = 0; i < n; ++i)
+        if (indices[i] & bit) p1 += std::norm(amplitudes[i]);
+    std::bernoulli_distribution dist(std::min(p1, 1.0));
     int result = dist(global_rng());
-    double norm_factor = std::sqrt(result ? p1 : 1.0 - p1);
-    for (auto it = state.begin(); it != state.end(); ) {
-        if ( ((it->first & bit) != 0) != static_cast<bool>(result) ) {
-            it = state.erase(it);
-        } else {
-            it->second /= norm_factor;
-            ++it;
-        }
+    const Real norm_factor = Real(std::sqrt(result ? p1 : 1.0 - p1));
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (((indices[i] & bit) != 0) != static_cast<bool>(result)) continue;
+        indices[kept] = indices[i];
+        amplitudes[kept++] = amplitudes[i] / norm_factor;
     }
+    indices.resize(kept);
+    amplitudes.resize(kept);
     return result;
 }
 
-} // namespace qpp
+template<typename Real>
+void SparseWavefunction<Real>::assign_dense(const StateVector<Real>& dense,
+                                            double tolerance) {
+    const std::size_t n = dense.size();
+    const std::size_t pieces = piece_count(n);
+    std::vector<std::size_t> offset(pieces + 1, 0);
+#pragma omp parallel for schedule(static)
+    for (std::size_t p = 0; p < pieces; ++p) {
+        std::size_t count = 0;
+        for (std::size_t i = n * p / pieces; i < n * (p + 1) / pieces; ++i)
+            if (std::norm(dense[i]) > tolerance) ++count;
+        offset[p + 1] = count;
+    }
+    for (std::size_t p = 0; p < pieces; ++p) offset[p + 1] += offset[p];
+    indices.resize(offset[pieces]);
+    amplitudes.resize(offset[pieces]);
+#pragma omp parallel for schedule(static)
+    for (std::size_t p = 0; p < pieces; ++p) {
+        std::size_t w = offset[p];
+        for (std::size_t i = n * p / pieces; i < n * (p + 1) / pieces; ++i) {
+            if (std::norm(dense[i]) <= tolerance) continue;
+            indices[w] = i;
+            amplitudes[w++] = dense[i];
+        }
+    }
+}
+
+template<typename Real>
+void SparseWavefunction<Real>::to_dense(StateVector<Real>& dense) const {
+    // A fresh block is already zero, so only the non-zero entries are
+    // written.
+    StateVector<Real>(1ULL << num_qubits).swap(dense);
+    const std::size_t n = indices.size();
+#pragma omp parallel for schedule(static) if (n >= kParallelEntries)
+    for (std::size_t i = 0; i < n; ++i)
+        if (indices[i] < dense.size()) dense[indices[i]] = amplitudes[i];
+}
 
+template<typename Real>
+void SparseWavefunction<Real>::permute(const std::vector<std::size_t>& from,
+                                       const std::vector<std::size_t>& to) {
+    const std::size_t width = from.size();
+    std::vector<std::pair<std::size_t, std::complex<Real>>> moved(indices.size());
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+        std::size_t idx = width < 64 ? indices[i] >> width << width : 0;
+        for (std::size_t q = 0; q < width; ++q)
+            idx |= ((indices[i] >> from[q]) & 1ULL) << to[q];
+        moved[i] = {idx, amplitudes[i]};
+    }
+    std::sort(moved.begin(), moved.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (std::size_t i = 0; i < moved.size(); ++i) {
+        indices[i] = moved[i].first;
+        amplitudes[i] = moved[i].second;
+    }
+}
+
+template class SparseWavefunction<double>;
+template class SparseWavefunction<float>;
+
+} // namespace qpp
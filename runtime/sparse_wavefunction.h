@@ -1,25 +1,68 @@
 #ifndef QPP_SPARSE_WAVEFUNCTION_H
 #define QPP_SPARSE_WAVEFUNCTION_H
 
+#include "state_allocator.h"
 #include <complex>
-#include <unordered_map>
+#include <vector>
 #include <cstddef>
 
 namespace qpp {
+// State vector holding only its non-zero amplitudes, sorted by basis index.
+// Gates stream the sorted entries into a second pair of buffers that is kept
+// between gates, so a circuit whose support stays small never touches 2^n
+// memory and, once the buffers have grown, does not allocate either.
+template<typename Real = double>
 class SparseWavefunction {
 public:
     explicit SparseWavefunction(std::size_t qubits = 1);
 
     void apply_h(std::size_t qubit);
     void apply_x(std::size_t qubit);
+    void apply_y(std::size_t qubit);
     void apply_z(std::size_t qubit);
+    void apply_s(std::size_t qubit);
+    void apply_t(std::size_t qubit);
+    void apply_rx(std::size_t qubit, Real theta);
+    void apply_ry(std::size_t qubit, Real theta);
+    void apply_rz(std::size_t qubit, Real theta);
     void apply_cnot(std::size_t control, std::size_t target);
+    void apply_cz(std::size_t control, std::size_t target);
+    void apply_ccnot(std::size_t c1, std::size_t c2, std::size_t target);
+    void apply_swap(std::size_t q1, std::size_t q2);
+
+    // 2x2 unitary `m` on `target`, applied where every bit of `controls` is
+    // set. Entries that cancel to zero are dropped.
+    void apply_controlled(std::size_t controls, std::size_t target,
+                          const std::complex<Real> m[2][2]);
+    // Multiply every amplitude whose index has all bits of `mask` set.
+    void apply_phase(std::size_t mask, std::complex<Real> phase);
+    // Diagonal gate with one phase per local basis state, bit j of the phase
+    // index being the value of qubits[j].
+    void apply_diagonal(const std::vector<std::size_t>& qubits,
+                        const std::vector<std::complex<Real>>& phases);
+
     int measure(std::size_t qubit);
     void reset();
-    std::complex<double> amplitude(std::size_t index) const;
+    // Drop every amplitude, e.g. while the owner keeps the state densely.
+    void clear();
+    std::complex<Real> amplitude(std::size_t index) const;
+    std::size_t nnz() const { return indices.size(); }
+    std::size_t memory_bytes() const;
 
-    std::unordered_map<std::size_t, std::complex<double>> state;
+    // Load the amplitudes of `dense` whose norm exceeds `tolerance`, and
+    // scatter the entries back into a dense vector of 2^num_qubits.
+    void assign_dense(const StateVector<Real>& dense, double tolerance);
+    void to_dense(StateVector<Real>& dense) const;
+    // Move bit from[q] of every index to bit to[q].
+    void permute(const std::vector<std::size_t>& from, const std::vector<std::size_t>& to);
+
+    IndexVector indices;
+    StateVector<Real> amplitudes;
     std::size_t num_qubits;
+
+private:
+    IndexVector next_indices;
+    StateVector<Real> next_amplitudes;
 };
 } // namespace qpp
 
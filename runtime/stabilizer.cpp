@@ -0,0 +1,194 @@
+#include "stabilizer.h"
+#include "random.h"
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <utility>
+
+namespace qpp {
+
+StabilizerState::StabilizerState(std::size_t qubits)
+    : num_qubits(qubits), words((qubits + 63) / 64) {
+    reset();
+}
+
+void StabilizerState::reset() {
+    std::size_t rows = 2 * num_qubits + 1;
+    xs.assign(rows * words, 0);
+    zs.assign(rows * words, 0);
+    signs.assign(rows, 0);
+    // destabilizer i = X_i, stabilizer i = Z_i describes |0...0>
+    for (std::size_t q = 0; q < num_qubits; ++q) {
+        x_row(q)[q >> 6] |= 1ULL << (q & 63);
+        z_row(q + num_qubits)[q >> 6] |= 1ULL << (q & 63);
+    }
+}
+
+void StabilizerState::apply_h(std::size_t qubit) {
+    std::size_t w = qubit >> 6;
+    std::uint64_t m = 1ULL << (qubit & 63);
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r) {
+        std::uint64_t& x = xs[r * words + w];
+        std::uint64_t& z = zs[r * words + w];
+        bool xb = x & m, zb = z & m;
+        signs[r] ^= xb & zb;
+        if (xb != zb) {
+            x ^= m;
+            z ^= m;
+        }
+    }
+}
+
+void StabilizerState::apply_s(std::size_t qubit) {
+    std::size_t w = qubit >> 6;
+    std::uint64_t m = 1ULL << (qubit & 63);
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r) {
+        std::uint64_t x = xs[r * words + w] & m;
+        std::uint64_t& z = zs[r * words + w];
+        signs[r] ^= (x & z) != 0;
+        z ^= x;
+    }
+}
+
+void StabilizerState::apply_x(std::size_t qubit) {
+    std::size_t w = qubit >> 6;
+    std::uint64_t m = 1ULL << (qubit & 63);
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r)
+        signs[r] ^= (zs[r * words + w] & m) != 0;
+}
+
+void StabilizerState::apply_z(std::size_t qubit) {
+    std::size_t w = qubit >> 6;
+    std::uint64_t m = 1ULL << (qubit & 63);
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r)
+        signs[r] ^= (xs[r * words + w] & m) != 0;
+}
+
+void StabilizerState::apply_y(std::size_t qubit) {
+    std::size_t w = qubit >> 6;
+    std::uint64_t m = 1ULL << (qubit & 63);
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r)
+        signs[r] ^= ((xs[r * words + w] ^ zs[r * words + w]) & m) != 0;
+}
+
+void StabilizerState::apply_cnot(std::size_t control, std::size_t target) {
+    if (control == target) return;
+    std::size_t wc = control >> 6, wt = target >> 6;
+    unsigned sc = control & 63, st = target & 63;
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r) {
+        std::uint64_t* x = x_row(r);
+        std::uint64_t* z = z_row(r);
+        unsigned xa = (x[wc] >> sc) & 1, za = (z[wc] >> sc) & 1;
+        unsigned xb = (x[wt] >> st) & 1, zb = (z[wt] >> st) & 1;
+        signs[r] ^= xa & zb & (xb ^ za ^ 1);
+        x[wt] ^= std::uint64_t(xa) << st;
+        z[wc] ^= std::uint64_t(zb) << sc;
+    }
+}
+
+void StabilizerState::apply_cz(std::size_t control, std::size_t target) {
+    apply_h(target);
+    apply_cnot(control, target);
+    apply_h(target);
+}
+
+void StabilizerState::apply_swap(std::size_t q1, std::size_t q2) {
+    if (q1 == q2) return;
+    std::size_t w1 = q1 >> 6, w2 = q2 >> 6;
+    unsigned s1 = q1 & 63, s2 = q2 & 63;
+    for (std::size_t r = 0; r < 2 * num_qubits; ++r) {
+        for (std::uint64_t* row : {x_row(r), z_row(r)}) {
+            std::uint64_t diff = ((row[w1] >> s1) ^ (row[w2] >> s2)) & 1;
+            row[w1] ^= diff << s1;
+            row[w2] ^= diff << s2;
+        }
+    }
+}
+
+void StabilizerState::rowsum(std::size_t h, std::size_t i) {
+    std::uint64_t* x1 = x_row(h);
+    std::uint64_t* z1 = z_row(h);
+    const std::uint64_t* x2 = x_row(i);
+    const std::uint64_t* z2 = z_row(i);
+    // Two bit-planes count the powers of i contributed at each qubit
+    // position modulo 4, so the phase of the product needs only popcounts.
+    std::uint64_t cnt1 = 0, cnt2 = 0;
+    for (std::size_t w = 0; w < words; ++w) {
+        std::uint64_t old_x = x1[w], old_z = z1[w];
+        x1[w] ^= x2[w];
+        z1[w] ^= z2[w];
+        std::uint64_t x1z2 = old_x & z2[w];
+        std::uint64_t anti = (x2[w] & old_z) ^ x1z2;
+        cnt2 ^= (cnt1 ^ x1[w] ^ z1[w] ^ x1z2) & anti;
+        cnt1 ^= anti;
+    }
+    unsigned phase = static_cast<unsigned>(__builtin_popcountll(cnt1)) +
+                     2u * static_cast<unsigned>(__builtin_popcountll(cnt2)) +
+                     2u * signs[h] + 2u * signs[i];
+    signs[h] = (phase & 3) >> 1;
+}
+
+void StabilizerState::copy_row(std::size_t dst, std::size_t src) {
+    std::copy(x_row(src), x_row(src) + words, x_row(dst));
+    std::copy(z_row(src), z_row(src) + words, z_row(dst));
+    signs[dst] = signs[src];
+}
+
+void StabilizerState::clear_row(std::size_t row) {
+    std::fill(x_row(row), x_row(row) + words, 0);
+    std::fill(z_row(row), z_row(row) + words, 0);
+    signs[row] = 0;
+}
+
+int StabilizerState::measure(std::size_t qubit) {
+    std::size_t n = num_qubits;
+    std::size_t p = 2 * n;
+    for (std::size_t r = n; r < 2 * n; ++r) {
+        if (x_bit(r, qubit)) { p = r; break; }
+    }
+    if (p < 2 * n) {
+        // Outcome is random: some stabilizer anticommutes with Z_qubit.
+        for (std::size_t r = 0; r < 2 * n; ++r) {
+            if (r != p && x_bit(r, qubit)) rowsum(r, p);
+        }
+        copy_row(p - n, p);
+        clear_row(p);
+        std::bernoulli_distribution dist(0.5);
+        int result = dist(global_rng());
+        z_row(p)[qubit >> 6] |= 1ULL << (qubit & 63);
+        signs[p] = static_cast<std::uint8_t>(result);
+        return result;
+    }
+    // Outcome is determined: accumulate the matching stabilizers in scratch.
+    std::size_t scratch = 2 * n;
+    clear_row(scratch);
+    for (std::size_t r = 0; r < n; ++r) {
+        if (x_bit(r, qubit)) rowsum(scratch, r + n);
+    }
+    return signs[scratch];
+}
+
+std::size_t StabilizerState::nnz() const {
+    // Gaussian elimination over GF(2) on a copy of the stabilizer X parts.
+    const std::size_t n = num_qubits;
+    std::vector<std::uint64_t> x(xs.begin() + n * words, xs.begin() + 2 * n * words);
+    std::size_t rank = 0;
+    for (std::size_t q = 0; q < n && rank < n; ++q) {
+        const std::size_t w = q >> 6;
+        const std::uint64_t m = 1ULL << (q & 63);
+        std::size_t pivot = rank;
+        while (pivot < n && !(x[pivot * words + w] & m)) ++pivot;
+        if (pivot == n) continue;
+        if (pivot != rank)
+            std::swap_ranges(x.begin() + pivot * words, x.begin() + (pivot + 1) * words,
+                             x.begin() + rank * words);
+        for (std::size_t r = rank + 1; r < n; ++r)
+            if (x[r * words + w] & m)
+                for (std::size_t k = 0; k < words; ++k) x[r * words + k] ^= x[rank * words + k];
+        ++rank;
+    }
+    if (rank >= 8 * sizeof(std::size_t)) return SIZE_MAX;
+    return std::size_t(1) << rank;
+}
+
+} // namespace qpp
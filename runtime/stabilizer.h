@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace qpp {
+// Aaronson-Gottesman (CHP) stabilizer tableau. Rows 0..n-1 hold the
+// destabilizers, rows n..2n-1 the stabilizers and row 2n is scratch space
+// for deterministic measurements. Each row stores its X and Z parts as packed
+// 64-bit words so row products run a word at a time, keeping memory at
+// O(n^2) bits instead of the 2^n amplitudes of the dense simulator.
+class StabilizerState {
+public:
+    explicit StabilizerState(std::size_t qubits = 1);
+
+    void apply_h(std::size_t qubit);
+    void apply_s(std::size_t qubit);
+    void apply_x(std::size_t qubit);
+    void apply_y(std::size_t qubit);
+    void apply_z(std::size_t qubit);
+    void apply_cnot(std::size_t control, std::size_t target);
+    void apply_cz(std::size_t control, std::size_t target);
+    void apply_swap(std::size_t q1, std::size_t q2);
+
+    int measure(std::size_t qubit);
+    void reset();
+    // Basis states with a non-zero amplitude: 2^r for r the rank of the X
+    // parts of the stabilizers, saturating at SIZE_MAX.
+    std::size_t nnz() const;
+
+    std::size_t qubits() const { return num_qubits; }
+    std::size_t memory_bytes() const {
+        return (xs.size() + zs.size()) * sizeof(std::uint64_t) + signs.size();
+    }
+
+private:
+    std::uint64_t* x_row(std::size_t row) { return xs.data() + row * words; }
+    std::uint64_t* z_row(std::size_t row) { return zs.data() + row * words; }
+    bool x_bit(std::size_t row, std::size_t q) const {
+        return (xs[row * words + (q >> 6)] >> (q & 63)) & 1ULL;
+    }
+    bool z_bit(std::size_t row, std::size_t q) const {
+        return (zs[row * words + (q >> 6)] >> (q & 63)) & 1ULL;
+    }
+    // row h <- row h * row i, tracking the phase of the Pauli product
+    void rowsum(std::size_t h, std::size_t i);
+    void copy_row(std::size_t dst, std::size_t src);
+    void clear_row(std::size_t row);
+
+    std::size_t num_qubits;
+    std::size_t words;
+    std::vector<std::uint64_t> xs;
+    std::vector<std::uint64_t> zs;
+    std::vector<std::uint8_t> signs;
+};
+} // namespace qpp
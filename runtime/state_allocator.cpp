@@ -0,0 +1,267 @@
+#include "state_allocator.h"
+#include "numa.h"
+#include "../include/runtime_config.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace qpp {
+namespace {
+
+// Bytes actually mapped for a block of `bytes`.
+std::size_t mapped_length(std::size_t bytes) {
+    const std::size_t huge = huge_page_size();
+    if (bytes < huge) return bytes;
+    return (bytes + huge - 1) / huge * huge;
+}
+
+void* map_anonymous(std::size_t length, int flags) {
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags,
+                   -1, 0);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+// A mapping of `length` bytes starting on an `align` boundary, trimmed out
+// of a larger one. Transparent huge pages only back aligned ranges.
+void* map_aligned(std::size_t length, std::size_t align) {
+    char* raw = static_cast<char*>(map_anonymous(length + align, 0));
+    if (!raw) return nullptr;
+    const std::size_t skip = (align - reinterpret_cast<std::uintptr_t>(raw) % align) % align;
+    char* base = raw + skip;
+    if (skip) munmap(raw, skip);
+    if (align > skip) munmap(base + length, align - skip);
+    return base;
+}
+
+// A huge page backed or NUMA placed block is only reused under the same
+// settings.
+std::uint8_t backing_key() {
+    return static_cast<std::uint8_t>(static_cast<unsigned>(runtime_config.huge_pages) * 4 +
+                                     static_cast<unsigned>(runtime_config.numa_policy));
+}
+
+void* map_fresh(std::size_t length) {
+    const HugePages mode = runtime_config.huge_pages;
+    void* p = nullptr;
+    if (length >= huge_page_size() && mode != HugePages::Off) {
+#ifdef MAP_HUGETLB
+        // Fails at once, rather than at the first fault, if the pool is
+        // short of pages.
+        if (mode == HugePages::Explicit) p = map_anonymous(length, MAP_HUGETLB);
+#endif
+        if (!p) {
+            p = map_aligned(length, huge_page_size());
+#ifdef MADV_HUGEPAGE
+            if (p) madvise(p, length, MADV_HUGEPAGE);
+#endif
+        }
+    }
+    if (!p) p = map_anonymous(length, 0);
+    if (p) place_state_pages(p, length);
+    return p;
+}
+
+// Freed blocks kept for reuse, oldest first. Registers of one size free
+// and allocate blocks of one length, so an exact match is all it takes.
+struct PoolEntry {
+    void* data;
+    std::size_t length;
+    std::uint8_t backing;
+};
+std::mutex pool_mutex;
+std::vector<PoolEntry> pool;
+StatePoolStats pool_stats;
+
+void* take_pooled(std::size_t length, std::uint8_t backing) {
+    if (runtime_config.state_pool_mb == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (std::size_t i = pool.size(); i-- > 0;) {
+        if (pool[i].length != length || pool[i].backing != backing) continue;
+        void* p = pool[i].data;
+        pool.erase(pool.begin() + i);
+        pool_stats.held_bytes -= length;
+        ++pool_stats.hits;
+        return p;
+    }
+    ++pool_stats.misses;
+    return nullptr;
+}
+
+bool give_pooled(void* data, std::size_t length, std::uint8_t backing) {
+    const std::size_t limit = runtime_config.state_pool_mb << 20;
+    if (length > limit) return false;
+#ifdef MADV_FREE
+    // The kernel may take the pages back under memory pressure instead of
+    // swapping them; until then they stay mapped and reuse is fault-free.
+    madvise(data, length, MADV_FREE);
+#endif
+    std::vector<PoolEntry> drop;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool.push_back({data, length, backing});
+        pool_stats.held_bytes += length;
+        std::size_t n = 0;
+        while (pool_stats.held_bytes > limit) {
+            pool_stats.held_bytes -= pool[n].length;
+            ++n;
+        }
+        drop.assign(pool.begin(), pool.begin() + n);
+        pool.erase(pool.begin(), pool.begin() + n);
+        pool_stats.trimmed += n;
+    }
+    for (const auto& e : drop) munmap(e.data, e.length);
+    return true;
+}
+
+// Blocks with file pages mapped over their start by share_state_pages(),
+// and how many bytes are shared.
+std::mutex shared_mutex;
+std::unordered_map<const void*, std::size_t> shared_blocks;
+
+// The page size share_state_pages() and discard_state_pages() work in: a
+// huge page for blocks that may be huge page backed.
+std::size_t share_granule(std::size_t bytes) {
+    if (bytes >= huge_page_size()) return huge_page_size();
+    return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Replace `length` bytes at `data` with `fresh`, a mapping of that length,
+// in one step: the old pages stay where they were if it fails.
+bool replace_pages(void* data, void* fresh, std::size_t length) {
+    if (mremap(fresh, length, length, MREMAP_MAYMOVE | MREMAP_FIXED, data) != MAP_FAILED)
+        return true;
+    munmap(fresh, length);
+    return false;
+}
+
+// How many leading bytes of `data` are shared with a file, forgetting the
+// block if `forget`.
+std::size_t shared_prefix(const void* data, bool forget) {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    auto it = shared_blocks.find(data);
+    if (it == shared_blocks.end()) return 0;
+    const std::size_t bytes = it->second;
+    if (forget) shared_blocks.erase(it);
+    return bytes;
+}
+
+// Zero `bytes` bytes at `data` from all threads, each clearing the slice a
+// static schedule gives it, so pages stay where first touch put them.
+void clear_block(void* data, std::size_t bytes) {
+    constexpr std::size_t kSlice = std::size_t(1) << 20;
+    char* base = static_cast<char*>(data);
+    const std::size_t slices = (bytes + kSlice - 1) / kSlice;
+#pragma omp parallel for schedule(static) if (slices > 1)
+    for (std::size_t i = 0; i < slices; ++i) {
+        const std::size_t begin = i * kSlice;
+        std::memset(base + begin, 0, std::min(kSlice, bytes - begin));
+    }
+}
+} // namespace
+
+std::size_t huge_page_size() {
+    static const std::size_t size = [] {
+        std::ifstream ifs("/proc/meminfo");
+        std::string line;
+        while (std::getline(ifs, line)) {
+            unsigned long kb = 0;
+            if (std::sscanf(line.c_str(), "Hugepagesize: %lu kB", &kb) == 1 && kb > 0)
+                return static_cast<std::size_t>(kb) * 1024;
+        }
+        return std::size_t(2) << 20;
+    }();
+    return size;
+}
+
+void* map_state_block(std::size_t bytes) {
+    const std::size_t length = mapped_length(bytes);
+    const std::uint8_t backing = backing_key();
+    if (void* p = take_pooled(length, backing)) {
+        // A pooled block holds its last owner's amplitudes, or zeros where
+        // the kernel reclaimed pages under MADV_FREE. Only the requested
+        // bytes are ever visible, so only they are cleared.
+        clear_block(p, bytes);
+        return p;
+    }
+    void* p = map_fresh(length);
+    if (!p && trim_state_pool(0) > 0) p = map_fresh(length);
+    return p;
+}
+
+void unmap_state_block(void* data, std::size_t bytes) {
+    const std::size_t length = mapped_length(bytes);
+    // MADV_FREE does not apply to file pages, so a shared block is not
+    // worth keeping.
+    if (shared_prefix(data, true) || !give_pooled(data, length, backing_key()))
+        munmap(data, length);
+}
+
+StatePoolStats state_pool_stats() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    StatePoolStats stats = pool_stats;
+    stats.held_blocks = pool.size();
+    return stats;
+}
+
+std::size_t trim_state_pool(std::size_t keep_bytes) {
+    std::vector<PoolEntry> drop;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        // Oldest first.
+        std::size_t n = 0;
+        while (n < pool.size() && pool_stats.held_bytes > keep_bytes) {
+            pool_stats.held_bytes -= pool[n].length;
+            ++n;
+        }
+        drop.assign(pool.begin(), pool.begin() + n);
+        pool.erase(pool.begin(), pool.begin() + n);
+        pool_stats.trimmed += n;
+    }
+    std::size_t released = 0;
+    for (const auto& e : drop) {
+        munmap(e.data, e.length);
+        released += e.length;
+    }
+    return released;
+}
+
+std::size_t discard_state_pages(void* data, std::size_t bytes) {
+    // Whole huge pages, which suits every backing: hugetlbfs pages can only
+    // be dropped whole, and a partial transparent huge page would be split.
+    // State sizes are powers of two, so at most a small tail is left.
+    const std::size_t huge = huge_page_size();
+    const std::size_t whole = bytes / huge * huge;
+    if (const std::size_t shared = shared_prefix(data, false)) {
+        // Dropped file pages would read back as the file, not as zeros:
+        // swap in anonymous ones instead.
+        void* fresh = map_fresh(shared);
+        if (!fresh || !replace_pages(data, fresh, shared)) return 0;
+        shared_prefix(data, true);
+        if (whole > shared) madvise(static_cast<char*>(data) + shared, whole - shared, MADV_DONTNEED);
+        return std::min(bytes, std::max(whole, shared));
+    }
+    if (whole && madvise(data, whole, MADV_DONTNEED) == 0) return whole;
+    return 0;
+}
+
+std::size_t share_state_pages(void* data, std::size_t bytes, int fd) {
+    const std::size_t granule = share_granule(bytes);
+    const std::size_t whole = bytes / granule * granule;
+    if (!whole) return 0;
+    // Mapped aside first and moved into place, so a failure leaves the
+    // block as it was.
+    void* file = mmap(nullptr, whole, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED || !replace_pages(data, file, whole)) return 0;
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    shared_blocks[data] = whole;
+    return whole;
+}
+} // namespace qpp
@@ -0,0 +1,122 @@
+#pragma once
+#include <complex>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace qpp {
+// Anonymous mappings behind large StateAllocator blocks. map_state_block()
+// backs the block with huge pages as runtime_config.huge_pages asks, falling
+// back to base pages, and applies runtime_config.numa_policy; it returns
+// nullptr if nothing could be mapped. Blocks of at least huge_page_size()
+// are rounded up to whole huge pages, so unmap_state_block() needs only the
+// requested size.
+void* map_state_block(std::size_t bytes);
+void unmap_state_block(void* data, std::size_t bytes);
+// Hand the whole pages of `bytes` bytes at `data`, the start of a mapped
+// block, back to the kernel. Returns how many leading bytes now read as
+// zero.
+std::size_t discard_state_pages(void* data, std::size_t bytes);
+std::size_t huge_page_size();
+// Map the first bytes of file `fd` privately over the start of the mapped
+// block `data`, in whole pages of the block's backing, so the block reads
+// as the file and a page is copied only when it is first written. Returns
+// how many leading bytes are shared; the block is unchanged where 0. A
+// shared block is never pooled, and discard_state_pages() gives it fresh
+// anonymous pages rather than the file's.
+std::size_t share_state_pages(void* data, std::size_t bytes, int fd);
+
+// Freed mapped blocks are kept, up to runtime_config.state_pool_mb, and
+// handed to the next allocation of the same length and backing, so a batch
+// of same-sized registers maps and faults its buffers once. Pooled pages
+// are marked MADV_FREE, which lets the kernel reclaim them under memory
+// pressure; a reused block is cleared before it is returned. When the pool
+// is over its limit, or a fresh mapping fails, the oldest blocks go first.
+struct StatePoolStats {
+    std::size_t hits = 0;        // allocations served from the pool
+    std::size_t misses = 0;      // allocations that found no pooled block
+    std::size_t trimmed = 0;     // blocks unmapped to stay within the limit
+    std::size_t held_bytes = 0;
+    std::size_t held_blocks = 0;
+};
+StatePoolStats state_pool_stats();
+// Unmap pooled blocks, oldest first, until at most `keep_bytes` are held.
+// Returns the bytes released.
+std::size_t trim_state_pool(std::size_t keep_bytes = 0);
+
+// Allocator for amplitude arrays. Blocks of kMapBytes or more are anonymous
+// mappings and smaller ones come from calloc, so a fresh block reads as
+// zero without ever having been written. Default construction leaves those
+// bytes alone: a new state costs nothing until a gate writes it. Mappings
+// get runtime_config.numa_policy before their first touch; under the
+// default FirstTouch each page lands on the NUMA node of the OpenMP thread
+// that first writes it. A vector shrunk with resize() and grown again
+// within its capacity keeps the old values in the regrown tail; use
+// assign() or zero_state() to clear one.
+template<typename T>
+struct StateAllocator {
+    using value_type = T;
+    static constexpr std::size_t kMapBytes = std::size_t(1) << 20;
+
+    template<typename U>
+    struct rebind { using other = StateAllocator<U>; };
+
+    StateAllocator() noexcept = default;
+    template<typename U>
+    StateAllocator(const StateAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n * sizeof(T) >= kMapBytes) {
+            void* p = map_state_block(n * sizeof(T));
+            if (!p) throw std::bad_alloc();
+            return static_cast<T*>(p);
+        }
+        void* p = std::calloc(n ? n : 1, sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t n) noexcept {
+        if (n * sizeof(T) >= kMapBytes)
+            unmap_state_block(p, n * sizeof(T));
+        else
+            std::free(p);
+    }
+
+    template<typename U>
+    void construct(U*) noexcept {
+        static_assert(std::is_trivially_copyable<U>::value,
+                      "StateAllocator relies on all-zero bytes being a zero value");
+    }
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template<typename U>
+    bool operator==(const StateAllocator<U>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const StateAllocator<U>&) const noexcept { return false; }
+};
+
+template<typename Real>
+using StateVector = std::vector<std::complex<Real>, StateAllocator<std::complex<Real>>>;
+// Basis indices of sparse states.
+using IndexVector = std::vector<std::size_t, StateAllocator<std::size_t>>;
+
+// Set every amplitude of `v` to zero. The whole pages of a mapped block are
+// handed back to the kernel, which maps them to the zero page again on the
+// next touch, instead of being written.
+template<typename Real>
+void zero_state(StateVector<Real>& v) {
+    using Amp = std::complex<Real>;
+    char* begin = reinterpret_cast<char*>(v.data());
+    char* end = begin + v.size() * sizeof(Amp);
+    if (v.capacity() * sizeof(Amp) >= StateAllocator<Amp>::kMapBytes)
+        begin += discard_state_pages(begin, end - begin);
+    std::memset(begin, 0, end - begin);
+}
+} // namespace qpp
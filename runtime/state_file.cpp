@@ -0,0 +1,302 @@
+#include "state_file.h"
+#include "checkpoint.h"
+#include "disk_pager.h"
+#include <algorithm>
+#include <cstring>
+
+namespace qpp {
+namespace {
+constexpr char kMagic[8] = {'Q', 'P', 'P', 'S', 'T', 'Z', '1', '\0'};
+// Pages of a disk-backed state requested ahead while it is saved.
+constexpr std::size_t kPrefetchPages = 4;
+
+struct FileHeader {
+    char magic[8];
+    std::uint64_t count;
+    std::uint64_t page_elems;
+    std::uint8_t codec;
+    std::uint8_t reserved[7];
+};
+
+// Fill `out` from `source`, asking again until it is full.
+bool fill(const StateSource& source, std::complex<double>* out, std::size_t n) {
+    while (n > 0) {
+        std::size_t got = source(out, n);
+        if (got == 0 || got > n)
+            return false;
+        out += got;
+        n -= got;
+    }
+    return true;
+}
+} // namespace
+
+bool save_state_file(const std::string& path, std::size_t count, const StateSource& source,
+                     PageCodec codec) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) return false;
+    const std::size_t page_elems = std::min(kStateFilePage, std::max<std::size_t>(count, 1));
+    std::vector<std::complex<double>> page(page_elems);
+    if (codec == PageCodec::Raw) {
+        ofs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (std::size_t i = 0; i < count; i += page_elems) {
+            const std::size_t n = std::min(page_elems, count - i);
+            if (!fill(source, page.data(), n)) return false;
+            ofs.write(reinterpret_cast<const char*>(page.data()), n * sizeof(page[0]));
+        }
+        return static_cast<bool>(ofs);
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.count = count;
+    header.page_elems = page_elems;
+    header.codec = static_cast<std::uint8_t>(codec);
+    const std::size_t pages = (count + page_elems - 1) / page_elems;
+    // The bitmap is only known at the end; it is written over this
+    // placeholder once every page has gone out.
+    std::vector<std::uint8_t> bitmap((pages + 7) / 8, 0);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const std::streamoff bitmap_at = ofs.tellp();
+    ofs.write(reinterpret_cast<const char*>(bitmap.data()), bitmap.size());
+    std::vector<std::uint8_t> encoded;
+    for (std::size_t p = 0; p < pages; ++p) {
+        const std::size_t n = std::min(page_elems, count - p * page_elems);
+        if (!fill(source, page.data(), n)) return false;
+        if (page_is_zero(page.data(), n)) continue;
+        bitmap[p / 8] |= static_cast<std::uint8_t>(1u << (p % 8));
+        encode_page(codec, page.data(), n, encoded);
+        const std::uint32_t size = static_cast<std::uint32_t>(encoded.size());
+        ofs.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        ofs.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    }
+    ofs.seekp(bitmap_at);
+    ofs.write(reinterpret_cast<const char*>(bitmap.data()), bitmap.size());
+    return static_cast<bool>(ofs);
+}
+
+bool load_state_file(const std::string& path, std::vector<std::complex<double>>& state) {
+    StateFileReader reader(path);
+    if (!reader.ok()) return false;
+    std::vector<std::complex<double>> st(reader.size());
+    for (std::size_t i = 0; i < st.size();) {
+        std::size_t got = reader.read(st.data() + i, st.size() - i);
+        if (got == 0) return false;
+        i += got;
+    }
+    state = std::move(st);
+    return true;
+}
+
+StateSource state_source(const Wavefunction<>& wf) {
+    auto next = std::make_shared<std::size_t>(0);
+    const std::size_t count = wf.uses_disk() ? wf.pager->size() : std::size_t(1) << wf.num_qubits;
+    // Physical index of logical index `i`, as in Wavefunction::amplitude().
+    const std::vector<std::size_t>& layout = wf.layout;
+    auto physical = [&layout](std::size_t i) {
+        if (layout.empty()) return i;
+        std::size_t index = i >> layout.size() << layout.size();
+        for (std::size_t q = 0; q < layout.size(); ++q)
+            index |= ((i >> q) & 1ULL) << layout[q];
+        return index;
+    };
+    const bool pending = wf.collapse_pending;
+    const std::size_t mask = wf.collapse_mask, value = wf.collapse_value;
+    const double norm = wf.collapse_norm;
+    auto collapsed = [=](std::complex<double> a, std::size_t index) {
+        if (!pending) return a;
+        return (index & mask) == value ? a / norm : std::complex<double>(0.0, 0.0);
+    };
+
+    if (wf.using_sparse()) {
+        // The entries are few: sort them by logical index once and hand out
+        // zeros between them.
+        auto entries = std::make_shared<std::vector<std::pair<std::size_t, std::complex<double>>>>();
+        const auto& sparse = wf.sparse_state;
+        entries->reserve(sparse.nnz());
+        for (std::size_t k = 0; k < sparse.nnz(); ++k) {
+            std::size_t logical = sparse.indices[k];
+            if (!layout.empty()) {
+                logical = sparse.indices[k] >> layout.size() << layout.size();
+                for (std::size_t q = 0; q < layout.size(); ++q)
+                    logical |= ((sparse.indices[k] >> layout[q]) & 1ULL) << q;
+            }
+            entries->emplace_back(logical, collapsed(sparse.amplitudes[k], sparse.indices[k]));
+        }
+        std::sort(entries->begin(), entries->end(),
+                  [](const auto& x, const auto& y) { return x.first < y.first; });
+        auto cursor = std::make_shared<std::size_t>(0);
+        return [entries, cursor, next, count](std::complex<double>* out, std::size_t max) {
+            const std::size_t n = std::min(max, count - *next);
+            std::fill(out, out + n, std::complex<double>(0.0, 0.0));
+            for (; *cursor < entries->size() && (*entries)[*cursor].first < *next + n; ++*cursor)
+                out[(*entries)[*cursor].first - *next] = (*entries)[*cursor].second;
+            *next += n;
+            return n;
+        };
+    }
+    if (wf.uses_disk()) {
+        // The layout only moves qubits above the page size, so a logical
+        // page is one physical page read in order.
+        DiskPager& pager = *wf.pager;
+        return [&pager, physical, collapsed, next](std::complex<double>* out, std::size_t max) {
+            const std::size_t page_elems = pager.page_elems();
+            const std::size_t first = physical(*next);
+            const std::size_t page = first / page_elems;
+            const std::size_t offset = first % page_elems;
+            const std::size_t n = std::min({max, page_elems - offset, pager.size() - *next});
+            for (std::size_t k = 1; k <= kPrefetchPages; ++k)
+                pager.prefetch(physical((*next / page_elems + k) * page_elems) / page_elems);
+            const std::complex<double>* data = pager.acquire(page, false);
+            for (std::size_t j = 0; j < n; ++j) out[j] = collapsed(data[offset + j], first + j);
+            pager.release(page);
+            *next += n;
+            return n;
+        };
+    }
+    if (wf.is_soa) {
+        const auto& re = wf.soa_re;
+        const auto& im = wf.soa_im;
+        return [&re, &im, physical, collapsed, next, count](std::complex<double>* out,
+                                                             std::size_t max) {
+            const std::size_t n = std::min(max, count - *next);
+            for (std::size_t j = 0; j < n; ++j) {
+                const std::size_t index = physical(*next + j);
+                out[j] = collapsed({re[index], im[index]}, index);
+            }
+            *next += n;
+            return n;
+        };
+    }
+    const StateVector<double>& state = wf.state;
+    return [&state, physical, collapsed, pending, next, count, &layout](std::complex<double>* out,
+                                                                         std::size_t max) {
+        const std::size_t n = std::min(max, count - *next);
+        if (layout.empty() && !pending) {
+            std::copy(state.begin() + *next, state.begin() + *next + n, out);
+        } else {
+            for (std::size_t j = 0; j < n; ++j) {
+                const std::size_t index = physical(*next + j);
+                out[j] = collapsed(state[index], index);
+            }
+        }
+        *next += n;
+        return n;
+    };
+}
+
+bool save_state_file(const std::string& path, const Wavefunction<>& wf, PageCodec codec) {
+    const std::size_t count = wf.uses_disk() ? wf.pager->size() : std::size_t(1) << wf.num_qubits;
+    return save_state_file(path, count, state_source(wf), codec);
+}
+
+bool load_state_file(const std::string& path, Wavefunction<>& wf) {
+    StateFileReader reader(path);
+    if (!reader.ok() || reader.size() != (std::size_t(1) << wf.num_qubits)) return false;
+    wf.decompress();
+    wf.to_aos();
+    wf.apply_collapse();
+    wf.layout.clear();
+    auto fill_from_reader = [&](std::complex<double>* out, std::size_t n) {
+        while (n > 0) {
+            std::size_t got = reader.read(out, n);
+            if (got == 0) return false;
+            out += got;
+            n -= got;
+        }
+        return true;
+    };
+    if (!wf.uses_disk()) {
+        // Read into a copy so a truncated file leaves the state untouched.
+        std::vector<std::complex<double>> st(reader.size());
+        if (!fill_from_reader(st.data(), st.size())) return false;
+        std::copy(st.begin(), st.end(), wf.state.begin());
+        return true;
+    }
+    DiskPager& pager = *wf.pager;
+    for (std::size_t p = 0; p < pager.page_count(); ++p) {
+        const std::size_t n = std::min(pager.page_elems(), pager.size() - p * pager.page_elems());
+        std::complex<double>* data = pager.overwrite(p);
+        const bool ok = fill_from_reader(data, n);
+        pager.release(p);
+        if (!ok) return false;
+        pager.write_behind(p);
+    }
+    return true;
+}
+
+StateFileReader::StateFileReader(const std::string& path) : ifs(path, std::ios::binary) {
+    FileHeader header;
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header.magic))) return;
+    if (is_checkpoint_magic(header.magic)) {
+        chain = std::make_unique<CheckpointReader>(path);
+        good = chain->ok();
+        count = chain->size();
+        return;
+    }
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        // Plain layout: the first word is the amplitude count.
+        std::memcpy(&count, header.magic, sizeof(count));
+        good = true;
+        return;
+    }
+    if (!ifs.read(reinterpret_cast<char*>(&header) + sizeof(header.magic),
+                  sizeof(header) - sizeof(header.magic)) ||
+        header.page_elems == 0 || header.codec > static_cast<std::uint8_t>(PageCodec::Fixed16))
+        return;
+    paged = true;
+    count = header.count;
+    page_elems = header.page_elems;
+    codec = static_cast<PageCodec>(header.codec);
+    bitmap.resize(((count + page_elems - 1) / page_elems + 7) / 8);
+    good = static_cast<bool>(ifs.read(reinterpret_cast<char*>(bitmap.data()), bitmap.size()));
+}
+
+StateFileReader::~StateFileReader() = default;
+
+bool StateFileReader::next_page() {
+    const std::size_t n = std::min(page_elems, count - page * page_elems);
+    current.resize(n);
+    used = 0;
+    if (!(bitmap[page / 8] & (1u << (page % 8)))) {
+        std::fill(current.begin(), current.end(), std::complex<double>(0.0, 0.0));
+    } else {
+        std::uint32_t size;
+        if (!ifs.read(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+        bytes.resize(size);
+        if (!ifs.read(reinterpret_cast<char*>(bytes.data()), size) ||
+            !decode_page(codec, bytes.data(), size, current.data(), n))
+            return false;
+    }
+    ++page;
+    return true;
+}
+
+std::size_t StateFileReader::read(std::complex<double>* out, std::size_t max) {
+    if (!good || delivered == count) return 0;
+    max = std::min(max, count - delivered);
+    if (chain) {
+        const std::size_t got = chain->read(out, max);
+        if (got == 0) good = false;
+        delivered += got;
+        return got;
+    }
+    if (!paged) {
+        ifs.read(reinterpret_cast<char*>(out), max * sizeof(std::complex<double>));
+        const std::size_t got =
+            static_cast<std::size_t>(ifs.gcount()) / sizeof(std::complex<double>);
+        if (got == 0) good = false;
+        delivered += got;
+        return got;
+    }
+    if (used == current.size() && !next_page()) {
+        good = false;
+        return 0;
+    }
+    const std::size_t n = std::min(max, current.size() - used);
+    std::copy(current.begin() + used, current.begin() + used + n, out);
+    used += n;
+    delivered += n;
+    return n;
+}
+} // namespace qpp
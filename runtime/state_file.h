@@ -0,0 +1,95 @@
+#pragma once
+#include "page_codec.h"
+#include "wavefunction.h"
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace qpp {
+// Saved dense states and checkpoints. There are two layouts:
+//  - plain: the amplitude count as a size_t, then the amplitudes. This is
+//    what PageCodec::Raw writes, so older readers keep working.
+//  - paged: a header naming the codec, a bitmap with one bit per page of
+//    kStateFilePage amplitudes that is set for pages holding a non-zero
+//    amplitude, then for each such page its encoded size (32 bits) and
+//    bytes. All-zero pages take one bit and no data.
+// Readers recognise both, and incremental checkpoint chains (see
+// checkpoint.h) as well.
+constexpr std::size_t kStateFilePage = std::size_t(1) << 14;
+
+// Fills up to `max` amplitudes in index order and returns how many it
+// wrote; 0 means the source failed.
+using StateSource = std::function<std::size_t(std::complex<double>*, std::size_t)>;
+
+bool save_state_file(const std::string& path, std::size_t count, const StateSource& source,
+                     PageCodec codec);
+template<typename Alloc>
+bool save_state_file(const std::string& path, const std::vector<std::complex<double>, Alloc>& state,
+                     PageCodec codec) {
+    std::size_t next = 0;
+    return save_state_file(path, state.size(),
+                           [&](std::complex<double>* out, std::size_t max) {
+                               const std::size_t n = std::min(max, state.size() - next);
+                               std::copy(state.begin() + next, state.begin() + next + n, out);
+                               next += n;
+                               return n;
+                           },
+                           codec);
+}
+bool load_state_file(const std::string& path, std::vector<std::complex<double>>& state);
+
+// Streams the amplitudes of `wf` in logical index order without changing
+// it: sparse entries, SoA arrays, a remapped layout and a pending collapse
+// are all resolved on the fly. A disk-backed state is read a page at a time
+// with read-ahead. `wf` must outlive the source and stay unchanged while it
+// is read.
+StateSource state_source(const Wavefunction<>& wf);
+
+// Save or load a whole wavefunction. Saving streams through state_source(),
+// so the register keeps its storage form and a disk-backed state is never
+// held in memory. Loading resolves pending collapse and layout first and
+// fails if the qubit counts differ.
+bool save_state_file(const std::string& path, const Wavefunction<>& wf, PageCodec codec);
+bool load_state_file(const std::string& path, Wavefunction<>& wf);
+
+class CheckpointReader;
+
+// Streams the amplitudes of a state file of either layout, or of a
+// checkpoint chain.
+class StateFileReader {
+public:
+    explicit StateFileReader(const std::string& path);
+    ~StateFileReader();
+    // False if the file could not be opened or has a bad header, or once a
+    // read has failed.
+    bool ok() const { return good; }
+    std::size_t size() const { return count; }
+    // Copy up to `max` of the next amplitudes into `out` and return how
+    // many; 0 at the end or on error.
+    std::size_t read(std::complex<double>* out, std::size_t max);
+
+private:
+    bool next_page();
+
+    std::ifstream ifs;
+    std::unique_ptr<CheckpointReader> chain;
+    bool good{false};
+    bool paged{false};
+    PageCodec codec{PageCodec::Raw};
+    std::size_t count{0};
+    std::size_t delivered{0};
+    std::size_t page_elems{0};
+    std::size_t page{0};
+    std::vector<std::uint8_t> bitmap;
+    std::vector<std::uint8_t> bytes;
+    // Decoded current page and how much of it has been handed out.
+    std::vector<std::complex<double>> current;
+    std::size_t used{0};
+};
+} // namespace qpp
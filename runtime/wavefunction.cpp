@@ -1,14 +1,20 @@
 #include "wavefunction.h"
 #include "device.h"
+#include "numa.h"
+#include "soa_kernels.h"
 #ifdef USE_CUDA
 #include "gpu_kernels.h"
 #endif
+#include <chrono>
 #include <cmath>
 #include <random>
 #include "random.h"
 #include <unordered_map>
 #include <string>
 #include <array>
+#include <algorithm>
+#include <numeric>
+#include <utility>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -19,22 +25,114 @@ namespace qpp {
 
 template<typename Real>
 Wavefunction<Real>::Wavefunction(std::size_t qubits)
-    : state(1ULL << qubits, {Real(0.0), Real(0.0)}), num_qubits(qubits) {
-    std::size_t bytes = (1ULL << qubits) * sizeof(std::complex<Real>);
-    if (runtime_config.disk_limit_mb > 0 && bytes / (1024 * 1024) >= runtime_config.disk_limit_mb) {
-        pager = std::make_unique<DiskPager>(1ULL << qubits);
-        disk_backed = true;
-        state.clear();
+    : sparse_state(qubits), num_qubits(qubits) {
+    if (runtime_config.pin_threads) pin_omp_threads();
+    if (disk_backed_size<Real>(qubits)) {
+        open_pager(runtime_config.disk_cache_mb * 1024 * 1024);
+    } else if (runtime_config.sparse_threshold > 0.0 && !runtime_config.soa_storage) {
+        // |0...0> has a single non-zero amplitude; the dense array is only
+        // allocated once the state fills in.
+        is_sparse = true;
     } else {
+        sparse_state.clear();
+        // The block comes zeroed from the allocator; only the page holding
+        // the first amplitude is touched here.
+        state.resize(1ULL << qubits);
         state[0] = Real(1.0);
+        if (runtime_config.soa_storage) to_soa();
     }
 }
 
 template<typename Real>
-static void apply_single_qubit_gate_cpu(std::vector<std::complex<Real>>& st,
+Wavefunction<Real>::Wavefunction(std::size_t qubits, DiskBacked disk)
+    : sparse_state(0), num_qubits(qubits) {
+    if (runtime_config.pin_threads) pin_omp_threads();
+    open_pager(disk.cache_bytes);
+}
+
+template<typename Real>
+void Wavefunction<Real>::open_pager(std::size_t cache_bytes) {
+    const std::size_t page = disk_page_amplitudes<Real>(num_qubits);
+    const std::size_t resident = cache_bytes / (page * sizeof(std::complex<double>));
+    pager = std::make_unique<DiskPager>(1ULL << num_qubits, page, std::max<std::size_t>(resident, 8),
+                                        runtime_config.disk_mmap, runtime_config.disk_async,
+                                        runtime_config.disk_io_uring, runtime_config.disk_codec);
+    pager->write(0, 1.0);
+    disk_backed = true;
+    sparse_state.clear();
+}
+
+template<typename Real>
+Wavefunction<Real>::Wavefunction(std::size_t qubits, ChunkTag)
+    : sparse_state(0), num_qubits(qubits), is_chunk(true) {
+    sparse_state.clear();
+    state.resize(1ULL << qubits);
+}
+
+// Dense gates between two nnz() counts when a sparse threshold is set; the
+// count is a read-only sweep, so checking every 16 gates costs a few percent.
+static constexpr std::size_t kDensityCheckInterval = 16;
+
+template<typename Real>
+bool Wavefunction<Real>::route_sparse() {
+    const double threshold = runtime_config.sparse_threshold;
+    if (threshold <= 0.0 || is_soa || disk_backed || is_chunk) return is_sparse;
+    const double size = double(1ULL << num_qubits);
+    if (is_sparse) {
+        if (double(sparse_state.nnz()) > threshold * size) decompress();
+    } else if (++gates_since_density_check >= kDensityCheckInterval) {
+        // Only go back to sparse well below the threshold so a state near
+        // it does not convert on every check.
+        gates_since_density_check = 0;
+        if (2.0 * double(nnz()) <= threshold * size) compress();
+    }
+    return is_sparse;
+}
+
+// A measurement projection deferred by lazy collapse: amplitudes whose index
+// disagrees with `value` on `mask` are zero, the others are divided by `norm`.
+struct Collapse {
+    std::size_t mask;
+    std::size_t value;
+    double norm;
+};
+
+// Hand the pending collapse of `wf` to a kernel that folds it into its own
+// sweep, clearing it on the wavefunction. Returns nullptr if none is pending.
+template<typename Real>
+static const Collapse* take_collapse(Wavefunction<Real>& wf, Collapse& c) {
+    if (!wf.collapse_pending) return nullptr;
+    c = {wf.collapse_mask, wf.collapse_value, wf.collapse_norm};
+    wf.collapse_pending = false;
+    wf.collapse_mask = wf.collapse_value = 0;
+    wf.collapse_norm = 1.0;
+    return &c;
+}
+
+template<typename Real>
+static inline std::complex<Real> collapsed(const std::complex<Real>& a, std::size_t i,
+                                           const Collapse& c) {
+    return (i & c.mask) == c.value ? a / Real(c.norm) : std::complex<Real>(0, 0);
+}
+
+template<typename Real>
+static void apply_single_qubit_gate_cpu(StateVector<Real>& st,
                                         std::size_t target,
-                                        const std::complex<Real> mat[2][2]) {
+                                        const std::complex<Real> mat[2][2],
+                                        const Collapse* c = nullptr) {
     std::size_t step = 1ULL << target;
+    if (c) {
+#pragma omp parallel for schedule(static)
+        for (std::size_t i = 0; i < st.size(); i += 2 * step) {
+            for (std::size_t j = 0; j < step; ++j) {
+                auto a = collapsed(st[i + j], i + j, *c);
+                auto b = collapsed(st[i + j + step], i + j + step, *c);
+                st[i + j] = mat[0][0] * a + mat[0][1] * b;
+                st[i + j + step] = mat[1][0] * a + mat[1][1] * b;
+            }
+        }
+        return;
+    }
 #pragma omp parallel for schedule(static)
     for (std::size_t i = 0; i < st.size(); i += 2 * step) {
 #pragma omp simd
@@ -47,156 +145,967 @@ static void apply_single_qubit_gate_cpu(std::vector<std::complex<Real>>& st,
     }
 }
 
+// Insert a zero bit at position `pos`, shifting the higher bits up by one.
+static inline std::size_t insert_zero_bit(std::size_t i, std::size_t pos) {
+    std::size_t low = i & ((1ULL << pos) - 1);
+    return ((i >> pos) << (pos + 1)) | low;
+}
+
+// Outcome bits of an index for a list of measured qubits, bit j holding
+// qubits[j]: a shift and mask when the qubits are consecutive and ascending,
+// otherwise one lookup per index byte (a portable PEXT).
+class OutcomeExtractor {
+public:
+    explicit OutcomeExtractor(const std::vector<std::size_t>& qubits) {
+        contiguous = !qubits.empty();
+        for (std::size_t j = 1; j < qubits.size(); ++j)
+            contiguous = contiguous && qubits[j] == qubits[0] + j;
+        if (contiguous) {
+            shift = qubits[0];
+            width_mask = (std::size_t(1) << qubits.size()) - 1;
+            return;
+        }
+        std::size_t top = 0;
+        for (auto q : qubits) top = std::max(top, q);
+        tables.resize(top / 8 + 1);
+        for (std::size_t b = 0; b < tables.size(); ++b) {
+            for (std::size_t v = 0; v < 256; ++v) {
+                std::size_t out = 0;
+                for (std::size_t j = 0; j < qubits.size(); ++j)
+                    if (qubits[j] / 8 == b && ((v >> (qubits[j] % 8)) & 1)) out |= std::size_t(1) << j;
+                tables[b][v] = out;
+            }
+        }
+    }
+    std::size_t operator()(std::size_t i) const {
+        if (contiguous) return (i >> shift) & width_mask;
+        std::size_t out = 0;
+        for (std::size_t b = 0; b < tables.size(); ++b) out |= tables[b][(i >> (8 * b)) & 0xff];
+        return out;
+    }
+
+private:
+    bool contiguous{false};
+    std::size_t shift{0};
+    std::size_t width_mask{0};
+    std::vector<std::array<std::size_t, 256>> tables;
+};
+
+// Disk-backed gates run on in-memory chunks: every group of pages that
+// differ only in the gate's qubits above the page size is copied into
+// `chunk`, the gate runs there on the ordinary kernels, and the pages go
+// back. Each page is read and written once per gate, and a target above the
+// page size streams page pairs. A pending collapse is applied on the way in.
+// Every pass is linear, so a group whose pages are all known to be zero is
+// skipped: a fresh state only streams the pages its gates have reached.
+template<typename Real>
+template<typename Op>
+void Wavefunction<Real>::page_pass(const std::vector<std::size_t>& qubits,
+                                   std::size_t idle_when_clear, Op op) {
+    const std::size_t page = pager->page_elems();
+    std::size_t page_bits = 0;
+    while ((std::size_t(2) << page_bits) <= page) ++page_bits;
+    // Pages are grouped by physical qubit; `local` and the idle mask are
+    // translated back to the logical qubits the caller passed.
+    std::vector<std::size_t> outer;
+    std::size_t idle_mask = 0;
+    for (auto q : qubits) {
+        if (q >= num_qubits) continue;
+        const std::size_t p = physical_qubit(q);
+        if ((idle_when_clear >> q) & 1ULL) idle_mask |= std::size_t(1) << p;
+        if (p >= page_bits && std::find(outer.begin(), outer.end(), p) == outer.end())
+            outer.push_back(p);
+    }
+    std::sort(outer.begin(), outer.end());
+    std::vector<std::size_t> local(std::max<std::size_t>(num_qubits, 64));
+    std::iota(local.begin(), local.end(), 0);
+    for (auto q : qubits) {
+        if (q >= num_qubits) continue;
+        const std::size_t p = physical_qubit(q);
+        local[q] = p < page_bits
+            ? p
+            : page_bits + (std::find(outer.begin(), outer.end(), p) - outer.begin());
+    }
+
+    Wavefunction chunk(page_bits + outer.size(), ChunkTag{});
+    Collapse c;
+    const Collapse* pending = take_collapse(*this, c);
+    const std::size_t members = std::size_t(1) << outer.size();
+    const std::size_t groups = pager->page_count() >> outer.size();
+    // Member e of group g, and whether the pass has to touch it.
+    auto member = [&](std::size_t g, std::size_t e, bool& active) {
+        std::size_t p = g;
+        for (auto q : outer) p = insert_zero_bit(p, q - page_bits);
+        active = true;
+        for (std::size_t j = 0; j < outer.size(); ++j) {
+            if ((e >> j) & 1ULL)
+                p |= std::size_t(1) << (outer[j] - page_bits);
+            else if ((idle_mask >> outer[j]) & 1ULL)
+                active = pending != nullptr;
+        }
+        return p;
+    };
+    // The next group is read while this one is computed on, as long as the
+    // pool can hold three groups: this one, the next and the last one still
+    // being written behind.
+    const bool ahead = pager->mapped() || 3 * members <= pager->frame_count();
+    std::vector<std::size_t> member_page(members);
+    std::vector<char> active(members);
+    for (std::size_t g = 0; g < groups; ++g) {
+        bool zero = true;
+        for (std::size_t e = 0; e < members; ++e) {
+            bool on;
+            member_page[e] = member(g, e, on);
+            active[e] = on;
+            if (on && !pager->known_zero(member_page[e])) zero = false;
+        }
+        if (zero) continue;
+        for (std::size_t e = 0; e < members; ++e) {
+            std::complex<Real>* dst = chunk.state.data() + e * page;
+            if (!active[e]) {
+                std::fill(dst, dst + page, std::complex<Real>(0, 0));
+                continue;
+            }
+            const std::size_t p = member_page[e];
+            const std::complex<double>* src = pager->acquire(p, false);
+            const std::size_t first = p * page;
+#pragma omp parallel for schedule(static)
+            for (std::size_t i = 0; i < page; ++i) {
+                std::complex<Real> a(src[i]);
+                dst[i] = pending ? collapsed(a, first + i, *pending) : a;
+            }
+            pager->release(p);
+        }
+        if (ahead && g + 1 < groups) {
+            for (std::size_t e = 0; e < members; ++e) {
+                bool on;
+                std::size_t p = member(g + 1, e, on);
+                if (on) pager->prefetch(p);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        op(chunk, local);
+        pager->add_compute(
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        for (std::size_t e = 0; e < members; ++e) {
+            if (!active[e]) continue;
+            // The page was read above, so there is no need to read it again
+            // if it has been evicted since.
+            std::complex<double>* dst = pager->overwrite(member_page[e]);
+            const std::complex<Real>* src = chunk.state.data() + e * page;
+#pragma omp parallel for schedule(static)
+            for (std::size_t i = 0; i < page; ++i) dst[i] = std::complex<double>(src[i]);
+            pager->release(member_page[e]);
+        }
+        for (std::size_t e = 0; e < members; ++e)
+            if (active[e]) pager->write_behind(member_page[e]);
+    }
+}
+
+// Qubits at or above the page size only pick which page an amplitude is
+// in, so moving them is a permutation of whole pages. Each cycle of the
+// permutation is followed with one page in hand: every page is read and
+// written once, and nothing inside a page moves.
+template<typename Real>
+void Wavefunction<Real>::remap_pages(const std::vector<std::size_t>& next) {
+    const std::size_t page = pager->page_elems();
+    std::size_t page_bits = 0;
+    while ((std::size_t(2) << page_bits) <= page) ++page_bits;
+    std::vector<std::size_t> current(num_qubits);
+    for (std::size_t q = 0; q < num_qubits; ++q) current[q] = physical_qubit(q);
+    auto move_bits = [&](std::size_t index, std::size_t shift) {
+        std::size_t out = 0;
+        for (std::size_t q = 0; q < num_qubits; ++q)
+            if (current[q] >= shift)
+                out |= ((index >> (current[q] - shift)) & 1ULL) << (next[q] - shift);
+        return out;
+    };
+    // A pending collapse is kept in physical bits, so it moves as well.
+    const std::size_t low = (std::size_t(1) << page_bits) - 1;
+    collapse_mask = (collapse_mask & low) | move_bits(collapse_mask, 0);
+    collapse_value = (collapse_value & low) | move_bits(collapse_value, 0);
 
+    std::vector<char> done(pager->page_count(), 0);
+    std::vector<std::complex<double>> carry(page);
+    for (std::size_t start = 0; start < done.size(); ++start) {
+        if (done[start]) continue;
+        done[start] = 1;
+        std::size_t to = move_bits(start, page_bits);
+        if (to == start) continue;
+        const std::complex<double>* first = pager->acquire(start, false);
+        std::copy(first, first + page, carry.data());
+        pager->release(start);
+        // Drop the carried page into its destination and pick up what was
+        // there, until the cycle closes at `start`.
+        for (;;) {
+            const std::size_t after = move_bits(to, page_bits);
+            pager->prefetch(after);
+            std::complex<double>* dst = pager->acquire(to, true);
+            std::swap_ranges(carry.begin(), carry.end(), dst);
+            pager->release(to);
+            pager->write_behind(to);
+            if (to == start) break;
+            done[to] = 1;
+            to = after;
+        }
+    }
+    bool identity = true;
+    for (std::size_t q = 0; q < num_qubits; ++q) identity = identity && next[q] == q;
+    if (identity) layout.clear();
+    else layout = next;
+}
+
+// Out-of-core execution of a gate run. Qubits below the page size are in
+// every chunk; a chunk of 2^c amplitudes also holds the physical qubits
+// page_bits .. c-1, so a phase may use up to c - page_bits distinct higher
+// qubits. Before each phase the qubits it needs are swapped into that window
+// with remap_pages(), evicting the resident qubit whose next use is
+// furthest away, and the phase itself is one page_pass() over contiguous
+// chunks. Disk traffic is two sweeps per phase rather than one per gate.
+template<typename Real>
+void Wavefunction<Real>::run_phases(const std::vector<GateMatrix<Real>>& gates) {
+    const std::size_t page = pager->page_elems();
+    std::size_t page_bits = 0;
+    while ((std::size_t(2) << page_bits) <= page) ++page_bits;
+    const std::size_t chunk_bits =
+        std::min(num_qubits, std::max(page_bits, disk_chunk_qubits<Real>()));
+    const std::size_t slots = chunk_bits - page_bits;
+    auto next_use = [&](std::size_t q, std::size_t from) {
+        for (std::size_t k = from; k < gates.size(); ++k)
+            if (std::find(gates[k].qubits.begin(), gates[k].qubits.end(), q) !=
+                gates[k].qubits.end())
+                return k;
+        return gates.size();
+    };
+
+    std::size_t i = 0;
+    while (i < gates.size()) {
+        // The phase runs while its qubits above the page size fit the window.
+        std::vector<std::size_t> high;
+        std::size_t end = i;
+        for (; end < gates.size(); ++end) {
+            std::vector<std::size_t> grown = high;
+            for (auto q : gates[end].qubits)
+                if (q < num_qubits && physical_qubit(q) >= page_bits &&
+                    std::find(grown.begin(), grown.end(), q) == grown.end())
+                    grown.push_back(q);
+            if (grown.size() > slots) break;
+            high.swap(grown);
+        }
+        if (end == i) {
+            // Wider than the window: stream it on its own.
+            if (gates[i].matrix.empty())
+                apply_diagonal({{gates[i].qubits, gates[i].phases}});
+            else
+                apply_matrix_k(gates[i].qubits, gates[i].matrix);
+            ++i;
+            continue;
+        }
+
+        std::vector<std::size_t> next(num_qubits), owner(num_qubits);
+        for (std::size_t q = 0; q < num_qubits; ++q) {
+            next[q] = physical_qubit(q);
+            owner[next[q]] = q;
+        }
+        bool moved = false;
+        for (auto q : high) {
+            if (next[q] < chunk_bits) continue;
+            std::size_t slot = chunk_bits, furthest = 0;
+            for (std::size_t p = page_bits; p < chunk_bits; ++p) {
+                if (std::find(high.begin(), high.end(), owner[p]) != high.end()) continue;
+                std::size_t use = next_use(owner[p], end);
+                if (slot == chunk_bits || use > furthest) {
+                    slot = p;
+                    furthest = use;
+                }
+            }
+            std::size_t evicted = owner[slot];
+            std::swap(next[q], next[evicted]);
+            owner[next[q]] = q;
+            owner[next[evicted]] = evicted;
+            moved = true;
+        }
+        if (moved) remap_pages(next);
+
+        std::vector<std::size_t> window;
+        for (std::size_t p = page_bits; p < chunk_bits; ++p) window.push_back(owner[p]);
+        page_pass(window, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            std::vector<GateMatrix<Real>> mapped(gates.begin() + i, gates.begin() + end);
+            for (auto& g : mapped)
+                for (auto& q : g.qubits) q = q < num_qubits ? local[q] : chunk.num_qubits;
+            chunk.apply_blocked(mapped);
+        });
+        i = end;
+    }
+}
+
+// Pages a streaming pass asks for ahead of the one it is working on.
+static constexpr std::size_t kPrefetchPages = 4;
+
+// Read-only pass over the pages of a disk-backed state in index order;
+// `visit(data, first, count)` sees amplitudes first .. first + count - 1.
+// Pages known to be zero are not visited, so `visit` must only accumulate.
+template<typename Real, typename Visit>
+static void scan_pages(const Wavefunction<Real>& wf, Visit visit) {
+    DiskPager& pager = *wf.pager;
+    const std::size_t page = pager.page_elems();
+    for (std::size_t p = 0; p < pager.page_count(); ++p) {
+        for (std::size_t k = 1; k <= kPrefetchPages; ++k) pager.prefetch(p + k);
+        if (pager.known_zero(p)) continue;
+        visit(pager.acquire(p, false), p * page, page);
+        pager.release(p);
+    }
+}
+
+// Swap the amplitude at `base | on` with `base | off` for every index whose
+// fixed bits (`fixed`, sorted ascending) are clear. Indices are built by
+// inserting the fixed bits instead of testing every index, and runs below the
+// lowest fixed bit are contiguous so the inner loop is a plain vector swap.
+template<typename Real, std::size_t N>
+static void swap_pairs_cpu(StateVector<Real>& st,
+                           const std::array<std::size_t, N>& fixed,
+                           std::size_t on, std::size_t off) {
+    if ((st.size() >> fixed[N - 1]) < 2) return; // qubit outside the register
+    const std::size_t groups = st.size() >> N;
+    const std::size_t run = std::size_t(1) << fixed[0];
+    const std::size_t blocks = groups / run;
+    std::complex<Real>* data = st.data();
+#pragma omp parallel for schedule(static)
+    for (std::size_t b = 0; b < blocks; ++b) {
+        std::size_t base = b * run;
+        for (std::size_t pos : fixed) base = insert_zero_bit(base, pos);
+        std::complex<Real>* p = data + (base | on);
+        std::complex<Real>* q = data + (base | off);
+#pragma omp simd
+        for (std::size_t j = 0; j < run; ++j) {
+            std::complex<Real> tmp = p[j];
+            p[j] = q[j];
+            q[j] = tmp;
+        }
+    }
+}
+
+template<typename Real>
+static void apply_cnot_cpu(StateVector<Real>& st,
+                           std::size_t control, std::size_t target) {
+    if (control == target) return;
+    std::array<std::size_t, 2> fixed{std::min(control, target),
+                                     std::max(control, target)};
+    std::size_t cbit = 1ULL << control;
+    swap_pairs_cpu(st, fixed, cbit, cbit | (1ULL << target));
+}
+
+template<typename Real>
+static void apply_swap_cpu(StateVector<Real>& st,
+                           std::size_t q1, std::size_t q2) {
+    if (q1 == q2) return;
+    std::array<std::size_t, 2> fixed{std::min(q1, q2), std::max(q1, q2)};
+    swap_pairs_cpu(st, fixed, 1ULL << q1, 1ULL << q2);
+}
+
+template<typename Real>
+static void apply_ccnot_cpu(StateVector<Real>& st,
+                            std::size_t c1, std::size_t c2, std::size_t target) {
+    if (c1 == c2 || c1 == target || c2 == target) return;
+    std::array<std::size_t, 3> fixed{c1, c2, target};
+    std::sort(fixed.begin(), fixed.end());
+    std::size_t cbits = (1ULL << c1) | (1ULL << c2);
+    swap_pairs_cpu(st, fixed, cbits, cbits | (1ULL << target));
+}
+
+// Multiply every amplitude whose `fixed` bits are all set by `phase`. Only
+// the affected quarter/half of the state is read, one contiguous run at a time.
+template<typename Real, std::size_t N>
+static void apply_phase_cpu(StateVector<Real>& st,
+                            const std::array<std::size_t, N>& fixed,
+                            std::complex<Real> phase) {
+    if ((st.size() >> fixed[N - 1]) < 2) return;
+    std::size_t mask = 0;
+    for (std::size_t pos : fixed) mask |= 1ULL << pos;
+    const std::size_t run = std::size_t(1) << fixed[0];
+    const std::size_t blocks = (st.size() >> N) / run;
+    std::complex<Real>* data = st.data();
+#pragma omp parallel for schedule(static)
+    for (std::size_t b = 0; b < blocks; ++b) {
+        std::size_t base = b * run;
+        for (std::size_t pos : fixed) base = insert_zero_bit(base, pos);
+        std::complex<Real>* p = data + (base | mask);
+#pragma omp simd
+        for (std::size_t j = 0; j < run; ++j) p[j] *= phase;
+    }
+}
+
+// diag(d0, d1) on `target` in a single streaming pass.
+template<typename Real>
+static void apply_diagonal_1q_cpu(StateVector<Real>& st,
+                                  std::size_t target,
+                                  std::complex<Real> d0, std::complex<Real> d1,
+                                  const Collapse* c = nullptr) {
+    std::size_t step = 1ULL << target;
+    if (st.size() < 2 * step) return;
+    if (c) {
+#pragma omp parallel for schedule(static)
+        for (std::size_t i = 0; i < st.size(); i += 2 * step) {
+            for (std::size_t j = 0; j < step; ++j) {
+                st[i + j] = collapsed(st[i + j], i + j, *c) * d0;
+                st[i + j + step] = collapsed(st[i + j + step], i + j + step, *c) * d1;
+            }
+        }
+        return;
+    }
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < st.size(); i += 2 * step) {
+#pragma omp simd
+        for (std::size_t j = 0; j < step; ++j) {
+            st[i + j] *= d0;
+            st[i + j + step] *= d1;
+        }
+    }
+}
+
+// Lookup tables are limited to this many qubits so they stay in L1.
+constexpr std::size_t kDiagonalTableQubits = 10;
+
+// Diagonal gates multiplied together over the bits of `qubits`.
+template<typename Real>
+struct PhaseTable {
+    std::vector<std::size_t> qubits;
+    std::vector<std::complex<Real>> phases{Real(1.0)};
+};
+
+// Multiply a run of diagonal gates together into phase tables indexed by the
+// bits of the qubits they touch, starting a new table whenever the current
+// one would outgrow kDiagonalTableQubits.
+template<typename Real>
+static std::vector<PhaseTable<Real>> phase_tables(const std::vector<DiagonalGate<Real>>& gates) {
+    std::vector<PhaseTable<Real>> tables;
+    for (const auto& g : gates) {
+        if (g.phases.size() != (std::size_t(1) << g.qubits.size())) continue;
+        std::size_t extra = 0;
+        if (!tables.empty()) {
+            for (auto q : g.qubits)
+                if (std::find(tables.back().qubits.begin(), tables.back().qubits.end(), q) ==
+                    tables.back().qubits.end())
+                    ++extra;
+        }
+        if (tables.empty() ||
+            tables.back().qubits.size() + extra > kDiagonalTableQubits)
+            tables.emplace_back();
+        PhaseTable<Real>& t = tables.back();
+        std::vector<std::size_t> local(g.qubits.size());
+        for (std::size_t j = 0; j < g.qubits.size(); ++j) {
+            auto it = std::find(t.qubits.begin(), t.qubits.end(), g.qubits[j]);
+            if (it == t.qubits.end()) {
+                t.qubits.push_back(g.qubits[j]);
+                std::size_t half = t.phases.size();
+                t.phases.resize(2 * half);
+                std::copy(t.phases.begin(), t.phases.begin() + half, t.phases.begin() + half);
+                it = t.qubits.end() - 1;
+            }
+            local[j] = static_cast<std::size_t>(it - t.qubits.begin());
+        }
+        for (std::size_t e = 0; e < t.phases.size(); ++e) {
+            std::size_t gi = 0;
+            for (std::size_t j = 0; j < local.size(); ++j)
+                gi |= ((e >> local[j]) & 1ULL) << j;
+            t.phases[e] *= g.phases[gi];
+        }
+    }
+    return tables;
+}
+
+// Combined phase the tables give amplitude `i`.
+template<typename Real>
+static inline std::complex<Real> table_phase(const std::vector<PhaseTable<Real>>& tables,
+                                             std::size_t i) {
+    std::complex<Real> ph(Real(1.0), Real(0.0));
+    for (const auto& t : tables) {
+        std::size_t idx = 0;
+        for (std::size_t j = 0; j < t.qubits.size(); ++j)
+            idx |= ((i >> t.qubits[j]) & 1ULL) << j;
+        ph *= t.phases[idx];
+    }
+    return ph;
+}
+
+// Apply a run of diagonal gates in one pass, so each amplitude is read and
+// written once no matter how many gates the run has.
+template<typename Real>
+static void apply_diagonal_block_cpu(StateVector<Real>& st,
+                                     const std::vector<DiagonalGate<Real>>& gates) {
+    const auto tables = phase_tables(gates);
+    if (tables.empty()) return;
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < st.size(); ++i) st[i] *= table_phase(tables, i);
+}
+
+// Serial form for one chunk of `count` amplitudes whose table qubits all lie
+// inside the chunk, used by cache-blocked runs.
+template<typename Real>
+static void apply_diagonal_block_cpu(std::complex<Real>* data, std::size_t count,
+                                     const std::vector<PhaseTable<Real>>& tables) {
+    for (std::size_t i = 0; i < count; ++i) data[i] *= table_phase(tables, i);
+}
+
+// Dense 2^k x 2^k gate on arbitrary qubits. Groups of amplitudes are
+// gathered through a precomputed offset table, several groups at a time when
+// the lowest target leaves contiguous runs, so the matrix-vector product in
+// the inner loop runs over unit-stride tiles.
+template<typename Real>
+struct MatrixKernel {
+    const std::complex<Real>* m{nullptr};
+    std::size_t dim{0};
+    std::size_t tile{0};
+    std::vector<std::size_t> sorted;
+    std::vector<std::size_t> offsets;
+
+    // Number of tiles covering a state of `size` amplitudes, 0 if the gate
+    // does not fit in it.
+    std::size_t blocks(std::size_t size) const {
+        if (dim == 0 || (size >> sorted.back()) < 2) return 0;
+        return (size >> sorted.size()) / tile;
+    }
+};
+
+template<typename Real>
+static MatrixKernel<Real> prepare_matrix_kernel(const std::vector<std::size_t>& qubits,
+                                                const std::vector<std::complex<Real>>& m) {
+    MatrixKernel<Real> kern;
+    const std::size_t k = qubits.size();
+    const std::size_t dim = std::size_t(1) << k;
+    if (k == 0 || m.size() != dim * dim) return kern;
+    kern.sorted = qubits;
+    std::sort(kern.sorted.begin(), kern.sorted.end());
+    if (std::adjacent_find(kern.sorted.begin(), kern.sorted.end()) != kern.sorted.end())
+        return kern;
+    kern.offsets.assign(dim, 0);
+    for (std::size_t e = 0; e < dim; ++e)
+        for (std::size_t j = 0; j < k; ++j)
+            if ((e >> j) & 1ULL) kern.offsets[e] |= std::size_t(1) << qubits[j];
+    kern.m = m.data();
+    kern.dim = dim;
+    kern.tile = std::min<std::size_t>(std::size_t(1) << kern.sorted[0], 8);
+    return kern;
+}
+
+// Apply tiles [first, last) of a prepared gate. `in` and `out` are scratch
+// buffers of dim * tile amplitudes.
+template<typename Real>
+static void run_matrix_kernel(std::complex<Real>* data, const MatrixKernel<Real>& kern,
+                              std::size_t first, std::size_t last,
+                              std::complex<Real>* in, std::complex<Real>* out) {
+    const std::size_t dim = kern.dim, tile = kern.tile;
+    for (std::size_t b = first; b < last; ++b) {
+        std::size_t base = b * tile;
+        for (std::size_t pos : kern.sorted) base = insert_zero_bit(base, pos);
+        for (std::size_t e = 0; e < dim; ++e)
+            std::copy(data + base + kern.offsets[e], data + base + kern.offsets[e] + tile,
+                      in + e * tile);
+        for (std::size_t r = 0; r < dim; ++r) {
+            std::complex<Real>* o = out + r * tile;
+            std::fill(o, o + tile, std::complex<Real>(0, 0));
+            for (std::size_t c = 0; c < dim; ++c) {
+                const std::complex<Real> mrc = kern.m[r * dim + c];
+                const std::complex<Real>* v = in + c * tile;
+#pragma omp simd
+                for (std::size_t j = 0; j < tile; ++j) o[j] += mrc * v[j];
+            }
+        }
+        for (std::size_t e = 0; e < dim; ++e)
+            std::copy(out + e * tile, out + (e + 1) * tile, data + base + kern.offsets[e]);
+    }
+}
+
+template<typename Real>
+static void apply_matrix_k_cpu(StateVector<Real>& st,
+                               const std::vector<std::size_t>& qubits,
+                               const std::vector<std::complex<Real>>& m) {
+    auto kern = prepare_matrix_kernel(qubits, m);
+    const std::size_t blocks = kern.blocks(st.size());
+    if (blocks == 0) return;
+    std::complex<Real>* data = st.data();
+#pragma omp parallel
+    {
+        std::vector<std::complex<Real>> in(kern.dim * kern.tile), out(kern.dim * kern.tile);
+#pragma omp for schedule(static)
+        for (std::size_t b = 0; b < blocks; ++b)
+            run_matrix_kernel(data, kern, b, b + 1, in.data(), out.data());
+    }
+}
+
+// Apply one gate of a blocked run on its own: diagonal entries go through
+// the phase tables, the rest through the dense kernel. Gates on qubits
+// outside the state are skipped.
+template<typename Real>
+static void apply_gate_cpu(StateVector<Real>& st, const GateMatrix<Real>& g) {
+    if (!g.matrix.empty()) {
+        apply_matrix_k_cpu(st, g.qubits, g.matrix);
+        return;
+    }
+    for (auto q : g.qubits)
+        if ((st.size() >> q) < 2) return;
+    apply_diagonal_block_cpu(st, std::vector<DiagonalGate<Real>>{{g.qubits, g.phases}});
+}
+
+// Apply a run of gates whose qubits all lie below `block_qubits` one
+// cache-sized chunk at a time: every gate in the run is applied to a chunk of
+// 2^block_qubits amplitudes before moving on, and chunks run in parallel, so
+// the state streams through DRAM once per run instead of once per gate.
+// Consecutive diagonal gates share one set of phase tables and never go
+// through the dense kernel.
+template<typename Real>
+static void apply_blocked_cpu(StateVector<Real>& st,
+                              const std::vector<GateMatrix<Real>>& gates,
+                              std::size_t block_qubits) {
+    const std::size_t chunk = std::size_t(1) << block_qubits;
+    struct Step {
+        MatrixKernel<Real> kern;
+        std::vector<PhaseTable<Real>> tables;
+    };
+    std::vector<Step> steps;
+    std::vector<DiagonalGate<Real>> diagonal;
+    auto flush_diagonal = [&]() {
+        if (diagonal.empty()) return;
+        steps.push_back({MatrixKernel<Real>{}, phase_tables(diagonal)});
+        diagonal.clear();
+    };
+    std::size_t scratch = 0;
+    for (const auto& g : gates) {
+        if (g.matrix.empty()) {
+            diagonal.push_back({g.qubits, g.phases});
+            continue;
+        }
+        flush_diagonal();
+        steps.push_back({prepare_matrix_kernel(g.qubits, g.matrix), {}});
+        scratch = std::max(scratch, steps.back().kern.dim * steps.back().kern.tile);
+    }
+    flush_diagonal();
+    const std::size_t chunks = st.size() / chunk;
+    std::complex<Real>* data = st.data();
+#pragma omp parallel
+    {
+        std::vector<std::complex<Real>> in(scratch), out(scratch);
+#pragma omp for schedule(static)
+        for (std::size_t c = 0; c < chunks; ++c) {
+            std::complex<Real>* base = data + c * chunk;
+            for (const auto& step : steps) {
+                if (!step.tables.empty())
+                    apply_diagonal_block_cpu(base, chunk, step.tables);
+                else
+                    run_matrix_kernel(base, step.kern, 0, step.kern.blocks(chunk), in.data(),
+                                      out.data());
+            }
+        }
+    }
+}
 
 template<typename Real>
 void Wavefunction<Real>::apply_h(std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_h(local[qubit]);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     const Real f = Real(1.0) / std::sqrt(Real(2.0));
     const std::complex<Real> mat[2][2] = {{f, f}, {f, -f}};
+    if (route_sparse()) {
+        sparse_state.apply_h(qubit);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().single_qubit(soa_re.data(), soa_im.data(), soa_re.size(), qubit, mat);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_x(std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_x(local[qubit]);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     const std::complex<Real> mat[2][2] = {{0, 1}, {1, 0}};
+    if (route_sparse()) {
+        sparse_state.apply_x(qubit);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().single_qubit(soa_re.data(), soa_im.data(), soa_re.size(), qubit, mat);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_y(std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_y(local[qubit]);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     const std::complex<Real> mat[2][2] = {
         {Real(0.0), std::complex<Real>(0, -1)},
         {std::complex<Real>(0, 1), Real(0.0)}
     };
+    if (route_sparse()) {
+        sparse_state.apply_y(qubit);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().single_qubit(soa_re.data(), soa_im.data(), soa_re.size(), qubit, mat);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_z(std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 1ULL << qubit, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_z(local[qubit]);
+        });
+        return;
+    }
+    apply_collapse();
+    qubit = physical_qubit(qubit);
     const std::complex<Real> mat[2][2] = {{1, 0}, {0, -1}};
+    if (route_sparse()) {
+        sparse_state.apply_z(qubit);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().phase(soa_re.data(), soa_im.data(), soa_re.size(), 1ULL << qubit, mat[1][1]);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        apply_phase_cpu(state, std::array<std::size_t, 1>{qubit}, mat[1][1]);
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        apply_phase_cpu(state, std::array<std::size_t, 1>{qubit}, mat[1][1]);
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_s(std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 1ULL << qubit, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_s(local[qubit]);
+        });
+        return;
+    }
+    apply_collapse();
+    qubit = physical_qubit(qubit);
     const std::complex<Real> mat[2][2] = {
         {1, 0},
         {0, std::complex<Real>(0, 1)}
     };
+    if (route_sparse()) {
+        sparse_state.apply_s(qubit);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().phase(soa_re.data(), soa_im.data(), soa_re.size(), 1ULL << qubit, mat[1][1]);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        apply_phase_cpu(state, std::array<std::size_t, 1>{qubit}, mat[1][1]);
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        apply_phase_cpu(state, std::array<std::size_t, 1>{qubit}, mat[1][1]);
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_t(std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 1ULL << qubit, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_t(local[qubit]);
+        });
+        return;
+    }
+    apply_collapse();
+    qubit = physical_qubit(qubit);
     const std::complex<Real> mat[2][2] = {
         {1, 0},
         {0, std::exp(std::complex<Real>(0, M_PI / 4))}
     };
+    if (route_sparse()) {
+        sparse_state.apply_t(qubit);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().phase(soa_re.data(), soa_im.data(), soa_re.size(), 1ULL << qubit, mat[1][1]);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        apply_phase_cpu(state, std::array<std::size_t, 1>{qubit}, mat[1][1]);
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        apply_phase_cpu(state, std::array<std::size_t, 1>{qubit}, mat[1][1]);
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_rx(std::size_t qubit, Real theta) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_rx(local[qubit], theta);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     Real c = std::cos(theta / Real(2.0));
     Real s = std::sin(theta / Real(2.0));
     const std::complex<Real> mat[2][2] = {
         {c, std::complex<Real>(0, -s)},
         {std::complex<Real>(0, -s), c}
     };
+    if (route_sparse()) {
+        sparse_state.apply_rx(qubit, theta);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().single_qubit(soa_re.data(), soa_im.data(), soa_re.size(), qubit, mat);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_ry(std::size_t qubit, Real theta) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_ry(local[qubit], theta);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     Real c = std::cos(theta / Real(2.0));
     Real s = std::sin(theta / Real(2.0));
     const std::complex<Real> mat[2][2] = {
         {c, -s},
         {s,  c}
     };
+    if (route_sparse()) {
+        sparse_state.apply_ry(qubit, theta);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().single_qubit(soa_re.data(), soa_im.data(), soa_re.size(), qubit, mat);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, mat, take_collapse(*this, c));
     }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_rz(std::size_t qubit, Real theta) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_rz(local[qubit], theta);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     std::complex<Real> e_pos = std::exp(std::complex<Real>(0, theta / Real(2.0)));
     std::complex<Real> e_neg = std::exp(std::complex<Real>(0, -theta / Real(2.0)));
-    const std::complex<Real> mat[2][2] = {
-        {e_neg, 0},
-        {0, e_pos}
-    };
+    if (route_sparse()) {
+        sparse_state.apply_rz(qubit, theta);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().diagonal_1q(soa_re.data(), soa_im.data(), soa_re.size(), qubit, e_neg, e_pos);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
+        apply_collapse();
+        const std::complex<Real> mat[2][2] = {
+            {e_neg, 0},
+            {0, e_pos}
+        };
         gpu_apply_single_qubit_gate(state, qubit, mat);
 #else
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_diagonal_1q_cpu(state, qubit, e_neg, e_pos, take_collapse(*this, c));
 #endif
     } else {
-        apply_single_qubit_gate_cpu(state, qubit, mat);
+        Collapse c;
+        apply_diagonal_1q_cpu(state, qubit, e_neg, e_pos, take_collapse(*this, c));
     }
 }
 
@@ -239,6 +1148,13 @@ static Mat2<Real> gate_matrix(const std::string& g) {
 template<typename Real>
 void Wavefunction<Real>::apply_fused(const std::vector<std::string>& gates,
                                      std::size_t qubit) {
+    if (disk_backed) {
+        page_pass({qubit}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_fused(gates, local[qubit]);
+        });
+        return;
+    }
+    qubit = physical_qubit(qubit);
     if (gates.empty()) return;
     static std::unordered_map<std::string, Mat2<Real>> cache;
     std::string key;
@@ -257,168 +1173,691 @@ void Wavefunction<Real>::apply_fused(const std::vector<std::string>& gates,
         }
         cache.emplace(key, fused);
     }
-    apply_single_qubit_gate_cpu(state, qubit, fused.v);
+    if (route_sparse()) {
+        sparse_state.apply_controlled(0, qubit, fused.v);
+        return;
+    }
+    if (is_soa)
+        soa_kernels<Real>().single_qubit(soa_re.data(), soa_im.data(), soa_re.size(), qubit, fused.v);
+    else {
+        Collapse c;
+        apply_single_qubit_gate_cpu(state, qubit, fused.v, take_collapse(*this, c));
+    }
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_swap(std::size_t q1, std::size_t q2) {
-    if (q1 == q2) return;
-    std::size_t bit1 = 1ULL << q1;
-    std::size_t bit2 = 1ULL << q2;
-#pragma omp parallel for schedule(static)
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        bool b1 = i & bit1;
-        bool b2 = i & bit2;
-        if (b1 != b2) {
-            std::size_t j = (i ^ bit1 ^ bit2);
-            if (i < j) std::swap(state[i], state[j]);
-        }
+    if (disk_backed) {
+        page_pass({q1, q2}, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            chunk.apply_swap(local[q1], local[q2]);
+        });
+        return;
     }
+    apply_collapse();
+    q1 = physical_qubit(q1);
+    q2 = physical_qubit(q2);
+    if (route_sparse()) {
+        sparse_state.apply_swap(q1, q2);
+        return;
+    }
+    if (is_soa) {
+        if (q1 == q2) return;
+        std::size_t a = 1ULL << q1, b = 1ULL << q2;
+        soa_kernels<Real>().swap_pairs(soa_re.data(), soa_im.data(), soa_re.size(), a | b, a, b);
+        return;
+    }
+    apply_swap_cpu(state, q1, q2);
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_cnot(std::size_t control, std::size_t target) {
+    if (disk_backed) {
+        if (control == target) return;
+        page_pass({control, target}, 1ULL << control,
+                  [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+                      chunk.apply_cnot(local[control], local[target]);
+                  });
+        return;
+    }
+    apply_collapse();
+    control = physical_qubit(control);
+    target = physical_qubit(target);
+    if (route_sparse()) {
+        sparse_state.apply_cnot(control, target);
+        return;
+    }
+    if (is_soa) {
+        if (control == target) return;
+        std::size_t cbit = 1ULL << control, both = cbit | (1ULL << target);
+        soa_kernels<Real>().swap_pairs(soa_re.data(), soa_im.data(), soa_re.size(), both, cbit, both);
+        return;
+    }
     if (current_device() == DeviceType::GPU && gpu_supported()) {
 #ifdef USE_CUDA
         gpu_apply_cnot(state, control, target);
 #else
-        std::size_t cbit = 1ULL << control;
-        std::size_t tbit = 1ULL << target;
-        for (std::size_t i = 0; i < state.size(); ++i) {
-            if ((i & cbit) && !(i & tbit)) {
-                std::size_t j = i | tbit;
-                std::swap(state[i], state[j]);
-            }
-        }
+        apply_cnot_cpu(state, control, target);
 #endif
     } else {
-        std::size_t cbit = 1ULL << control;
-        std::size_t tbit = 1ULL << target;
-        for (std::size_t i = 0; i < state.size(); ++i) {
-            if ((i & cbit) && !(i & tbit)) {
-                std::size_t j = i | tbit;
-                std::swap(state[i], state[j]);
+        apply_cnot_cpu(state, control, target);
+    }
+}
+
+template<typename Real>
+void Wavefunction<Real>::apply_cz(std::size_t control, std::size_t target) {
+    if (disk_backed) {
+        if (control == target) return;
+        page_pass({control, target}, (1ULL << control) | (1ULL << target),
+                  [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+                      chunk.apply_cz(local[control], local[target]);
+                  });
+        return;
+    }
+    apply_collapse();
+    control = physical_qubit(control);
+    target = physical_qubit(target);
+    if (control == target) return;
+    if (route_sparse()) {
+        sparse_state.apply_cz(control, target);
+        return;
+    }
+    if (is_soa) {
+        soa_kernels<Real>().phase(soa_re.data(), soa_im.data(), soa_re.size(),
+                                  (1ULL << control) | (1ULL << target), std::complex<Real>(-1.0, 0.0));
+        return;
+    }
+    std::array<std::size_t, 2> fixed{std::min(control, target),
+                                     std::max(control, target)};
+    apply_phase_cpu(state, fixed, std::complex<Real>(-1.0, 0.0));
+}
+
+template<typename Real>
+void Wavefunction<Real>::apply_matrix_k(const std::vector<std::size_t>& qubits,
+                                        const std::vector<std::complex<Real>>& matrix) {
+    if (disk_backed) {
+        page_pass(qubits, 0, [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+            std::vector<std::size_t> mapped(qubits.size());
+            for (std::size_t j = 0; j < qubits.size(); ++j)
+                mapped[j] = qubits[j] < num_qubits ? local[qubits[j]] : chunk.num_qubits;
+            chunk.apply_matrix_k(mapped, matrix);
+        });
+        return;
+    }
+    apply_collapse();
+    to_aos();
+    decompress();
+    if (layout.empty()) {
+        apply_matrix_k_cpu(state, qubits, matrix);
+        return;
+    }
+    std::vector<std::size_t> phys(qubits.size());
+    for (std::size_t j = 0; j < qubits.size(); ++j) phys[j] = physical_qubit(qubits[j]);
+    apply_matrix_k_cpu(state, phys, matrix);
+}
+
+template<typename Real>
+void Wavefunction<Real>::apply_blocked(const std::vector<GateMatrix<Real>>& gates,
+                                       std::size_t block_qubits) {
+    if (disk_backed) {
+        run_phases(gates);
+        return;
+    }
+    apply_collapse();
+    to_aos();
+    decompress();
+    if (block_qubits == 0) block_qubits = cache_block_qubits<Real>();
+    const std::size_t chunk = std::size_t(1) << block_qubits;
+    // A run that keeps returning to high qubits but touches no more qubits
+    // than fit in a chunk is cheaper to move into the chunk once than to
+    // sweep at a large stride for every gate.
+    if (runtime_config.qubit_remap && state.size() > chunk) {
+        std::vector<std::size_t> used;
+        std::size_t high = 0;
+        for (const auto& g : gates) {
+            bool reaches = false;
+            for (auto q : g.qubits) {
+                if (physical_qubit(q) >= block_qubits) reaches = true;
+                if (std::find(used.begin(), used.end(), q) == used.end()) used.push_back(q);
             }
+            high += reaches;
         }
+        if (high >= 2 && used.size() <= block_qubits) localize(used, block_qubits);
     }
+    // Chunking only pays off when the state spans several chunks; gates that
+    // reach above the chunk are applied on their own, splitting the run.
+    std::vector<GateMatrix<Real>> run;
+    auto flush = [&]() {
+        if (run.size() > 1 && state.size() > chunk) {
+            apply_blocked_cpu(state, run, block_qubits);
+        } else {
+            for (const auto& g : run) apply_gate_cpu(state, g);
+        }
+        run.clear();
+    };
+    for (auto g : gates) {
+        bool low = !g.qubits.empty();
+        for (auto& q : g.qubits) {
+            q = physical_qubit(q);
+            if (q >= block_qubits) low = false;
+        }
+        if (low) {
+            run.push_back(g);
+        } else {
+            flush();
+            apply_gate_cpu(state, g);
+        }
+    }
+    flush();
 }
 
 template<typename Real>
-void Wavefunction<Real>::apply_cz(std::size_t control, std::size_t target) {
-    std::size_t cbit = 1ULL << control;
-    std::size_t tbit = 1ULL << target;
+void Wavefunction<Real>::apply_diagonal(const std::vector<DiagonalGate<Real>>& logical) {
+    if (disk_backed) {
+        // The phases only depend on the index, so the whole run is one sweep
+        // over the pages however high its qubits reach.
+        std::vector<DiagonalGate<Real>> gates = logical;
+        std::vector<OutcomeExtractor> bits;
+        for (auto& g : gates) {
+            for (auto& q : g.qubits) q = physical_qubit(q);
+            bits.emplace_back(g.qubits);
+        }
+        Collapse c;
+        const Collapse* pending = take_collapse(*this, c);
+        const std::size_t page = pager->page_elems();
+        for (std::size_t p = 0; p < pager->page_count(); ++p) {
+            for (std::size_t k = 1; k <= kPrefetchPages; ++k) pager->prefetch(p + k);
+            if (pager->known_zero(p)) continue;
+            std::complex<double>* data = pager->acquire(p, true);
+            const std::size_t first = p * page;
 #pragma omp parallel for schedule(static)
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        if ((i & cbit) && (i & tbit)) {
-            state[i] = -state[i];
+            for (std::size_t i = 0; i < page; ++i) {
+                std::complex<Real> a(data[i]);
+                if (pending) a = collapsed(a, first + i, *pending);
+                for (std::size_t k = 0; k < gates.size(); ++k)
+                    if (bits[k](first + i) < gates[k].phases.size())
+                        a *= gates[k].phases[bits[k](first + i)];
+                data[i] = std::complex<double>(a);
+            }
+            pager->release(p);
+            pager->write_behind(p);
         }
+        return;
     }
+    apply_collapse();
+    std::vector<DiagonalGate<Real>> mapped;
+    if (!layout.empty()) {
+        mapped = logical;
+        for (auto& g : mapped)
+            for (auto& q : g.qubits) q = physical_qubit(q);
+    }
+    const auto& gates = layout.empty() ? logical : mapped;
+    if (route_sparse()) {
+        for (const auto& g : gates) sparse_state.apply_diagonal(g.qubits, g.phases);
+        return;
+    }
+    if (is_soa) {
+        // Runs built by fuse_diagonal_runs only hold single-qubit diagonals
+        // and controlled phases, both of which have SoA kernels.
+        bool fits = true;
+        for (const auto& g : gates) {
+            bool controlled = g.phases.size() == (std::size_t(1) << g.qubits.size());
+            for (std::size_t e = 0; controlled && e + 1 < g.phases.size(); ++e)
+                controlled = g.phases[e] == std::complex<Real>(Real(1.0), Real(0.0));
+            fits = fits && (g.qubits.size() == 1 || controlled) && g.phases.size() >= 2;
+        }
+        if (fits) {
+            const auto& k = soa_kernels<Real>();
+            for (const auto& g : gates) {
+                if (g.qubits.size() == 1) {
+                    k.diagonal_1q(soa_re.data(), soa_im.data(), soa_re.size(), g.qubits[0],
+                                  g.phases[0], g.phases[1]);
+                    continue;
+                }
+                std::size_t mask = 0;
+                for (auto q : g.qubits) mask |= 1ULL << q;
+                k.phase(soa_re.data(), soa_im.data(), soa_re.size(), mask, g.phases.back());
+            }
+            return;
+        }
+        to_aos();
+    }
+    if (gates.size() == 1 && gates[0].qubits.size() == 1 && gates[0].phases.size() == 2) {
+        apply_diagonal_1q_cpu(state, gates[0].qubits[0], gates[0].phases[0], gates[0].phases[1]);
+        return;
+    }
+    apply_diagonal_block_cpu(state, gates);
 }
 
 template<typename Real>
 void Wavefunction<Real>::apply_ccnot(std::size_t c1, std::size_t c2, std::size_t target) {
-    std::size_t b1 = 1ULL << c1;
-    std::size_t b2 = 1ULL << c2;
-    std::size_t tbit = 1ULL << target;
-#pragma omp parallel for schedule(static)
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        if ((i & b1) && (i & b2) && !(i & tbit)) {
-            std::size_t j = i | tbit;
-            std::swap(state[i], state[j]);
+    if (disk_backed) {
+        if (c1 == c2 || c1 == target || c2 == target) return;
+        page_pass({c1, c2, target}, (1ULL << c1) | (1ULL << c2),
+                  [&](Wavefunction& chunk, const std::vector<std::size_t>& local) {
+                      chunk.apply_ccnot(local[c1], local[c2], local[target]);
+                  });
+        return;
+    }
+    apply_collapse();
+    c1 = physical_qubit(c1);
+    c2 = physical_qubit(c2);
+    target = physical_qubit(target);
+    if (route_sparse()) {
+        sparse_state.apply_ccnot(c1, c2, target);
+        return;
+    }
+    if (is_soa) {
+        if (c1 == c2 || c1 == target || c2 == target) return;
+        std::size_t cbits = (1ULL << c1) | (1ULL << c2), all = cbits | (1ULL << target);
+        soa_kernels<Real>().swap_pairs(soa_re.data(), soa_im.data(), soa_re.size(), all, cbits, all);
+        return;
+    }
+    apply_ccnot_cpu(state, c1, c2, target);
+}
+
+// Probability of every outcome in one pass. Each thread accumulates into its
+// own row of bins padded to whole cache lines, so there is no false sharing
+// and no critical section; the rows are summed afterwards.
+template<typename Weight>
+static std::vector<double> outcome_probabilities(std::size_t size, Weight weight,
+                                                 const OutcomeExtractor& outcome_of,
+                                                 std::size_t outcomes,
+                                                 const Collapse* c) {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    const std::size_t stride = (outcomes + 7) / 8 * 8;
+    std::vector<double, AlignedAllocator<double>> rows(stride * threads, 0.0);
+    const double scale = c ? 1.0 / (c->norm * c->norm) : 1.0;
+#pragma omp parallel
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        double* row = rows.data() + stride * tid;
+#pragma omp for schedule(static)
+        for (std::size_t i = 0; i < size; ++i) {
+            if (c && (i & c->mask) != c->value) continue;
+            row[outcome_of(i)] += weight(i);
         }
     }
+    std::vector<double> probs(outcomes, 0.0);
+    for (int t = 0; t < threads; ++t)
+        for (std::size_t o = 0; o < outcomes; ++o) probs[o] += rows[stride * t + o] * scale;
+    return probs;
+}
+
+// outcome_probabilities for a disk-backed state, one page at a time.
+template<typename Real>
+static std::vector<double> disk_outcome_probabilities(const Wavefunction<Real>& wf,
+                                                      const OutcomeExtractor& outcome_of,
+                                                      std::size_t outcomes) {
+    std::vector<double> probs(outcomes, 0.0);
+    const bool pending = wf.collapse_pending;
+    scan_pages(wf, [&](const std::complex<double>* data, std::size_t first, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (pending && ((first + i) & wf.collapse_mask) != wf.collapse_value) continue;
+            probs[outcome_of(first + i)] += std::norm(data[i]);
+        }
+    });
+    if (pending)
+        for (auto& p : probs) p /= wf.collapse_norm * wf.collapse_norm;
+    return probs;
 }
 
+// Past this many outcomes the tables above cost more memory than they save
+// (2^30 outcomes would be 8 GiB a thread), so measure() and sample() draw
+// state indices instead and map each to its outcome.
+constexpr std::size_t kMaxOutcomeTable = std::size_t(1) << 16;
+
+// `shots` uniform draws below `total`, sorted.
+static std::vector<double> sorted_draws(double total, std::size_t shots) {
+    std::vector<double> draws(shots);
+    std::uniform_real_distribution<double> dist(0.0, total);
+    auto& rng = global_rng();
+    const double top = std::nextafter(total, 0.0);
+    for (auto& r : draws) r = std::min(dist(rng), top);
+    std::sort(draws.begin(), draws.end());
+    return draws;
+}
+
+// Draw `shots` indices with probability weight(i) in two passes and no
+// per-outcome storage. The first sums each thread's block of indices; the
+// sorted draws then fall into blocks, and each thread walks its block again
+// to find the index every one of its draws lands on.
+template<typename Weight>
+static std::vector<std::size_t> draw_indices(std::size_t size, Weight weight, std::size_t shots,
+                                             const Collapse* c) {
+    std::size_t blocks = 1;
+#ifdef _OPENMP
+    blocks = std::max<std::size_t>(1, std::min<std::size_t>(omp_get_max_threads(), size));
+#endif
+    const std::size_t span = (size + blocks - 1) / blocks;
+    auto counted = [c](std::size_t i) { return !c || (i & c->mask) == c->value; };
+    std::vector<double> start(blocks + 1, 0.0);
+#pragma omp parallel for schedule(static, 1)
+    for (std::size_t b = 0; b < blocks; ++b) {
+        double sum = 0.0;
+        for (std::size_t i = b * span; i < std::min(size, (b + 1) * span); ++i)
+            if (counted(i)) sum += weight(i);
+        start[b + 1] = sum;
+    }
+    std::partial_sum(start.begin(), start.end(), start.begin());
+    std::vector<std::size_t> drawn;
+    if (start.back() <= 0.0) return drawn;
+    const std::vector<double> draws = sorted_draws(start.back(), shots);
+    drawn.resize(shots);
+#pragma omp parallel for schedule(static, 1)
+    for (std::size_t b = 0; b < blocks; ++b) {
+        std::size_t d = std::lower_bound(draws.begin(), draws.end(), start[b]) - draws.begin();
+        const std::size_t last =
+            std::lower_bound(draws.begin(), draws.end(), start[b + 1]) - draws.begin();
+        double sum = start[b];
+        std::size_t hit = b * span;
+        for (std::size_t i = b * span; i < std::min(size, (b + 1) * span) && d < last; ++i) {
+            const double w = counted(i) ? weight(i) : 0.0;
+            if (w == 0.0) continue;
+            sum += w;
+            hit = i;
+            while (d < last && draws[d] < sum) drawn[d++] = i;
+        }
+        // Rounding can leave the running sum just short of the block's end.
+        while (d < last) drawn[d++] = hit;
+    }
+    return drawn;
+}
+
+// Probability of one outcome, in a pass that keeps a single sum.
+template<typename Weight>
+static double outcome_probability(std::size_t size, Weight weight,
+                                  const OutcomeExtractor& outcome_of, std::size_t outcome,
+                                  const Collapse* c) {
+    double p = 0.0;
+#pragma omp parallel for reduction(+:p) schedule(static)
+    for (std::size_t i = 0; i < size; ++i)
+        if ((!c || (i & c->mask) == c->value) && outcome_of(i) == outcome) p += weight(i);
+    return c ? p / (c->norm * c->norm) : p;
+}
+
+// draw_indices and outcome_probability for a disk-backed state, one page at
+// a time.
+template<typename Real>
+static std::vector<std::size_t> disk_draw_indices(const Wavefunction<Real>& wf,
+                                                  std::size_t shots) {
+    const bool pending = wf.collapse_pending;
+    auto counted = [&](std::size_t i) {
+        return !pending || (i & wf.collapse_mask) == wf.collapse_value;
+    };
+    double total = 0.0;
+    scan_pages(wf, [&](const std::complex<double>* data, std::size_t first, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i)
+            if (counted(first + i)) total += std::norm(data[i]);
+    });
+    std::vector<std::size_t> drawn;
+    if (total <= 0.0) return drawn;
+    const std::vector<double> draws = sorted_draws(total, shots);
+    drawn.resize(shots);
+    std::size_t d = 0, hit = 0;
+    double sum = 0.0;
+    scan_pages(wf, [&](const std::complex<double>* data, std::size_t first, std::size_t count) {
+        for (std::size_t i = 0; i < count && d < shots; ++i) {
+            const double w = counted(first + i) ? std::norm(data[i]) : 0.0;
+            if (w == 0.0) continue;
+            sum += w;
+            hit = first + i;
+            while (d < shots && draws[d] < sum) drawn[d++] = hit;
+        }
+    });
+    while (d < shots) drawn[d++] = hit;
+    return drawn;
+}
+
+template<typename Real>
+static double disk_outcome_probability(const Wavefunction<Real>& wf,
+                                       const OutcomeExtractor& outcome_of, std::size_t outcome) {
+    const bool pending = wf.collapse_pending;
+    double p = 0.0;
+    scan_pages(wf, [&](const std::complex<double>* data, std::size_t first, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (pending && ((first + i) & wf.collapse_mask) != wf.collapse_value) continue;
+            if (outcome_of(first + i) == outcome) p += std::norm(data[i]);
+        }
+    });
+    return pending ? p / (wf.collapse_norm * wf.collapse_norm) : p;
+}
 
 template<typename Real>
 int Wavefunction<Real>::measure(std::size_t qubit) {
-    std::size_t bit = 1ULL << qubit;
-    double p1 = 0.0;
+    if (is_sparse) return sparse_state.measure(physical_qubit(qubit));
+    if (is_soa) {
+        qubit = physical_qubit(qubit);
+        std::size_t bit = 1ULL << qubit;
+        Real* re = soa_re.data();
+        Real* im = soa_im.data();
+        const std::size_t n = soa_re.size();
+        double p1 = 0.0;
 #pragma omp parallel for reduction(+:p1) schedule(static)
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        if (i & bit)
-            p1 += std::norm(state[i]);
-    }
-    std::bernoulli_distribution dist(p1);
-    int result = dist(global_rng());
-    double norm_factor = std::sqrt(result ? p1 : 1.0 - p1);
+        for (std::size_t i = 0; i < n; ++i)
+            if (i & bit) p1 += double(re[i]) * re[i] + double(im[i]) * im[i];
+        std::bernoulli_distribution dist(p1);
+        int result = dist(global_rng());
+        Real norm_factor = Real(std::sqrt(result ? p1 : 1.0 - p1));
 #pragma omp parallel for schedule(static)
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        if (((i & bit) != 0) != static_cast<bool>(result))
-            state[i] = 0;
-        else
-            state[i] /= norm_factor;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (((i & bit) != 0) != static_cast<bool>(result)) {
+                re[i] = 0;
+                im[i] = 0;
+            } else {
+                re[i] /= norm_factor;
+                im[i] /= norm_factor;
+            }
+        }
+        return result;
     }
-    return result;
+    return static_cast<int>(measure(std::vector<std::size_t>{qubit}));
 }
 
 template<typename Real>
-std::size_t Wavefunction<Real>::measure(const std::vector<std::size_t>& qubits) {
-    if (qubits.empty()) return 0;
-    decompress();
+std::size_t Wavefunction<Real>::measure(const std::vector<std::size_t>& logical) {
+    if (logical.empty()) return 0;
+    to_aos();
+    std::vector<std::size_t> qubits(logical.size());
+    for (std::size_t j = 0; j < logical.size(); ++j) qubits[j] = physical_qubit(logical[j]);
+    if (is_sparse) {
+        // A pass over the stored entries is cheap, so measure one qubit at
+        // a time; the joint distribution is the same.
+        std::size_t result = 0;
+        for (std::size_t j = 0; j < qubits.size(); ++j)
+            result |= std::size_t(sparse_state.measure(qubits[j])) << j;
+        return result;
+    }
 
-    // mask covering all measured qubits
-    std::size_t mask = 0;
-    for (auto q : qubits) mask |= 1ULL << q;
+    // Probabilities see any collapse still pending from earlier measurements.
+    Collapse pending{collapse_mask, collapse_value, collapse_norm};
+    const std::size_t outcomes = std::size_t(1) << qubits.size();
+    const OutcomeExtractor outcome_of(qubits);
+    const Collapse* c = collapse_pending ? &pending : nullptr;
+    auto weight = [this](std::size_t i) { return double(std::norm(state[i])); };
+    std::size_t result = 0;
+    double p;
+    if (outcomes > kMaxOutcomeTable) {
+        // Too many outcomes for a table: draw one index, take its outcome
+        // and sum that outcome's probability in a second pass.
+        auto drawn = disk_backed ? disk_draw_indices(*this, 1)
+                                 : draw_indices(state.size(), weight, 1, c);
+        if (!drawn.empty()) result = outcome_of(drawn[0]);
+        p = disk_backed ? disk_outcome_probability(*this, outcome_of, result)
+                        : outcome_probability(state.size(), weight, outcome_of, result, c);
+    } else {
+        auto probs = disk_backed
+            ? disk_outcome_probabilities(*this, outcome_of, outcomes)
+            : outcome_probabilities(state.size(), weight, outcome_of, outcomes, c);
+        if (qubits.size() == 1) {
+            std::bernoulli_distribution dist(probs[1]);
+            result = dist(global_rng());
+        } else {
+            std::discrete_distribution<std::size_t> dist(probs.begin(), probs.end());
+            result = dist(global_rng());
+        }
+        p = probs[result];
+    }
 
-    // compute probabilities for each measurement outcome
-    std::size_t outcomes = 1ULL << qubits.size();
-    std::vector<double> probs(outcomes, 0.0);
+    // Record the projection; with lazy collapse the next sweep over the
+    // state applies it, otherwise it is written out now.
+    for (std::size_t j = 0; j < qubits.size(); ++j) {
+        collapse_mask |= 1ULL << qubits[j];
+        if ((result >> j) & 1ULL) collapse_value |= 1ULL << qubits[j];
+    }
+    collapse_norm *= std::sqrt(p);
+    collapse_pending = true;
+    if (!runtime_config.lazy_collapse) apply_collapse();
+    return result;
+}
 
-#pragma omp parallel
-    {
-        std::vector<double> local(outcomes, 0.0);
-#pragma omp for schedule(static)
-        for (std::size_t i = 0; i < state.size(); ++i) {
-            std::size_t bits = i & mask;
-            std::size_t outcome = 0;
-            for (std::size_t j = 0; j < qubits.size(); ++j)
-                if (bits & (1ULL << qubits[j])) outcome |= 1ULL << j;
-            local[outcome] += std::norm(state[i]);
-        }
-#pragma omp critical
-        {
-            for (std::size_t o = 0; o < outcomes; ++o)
-                probs[o] += local[o];
-        }
+template<typename Real>
+void Wavefunction<Real>::apply_collapse() {
+    if (!collapse_pending) return;
+    if (disk_backed) {
+        // page_pass writes the pending collapse into every page it loads.
+        page_pass({}, 0, [](Wavefunction&, const std::vector<std::size_t>&) {});
+        return;
     }
-    std::discrete_distribution<std::size_t> dist(probs.begin(), probs.end());
-    std::size_t result = dist(global_rng());
-    double norm_factor = std::sqrt(probs[result]);
+    Collapse c;
+    take_collapse(*this, c);
 #pragma omp parallel for schedule(static)
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        std::size_t bits = i & mask;
-        std::size_t outcome = 0;
-        for (std::size_t j = 0; j < qubits.size(); ++j)
-            if (bits & (1ULL << qubits[j])) outcome |= 1ULL << j;
-        if (outcome == result)
-            state[i] /= norm_factor;
+    for (std::size_t i = 0; i < state.size(); ++i) state[i] = collapsed(state[i], i, c);
+}
+
+template<typename Real>
+std::map<std::size_t, std::size_t> Wavefunction<Real>::sample(
+    const std::vector<std::size_t>& logical, std::size_t shots) const {
+    std::map<std::size_t, std::size_t> histogram;
+    if (shots == 0) return histogram;
+    std::vector<std::size_t> qubits(logical.size());
+    for (std::size_t j = 0; j < logical.size(); ++j) qubits[j] = physical_qubit(logical[j]);
+    OutcomeExtractor outcome_of(qubits);
+    const std::size_t outcomes = std::size_t(1) << qubits.size();
+
+    // One cumulative table over the outcomes (or, for sparse states, over
+    // the stored entries) serves every shot with a binary search. Past
+    // kMaxOutcomeTable outcomes the shots are drawn over state indices.
+    const bool by_index = !is_sparse && outcomes > kMaxOutcomeTable;
+    std::vector<double> cumulative;
+    std::vector<std::size_t> entry_outcome;
+    std::vector<std::size_t> drawn;
+    if (is_sparse) {
+        cumulative.resize(sparse_state.nnz());
+        entry_outcome.resize(sparse_state.nnz());
+        for (std::size_t e = 0; e < sparse_state.nnz(); ++e) {
+            cumulative[e] = std::norm(sparse_state.amplitudes[e]);
+            entry_outcome[e] = outcome_of(sparse_state.indices[e]);
+        }
+    } else if (disk_backed) {
+        if ((pager->size() >> qubits.size()) == 0) return histogram;
+        if (by_index)
+            drawn = disk_draw_indices(*this, shots);
         else
-            state[i] = {Real(0.0), Real(0.0)};
+            cumulative = disk_outcome_probabilities(*this, outcome_of, outcomes);
+    } else {
+        const std::size_t n = is_soa ? soa_re.size() : state.size();
+        if (n == 0 || (n >> qubits.size()) == 0) return histogram;
+        Collapse pending{collapse_mask, collapse_value, collapse_norm};
+        if (is_soa) {
+            auto weight = [this](std::size_t i) {
+                return double(soa_re[i]) * soa_re[i] + double(soa_im[i]) * soa_im[i];
+            };
+            if (by_index)
+                drawn = draw_indices(n, weight, shots, nullptr);
+            else
+                cumulative = outcome_probabilities(n, weight, outcome_of, outcomes, nullptr);
+        } else {
+            auto weight = [this](std::size_t i) { return double(std::norm(state[i])); };
+            const Collapse* c = collapse_pending ? &pending : nullptr;
+            if (by_index)
+                drawn = draw_indices(n, weight, shots, c);
+            else
+                cumulative = outcome_probabilities(n, weight, outcome_of, outcomes, c);
+        }
+    }
+    if (by_index) {
+        for (std::size_t i : drawn) histogram[outcome_of(i)]++;
+        return histogram;
     }
+    std::partial_sum(cumulative.begin(), cumulative.end(), cumulative.begin());
+    if (cumulative.empty() || cumulative.back() <= 0.0) return histogram;
 
-    return result;
+    std::uniform_real_distribution<double> dist(0.0, cumulative.back());
+    auto& rng = global_rng();
+    for (std::size_t s = 0; s < shots; ++s) {
+        std::size_t pos = std::upper_bound(cumulative.begin(), cumulative.end(), dist(rng)) -
+                          cumulative.begin();
+        pos = std::min(pos, cumulative.size() - 1);
+        histogram[is_sparse ? entry_outcome[pos] : pos]++;
+    }
+    return histogram;
 }
 
 template<typename Real>
 void Wavefunction<Real>::reset() {
-    state.assign(state.size(), {Real(0.0),Real(0.0)});
+    layout.clear();
+    Collapse dropped;
+    take_collapse(*this, dropped);
+    gates_since_density_check = kDensityCheckInterval;
+    if (is_sparse) {
+        sparse_state.reset();
+        return;
+    }
+    if (disk_backed) {
+        pager->reset();
+        pager->write(0, 1.0);
+        return;
+    }
+    if (is_soa) {
+        std::fill(soa_re.begin(), soa_re.end(), Real(0.0));
+        std::fill(soa_im.begin(), soa_im.end(), Real(0.0));
+        if (!soa_re.empty()) soa_re[0] = Real(1.0);
+        return;
+    }
+    zero_state(state);
     if (!state.empty()) state[0] = Real(1.0);
 }
 
 template<typename Real>
-std::complex<Real> Wavefunction<Real>::amplitude(std::size_t index) const {
-    if (is_sparse) {
-        auto it = sparse_state.find(index);
-        if (it == sparse_state.end()) return {Real(0.0), Real(0.0)};
-        return it->second;
+std::complex<Real> Wavefunction<Real>::amplitude(std::size_t logical) const {
+    std::size_t index = logical;
+    if (!layout.empty()) {
+        index = logical >> layout.size() << layout.size();
+        for (std::size_t q = 0; q < layout.size(); ++q)
+            index |= ((logical >> q) & 1ULL) << layout[q];
+    }
+    if (is_sparse) return sparse_state.amplitude(index);
+    if (disk_backed) {
+        if (index >= pager->size()) return {Real(0.0), Real(0.0)};
+        std::complex<Real> a(pager->read(index));
+        if (collapse_pending)
+            return collapsed(a, index, Collapse{collapse_mask, collapse_value, collapse_norm});
+        return a;
+    }
+    if (is_soa) {
+        if (index >= soa_re.size()) return {Real(0.0), Real(0.0)};
+        return {soa_re[index], soa_im[index]};
     }
     if (index >= state.size()) return {Real(0.0),Real(0.0)};
+    if (collapse_pending)
+        return collapsed(state[index], index, Collapse{collapse_mask, collapse_value, collapse_norm});
     return state[index];
 }
 
 template<typename Real>
 bool Wavefunction<Real>::schmidt_low_rank(std::size_t qubit, double threshold) {
+    // Needs both halves of the state in memory at once.
+    if (disk_backed) return false;
+    apply_collapse();
+    to_aos();
+    decompress();
+    qubit = physical_qubit(qubit);
     if (qubit >= num_qubits) return false;
     std::size_t mask = 1ULL << qubit;
     std::size_t dim_rest = 1ULL << (num_qubits - 1);
@@ -477,38 +1916,152 @@ bool Wavefunction<Real>::schmidt_low_rank(std::size_t qubit, double threshold) {
     return true;
 }
 
+// Move every amplitude to the index it has under the layout `to`, given
+// the current layout `from`, in place. The permutation is applied as qubit
+// swaps, each streaming contiguous runs of the half of the state it moves,
+// so a remap needs no second state and at most one swap per qubit moved.
 template<typename Real>
-void Wavefunction<Real>::compress() {
-    if (is_sparse) return;
-    sparse_state.clear();
-    for (std::size_t i = 0; i < state.size(); ++i) {
-        if (std::norm(state[i]) > 1e-12)
-            sparse_state[i] = state[i];
+static void permute_qubits_cpu(StateVector<Real>& st,
+                               const std::vector<std::size_t>& from,
+                               const std::vector<std::size_t>& to) {
+    const std::size_t n = from.size();
+    std::vector<std::size_t> at = from;
+    std::vector<std::size_t> owner(n);
+    for (std::size_t q = 0; q < n; ++q) owner[at[q]] = q;
+    for (std::size_t q = 0; q < n; ++q) {
+        if (at[q] == to[q]) continue;
+        const std::size_t other = owner[to[q]];
+        apply_swap_cpu(st, at[q], to[q]);
+        owner[at[q]] = other;
+        owner[to[q]] = q;
+        at[other] = at[q];
+        at[q] = to[q];
+    }
+}
+
+template<typename Real>
+void Wavefunction<Real>::localize(const std::vector<std::size_t>& qubits, std::size_t window) {
+    apply_collapse();
+    to_aos();
+    if (disk_backed || is_chunk || window > num_qubits || qubits.size() > window) return;
+    std::vector<std::size_t> current(num_qubits);
+    for (std::size_t q = 0; q < num_qubits; ++q) current[q] = physical_qubit(q);
+    std::vector<std::size_t> next = current;
+    std::vector<std::size_t> owner(num_qubits);
+    for (std::size_t q = 0; q < num_qubits; ++q) owner[next[q]] = q;
+    auto wanted = [&](std::size_t q) {
+        return std::find(qubits.begin(), qubits.end(), q) != qubits.end();
+    };
+    // Evict from the top of the window so the lowest physical qubits, which
+    // give unit-stride access, keep whatever was already there.
+    std::size_t slot = window;
+    bool moved = false;
+    for (auto q : qubits) {
+        if (q >= num_qubits || next[q] < window) continue;
+        do { --slot; } while (wanted(owner[slot]));
+        std::size_t evicted = owner[slot];
+        std::swap(next[q], next[evicted]);
+        owner[next[q]] = q;
+        owner[next[evicted]] = evicted;
+        moved = true;
+    }
+    if (!moved) return;
+    if (is_sparse) {
+        sparse_state.permute(current, next);
+    } else {
+        permute_qubits_cpu(state, current, next);
+    }
+    layout = std::move(next);
+}
+
+template<typename Real>
+void Wavefunction<Real>::restore_layout() {
+    if (layout.empty()) return;
+    apply_collapse();
+    to_aos();
+    std::vector<std::size_t> identity(num_qubits);
+    for (std::size_t q = 0; q < num_qubits; ++q) identity[q] = q;
+    if (is_sparse) {
+        sparse_state.permute(layout, identity);
+    } else if (disk_backed) {
+        remap_pages(identity);
+    } else {
+        permute_qubits_cpu(state, layout, identity);
     }
-    state.clear();
+    layout.clear();
+}
+
+template<typename Real>
+void Wavefunction<Real>::compress() {
+    apply_collapse();
+    to_aos();
+    if (is_sparse || disk_backed) return;
+    sparse_state.assign_dense(state, 1e-12);
+    StateVector<Real>().swap(state);
     is_sparse = true;
 }
 
 template<typename Real>
 void Wavefunction<Real>::decompress() {
     if (!is_sparse) return;
-    state.assign(1ULL << num_qubits, {Real(0.0),Real(0.0)});
-    for (const auto& kv : sparse_state)
-        if (kv.first < state.size())
-            state[kv.first] = kv.second;
+    sparse_state.to_dense(state);
     sparse_state.clear();
     is_sparse = false;
 }
 
 template<typename Real>
 std::size_t Wavefunction<Real>::nnz() const {
-    if (is_sparse) return sparse_state.size();
+    if (is_sparse) return sparse_state.nnz();
     std::size_t count = 0;
-    for (const auto& amp : state)
-        if (std::norm(amp) > 1e-12) ++count;
+    if (disk_backed) {
+        scan_pages(*this, [&](const std::complex<double>* data, std::size_t first, std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+                if (collapse_pending && ((first + i) & collapse_mask) != collapse_value) continue;
+                if (std::norm(data[i]) > 1e-12) ++count;
+            }
+        });
+        return count;
+    }
+    if (is_soa) {
+        for (std::size_t i = 0; i < soa_re.size(); ++i)
+            if (std::norm(std::complex<Real>(soa_re[i], soa_im[i])) > 1e-12) ++count;
+        return count;
+    }
+#pragma omp parallel for reduction(+:count) schedule(static)
+    for (std::size_t i = 0; i < state.size(); ++i) {
+        if (collapse_pending && (i & collapse_mask) != collapse_value) continue;
+        if (std::norm(state[i]) > 1e-12) ++count;
+    }
     return count;
 }
 
+template<typename Real>
+void Wavefunction<Real>::to_soa() {
+    apply_collapse();
+    if (is_soa || is_sparse || disk_backed) return;
+    soa_re.resize(state.size());
+    soa_im.resize(state.size());
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < state.size(); ++i) {
+        soa_re[i] = state[i].real();
+        soa_im[i] = state[i].imag();
+    }
+    StateVector<Real>().swap(state);
+    is_soa = true;
+}
+
+template<typename Real>
+void Wavefunction<Real>::to_aos() {
+    if (!is_soa) return;
+    state.resize(soa_re.size());
+#pragma omp parallel for schedule(static)
+    for (std::size_t i = 0; i < soa_re.size(); ++i)
+        state[i] = {soa_re[i], soa_im[i]};
+    decltype(soa_re)().swap(soa_re);
+    decltype(soa_im)().swap(soa_im);
+    is_soa = false;
+}
+
 template<typename Real>
 bool Wavefunction<Real>::using_sparse() const {
     return is_sparse;
@@ -517,7 +2070,9 @@ bool Wavefunction<Real>::using_sparse() const {
 template<typename Real>
 std::size_t detect_periodicity_ripple(const Wavefunction<Real>& wf,
                                       double threshold) {
-    std::size_t N = wf.using_sparse() ? (1ULL << wf.num_qubits) : wf.state.size();
+    std::size_t N = wf.using_sparse() || wf.using_soa() || wf.uses_disk()
+                        ? (1ULL << wf.num_qubits)
+                        : wf.state.size();
     if (N < 2)
         return 0;
 
@@ -1,21 +1,49 @@
 #ifndef QPP_WAVEFUNCTION_H
 #define QPP_WAVEFUNCTION_H
 
+#include "aligned_allocator.h"
 #include "disk_pager.h"
 #include "runtime_config.h"
+#include "sparse_wavefunction.h"
+#include "state_allocator.h"
 #include <complex>
 #include <vector>
 #include <string>
 #include <cstddef>
+#include <map>
 #include <memory>
 #include <vector>
 #include <unordered_map>
 
 namespace qpp {
+// Diagonal gate acting on `qubits`. `phases` holds one entry per local basis
+// state, where bit j of the entry index is the value of qubits[j].
+template<typename Real = double>
+struct DiagonalGate {
+    std::vector<std::size_t> qubits;
+    std::vector<std::complex<Real>> phases;
+};
+
+// Dense k-qubit gate. `matrix` is 2^k x 2^k in row-major order and bit j of
+// a row or column index is the value of qubits[j]. Diagonal gates leave
+// `matrix` empty and list their 2^k diagonal entries in `phases` instead,
+// indexed like DiagonalGate::phases.
+template<typename Real = double>
+struct GateMatrix {
+    std::vector<std::size_t> qubits;
+    std::vector<std::complex<Real>> matrix;
+    std::vector<std::complex<Real>> phases{};
+};
+
 template<typename Real = double>
 class Wavefunction {
 public:
     explicit Wavefunction(std::size_t qubits = 1);
+    // Disk-backed whatever its size, keeping at most `cache_bytes` of pages
+    // in memory (never fewer than 8 pages). Used when the memory budget
+    // turns down an in-memory state.
+    struct DiskBacked { std::size_t cache_bytes; };
+    Wavefunction(std::size_t qubits, DiskBacked disk);
 
     void apply_h(std::size_t qubit);
     void apply_x(std::size_t qubit);
@@ -31,6 +59,24 @@ public:
     void apply_t(std::size_t qubit);
     void apply_swap(std::size_t q1, std::size_t q2);
 
+    // Apply a dense 2^k x 2^k unitary to the given qubits.
+    void apply_matrix_k(const std::vector<std::size_t>& qubits,
+                        const std::vector<std::complex<Real>>& matrix);
+
+    // Apply a run of gates cache block by cache block: every gate acting only
+    // on qubits below `block_qubits` is applied to one chunk of
+    // 2^block_qubits amplitudes before the next chunk is touched. 0 selects
+    // cache_block_qubits(); gates reaching higher qubits run on their own
+    // unless runtime_config.qubit_remap lets the run be localized first.
+    // Disk-backed states run the gates in out-of-core phases instead, see
+    // run_phases().
+    void apply_blocked(const std::vector<GateMatrix<Real>>& gates,
+                       std::size_t block_qubits = 0);
+
+    // Apply a run of diagonal gates on any qubits in a single pass over the
+    // state.
+    void apply_diagonal(const std::vector<DiagonalGate<Real>>& gates);
+
     // Apply a sequence of single qubit gates by fusing them into one matrix.
     void apply_fused(const std::vector<std::string>& gates,
                      std::size_t qubit);
@@ -38,11 +84,43 @@ public:
     void reset();
     std::complex<Real> amplitude(std::size_t index) const;
 
+    // Physical position of a logical qubit in `state`. Gates, measurements
+    // and amplitude() take logical qubits and indices; `state` itself is laid
+    // out by physical qubit.
+    std::size_t physical_qubit(std::size_t qubit) const {
+        return layout.empty() || qubit >= layout.size() ? qubit : layout[qubit];
+    }
+    // Permute the state in place so every qubit in `qubits` sits below
+    // physical position `window`, keeping qubits already there in place.
+    void localize(const std::vector<std::size_t>& qubits, std::size_t window);
+    // Return to the identity layout so `state` is in logical order.
+    void restore_layout();
+
+    // Measurements take one pass over the state. The collapse is recorded
+    // in collapse_* and, with runtime_config.lazy_collapse, folded into the
+    // next single-qubit gate's sweep instead of written out right away.
     int measure(std::size_t qubit);
     std::size_t measure(const std::vector<std::size_t>& qubits);
+    // Write a pending measurement collapse into `state`.
+    void apply_collapse();
+
+    // Draw `shots` measurement outcomes of `qubits` from the current state
+    // without collapsing it. Bit j of each outcome is the value of
+    // qubits[j]; the result maps outcome to count.
+    std::map<std::size_t, std::size_t> sample(const std::vector<std::size_t>& qubits,
+                                              std::size_t shots) const;
 
+    // Move between dense `state` and the sparse engine in `sparse_state`.
+    // With runtime_config.sparse_threshold set, gates switch on their own
+    // when the fraction of non-zero amplitudes crosses the threshold.
     void compress();
     void decompress();
+    // Move between interleaved `state` and structure-of-arrays storage in
+    // `soa_re` / `soa_im`. In SoA mode single-qubit, diagonal and controlled
+    // gates run on vector kernels; anything that needs `state` converts back.
+    void to_soa();
+    void to_aos();
+    bool using_soa() const { return is_soa; }
     std::size_t nnz() const;
     bool using_sparse() const;
     bool uses_disk() const { return disk_backed; }
@@ -52,12 +130,56 @@ public:
     // if the decomposition was applied.
     bool schmidt_low_rank(std::size_t qubit, double threshold = 1e-6);
 
-  std::vector<std::complex<Real>> state;
-  std::unordered_map<std::size_t, std::complex<Real>> sparse_state;
+  StateVector<Real> state;
+  SparseWavefunction<Real> sparse_state;
   bool is_sparse{false};
+  // Dense gates applied since nnz() was last compared with the threshold.
+  std::size_t gates_since_density_check{0};
+  std::vector<Real, AlignedAllocator<Real>> soa_re;
+  std::vector<Real, AlignedAllocator<Real>> soa_im;
+  bool is_soa{false};
+  // With runtime_config.disk_limit_mb set, large states live in `pager`
+  // and `state` stays empty; every gate streams the pages it touches.
+  // `layout` applies to the pages too but only ever moves qubits above the
+  // page size.
   std::unique_ptr<DiskPager> pager;
   bool disk_backed{false};
   std::size_t num_qubits;
+  // layout[logical] = physical qubit; empty means the identity.
+  std::vector<std::size_t> layout;
+  // Pending collapse: amplitudes whose index differs from collapse_value on
+  // collapse_mask are zero, the rest are divided by collapse_norm.
+  bool collapse_pending{false};
+  std::size_t collapse_mask{0};
+  std::size_t collapse_value{0};
+  double collapse_norm{1.0};
+
+private:
+  // Switch storage if the density crossed runtime_config.sparse_threshold
+  // and report whether the next gate runs on the sparse engine.
+  bool route_sparse();
+
+  // In-memory working copy of a few pages of a disk-backed state. It never
+  // goes to disk, sparse storage or SoA, and never changes its layout.
+  struct ChunkTag {};
+  Wavefunction(std::size_t qubits, ChunkTag);
+  bool is_chunk{false};
+
+  // Keep the state in a new pager caching up to `cache_bytes` of pages.
+  void open_pager(std::size_t cache_bytes);
+
+  // Run `op(chunk, local)` on every group of pages that differ only in the
+  // bits of `qubits` above the page size; `local[q]` is the chunk qubit of
+  // state qubit q. Pages where a bit of `idle_when_clear` is 0 are skipped.
+  template<typename Op>
+  void page_pass(const std::vector<std::size_t>& qubits, std::size_t idle_when_clear, Op op);
+  // Move whole pages so the state is laid out by `next`, which differs from
+  // the current layout only in qubits above the page size.
+  void remap_pages(const std::vector<std::size_t>& next);
+  // Split `gates` into phases whose qubits fit in one chunk of
+  // disk_chunk_qubits(), swap the phase's qubits into the chunk, then apply
+  // the whole phase with one read and one write of every page.
+  void run_phases(const std::vector<GateMatrix<Real>>& gates);
 };
 
 // Analyze amplitude magnitudes using a naive discrete Fourier scan and return
@@ -70,6 +192,48 @@ std::size_t detect_periodicity_ripple(const Wavefunction<Real>& wf,
 
 using WavefunctionF = Wavefunction<float>;
 
+// Number of low qubits whose amplitudes fit in one cache block of
+// runtime_config.cache_block_kb kilobytes.
+template<typename Real = double>
+std::size_t cache_block_qubits() {
+    std::size_t amps = runtime_config.cache_block_kb * 1024 / sizeof(std::complex<Real>);
+    std::size_t q = 0;
+    while ((std::size_t(2) << q) <= amps) ++q;
+    return q;
+}
+
+// Whether a state of `qubits` qubits is kept on disk under
+// runtime_config.disk_limit_mb.
+template<typename Real = double>
+bool disk_backed_size(std::size_t qubits) {
+    std::size_t bytes = (std::size_t(1) << qubits) * sizeof(std::complex<Real>);
+    return runtime_config.disk_limit_mb > 0 &&
+           bytes / (1024 * 1024) >= runtime_config.disk_limit_mb;
+}
+
+// Amplitudes per page of a disk-backed state of `qubits` qubits: the
+// largest power of two that fits in runtime_config.disk_page_kb. Pages are
+// a power of two so a gate's qubits split cleanly into in-page and
+// page-selecting bits.
+template<typename Real = double>
+std::size_t disk_page_amplitudes(std::size_t qubits) {
+    std::size_t page = 1;
+    while (2 * page * sizeof(std::complex<double>) <= runtime_config.disk_page_kb * 1024 &&
+           2 * page <= (std::size_t(1) << qubits))
+        page *= 2;
+    return page;
+}
+
+// Number of qubits whose amplitudes fit in one out-of-core chunk of
+// runtime_config.disk_chunk_mb megabytes.
+template<typename Real = double>
+std::size_t disk_chunk_qubits() {
+    std::size_t amps = runtime_config.disk_chunk_mb * 1024 * 1024 / sizeof(std::complex<Real>);
+    std::size_t q = 0;
+    while ((std::size_t(2) << q) <= amps) ++q;
+    return q;
+}
+
 // TODO(good-first-issue): extend with parameterized rotations and register
 // import/export helpers
 } // namespace qpp
@@ -0,0 +1,86 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/disk_pager.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+int main() {
+    std::mt19937 gen(8);
+
+    // Background reads and writes on both backends. io_uring may be refused
+    // by the kernel, in which case the pager falls back to the thread pool.
+    for (bool uring : {true, false}) {
+        DiskPager pager(4096, 32, 16, false, true, uring);
+        assert(std::strcmp(pager.io_backend(), "sync") != 0);
+        if (!uring) assert(std::strcmp(pager.io_backend(), "threads") == 0);
+        for (std::size_t p = 0; p < pager.page_count(); ++p) {
+            std::complex<double>* data = pager.overwrite(p);
+            for (std::size_t i = 0; i < 32; ++i) data[i] = {double(p * 32 + i), 1.0};
+            pager.release(p);
+            pager.write_behind(p);
+        }
+        // Stream the pages back with the next few always requested ahead.
+        for (std::size_t p = 0; p < pager.page_count(); ++p) {
+            for (std::size_t k = 1; k <= 4; ++k) pager.prefetch(p + k);
+            const std::complex<double>* data = pager.acquire(p, false);
+            for (std::size_t i = 0; i < 32; ++i)
+                assert(data[i] == std::complex<double>(double(p * 32 + i), 1.0));
+            pager.release(p);
+        }
+        assert(pager.stats().prefetched > 0);
+        assert(pager.stats().pages_written >= pager.page_count());
+        for (int k = 0; k < 300; ++k) {
+            std::size_t i = gen() % pager.size();
+            pager.write(i, {-double(i), 0.0});
+            pager.write_behind(i / 32);
+            pager.prefetch((i / 32 + 7) % pager.page_count());
+            assert(pager.read(i) == std::complex<double>(-double(i), 0.0));
+        }
+        pager.flush();
+        pager.reset();
+        pager.prefetch(5);
+        assert(pager.read(5 * 32) == 0.0);
+    }
+
+    // A disk-backed circuit gives the same state with and without async I/O,
+    // and the pager accounts for its stall and compute time.
+    const std::size_t n = 17;
+    runtime_config.disk_page_kb = 4;
+    runtime_config.disk_cache_mb = 1;
+    set_disk_limit_mb(0);
+    Wavefunction<> mem(n);
+    set_disk_limit_mb(1);
+    runtime_config.disk_async = false;
+    Wavefunction<> sync(n);
+    runtime_config.disk_async = true;
+    Wavefunction<> async(n);
+    assert(std::strcmp(sync.pager->io_backend(), "sync") == 0);
+    assert(std::strcmp(async.pager->io_backend(), "sync") != 0);
+    for (int k = 0; k < 30; ++k) {
+        std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+        for (Wavefunction<>* wf : {&mem, &sync, &async}) {
+            wf->apply_h(a);
+            wf->apply_cnot(a, b);
+            wf->apply_t(b);
+        }
+    }
+    for (std::size_t i = 0; i < (std::size_t(1) << n); ++i) {
+        assert(std::abs(async.amplitude(i) - mem.amplitude(i)) < 1e-9);
+        assert(std::abs(sync.amplitude(i) - mem.amplitude(i)) < 1e-9);
+    }
+    const auto& stats = async.pager->stats();
+    assert(stats.prefetched > 0 && stats.compute_seconds > 0.0);
+    assert(sync.pager->stats().prefetched == 0);
+
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+
+    std::cout << "Async pager test passed." << std::endl;
+    return 0;
+}
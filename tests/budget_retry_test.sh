@@ -0,0 +1,37 @@
+#!/bin/sh
+set -e
+# The qpp-run to test, passed in by add_test.
+RUN="$1"
+# Private files, so parallel ctest runs do not share them.
+IR="$(mktemp)"
+OUT="$(mktemp)"
+trap 'rm -f "$IR" "$OUT"' EXIT
+# Task big prints and applies H before the memory budget turns its second
+# register away, is put back and refused again. Neither attempt completes,
+# so none of its output or gate counts may show up.
+cat >"$IR" <<'IR'
+TASK small CPU
+QALLOC q 2
+T q 0
+PRINT small-done
+ENDTASK
+TASK big CPU DENSE
+QALLOC a 1
+H a 0
+PRINT before-refusal
+QALLOC b 30
+T b 0
+ENDTASK
+IR
+"$RUN" --memory-budget 1 "$IR" >"$OUT" 2>&1
+status=0
+grep -q "Task 'big' dropped" "$OUT" || status=1
+grep -q "small-done" "$OUT" || status=1
+if grep -q "before-refusal" "$OUT" || grep -q "  H:" "$OUT"; then
+  status=1
+fi
+if [ $status -ne 0 ]; then
+  echo "Output of a refused task leaked" >&2
+  cat "$OUT" >&2
+fi
+exit $status
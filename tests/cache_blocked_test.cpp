@@ -0,0 +1,102 @@
+#include "../runtime/gate_fusion.h"
+#include "../runtime/wavefunction.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace qpp;
+
+static GateMatrix<double> random_gate(std::vector<std::size_t> qubits, std::mt19937& gen) {
+    std::normal_distribution<double> dist(0.0, 1.0);
+    std::size_t dim = 1ULL << qubits.size();
+    GateMatrix<double> g{qubits, std::vector<std::complex<double>>(dim * dim)};
+    for (auto& a : g.matrix) a = {dist(gen), dist(gen)};
+    return g;
+}
+
+int main() {
+    std::mt19937 gen(5);
+    std::normal_distribution<double> dist(0.0, 1.0);
+    const std::size_t n = 9;
+    StateVector<double> init(1ULL << n);
+    for (auto& a : init) a = {dist(gen), dist(gen)};
+
+    // Mix low-qubit gates with ones crossing the 4-qubit block boundary so
+    // the run is split and each low segment sweeps 32 chunks.
+    std::vector<GateMatrix<double>> gates = {
+        random_gate({0}, gen),    random_gate({2, 1}, gen), random_gate({3, 0, 1}, gen),
+        random_gate({1}, gen),    random_gate({6, 2}, gen), random_gate({0, 3}, gen),
+        random_gate({2}, gen),    random_gate({8}, gen),    random_gate({3, 1}, gen),
+    };
+
+    Wavefunction<> seq(n), blocked(n);
+    seq.state = init;
+    blocked.state = init;
+    for (const auto& g : gates) seq.apply_matrix_k(g.qubits, g.matrix);
+    blocked.apply_blocked(gates, 4);
+    for (std::size_t i = 0; i < init.size(); ++i)
+        assert(std::abs(seq.state[i] - blocked.state[i]) < 1e-9);
+
+    // The IR pass marks low-qubit clusters and the matrices it feeds
+    // apply_blocked reproduce the individual gates.
+    runtime_config.qubit_remap = false;
+    std::vector<std::vector<std::string>> ops = {
+        {"H", "q", "0"}, {"CNOT", "q", "0", "q", "1"}, {"T", "q", "1"},
+        {"H", "q", "7"}, {"X", "q", "2"},
+    };
+    auto marked = ops;
+    block_low_qubit_runs(marked, 4);
+    assert(marked.size() == ops.size() + 1);
+    assert(marked[0][0] == "BLOCK" && marked[0][1] == "3");
+    assert(marked[4][0] == "H" && marked[5][0] == "X");
+
+    Wavefunction<> ref(n), run(n);
+    ref.state = init;
+    run.state = init;
+    ref.apply_h(0);
+    ref.apply_cnot(0, 1);
+    ref.apply_t(1);
+    run.apply_blocked(block_matrices({marked.begin() + 1, marked.begin() + 4}), 4);
+    for (std::size_t i = 0; i < init.size(); ++i)
+        assert(std::abs(ref.state[i] - run.state[i]) < 1e-9);
+
+    // Diagonal runs inside a block keep their phases instead of becoming
+    // dense matrices, including one reaching above the block.
+    ops = {
+        {"H", "q", "0"}, {"T", "q", "1"}, {"CZ", "q", "0", "q", "2"}, {"S", "q", "1"},
+        {"CNOT", "q", "1", "q", "3"}, {"Z", "q", "3"},
+    };
+    marked = ops;
+    fuse_diagonal_runs(marked);
+    block_low_qubit_runs(marked, 4);
+    assert(marked[0][0] == "BLOCK" && marked[2][0] == "DIAG");
+    auto mixed = block_matrices({marked.begin() + 1, marked.end()});
+    assert(mixed.size() == ops.size());
+    for (std::size_t g = 0; g < mixed.size(); ++g) {
+        bool diagonal = ops[g][0] != "H" && ops[g][0] != "CNOT";
+        assert(mixed[g].matrix.empty() == diagonal && mixed[g].phases.empty() != diagonal);
+    }
+    mixed.push_back(block_matrices({{"T", "q", "7"}})[0]);
+    mixed.push_back(block_matrices({{"X", "q", "2"}})[0]);
+    ref.state = init;
+    run.state = init;
+    ref.apply_h(0);
+    ref.apply_t(1);
+    ref.apply_cz(0, 2);
+    ref.apply_s(1);
+    ref.apply_cnot(1, 3);
+    ref.apply_z(3);
+    ref.apply_t(7);
+    ref.apply_x(2);
+    run.apply_blocked(mixed, 4);
+    for (std::size_t i = 0; i < init.size(); ++i)
+        assert(std::abs(ref.state[i] - run.state[i]) < 1e-9);
+
+    assert(cache_block_qubits<double>() >= 1);
+    std::cout << "Cache blocked gate test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "../runtime/wavefunction.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace qpp;
+
+static StateVector<double> random_state(std::size_t n, std::mt19937& gen) {
+    std::normal_distribution<double> dist(0.0, 1.0);
+    StateVector<double> st(1ULL << n);
+    for (auto& a : st) a = {dist(gen), dist(gen)};
+    return st;
+}
+
+static void expect_equal(const StateVector<double>& a, const StateVector<double>& b) {
+    assert(a.size() == b.size());
+    for (std::size_t i = 0; i < a.size(); ++i) assert(std::abs(a[i] - b[i]) < 1e-12);
+}
+
+int main() {
+    const std::size_t n = 5;
+    std::mt19937 gen(99);
+    for (std::size_t a = 0; a < n; ++a) {
+        for (std::size_t b = 0; b < n; ++b) {
+            if (a == b) continue;
+            auto init = random_state(n, gen);
+            std::size_t abit = 1ULL << a, bbit = 1ULL << b;
+
+            Wavefunction<> wf(n);
+            wf.state = init;
+            wf.apply_cnot(a, b);
+            auto ref = init;
+            for (std::size_t i = 0; i < ref.size(); ++i)
+                if ((i & abit) && !(i & bbit)) std::swap(ref[i], ref[i | bbit]);
+            expect_equal(wf.state, ref);
+
+            wf.state = init;
+            wf.apply_swap(a, b);
+            ref = init;
+            for (std::size_t i = 0; i < ref.size(); ++i)
+                if ((i & abit) && !(i & bbit)) std::swap(ref[i], ref[i ^ abit ^ bbit]);
+            expect_equal(wf.state, ref);
+
+            for (std::size_t t = 0; t < n; ++t) {
+                if (t == a || t == b) continue;
+                std::size_t tbit = 1ULL << t;
+                wf.state = init;
+                wf.apply_ccnot(a, b, t);
+                ref = init;
+                for (std::size_t i = 0; i < ref.size(); ++i)
+                    if ((i & abit) && (i & bbit) && !(i & tbit)) std::swap(ref[i], ref[i | tbit]);
+                expect_equal(wf.state, ref);
+            }
+        }
+    }
+
+    // out-of-range qubits leave the state untouched
+    Wavefunction<float> small(2);
+    small.apply_cnot(0, 7);
+    assert(small.state[0] == std::complex<float>(1.0f, 0.0f));
+
+    std::cout << "Controlled gate kernel test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "../runtime/wavefunction.h"
+#include "../runtime/gate_fusion.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace qpp;
+
+int main() {
+    const std::size_t n = 12;
+    std::mt19937 gen(5);
+    std::normal_distribution<double> dist(0.0, 1.0);
+    StateVector<double> init(1ULL << n);
+    for (auto& a : init) a = {dist(gen), dist(gen)};
+
+    // Reference: phase of each index computed gate by gate.
+    std::vector<std::vector<std::string>> ops;
+    for (int k = 0; k < 30; ++k) {
+        std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+        switch (gen() % 4) {
+        case 0: ops.push_back({"Z", "q", std::to_string(a)}); break;
+        case 1: ops.push_back({"S", "q", std::to_string(a)}); break;
+        case 2: ops.push_back({"T", "q", std::to_string(a)}); break;
+        default: ops.push_back({"CZ", "q", std::to_string(a), "q", std::to_string(b)}); break;
+        }
+    }
+
+    Wavefunction<> seq(n), fused(n);
+    seq.state = init;
+    fused.state = init;
+    for (const auto& ins : ops) {
+        std::size_t q = std::stoul(ins[2]);
+        if (ins[0] == "Z") seq.apply_z(q);
+        else if (ins[0] == "S") seq.apply_s(q);
+        else if (ins[0] == "T") seq.apply_t(q);
+        else seq.apply_cz(q, std::stoul(ins[4]));
+    }
+    fused.apply_diagonal(diagonal_gates(ops));
+    for (std::size_t i = 0; i < init.size(); ++i)
+        assert(std::abs(seq.state[i] - fused.state[i]) < 1e-9);
+
+    // Z, S, T and CZ against their definitions on a small state.
+    Wavefunction<float> wf(2);
+    wf.apply_h(0);
+    wf.apply_h(1);
+    wf.apply_cz(0, 1);
+    wf.apply_s(0);
+    wf.apply_t(1);
+    const std::complex<float> i1(0.0f, 1.0f);
+    const std::complex<float> t1 = std::exp(std::complex<float>(0.0f, float(M_PI / 4)));
+    assert(std::abs(wf.state[0] - std::complex<float>(0.5f)) < 1e-6);
+    assert(std::abs(wf.state[1] - 0.5f * i1) < 1e-6);
+    assert(std::abs(wf.state[2] - 0.5f * t1) < 1e-6);
+    assert(std::abs(wf.state[3] + 0.5f * i1 * t1) < 1e-6);
+
+    // RZ uses both diagonal entries.
+    Wavefunction<> rz(1);
+    rz.apply_h(0);
+    rz.apply_rz(0, M_PI / 2);
+    assert(std::abs(rz.state[0] - std::exp(std::complex<double>(0, -M_PI / 4)) / std::sqrt(2.0)) < 1e-9);
+    assert(std::abs(rz.state[1] - std::exp(std::complex<double>(0, M_PI / 4)) / std::sqrt(2.0)) < 1e-9);
+
+    // Runs on the same register are prefixed with a DIAG marker.
+    std::vector<std::vector<std::string>> ir = {
+        {"H", "q", "0"}, {"Z", "q", "0"}, {"T", "q", "1"}, {"CZ", "q", "0", "q", "1"},
+        {"X", "q", "0"}, {"S", "q", "0"}};
+    fuse_diagonal_runs(ir);
+    assert(ir.size() == 7);
+    assert(ir[1][0] == "DIAG" && ir[1][1] == "3");
+    assert(ir[6][0] == "S");
+
+    std::cout << "Diagonal gate test passed." << std::endl;
+    return 0;
+}
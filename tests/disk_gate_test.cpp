@@ -0,0 +1,178 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/disk_pager.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+template<typename Real>
+static void run_circuit(Wavefunction<Real>& disk, Wavefunction<Real>& mem, std::mt19937& gen,
+                        int steps) {
+    const std::size_t n = mem.num_qubits;
+    for (int step = 0; step < steps; ++step) {
+        std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+        std::size_t c = (b + 1) % n == a ? (b + 2) % n : (b + 1) % n;
+        Real theta = Real(0.1 * (gen() % 63));
+        switch (gen() % 17) {
+        case 0: disk.apply_h(a); mem.apply_h(a); break;
+        case 1: disk.apply_x(a); mem.apply_x(a); break;
+        case 2: disk.apply_y(a); mem.apply_y(a); break;
+        case 3: disk.apply_z(a); mem.apply_z(a); break;
+        case 4: disk.apply_s(a); mem.apply_s(a); break;
+        case 5: disk.apply_t(a); mem.apply_t(a); break;
+        case 6: disk.apply_rx(a, theta); mem.apply_rx(a, theta); break;
+        case 7: disk.apply_ry(a, theta); mem.apply_ry(a, theta); break;
+        case 8: disk.apply_rz(a, theta); mem.apply_rz(a, theta); break;
+        case 9: disk.apply_cnot(a, b); mem.apply_cnot(a, b); break;
+        case 10: disk.apply_cz(a, b); mem.apply_cz(a, b); break;
+        case 11: disk.apply_ccnot(a, b, c); mem.apply_ccnot(a, b, c); break;
+        case 12: disk.apply_swap(a, b); mem.apply_swap(a, b); break;
+        case 13: disk.apply_fused({"H", "T", "S"}, a); mem.apply_fused({"H", "T", "S"}, a); break;
+        case 14: {
+            // H on a, X on b.
+            const Real f = Real(1.0) / std::sqrt(Real(2.0));
+            const Real h[2][2] = {{f, f}, {f, -f}};
+            std::vector<std::complex<Real>> m(16);
+            for (std::size_t r = 0; r < 4; ++r)
+                for (std::size_t col = 0; col < 4; ++col)
+                    m[r * 4 + col] = h[r & 1][col & 1] * Real((r >> 1) != (col >> 1));
+            disk.apply_matrix_k({a, b}, m);
+            mem.apply_matrix_k({a, b}, m);
+            break;
+        }
+        case 15: {
+            std::vector<DiagonalGate<Real>> run{
+                {{a}, {Real(1.0), std::exp(std::complex<Real>(0, theta))}},
+                {{a, b}, {Real(1.0), Real(1.0), Real(1.0), Real(-1.0)}}};
+            disk.apply_diagonal(run);
+            mem.apply_diagonal(run);
+            break;
+        }
+        default: {
+            GateMatrix<Real> g{{a}, {Real(0.0), Real(1.0), Real(1.0), Real(0.0)}};
+            disk.apply_blocked({g, g, g});
+            mem.apply_blocked({g, g, g});
+            break;
+        }
+        }
+    }
+}
+
+template<typename Real>
+static void check_same(const Wavefunction<Real>& disk, const Wavefunction<Real>& mem, double tol) {
+    for (std::size_t i = 0; i < (std::size_t(1) << mem.num_qubits); ++i)
+        assert(std::abs(disk.amplitude(i) - mem.amplitude(i)) < tol);
+}
+
+int main() {
+    seed_rng(21);
+    std::mt19937 gen(99);
+
+    // Pager on its own: a four-frame pool over 63 pages of 16 amplitudes.
+    {
+        DiskPager pager(1000, 16, 4);
+        for (std::size_t i = 0; i < pager.size(); ++i) pager.write(i, {double(i), -double(i)});
+        for (std::size_t k = 0; k < 500; ++k) {
+            std::size_t i = gen() % pager.size();
+            assert(pager.read(i) == std::complex<double>(double(i), -double(i)));
+        }
+        assert(pager.stats().pages_written > 0 && pager.stats().read_ahead > 0);
+        std::complex<double>* p3 = pager.acquire(3, true);
+        std::complex<double>* p40 = pager.acquire(40, true);
+        p3[1] = 7.0;
+        p40[0] = 8.0;
+        for (std::size_t i = 0; i < pager.size(); i += 5) pager.read(i);
+        assert(p3[1] == 7.0); // pinned pages survive a full scan
+        pager.release(3);
+        pager.release(40);
+        pager.flush();
+        assert(pager.read(3 * 16 + 1) == 7.0 && pager.read(40 * 16) == 8.0);
+        pager.reset();
+        assert(pager.read(3 * 16 + 1) == 0.0 && pager.read(999) == 0.0);
+    }
+
+    // Out-of-core gates against the in-memory simulator: 16 qubits in pages
+    // of 64 amplitudes, so ten qubits select pages and eight frames hold an
+    // eighth of a percent of the state.
+    const std::size_t n = 16;
+    runtime_config.disk_page_kb = 1;
+    runtime_config.disk_cache_mb = 0;
+    for (bool mapped : {false, true}) {
+        runtime_config.disk_mmap = mapped;
+        set_disk_limit_mb(0);
+        Wavefunction<> mem(n);
+        set_disk_limit_mb(1);
+        Wavefunction<> disk(n);
+        assert(disk.uses_disk() && disk.state.empty());
+        assert(disk.pager->mapped() == mapped);
+        check_same(disk, mem, 1e-12);
+        run_circuit(disk, mem, gen, 120);
+        check_same(disk, mem, 1e-9);
+        if (!mapped) assert(disk.pager->stats().misses > 100);
+
+        seed_rng(4);
+        std::size_t joint = disk.measure({3, 12});
+        seed_rng(4);
+        const std::size_t mem_joint = mem.measure({3, 12});
+        assert(mem_joint == joint);
+        check_same(disk, mem, 1e-9);
+        assert(disk.nnz() == mem.nnz());
+
+        auto counts = disk.sample({0, 15}, 200);
+        std::size_t total = 0;
+        for (const auto& kv : counts) {
+            total += kv.second;
+            double p = 0.0;
+            for (std::size_t i = 0; i < (std::size_t(1) << n); ++i)
+                if (((i & 1) | ((i >> 15) << 1)) == kv.first) p += std::norm(mem.amplitude(i));
+            assert(p > 0.0);
+        }
+        assert(total == 200);
+
+        disk.reset();
+        assert(std::abs(disk.amplitude(0) - 1.0) < 1e-12 && std::abs(disk.amplitude(77)) < 1e-12);
+    }
+
+    // Deferred collapse rides along with the next gate's pass.
+    runtime_config.disk_mmap = false;
+    runtime_config.lazy_collapse = true;
+    {
+        set_disk_limit_mb(0);
+        Wavefunction<> mem(n);
+        set_disk_limit_mb(1);
+        Wavefunction<> disk(n);
+        for (std::size_t q = 0; q < n; ++q) { disk.apply_h(q); mem.apply_h(q); }
+        seed_rng(9);
+        int r = disk.measure(14);
+        seed_rng(9);
+        const int mem_r = mem.measure(14);
+        assert(mem_r == r);
+        assert(disk.collapse_pending);
+        disk.apply_cnot(14, 2);
+        mem.apply_cnot(14, 2);
+        assert(!disk.collapse_pending);
+        check_same(disk, mem, 1e-12);
+    }
+    runtime_config.lazy_collapse = false;
+
+    // Single precision pages are converted on the way through.
+    {
+        set_disk_limit_mb(0);
+        Wavefunction<float> mem(n + 1);
+        set_disk_limit_mb(1);
+        Wavefunction<float> disk(n + 1);
+        assert(disk.uses_disk());
+        run_circuit(disk, mem, gen, 40);
+        check_same(disk, mem, 1e-4);
+    }
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+
+    std::cout << "Disk gate test passed." << std::endl;
+    return 0;
+}
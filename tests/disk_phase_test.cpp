@@ -0,0 +1,117 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/disk_pager.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+// Random unitary from the QR decomposition of a Gaussian matrix.
+static GateMatrix<double> random_unitary(std::vector<std::size_t> qubits, std::mt19937& gen) {
+    std::normal_distribution<double> dist(0.0, 1.0);
+    const std::size_t dim = std::size_t(1) << qubits.size();
+    std::vector<std::complex<double>> m(dim * dim);
+    for (auto& a : m) a = {dist(gen), dist(gen)};
+    for (std::size_t c = 0; c < dim; ++c) {
+        for (std::size_t p = 0; p < c; ++p) {
+            std::complex<double> dot = 0.0;
+            for (std::size_t r = 0; r < dim; ++r) dot += std::conj(m[r * dim + p]) * m[r * dim + c];
+            for (std::size_t r = 0; r < dim; ++r) m[r * dim + c] -= dot * m[r * dim + p];
+        }
+        double norm = 0.0;
+        for (std::size_t r = 0; r < dim; ++r) norm += std::norm(m[r * dim + c]);
+        for (std::size_t r = 0; r < dim; ++r) m[r * dim + c] /= std::sqrt(norm);
+    }
+    return {qubits, m};
+}
+
+static void check_same(const Wavefunction<>& disk, const Wavefunction<>& mem) {
+    for (std::size_t i = 0; i < (std::size_t(1) << mem.num_qubits); ++i)
+        assert(std::abs(disk.amplitude(i) - mem.amplitude(i)) < 1e-9);
+}
+
+int main() {
+    std::mt19937 gen(5);
+    // 18 qubits in pages of 64 amplitudes with a 1 MB chunk: six qubits are
+    // inside every page and ten more fit in the chunk, so two of the twelve
+    // page-selecting qubits are always outside it.
+    const std::size_t n = 18;
+    runtime_config.disk_page_kb = 1;
+    runtime_config.disk_cache_mb = 0;
+    runtime_config.disk_chunk_mb = 1;
+    assert(disk_chunk_qubits<double>() == 16);
+
+    set_disk_limit_mb(0);
+    Wavefunction<> mem(n);
+    set_disk_limit_mb(1);
+    Wavefunction<> disk(n);
+    assert(disk.uses_disk());
+    const std::size_t pages = disk.pager->page_count();
+
+    std::vector<GateMatrix<double>> gates;
+    for (std::size_t q = 0; q < n; ++q) gates.push_back(random_unitary({q}, gen));
+    for (int k = 0; k < 40; ++k) {
+        std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+        gates.push_back(k % 3 ? random_unitary({a, b}, gen) : random_unitary({a}, gen));
+    }
+    for (const auto& g : gates) mem.apply_matrix_k(g.qubits, g.matrix);
+
+    const std::size_t before = disk.pager->stats().pages_read;
+    disk.apply_blocked(gates);
+    const std::size_t read = disk.pager->stats().pages_read - before;
+    // One gate at a time would read every page 58 times; the phases and the
+    // swaps between them take a handful of sweeps.
+    assert(read <= 8 * pages);
+    check_same(disk, mem);
+
+    // The remapped layout carries over to single gates, measurement and
+    // diagonal runs, and restore_layout() puts every page back.
+    disk.apply_h(17);
+    mem.apply_h(17);
+    disk.apply_cnot(16, 0);
+    mem.apply_cnot(16, 0);
+    std::vector<DiagonalGate<double>> diag{
+        {{17}, {1.0, std::complex<double>(0.0, 1.0)}},
+        {{3, 15}, {1.0, 1.0, 1.0, -1.0}},
+        {{16, 9, 2}, {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, std::exp(std::complex<double>(0, 0.3))}}};
+    disk.apply_diagonal(diag);
+    mem.apply_diagonal(diag);
+    check_same(disk, mem);
+
+    // A deferred collapse is carried through the page swaps.
+    runtime_config.lazy_collapse = true;
+    seed_rng(3);
+    std::size_t outcome = disk.measure({17, 1});
+    seed_rng(3);
+    const std::size_t mem_outcome = mem.measure({17, 1});
+    assert(mem_outcome == outcome);
+    // Diagonal entries ride along in the phases as phase tables.
+    std::vector<GateMatrix<double>> tail{random_unitary({16, 4}, gen),
+                                         {{17, 3}, {}, {1.0, 1.0, 1.0, -1.0}},
+                                         random_unitary({17, 2}, gen),
+                                         {{12}, {}, {1.0, std::complex<double>(0.0, 1.0)}},
+                                         random_unitary({12, 13}, gen)};
+    disk.apply_blocked(tail);
+    for (const auto& g : tail) {
+        if (g.matrix.empty()) mem.apply_diagonal({{g.qubits, g.phases}});
+        else mem.apply_matrix_k(g.qubits, g.matrix);
+    }
+    runtime_config.lazy_collapse = false;
+    assert(!disk.collapse_pending);
+    check_same(disk, mem);
+
+    disk.restore_layout();
+    assert(disk.layout.empty());
+    check_same(disk, mem);
+
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+    runtime_config.disk_chunk_mb = 64;
+
+    std::cout << "Disk phase test passed." << std::endl;
+    return 0;
+}
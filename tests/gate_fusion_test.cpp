@@ -0,0 +1,116 @@
+#include "../runtime/wavefunction.h"
+#include "../runtime/gate_fusion.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace qpp;
+
+static void apply(Wavefunction<>& wf, const std::vector<std::string>& ins) {
+    const std::string& g = ins[0];
+    std::size_t a = std::stoul(ins[2]);
+    if (g == "H") wf.apply_h(a);
+    else if (g == "X") wf.apply_x(a);
+    else if (g == "Y") wf.apply_y(a);
+    else if (g == "Z") wf.apply_z(a);
+    else if (g == "S") wf.apply_s(a);
+    else if (g == "T") wf.apply_t(a);
+    else if (g == "CNOT") wf.apply_cnot(a, std::stoul(ins[4]));
+    else if (g == "CZ") wf.apply_cz(a, std::stoul(ins[4]));
+    else if (g == "SWAP") wf.apply_swap(a, std::stoul(ins[4]));
+    else if (g == "CCX") wf.apply_ccnot(a, std::stoul(ins[4]), std::stoul(ins[6]));
+}
+
+int main() {
+    const std::size_t n = 7;
+    std::mt19937 gen(11);
+    const std::vector<std::string> single = {"H", "X", "Y", "Z", "S", "T"};
+    std::vector<std::vector<std::string>> circuit;
+    for (int i = 0; i < 120; ++i) {
+        std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+        std::size_t c = (b + 1 + gen() % (n - 1)) % n;
+        if (c == a) c = (c + 1) % n;
+        if (c == b) c = (c + 1) % n;
+        if (c == a) c = (c + 1) % n;
+        std::string sa = std::to_string(a), sb = std::to_string(b), sc = std::to_string(c);
+        switch (gen() % 6) {
+        case 0: circuit.push_back({"CNOT", "q", sa, "q", sb}); break;
+        case 1: circuit.push_back({"CZ", "q", sa, "q", sb}); break;
+        case 2: circuit.push_back({"SWAP", "q", sa, "q", sb}); break;
+        case 3: circuit.push_back({"CCX", "q", sa, "q", sb, "q", sc}); break;
+        default: circuit.push_back({single[gen() % single.size()], "q", sa}); break;
+        }
+    }
+
+    Wavefunction<> ref(n);
+    for (const auto& ins : circuit) apply(ref, ins);
+
+    for (std::size_t k = 2; k <= 5; ++k) {
+        auto ops = circuit;
+        fuse_diagonal_runs(ops);
+        fuse_gates(ops, k);
+        std::size_t markers = 0;
+        Wavefunction<> wf(n);
+        for (std::size_t pc = 0; pc < ops.size(); ++pc) {
+            const auto& ins = ops[pc];
+            if (ins[0] == "FUSE" || ins[0] == "DIAG") {
+                std::size_t count = std::stoul(ins[1]);
+                std::vector<std::vector<std::string>> run(ops.begin() + pc + 1,
+                                                          ops.begin() + pc + 1 + count);
+                if (ins[0] == "FUSE") {
+                    auto m = fused_matrix(run);
+                    assert(m.qubits.size() <= k);
+                    wf.apply_matrix_k(m.qubits, m.matrix);
+                    ++markers;
+                } else {
+                    wf.apply_diagonal(diagonal_gates(run));
+                }
+                pc += count;
+            } else {
+                apply(wf, ins);
+            }
+        }
+        assert(markers > 0);
+        for (std::size_t i = 0; i < ref.state.size(); ++i)
+            assert(std::abs(ref.state[i] - wf.state[i]) < 1e-9);
+    }
+
+    // A fused Bell preparation matches the gate-by-gate result.
+    std::vector<std::vector<std::string>> bell = {{"H", "q", "0"}, {"CNOT", "q", "0", "q", "1"}};
+    auto m = fused_matrix(bell);
+    assert(m.qubits.size() == 2 && m.matrix.size() == 16);
+    Wavefunction<> wf(2);
+    wf.apply_matrix_k(m.qubits, m.matrix);
+    assert(std::abs(std::norm(wf.state[0]) - 0.5) < 1e-9);
+    assert(std::abs(std::norm(wf.state[3]) - 0.5) < 1e-9);
+
+    // Far more distinct blocks than the cache holds, built from several
+    // threads at once, still come back right after being evicted.
+    auto distinct = [](std::size_t b) {
+        const std::string lo = std::to_string(b), hi = std::to_string(b + 1);
+        return std::vector<std::vector<std::string>>{
+            {b % 2 ? "H" : "T", "q", lo}, {"CNOT", "q", lo, "q", hi}, {"S", "q", hi}};
+    };
+    std::vector<GateMatrix<double>> first(48);
+    for (std::size_t b = 0; b < first.size(); ++b) first[b] = fused_matrix(distinct(b));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t)
+        workers.emplace_back([&, t]() {
+            for (std::size_t b = 0; b < 1000; ++b) fused_matrix(distinct(b * 4 + t));
+        });
+    for (auto& w : workers) w.join();
+    for (std::size_t b = 0; b < first.size(); ++b) {
+        auto again = fused_matrix(distinct(b));
+        assert(again.qubits == first[b].qubits);
+        for (std::size_t e = 0; e < again.matrix.size(); ++e)
+            assert(std::abs(again.matrix[e] - first[b].matrix[e]) < 1e-12);
+    }
+
+    std::cout << "Gate fusion test passed." << std::endl;
+    return 0;
+}
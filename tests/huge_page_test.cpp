@@ -0,0 +1,93 @@
+#include "../include/runtime_config.h"
+#include "../runtime/state_allocator.h"
+#include "../runtime/sparse_wavefunction.h"
+#include "../runtime/wavefunction.h"
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace qpp;
+
+// VmFlags of the mapping holding `addr`, or "" if it is not found.
+static std::string vm_flags(const void* addr) {
+    const auto a = reinterpret_cast<std::uintptr_t>(addr);
+    std::ifstream ifs("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+    while (std::getline(ifs, line)) {
+        std::uintptr_t lo = 0, hi = 0;
+        char dash = 0;
+        std::istringstream ss(line);
+        if (ss >> std::hex >> lo >> dash >> hi && dash == '-') {
+            inside = lo <= a && a < hi;
+        } else if (inside && line.rfind("VmFlags:", 0) == 0) {
+            return line;
+        }
+    }
+    return "";
+}
+
+static void run_gates(Wavefunction<>& wf) {
+    const std::size_t n = wf.num_qubits;
+    for (std::size_t q = 0; q < n; q += 2) wf.apply_h(q);
+    wf.apply_cnot(0, n - 1);
+    wf.apply_t(n - 1);
+    wf.apply_rx(n - 2, 0.3);
+    wf.apply_cnot(n - 2, 1);
+}
+
+int main() {
+    const std::size_t n = 21;
+    const std::size_t huge = huge_page_size();
+    assert(huge >= 4096 && (huge & (huge - 1)) == 0);
+    Wavefunction<> ref(n);
+    run_gates(ref);
+
+    std::ifstream thp("/sys/kernel/mm/transparent_hugepage/enabled");
+    const bool have_thp = thp.good();
+    for (HugePages mode : {HugePages::Off, HugePages::Transparent, HugePages::Explicit}) {
+        runtime_config.huge_pages = mode;
+        // Dense states: huge page backed blocks start on a huge page, give
+        // the same results and reset to zero.
+        Wavefunction<> wf(n);
+        if (mode != HugePages::Off)
+            assert(reinterpret_cast<std::uintptr_t>(wf.state.data()) % huge == 0);
+        if (mode == HugePages::Transparent && have_thp)
+            assert(vm_flags(wf.state.data()).find(" hg") != std::string::npos);
+        run_gates(wf);
+        assert(wf.state == ref.state);
+        wf.reset();
+        assert(wf.state[0] == 1.0);
+        for (std::size_t i = 1; i < wf.state.size(); i += 511) assert(wf.state[i] == 0.0);
+
+        // Sparse buffers grow into mapped blocks past 1 MiB.
+        SparseWavefunction<> sparse(n);
+        for (std::size_t q = 0; q < 17; ++q) sparse.apply_h(q);
+        assert(sparse.nnz() == std::size_t(1) << 17);
+        sparse.apply_cnot(3, n - 1);
+        const std::size_t flipped = (std::size_t(1) << 17) - 1 + (std::size_t(1) << (n - 1));
+        assert(std::abs(sparse.amplitude(flipped) - std::pow(std::sqrt(0.5), 17)) < 1e-12);
+        assert(sparse.amplitude(flipped - (std::size_t(1) << (n - 1))) == 0.0);
+
+        // Pager frames come from the same allocator.
+        runtime_config.disk_page_kb = 64;
+        runtime_config.disk_cache_mb = 4;
+        set_disk_limit_mb(1);
+        Wavefunction<> disk(n);
+        assert(disk.uses_disk());
+        run_gates(disk);
+        for (std::size_t i = 0; i < ref.state.size(); i += 97)
+            assert(std::abs(disk.amplitude(i) - ref.state[i]) < 1e-12);
+        set_disk_limit_mb(0);
+        runtime_config.disk_page_kb = 1024;
+        runtime_config.disk_cache_mb = 256;
+    }
+    runtime_config.huge_pages = HugePages::Off;
+
+    std::cout << "Huge page test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "../include/runtime_config.h"
+#include "../runtime/checkpoint.h"
+#include "../runtime/memory.h"
+#include "../runtime/disk_pager.h"
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace qpp;
+
+static bool exists(const std::string& path) { return static_cast<bool>(std::ifstream(path)); }
+
+static std::size_t file_size(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    return static_cast<std::size_t>(ifs.tellg());
+}
+
+static bool matches(const std::string& path, const Wavefunction<>& wf) {
+    std::vector<std::complex<double>> loaded;
+    if (!load_state_file(path, loaded)) return false;
+    return loaded == std::vector<std::complex<double>>(wf.state.begin(), wf.state.end());
+}
+
+static std::vector<std::complex<double>> amplitudes(int id) {
+    std::vector<std::complex<double>> amps(std::size_t(1) << memory.qreg(id).num_qubits);
+    for (std::size_t i = 0; i < amps.size(); ++i) amps[i] = memory.qreg(id).amp(i);
+    return amps;
+}
+
+static void remove_chain(const std::string& path) {
+    std::remove(path.c_str());
+    for (int k = 1; k <= 8; ++k) std::remove((path + "." + std::to_string(k)).c_str());
+}
+
+int main() {
+    // 2^20 amplitudes are 64 pages. The first checkpoint is a base with a
+    // header naming the state.
+    const std::size_t n = 20;
+    const std::string path = "incremental_cp.bin";
+    runtime_config.checkpoint_codec = PageCodec::Lossless;
+    Wavefunction<> wf(n);
+    for (std::size_t q = 0; q < 4; ++q) wf.apply_h(q);
+    {
+        IncrementalCheckpoint cp(path);
+        bool ok = cp.write(n, wf.state.data()) && cp.wait();
+        assert(ok && matches(path, wf));
+        CheckpointHeader header;
+        std::ifstream(path, std::ios::binary).read(reinterpret_cast<char*>(&header), sizeof(header));
+        assert(is_checkpoint_magic(header.magic) && header.qubits == n && header.precision == 64);
+        assert(header.sequence == 0 && header.records == 1);
+
+        // Moving the amplitudes to the top half changes two pages; only
+        // they go into the delta.
+        wf.apply_x(n - 1);
+        ok = cp.write(n, wf.state.data()) && cp.wait();
+        assert(ok);
+        CheckpointStats stats = cp.stats();
+        assert(stats.bases == 1 && stats.deltas == 1 && stats.pages_skipped == 62);
+        assert(exists(path + ".1"));
+        assert(file_size(path + ".1") * 100 < kStateFilePage * sizeof(std::complex<double>));
+        assert(matches(path, wf));
+
+        // The caller may change the state while the delta is written.
+        wf.apply_t(0);
+        ok = cp.write(n, wf.state.data());
+        assert(ok);
+        const std::vector<std::complex<double>> third(wf.state.begin(), wf.state.end());
+        wf.apply_h(5);
+        ok = cp.wait();
+        assert(ok);
+        std::vector<std::complex<double>> loaded;
+        ok = load_state_file(path, loaded);
+        assert(ok && loaded == third);
+
+        // A corrupt delta fails the checksum instead of loading.
+        {
+            std::fstream f(path + ".2", std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(static_cast<std::streamoff>(file_size(path + ".2")) - 3);
+            f.put('\x5a');
+        }
+        ok = load_state_file(path, loaded);
+        assert(!ok);
+
+        // When most pages change, a new base replaces the chain.
+        for (std::size_t q = 0; q < n; ++q) wf.apply_h(q);
+        ok = cp.write(n, wf.state.data()) && cp.wait();
+        assert(ok);
+        stats = cp.stats();
+        assert(stats.bases == 2 && stats.deltas == 2);
+        assert(!exists(path + ".1") && !exists(path + ".2"));
+        assert(matches(path, wf));
+
+        // After checkpoint_max_deltas deltas the next one is a base, and a
+        // change too big for the buffer is written before write() returns.
+        runtime_config.checkpoint_max_deltas = 1;
+        runtime_config.checkpoint_buffer_mb = 0;
+        wf.apply_cz(18, n - 1);
+        ok = cp.write(n, wf.state.data());
+        assert(ok && cp.stats().deltas == 3);
+        assert(matches(path, wf));
+        wf.apply_cz(17, n - 1);
+        ok = cp.write(n, wf.state.data());
+        assert(ok && cp.stats().bases == 3);
+        assert(matches(path, wf));
+        runtime_config.checkpoint_max_deltas = 8;
+        runtime_config.checkpoint_buffer_mb = 1024;
+
+        // A streamed state gives the same chain.
+        wf.apply_x(7);
+        ok = cp.write(n, state_source(wf)) && cp.wait();
+        assert(ok);
+        assert(matches(path, wf));
+    }
+    remove_chain(path);
+
+    // Registers checkpoint through the manager, disk-backed ones a page at
+    // a time, and loading waits for the write in flight.
+    runtime_config.disk_page_kb = 4;
+    runtime_config.disk_cache_mb = 1;
+    for (std::size_t limit : {std::size_t(0), std::size_t(1)}) {
+        set_disk_limit_mb(limit);
+        const std::size_t m = 17;
+        int id = memory.create_qregister(m);
+        assert(memory.qreg(id).wave().uses_disk() == (limit != 0));
+        for (std::size_t q = 0; q < 3; ++q) memory.qreg(id).h(q);
+        bool written = memory.checkpoint_if_needed(id, 3, 0.0, path);
+        assert(written);
+        memory.qreg(id).x(m - 1);
+        written = memory.checkpoint_if_needed(id, 3, 0.0, path);
+        assert(!written);
+        memory.qreg(id).z(0);
+        memory.qreg(id).s(1);
+        written = memory.checkpoint_if_needed(id, 3, 0.0, path);
+        assert(written);
+        const std::vector<std::complex<double>> expect = amplitudes(id);
+        bool ok = memory.wait_checkpoint(id);
+        assert(ok);
+        const CheckpointStats stats = memory.checkpoint_stats(id);
+        assert(stats.bases == 1 && stats.deltas == 1 && stats.pages_written == 3);
+        memory.qreg(id).h(m - 1);
+        ok = memory.load_state_from_file(id, path);
+        assert(ok);
+        assert(amplitudes(id) == expect);
+        memory.release_qregister(id);
+        remove_chain(path);
+    }
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+
+    // Sparse, SoA, remapped and lazily collapsed registers are checkpointed
+    // in logical order and keep their form.
+    for (int form = 0; form < 4; ++form) {
+        const std::size_t m = 12;
+        runtime_config.sparse_threshold = form == 0 ? 0.5 : 0.0;
+        int id = memory.create_qregister(m);
+        QRegister& reg = memory.qreg(id);
+        reg.h(0);
+        reg.cnot(0, 9);
+        reg.t(9);
+        Wavefunction<>& wf = reg.wave();
+        if (form == 1) wf.to_soa();
+        if (form == 2) wf.localize({9, 11}, 2);
+        if (form == 3) {
+            runtime_config.lazy_collapse = true;
+            reg.h(4);
+            reg.measure(4);
+            runtime_config.lazy_collapse = false;
+        }
+        const bool sparse = wf.using_sparse(), soa = wf.is_soa;
+        const auto layout = wf.layout;
+        const bool pending = wf.collapse_pending;
+        assert(sparse == (form == 0) && soa == (form == 1) && layout.empty() == (form != 2) &&
+               pending == (form == 3));
+        bool written = memory.checkpoint_if_needed(id, 1, 0.0, path);
+        assert(written);
+        bool ok = memory.wait_checkpoint(id);
+        assert(ok);
+        assert(wf.using_sparse() == sparse && wf.is_soa == soa && wf.layout == layout &&
+               wf.collapse_pending == pending);
+        std::vector<std::complex<double>> loaded;
+        ok = load_state_file(path, loaded);
+        assert(ok);
+        const std::vector<std::complex<double>> expect = amplitudes(id);
+        assert(loaded.size() == expect.size());
+        for (std::size_t i = 0; i < expect.size(); ++i)
+            assert(std::abs(loaded[i] - expect[i]) < 1e-12);
+        memory.release_qregister(id);
+        remove_chain(path);
+    }
+    runtime_config.sparse_threshold = 0.0;
+    runtime_config.checkpoint_codec = PageCodec::Raw;
+
+    std::cout << "Incremental checkpoint test passed." << std::endl;
+    return 0;
+}
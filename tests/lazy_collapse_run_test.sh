@@ -0,0 +1,35 @@
+#!/bin/sh
+set -e
+# The qpp-run to test, passed in by add_test.
+RUN="$1"
+# Private files, so parallel ctest runs do not share them.
+IR="$(mktemp)"
+OUT="$(mktemp)"
+trap 'rm -f "$IR" "$OUT"' EXIT
+# q[0] is measured, then rotated back onto its outcome and copied to q[1],
+# so every shot must read 000 or 111 whether or not the collapse is
+# deferred into the following gates.
+cat >"$IR" <<'IR'
+TASK lazy CPU
+QALLOC q 2
+CALLOC c 3
+SHOTS 40
+H q 0
+T q 1
+MEASURE q 0 -> c 0
+H q 0
+H q 0
+CNOT q 0 q 1
+MEASURE q 0 -> c 1
+MEASURE q 1 -> c 2
+ENDTASK
+IR
+for flag in "" --lazy-collapse; do
+  "$RUN" $flag "$IR" >"$OUT"
+  grep -q "40 shots" "$OUT"
+  if grep -E "lazy: +[01]{3}:" "$OUT" | grep -vqE " (000|111):"; then
+    echo "Collapse lost with flag '$flag'" >&2
+    cat "$OUT" >&2
+    exit 1
+  fi
+done
@@ -0,0 +1,93 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <vector>
+
+using namespace qpp;
+
+// Run the same feed-forward style circuit with eager and lazy collapse and
+// return the final state and measurement record.
+static std::vector<std::complex<double>> run(bool lazy, std::vector<std::size_t>& record) {
+    runtime_config.lazy_collapse = lazy;
+    seed_rng(31);
+    Wavefunction<> wf(5);
+    for (std::size_t q = 0; q < 5; ++q) wf.apply_h(q);
+    wf.apply_cnot(0, 3);
+    wf.apply_t(2);
+    record.push_back(wf.measure(1));
+    if (lazy) assert(wf.collapse_pending);
+    wf.apply_h(1);                // folds the pending collapse into its sweep
+    assert(!wf.collapse_pending);
+    record.push_back(wf.measure(4));
+    record.push_back(wf.measure({3, 0, 2}));
+    wf.apply_ry(0, 0.3);
+    record.push_back(wf.measure(2));
+    wf.apply_rz(3, 0.9);
+    wf.apply_cz(0, 3);
+    record.push_back(wf.measure({0, 3}));
+    std::vector<std::complex<double>> out;
+    for (std::size_t i = 0; i < wf.state.size(); ++i) out.push_back(wf.amplitude(i));
+    wf.apply_collapse();
+    for (std::size_t i = 0; i < wf.state.size(); ++i) assert(std::abs(wf.state[i] - out[i]) < 1e-12);
+    return out;
+}
+
+int main() {
+    std::vector<std::size_t> eager_record, lazy_record;
+    auto eager = run(false, eager_record);
+    auto lazy = run(true, lazy_record);
+    assert(eager_record == lazy_record);
+    double norm = 0.0;
+    for (std::size_t i = 0; i < eager.size(); ++i) {
+        assert(std::abs(eager[i] - lazy[i]) < 1e-12);
+        norm += std::norm(lazy[i]);
+    }
+    assert(std::abs(norm - 1.0) < 1e-9);
+
+    // Consecutive lazy measurements compose into one projector.
+    runtime_config.lazy_collapse = true;
+    Wavefunction<> bell(2);
+    bell.apply_h(0);
+    bell.apply_cnot(0, 1);
+    int a = bell.measure(0);
+    int b = bell.measure(1);
+    assert(a == b && bell.collapse_pending);
+    assert(std::abs(std::abs(bell.amplitude(a ? 3 : 0)) - 1.0) < 1e-12);
+
+    // Measuring all 17 qubits has too many outcomes for a table. The joint
+    // outcome is drawn over state indices, sees the collapse still pending
+    // from the first measurement, and leaves one basis state, in memory and
+    // on disk.
+    const std::size_t wide = 17;
+    std::vector<std::size_t> all(wide);
+    for (std::size_t q = 0; q < wide; ++q) all[q] = q;
+    runtime_config.disk_page_kb = 4;
+    std::size_t heavy = 0;
+    const int runs = 100;
+    for (int run = 0; run < runs; ++run) {
+        set_disk_limit_mb(run % 10 == 0 ? 1 : 0);
+        Wavefunction<> wf(wide);
+        wf.apply_ry(0, 2.0 * std::acos(std::sqrt(0.8)));
+        for (std::size_t q = 1; q < wide; ++q) wf.apply_cnot(0, q);
+        wf.apply_h(7);
+        const int bit7 = wf.measure(7);
+        assert(wf.collapse_pending);
+        const std::size_t joint = wf.measure(all);
+        const std::size_t rest = joint & ~(std::size_t(1) << 7);
+        assert(rest == 0 || rest == ((std::size_t(1) << wide) - 1) - (std::size_t(1) << 7));
+        assert(((joint >> 7) & 1) == std::size_t(bit7));
+        assert(std::abs(std::abs(wf.amplitude(joint)) - 1.0) < 1e-9);
+        if (rest) ++heavy;
+    }
+    assert(std::abs(double(heavy) / runs - 0.2) < 0.1);
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.lazy_collapse = false;
+
+    std::cout << "Lazy collapse test passed." << std::endl;
+    return 0;
+}
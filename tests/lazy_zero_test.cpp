@@ -0,0 +1,72 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/disk_pager.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace qpp;
+
+// Pages of `data` .. `data + bytes` the process has touched.
+static std::size_t resident_pages(const void* data, std::size_t bytes) {
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t count = (bytes + page - 1) / page;
+    std::vector<unsigned char> vec(count);
+    const int rc = mincore(const_cast<void*>(data), bytes, vec.data());
+    assert(rc == 0);
+    std::size_t touched = 0;
+    for (unsigned char v : vec) touched += v & 1;
+    return touched;
+}
+
+int main() {
+    // A fresh dense state is zero without having been written: only the
+    // page holding |0...0> is in memory until a gate runs.
+    const std::size_t n = 22;
+    Wavefunction<> wf(n);
+    const std::size_t bytes = wf.state.size() * sizeof(wf.state[0]);
+    assert(resident_pages(wf.state.data(), bytes) <= 2);
+    assert(wf.state[0] == 1.0 && wf.state[wf.state.size() - 1] == 0.0);
+    wf.apply_h(n - 1);
+    assert(std::abs(wf.state[std::size_t(1) << (n - 1)] - std::sqrt(0.5)) < 1e-12);
+    // reset() hands whole pages back rather than writing zeros over them.
+    wf.reset();
+    assert(resident_pages(wf.state.data(), bytes) <= 2);
+    for (std::size_t i = 1; i < wf.state.size(); i += 4099) assert(wf.state[i] == 0.0);
+    assert(wf.state[0] == 1.0);
+
+    // A fresh disk-backed state reads and writes only the pages its gates
+    // reach; the rest are known to be zero and skipped.
+    runtime_config.disk_page_kb = 4;
+    runtime_config.disk_cache_mb = 1;
+    set_disk_limit_mb(1);
+    Wavefunction<> disk(n);
+    assert(disk.uses_disk());
+    const std::size_t pages = disk.pager->page_count();
+    for (std::size_t p = 1; p < pages; ++p) assert(disk.pager->known_zero(p));
+    disk.apply_h(0);
+    disk.apply_h(n - 1);
+    disk.apply_cnot(n - 1, 3);
+    disk.apply_t(3);
+    const auto& stats = disk.pager->stats();
+    assert(stats.misses <= 8 && stats.bytes_read == 0);
+    assert(std::abs(disk.amplitude(0) - 0.5) < 1e-12);
+    assert(disk.nnz() == 4);
+    disk.pager->flush();
+    assert(stats.pages_written <= 16);
+    assert(!disk.pager->known_zero(pages / 2) && disk.pager->known_zero(pages / 2 + 1));
+
+    // After reset() every page is zero again.
+    disk.reset();
+    for (std::size_t p = 1; p < pages; ++p) assert(disk.pager->known_zero(p));
+    assert(disk.nnz() == 1);
+
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+
+    std::cout << "Lazy zero test passed." << std::endl;
+    return 0;
+}
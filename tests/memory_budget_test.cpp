@@ -0,0 +1,98 @@
+#include "../include/runtime_config.h"
+#include "../runtime/memory.h"
+#include "../runtime/scheduler.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+using namespace qpp;
+
+int main() {
+    // Accounting covers every representation.
+    const std::size_t base = memory.memory_usage();
+    int dense = memory.create_qregister(10);
+    memory.qreg(dense).h(0);
+    int stab = memory.create_qregister(200, RegisterForm::Stabilizer);
+    memory.qreg(stab).h(199);
+    int dd = memory.create_qregister(30, RegisterForm::QuIDD);
+    memory.qreg(dd).h(29);
+    int bits = memory.create_cregister(64);
+    bool saved = memory.save_resonance_zone(dense, "budget");
+    assert(saved);
+    MemoryBreakdown m = memory.memory_breakdown();
+    assert(m.dense >= 1024 * sizeof(std::complex<double>));
+    assert(m.stabilizer > 0 && m.quidd > 0 && m.classical >= 64 * sizeof(int));
+    assert(m.resonance_cache >= 1024 * sizeof(std::complex<double>));
+    assert(memory.memory_usage() == m.total() && m.total() > base);
+
+    runtime_config.sparse_threshold = 0.1;
+    int sparse = memory.create_qregister(16);
+    memory.qreg(sparse).h(3);
+    assert(memory.qreg(sparse).using_sparse());
+    assert(memory.memory_breakdown().sparse > 0);
+    runtime_config.sparse_threshold = 0.0;
+
+    runtime_config.disk_page_kb = 64;
+    runtime_config.disk_cache_mb = 4;
+    set_disk_limit_mb(1);
+    int disk = memory.create_qregister(18);
+    memory.qreg(disk).h(17);
+    memory.qreg(disk).wave().pager->flush();
+    m = memory.memory_breakdown();
+    assert(m.pager > 0 && m.pager <= (std::size_t(4) << 20) && m.disk > 0);
+    set_disk_limit_mb(0);
+    runtime_config.disk_cache_mb = 256;
+    memory.release_qregisters({dense, stab, dd, sparse, disk});
+    memory.release_cregister(bits);
+
+    // Admission: a dense state that does not fit goes to disk with the
+    // cache that does; once nothing fits, creation fails.
+    runtime_config.memory_budget_mb = 64;
+    int fits = memory.create_qregister(21);
+    assert(memory.qreg(fits).disk_cache_bytes == 0);
+    assert(memory.memory_reserved() >= std::size_t(32) << 20);
+    int spilled = memory.create_qregister(22);
+    QRegister& reg = memory.qreg(spilled);
+    assert(reg.disk_cache_bytes > 0 && reg.disk_cache_bytes <= std::size_t(32) << 20);
+    reg.h(21);
+    reg.cnot(21, 0);
+    assert(reg.wave().uses_disk());
+    assert(std::abs(reg.amp((std::size_t(1) << 21) | 1) - std::sqrt(0.5)) < 1e-12);
+    assert(memory.memory_reserved() <= std::size_t(64) << 20);
+    bool threw = false;
+    try {
+        memory.create_qregister(22);
+    } catch (const MemoryBudgetExceeded&) {
+        threw = true;
+    }
+    assert(threw);
+    // Stabilizer registers only need their tableau.
+    int wide = memory.create_qregister(300, RegisterForm::Stabilizer);
+    memory.release_qregisters({fits, spilled, wide});
+
+    // The scheduler puts a task that ran out of budget back once and keeps
+    // going past tasks that fail.
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.memory_budget_mb = 33;
+    int blocker = memory.create_qregister(21);
+    int attempts = 0, completed = 0;
+    bool later_ran = false;
+    Scheduler sched;
+    sched.add_task({"big", Target::CPU, ExecHint::NONE, 2, [&] {
+        ++attempts;
+        int id = memory.create_qregister(22);
+        memory.qreg(id).x(0);
+        memory.release_qregister(id);
+        ++completed;
+    }});
+    sched.add_task({"free", Target::CPU, ExecHint::NONE, 1, [&] { memory.release_qregister(blocker); }});
+    sched.add_task({"broken", Target::CPU, ExecHint::NONE, 0, [] { throw std::runtime_error("bad task"); }});
+    sched.add_task({"later", Target::CPU, ExecHint::NONE, -1, [&] { later_ran = true; }});
+    sched.run();
+    assert(attempts == 2 && completed == 1 && later_ran);
+
+    runtime_config.memory_budget_mb = 0;
+    std::cout << "Memory budget test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "../include/runtime_config.h"
+#include "../runtime/numa.h"
+#include "../runtime/wavefunction.h"
+#include <cassert>
+#include <iostream>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h>
+#define HAVE_MEMPOLICY 1
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace qpp;
+
+static std::size_t resident_pages(const void* data, std::size_t bytes) {
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> vec((bytes + page - 1) / page);
+    const int rc = mincore(const_cast<void*>(data), bytes, vec.data());
+    assert(rc == 0);
+    std::size_t touched = 0;
+    for (unsigned char v : vec) touched += v & 1;
+    return touched;
+}
+
+static void run_gates(Wavefunction<>& wf) {
+    const std::size_t n = wf.num_qubits;
+    for (std::size_t q = 0; q < n; q += 3) wf.apply_h(q);
+    wf.apply_cnot(0, n - 1);
+    wf.apply_t(n - 1);
+    wf.apply_h(n - 2);
+    wf.apply_cnot(n - 2, 1);
+}
+
+int main() {
+    assert((parse_cpu_list("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    assert(parse_cpu_list("").empty());
+    assert(parse_cpu_list("x-2").empty());
+    assert(!numa_nodes().empty());
+
+    // Every policy gives the same state and keeps allocation lazy.
+    const std::size_t n = 20;
+    Wavefunction<> ref(n);
+    run_gates(ref);
+    for (NumaPolicy policy : {NumaPolicy::FirstTouch, NumaPolicy::Interleave, NumaPolicy::Partition}) {
+        runtime_config.numa_policy = policy;
+        Wavefunction<> wf(n);
+        const std::size_t bytes = wf.state.size() * sizeof(wf.state[0]);
+        assert(resident_pages(wf.state.data(), bytes) <= 2);
+        run_gates(wf);
+        assert(wf.state == ref.state);
+    }
+
+#ifdef HAVE_MEMPOLICY
+    // Where the kernel supports it, the block carries the requested policy.
+    const std::size_t bytes = std::size_t(1) << 22;
+    void* block = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(block != MAP_FAILED);
+    const bool placed = place_state_pages(block, bytes, NumaPolicy::FirstTouch);
+    assert(!placed);
+    if (place_state_pages(block, bytes, NumaPolicy::Interleave)) {
+        int mode = -1;
+        unsigned long mask[16] = {};
+        const long rc = syscall(SYS_get_mempolicy, &mode, mask, 16 * 8 * sizeof(unsigned long),
+                                block, MPOL_F_ADDR);
+        assert(rc == 0);
+        assert(mode == MPOL_INTERLEAVE);
+        assert(mask[0] & (1UL << numa_nodes()[0]));
+    }
+    if (place_state_pages(block, bytes, NumaPolicy::Partition)) {
+        int mode = -1;
+        char* last = static_cast<char*>(block) + bytes - 1;
+        const long rc = syscall(SYS_get_mempolicy, &mode, nullptr, 0, last, MPOL_F_ADDR);
+        assert(rc == 0);
+        assert(mode == MPOL_PREFERRED);
+    }
+    munmap(block, bytes);
+#endif
+    runtime_config.numa_policy = NumaPolicy::FirstTouch;
+
+#ifdef _OPENMP
+    // Pinning binds every thread of the team to one CPU, once.
+    runtime_config.pin_threads = true;
+    Wavefunction<> pinned(n);
+    const int repinned = pin_omp_threads();
+    assert(repinned == 0);
+    int loose = 0;
+#pragma omp parallel reduction(+ : loose)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        const int rc = sched_getaffinity(0, sizeof(set), &set);
+        assert(rc == 0);
+        loose += CPU_COUNT(&set) != 1;
+    }
+    assert(loose == 0);
+    run_gates(pinned);
+    assert(pinned.state == ref.state);
+    runtime_config.pin_threads = false;
+#endif
+
+    std::cout << "NUMA allocation test passed." << std::endl;
+    return 0;
+}
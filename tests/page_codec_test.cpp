@@ -0,0 +1,174 @@
+#include "../include/runtime_config.h"
+#include "../runtime/page_codec.h"
+#include "../runtime/state_file.h"
+#include "../runtime/memory.h"
+#include "../runtime/disk_pager.h"
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+static std::size_t file_size(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    return static_cast<std::size_t>(ifs.tellg());
+}
+
+int main() {
+    std::mt19937 gen(11);
+    std::normal_distribution<double> dist(0.0, 1.0);
+    const std::size_t count = 1024;
+
+    // Random amplitudes spanning many magnitudes, a page with a few
+    // non-zeros and a uniform superposition.
+    std::vector<std::vector<std::complex<double>>> pages(3);
+    for (std::size_t i = 0; i < count; ++i)
+        pages[0].push_back({dist(gen) * std::pow(10.0, -double(i % 9)), dist(gen)});
+    pages[1].assign(count, 0.0);
+    for (std::size_t i = 0; i < count; i += 97) pages[1][i] = {0.25, -0.5};
+    pages[2].assign(count, 1.0 / std::sqrt(double(count)));
+
+    std::vector<std::uint8_t> bytes;
+    std::vector<std::complex<double>> back(count);
+    for (const auto& page : pages) {
+        encode_page(PageCodec::Lossless, page.data(), count, bytes);
+        assert(bytes.size() <= count * sizeof(std::complex<double>) + 1);
+        bool ok = decode_page(PageCodec::Lossless, bytes.data(), bytes.size(), back.data(), count);
+        assert(ok && back == page);
+        // A truncated page is rejected rather than decoded.
+        ok = decode_page(PageCodec::Lossless, bytes.data(), bytes.size() / 2, back.data(), count);
+        assert(!ok);
+
+        for (PageCodec codec : {PageCodec::Half, PageCodec::BFloat16, PageCodec::Fixed16}) {
+            encode_page(codec, page.data(), count, bytes);
+            assert(bytes.size() <= count * 2 * sizeof(std::uint16_t) + sizeof(double) + 1);
+            ok = decode_page(codec, bytes.data(), bytes.size(), back.data(), count);
+            assert(ok);
+            double peak = 0.0;
+            for (const auto& a : page) peak = std::max({peak, std::fabs(a.real()), std::fabs(a.imag())});
+            const double bound = page_codec_error(codec) * peak * (1.0 + 1e-9);
+            for (std::size_t i = 0; i < count; ++i) {
+                assert(std::fabs(back[i].real() - page[i].real()) <= bound);
+                assert(std::fabs(back[i].imag() - page[i].imag()) <= bound);
+            }
+        }
+    }
+    // Structured pages shrink well below their raw size.
+    encode_page(PageCodec::Lossless, pages[2].data(), count, bytes);
+    assert(bytes.size() * 20 < count * sizeof(std::complex<double>));
+    encode_page(PageCodec::Lossless, pages[1].data(), count, bytes);
+    assert(bytes.size() * 8 < count * sizeof(std::complex<double>));
+
+    PageCodec parsed;
+    bool ok = parse_page_codec("bf16", parsed);
+    assert(ok && parsed == PageCodec::BFloat16);
+    ok = parse_page_codec("zip", parsed);
+    assert(!ok);
+
+    // State files: Raw keeps the plain layout, the others skip zero pages.
+    const std::size_t n = 17;
+    Wavefunction<> wf(n);
+    for (std::size_t q = 0; q < 5; ++q) wf.apply_h(q);
+    wf.apply_t(2);
+    wf.apply_cnot(4, 16);
+    const std::string raw_path = "page_codec_raw.bin";
+    const std::string lz_path = "page_codec_lz.bin";
+    const std::string fp_path = "page_codec_fp16.bin";
+    ok = save_state_file(raw_path, wf, PageCodec::Raw) &&
+         save_state_file(lz_path, wf, PageCodec::Lossless) &&
+         save_state_file(fp_path, wf, PageCodec::Half);
+    assert(ok);
+    assert(file_size(raw_path) == sizeof(std::size_t) + wf.state.size() * sizeof(wf.state[0]));
+    assert(file_size(lz_path) * 100 < file_size(raw_path));
+    assert(file_size(fp_path) < file_size(lz_path) * 2);
+    const std::vector<std::complex<double>> expect(wf.state.begin(), wf.state.end());
+    std::vector<std::complex<double>> loaded;
+    ok = load_state_file(raw_path, loaded);
+    assert(ok && loaded == expect);
+    ok = load_state_file(lz_path, loaded);
+    assert(ok && loaded == expect);
+    ok = load_state_file(fp_path, loaded);
+    assert(ok);
+    for (std::size_t i = 0; i < loaded.size(); ++i)
+        assert(std::abs(loaded[i] - wf.state[i]) < 1e-3);
+
+    // Registers and checkpoints use runtime_config.checkpoint_codec, and
+    // load either layout. A decision diagram reads the coded files too.
+    runtime_config.checkpoint_codec = PageCodec::Lossless;
+    int id = memory.create_qregister(n);
+    ok = memory.import_state(id, expect) && memory.save_state_to_file(id, "page_codec_cp.bin");
+    assert(ok);
+    assert(file_size("page_codec_cp.bin") == file_size(lz_path));
+    memory.release_qregister(id);
+    int other = memory.create_qregister(n);
+    ok = memory.load_state_from_file(other, raw_path);
+    assert(ok);
+    ok = memory.load_state_from_file(other, "page_codec_cp.bin");
+    assert(ok);
+    assert(memory.export_state(other) == expect);
+    QuIDD dd(std::size_t(0));
+    ok = dd.load(lz_path);
+    assert(ok && dd.num_qubits() == n);
+    assert(std::abs(dd.amplitude(17) - wf.state[17]) < 1e-12);
+    memory.release_qregister(other);
+    runtime_config.checkpoint_codec = PageCodec::Raw;
+
+    // Disk-backed states with coded pages, with and without async I/O,
+    // match the in-memory state and write far fewer bytes.
+    runtime_config.disk_page_kb = 4;
+    runtime_config.disk_cache_mb = 1;
+    std::size_t raw_bytes = 0;
+    for (PageCodec codec : {PageCodec::Raw, PageCodec::Lossless, PageCodec::Half}) {
+        for (bool async : {false, true}) {
+            runtime_config.disk_codec = codec;
+            runtime_config.disk_async = async;
+            set_disk_limit_mb(1);
+            Wavefunction<> disk(n);
+            assert(disk.uses_disk() && disk.pager->codec() == codec);
+            for (std::size_t q = 0; q < 5; ++q) disk.apply_h(q);
+            disk.apply_t(2);
+            disk.apply_cnot(4, 16);
+            // Pages that fill and empty again are written back as zero.
+            disk.apply_x(15);
+            disk.pager->flush();
+            disk.apply_x(15);
+            disk.pager->flush();
+            const double tol = codec == PageCodec::Half ? 1e-3 : 1e-12;
+            for (std::size_t i = 0; i < wf.state.size(); ++i)
+                assert(std::abs(disk.amplitude(i) - wf.state[i]) < tol);
+            const auto& stats = disk.pager->stats();
+            if (codec == PageCodec::Raw) {
+                raw_bytes = stats.bytes_written;
+            } else {
+                assert(stats.zero_pages > 0);
+                assert(stats.bytes_written * 10 < raw_bytes);
+            }
+            if (codec == PageCodec::Lossless && async) {
+                // A disk-backed state saves and loads a page at a time.
+                ok = save_state_file("page_codec_disk.bin", disk, PageCodec::Lossless);
+                assert(ok);
+                ok = load_state_file("page_codec_disk.bin", loaded);
+                assert(ok && loaded == expect);
+                disk.apply_x(0);
+                ok = load_state_file(lz_path, disk);
+                assert(ok);
+                for (std::size_t i = 0; i < wf.state.size(); ++i)
+                    assert(disk.amplitude(i) == wf.state[i]);
+            }
+        }
+    }
+    set_disk_limit_mb(0);
+    runtime_config.disk_codec = PageCodec::Raw;
+    runtime_config.disk_async = true;
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+
+    for (const char* path : {"page_codec_raw.bin", "page_codec_lz.bin", "page_codec_fp16.bin",
+                             "page_codec_cp.bin", "page_codec_disk.bin"})
+        std::remove(path);
+    std::cout << "Page codec test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "../runtime/wavefunction.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace qpp;
+
+static GateMatrix<double> random_gate(std::vector<std::size_t> qubits, std::mt19937& gen) {
+    std::normal_distribution<double> dist(0.0, 1.0);
+    std::size_t dim = 1ULL << qubits.size();
+    GateMatrix<double> g{qubits, std::vector<std::complex<double>>(dim * dim)};
+    for (auto& a : g.matrix) a = {dist(gen), dist(gen)};
+    return g;
+}
+
+static void expect_same(const Wavefunction<>& wf, const Wavefunction<>& ref) {
+    for (std::size_t i = 0; i < ref.state.size(); ++i)
+        assert(std::abs(wf.amplitude(i) - ref.state[i]) < 1e-9);
+}
+
+int main() {
+    std::mt19937 gen(11);
+    std::normal_distribution<double> dist(0.0, 1.0);
+    const std::size_t n = 10;
+    StateVector<double> init(1ULL << n);
+    double norm = 0.0;
+    for (auto& a : init) {
+        a = {dist(gen), dist(gen)};
+        norm += std::norm(a);
+    }
+    for (auto& a : init) a /= std::sqrt(norm);
+
+    // A cluster living on high qubits is moved below the 4-qubit block.
+    std::vector<GateMatrix<double>> gates = {
+        random_gate({9}, gen), random_gate({8, 9}, gen), random_gate({0, 8}, gen),
+        random_gate({9, 0, 8}, gen), random_gate({7}, gen),
+    };
+    Wavefunction<> wf(n), ref(n);
+    wf.state = init;
+    ref.state = init;
+    const std::complex<double>* buffer = wf.state.data();
+    wf.apply_blocked(gates, 4);
+    for (const auto& g : gates) ref.apply_matrix_k(g.qubits, g.matrix);
+    assert(!wf.layout.empty());
+    // The remap happens in place.
+    assert(wf.state.data() == buffer);
+    for (auto q : {0, 7, 8, 9}) assert(wf.physical_qubit(q) < 4);
+    expect_same(wf, ref);
+
+    // Later gates and measurements keep addressing logical qubits.
+    wf.apply_h(9);
+    ref.apply_h(9);
+    wf.apply_cnot(8, 3);
+    ref.apply_cnot(8, 3);
+    wf.apply_t(7);
+    ref.apply_t(7);
+    wf.apply_swap(9, 5);
+    ref.apply_swap(9, 5);
+    expect_same(wf, ref);
+
+    seed_rng(4);
+    int a = wf.measure(9);
+    seed_rng(4);
+    int b = ref.measure(9);
+    assert(b == a);
+    seed_rng(5);
+    std::size_t m = wf.measure({8, 2, 0});
+    seed_rng(5);
+    std::size_t ref_m = ref.measure({8, 2, 0});
+    assert(ref_m == m);
+    expect_same(wf, ref);
+
+    // Sparse states are remapped through their keys.
+    wf.compress();
+    expect_same(wf, ref);
+    wf.decompress();
+
+    wf.restore_layout();
+    assert(wf.layout.empty());
+    for (std::size_t i = 0; i < ref.state.size(); ++i)
+        assert(std::abs(wf.state[i] - ref.state[i]) < 1e-9);
+
+    std::cout << "Qubit remap test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "../runtime/wavefunction.h"
+#include "../runtime/quidd.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+int main() {
+    seed_rng(5);
+    std::mt19937 gen(9);
+
+    // Amplitudes that differ only by rounding noise share nodes: a uniform
+    // superposition needs one node per qubit.
+    const std::size_t n = 12;
+    std::normal_distribution<double> noise(0.0, 1e-16);
+    std::vector<std::complex<double>> st(1ULL << n);
+    const double amp = 1.0 / std::sqrt(static_cast<double>(st.size()));
+    for (auto& c : st) c = amp * std::complex<double>(1.0 + noise(gen), noise(gen));
+    QuIDD uniform(st);
+    assert(uniform.node_count() == n);
+    for (std::size_t i = 0; i < st.size(); i += 97)
+        assert(std::abs(uniform.amplitude(i) - st[i]) < 1e-12);
+
+    // A long circuit leaves dead intermediates behind; collecting drops
+    // them without changing the state.
+    Wavefunction<> wf(n);
+    QuIDD dd(n);
+    for (int step = 0; step < 400; ++step) {
+        std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+        double theta = 0.1 * (gen() % 63);
+        switch (gen() % 4) {
+        case 0: wf.apply_h(a); dd.apply_h(a); break;
+        case 1: wf.apply_ry(a, theta); dd.apply_ry(a, theta); break;
+        case 2: wf.apply_t(a); dd.apply_t(a); break;
+        default: wf.apply_cnot(a, b); dd.apply_cnot(a, b); break;
+        }
+    }
+    std::size_t before = dd.node_count();
+    std::size_t bytes = dd.memory_bytes();
+    dd.collect();
+    assert(dd.node_count() <= before && dd.memory_bytes() <= bytes);
+    assert(dd.node_count() < (1ULL << n));
+    auto vec = dd.to_vector();
+    for (std::size_t i = 0; i < vec.size(); ++i) assert(std::abs(vec[i] - wf.state[i]) < 1e-9);
+
+    // Freed slots are reused, so the arena stays bounded over many gates.
+    QuIDD ghz(30);
+    ghz.apply_h(0);
+    for (int round = 0; round < 200; ++round)
+        for (std::size_t q = 1; q < 30; ++q) ghz.apply_cnot(0, q);
+    ghz.collect();
+    assert(ghz.node_count() <= 2 * 30);
+    assert(std::abs(std::abs(ghz.amplitude(0)) - 1.0 / std::sqrt(2.0)) < 1e-12);
+
+    std::cout << "QuIDD arena test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "../runtime/quidd.h"
+#include "../runtime/disk_pager.h"
+#include "../runtime/memory.h"
+#include "../runtime/random.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace qpp;
+
+int main() {
+    seed_rng(8);
+
+    // A dense checkpoint streams into the same diagram as the in-memory build.
+    const std::size_t n = 10;
+    QRegister dense(n);
+    dense.h(0);
+    for (std::size_t q = 1; q < n; ++q) dense.cnot(q - 1, q);
+    dense.ry(4, 0.7);
+    dense.t(9);
+    const std::string ckpt = "quidd_file_test.ckpt";
+    bool ok = dense.save_to_file(ckpt);
+    assert(ok);
+    QuIDD streamed(std::size_t(0));
+    ok = streamed.load(ckpt);
+    assert(ok);
+    QuIDD built(dense.wave().state);
+    assert(streamed.num_qubits() == n && streamed.node_count() == built.node_count());
+    for (std::size_t i = 0; i < dense.wave().state.size(); ++i)
+        assert(std::abs(streamed.amplitude(i) - dense.wave().state[i]) < 1e-12);
+
+    // Chunks of any size, including ones that split a level.
+    std::size_t next = 0;
+    QuIDD chunked(n, [&](std::complex<double>* out, std::size_t max) {
+        std::size_t count = std::min<std::size_t>(max, 7);
+        count = std::min(count, dense.wave().state.size() - next);
+        for (std::size_t k = 0; k < count; ++k) out[k] = dense.wave().state[next + k];
+        next += count;
+        return count;
+    });
+    assert(chunked.node_count() == built.node_count());
+    bool threw = false;
+    try {
+        QuIDD truncated(n, [](std::complex<double>*, std::size_t) { return std::size_t(0); });
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Straight from a pager.
+    DiskPager pager(1ULL << n, 64);
+    for (std::size_t i = 0; i < pager.size(); ++i) pager.write(i, dense.wave().state[i]);
+    QuIDD paged(pager);
+    for (std::size_t i = 0; i < pager.size(); i += 13)
+        assert(std::abs(paged.amplitude(i) - dense.wave().state[i]) < 1e-12);
+
+    // A 60-qubit diagram file is a few hundred bytes, answers single
+    // amplitudes through the mapping and loads back for further gates.
+    QRegister wide(60);
+    wide.use_quidd();
+    wide.h(0);
+    for (std::size_t q = 1; q < 60; ++q) wide.cnot(0, q);
+    wide.rz(30, 0.4);
+    const std::string qdd = "quidd_file_test.qdd";
+    ok = wide.save_to_file(qdd);
+    assert(ok);
+    {
+        MappedQuIDD mapped(qdd);
+        assert(mapped.num_qubits() == 60 && mapped.node_count() <= 2 * 60);
+        const std::size_t ones = (1ULL << 60) - 1;
+        assert(std::abs(mapped.amplitude(0) - wide.amp(0)) < 1e-12);
+        assert(std::abs(mapped.amplitude(ones) - wide.amp(ones)) < 1e-12);
+        assert(std::abs(mapped.amplitude(12345)) < 1e-12);
+    }
+    QRegister restored(60);
+    restored.use_quidd();
+    ok = restored.load_from_file(qdd);
+    assert(ok);
+    restored.cnot(0, 59);
+    restored.h(0);
+    wide.cnot(0, 59);
+    wide.h(0);
+    for (std::size_t i : {0ULL, 1ULL, (1ULL << 59) - 1, (1ULL << 60) - 1})
+        assert(std::abs(restored.amp(i) - wide.amp(i)) < 1e-12);
+    QRegister mismatched(59);
+    mismatched.use_quidd();
+    ok = mismatched.load_from_file(qdd);
+    assert(!ok);
+
+    threw = false;
+    try {
+        MappedQuIDD bad(ckpt);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // A node that refers to itself, names a missing weight or tests a qubit
+    // outside the register is rejected on opening instead of followed.
+    std::ifstream in(qdd, std::ios::binary);
+    const std::string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::uint32_t weights = 0;
+    std::memcpy(&weights, good.data() + 16, sizeof(weights));
+    const std::size_t node = 40 + weights * sizeof(std::complex<double>) + 2 * sizeof(QuIDD::Node);
+    const std::string broken = "quidd_file_test_bad.qdd";
+    for (std::size_t field : {std::size_t(0), std::size_t(12), std::size_t(16)}) {
+        std::string bytes = good;
+        const std::uint32_t value = field == 0 ? 2 : field == 12 ? weights : 60;
+        std::memcpy(&bytes[node + field], &value, sizeof(value));
+        std::ofstream(broken, std::ios::binary) << bytes;
+        threw = false;
+        try {
+            MappedQuIDD bad(broken);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        QuIDD loaded(std::size_t(0));
+        ok = loaded.load(broken);
+        assert(!ok);
+    }
+    // Header counts far beyond the file, or a file cut short, fail without
+    // allocating what the header claims.
+    for (std::size_t field : {std::size_t(12), std::size_t(16), std::size_t(0)}) {
+        std::string bytes = good;
+        if (field == 0) {
+            bytes.resize(bytes.size() - sizeof(QuIDD::Node));
+        } else {
+            const std::uint32_t huge = 0xFFFFFFF0u;
+            std::memcpy(&bytes[field], &huge, sizeof(huge));
+        }
+        std::ofstream(broken, std::ios::binary) << bytes;
+        QuIDD loaded(std::size_t(0));
+        ok = loaded.load(broken);
+        assert(!ok);
+    }
+    std::remove(broken.c_str());
+
+    // The memory manager's state helpers work on the diagram itself: no
+    // dense state is built beside it, even for a 60-qubit register.
+    int id = memory.create_qregister(60, RegisterForm::QuIDD);
+    memory.qreg(id).h(0);
+    for (std::size_t q = 1; q < 60; ++q) memory.qreg(id).cnot(0, q);
+    assert(memory.qreg(id).nnz() == 2 && !memory.qreg(id).using_sparse());
+    memory.qreg(id).compress();
+    ok = memory.save_state_to_file(id, qdd);
+    assert(ok);
+    memory.qreg(id).x(5);
+    ok = memory.load_state_from_file(id, qdd);
+    assert(ok);
+    assert(std::abs(memory.qreg(id).amp((1ULL << 60) - 1) - std::sqrt(0.5)) < 1e-12);
+    ok = memory.import_state(id, {1.0});
+    assert(!ok);
+    assert(!memory.qreg(id).wf);
+    memory.release_qregister(id);
+
+    id = memory.create_qregister(10, RegisterForm::QuIDD);
+    QRegister& small = memory.qreg(id);
+    for (std::size_t q = 0; q < 10; q += 3) small.h(q);
+    small.cnot(0, 9);
+    small.rz(4, 0.3);
+    small.t(6);
+    std::vector<std::complex<double>> exported = memory.export_state(id);
+    assert(exported.size() == 1024 && small.nnz() == 16);
+    // Streamed in uneven chunks, the diagram gives the exported amplitudes.
+    QuIDD::AmplitudeSource source = small.dd->stream();
+    std::vector<std::complex<double>> chunks(exported.size());
+    for (std::size_t i = 0; i < chunks.size();) {
+        const std::size_t got = source(chunks.data() + i, 7);
+        assert(got > 0);
+        i += got;
+    }
+    assert(source(chunks.data(), 7) == 0);
+    for (std::size_t i = 0; i < exported.size(); ++i) {
+        assert(std::abs(exported[i] - small.amp(i)) < 1e-12);
+        assert(std::abs(chunks[i] - exported[i]) < 1e-12);
+    }
+    const std::string chain = "quidd_file_test_chain.bin";
+    bool written = memory.checkpoint_if_needed(id, 1, 0.0, chain);
+    assert(written);
+    ok = memory.wait_checkpoint(id);
+    assert(ok && !small.wf);
+    std::vector<std::complex<double>> loaded;
+    ok = load_state_file(chain, loaded);
+    assert(ok && loaded.size() == exported.size());
+    for (std::size_t i = 0; i < exported.size(); ++i)
+        assert(std::abs(loaded[i] - exported[i]) < 1e-12);
+    std::reverse(exported.begin(), exported.end());
+    ok = memory.import_state(id, exported);
+    assert(ok && std::abs(small.amp(1023 - 9) - exported[1023 - 9]) < 1e-12);
+    memory.release_qregister(id);
+    std::remove(chain.c_str());
+
+    std::remove(ckpt.c_str());
+    std::remove(qdd.c_str());
+    std::cout << "QuIDD file test passed." << std::endl;
+    return 0;
+}
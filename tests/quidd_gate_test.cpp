@@ -0,0 +1,98 @@
+#include "../runtime/wavefunction.h"
+#include "../runtime/quidd.h"
+#include "../runtime/memory.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+int main() {
+    seed_rng(3);
+    std::mt19937 gen(77);
+
+    // Random circuits against the dense simulator.
+    const std::size_t n = 6;
+    for (int trial = 0; trial < 30; ++trial) {
+        Wavefunction<> wf(n);
+        QuIDD dd(n);
+        for (int step = 0; step < 50; ++step) {
+            std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+            std::size_t c = (b + 1) % n == a ? (b + 2) % n : (b + 1) % n;
+            double theta = 0.1 * (gen() % 63);
+            switch (gen() % 13) {
+            case 0: wf.apply_h(a); dd.apply_h(a); break;
+            case 1: wf.apply_x(a); dd.apply_x(a); break;
+            case 2: wf.apply_y(a); dd.apply_y(a); break;
+            case 3: wf.apply_z(a); dd.apply_z(a); break;
+            case 4: wf.apply_s(a); dd.apply_s(a); break;
+            case 5: wf.apply_t(a); dd.apply_t(a); break;
+            case 6: wf.apply_rx(a, theta); dd.apply_rx(a, theta); break;
+            case 7: wf.apply_ry(a, theta); dd.apply_ry(a, theta); break;
+            case 8: wf.apply_rz(a, theta); dd.apply_rz(a, theta); break;
+            case 9: wf.apply_cnot(a, b); dd.apply_cnot(a, b); break;
+            case 10: wf.apply_cz(a, b); dd.apply_cz(a, b); break;
+            case 11: wf.apply_ccnot(a, b, c); dd.apply_ccnot(a, b, c); break;
+            default: wf.apply_swap(a, b); dd.apply_swap(a, b); break;
+            }
+        }
+        auto vec = dd.to_vector();
+        for (std::size_t i = 0; i < vec.size(); ++i) {
+            assert(std::abs(vec[i] - wf.state[i]) < 1e-9);
+            assert(std::abs(dd.amplitude(i) - wf.state[i]) < 1e-9);
+        }
+    }
+
+    // 50-qubit GHZ: a handful of nodes per qubit, perfectly correlated
+    // samples and measurements.
+    const std::size_t wide = 50;
+    QuIDD ghz(wide);
+    ghz.apply_h(0);
+    for (std::size_t q = 1; q < wide; ++q) ghz.apply_cnot(0, q);
+    const std::size_t ones = (1ULL << wide) - 1;
+    assert(std::abs(std::abs(ghz.amplitude(0)) - 1.0 / std::sqrt(2.0)) < 1e-12);
+    assert(std::abs(std::abs(ghz.amplitude(ones)) - 1.0 / std::sqrt(2.0)) < 1e-12);
+    assert(std::abs(ghz.amplitude(5)) < 1e-12);
+    auto counts = ghz.sample({0, 17, 49}, 200);
+    assert(counts.size() == 2 && counts[0] + counts[7] == 200);
+    assert(counts[0] > 50 && counts[7] > 50);
+    int first = ghz.measure(25);
+    for (std::size_t q = 0; q < wide; q += 7) {
+        int m = ghz.measure(q);
+        assert(m == first);
+    }
+
+    // Ripple-carry increment on a 40-qubit register built from CCX/CNOT/X.
+    const std::size_t bits = 40;
+    QuIDD adder(bits);
+    const std::size_t value = 0x5A5A5A5A5FULL;
+    for (std::size_t q = 0; q < bits; ++q)
+        if ((value >> q) & 1ULL) adder.apply_x(q);
+    // +1: flip bit q when every lower bit is 1, highest bit first.
+    for (std::size_t q = bits - 1; q > 0; --q) {
+        std::vector<std::size_t> lower;
+        for (std::size_t j = 0; j < q; ++j) lower.push_back(j);
+        std::size_t mask = 0;
+        for (auto j : lower) mask |= 1ULL << j;
+        const std::complex<double> xm[2][2] = {{0, 1}, {1, 0}};
+        adder.apply_controlled(mask, q, xm);
+    }
+    adder.apply_x(0);
+    assert(std::abs(adder.amplitude(value + 1) - 1.0) < 1e-12);
+
+    // A register in decision-diagram mode never builds the dense state.
+    QRegister qr(48);
+    qr.use_quidd();
+    qr.h(0);
+    for (std::size_t q = 1; q < 48; ++q) qr.cnot(q - 1, q);
+    qr.t(3);
+    assert(!qr.wf);
+    int low = qr.measure(0);
+    int high = qr.measure(47);
+    assert(low == high);
+
+    std::cout << "QuIDD gate test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "../runtime/memory.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace qpp;
+
+int main() {
+    // A handle keeps a released register alive, and its id out of reuse,
+    // until the handle goes away.
+    int id = memory.create_qregister(2);
+    {
+        QRegHandle h = memory.qreg_handle(id);
+        h->x(1);
+        bool released = memory.release_qregister(id);
+        assert(released);
+        released = memory.release_qregister(id);
+        assert(!released);
+        bool threw = false;
+        try {
+            memory.qreg(id);
+        } catch (const std::out_of_range&) {
+            threw = true;
+        }
+        assert(threw);
+        h->h(0);
+        assert(h->ops() == 2);
+        int other = memory.create_qregister(1);
+        assert(other != id);
+        memory.release_qregister(other);
+        QRegHandle moved = std::move(h);
+        assert(!h && moved);
+    }
+    int again = memory.create_qregister(1);
+    assert(again == id);
+    memory.release_qregister(again);
+
+    bool threw = false;
+    try {
+        memory.qreg_handle(1 << 30);
+    } catch (const std::out_of_range&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Readers run gates through lookups and handles while other threads
+    // create and release registers around them.
+    std::vector<int> ids;
+    for (int i = 0; i < 4; ++i) ids.push_back(memory.create_qregister(1));
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&, i] {
+            QRegHandle h = memory.qreg_handle(ids[i]);
+            for (int k = 0; k < 2000; ++k) {
+                memory.qreg(ids[i]).x(0);
+                h->x(0);
+            }
+        });
+    }
+    std::atomic<int> churned{0};
+    for (int i = 0; i < 2; ++i) {
+        threads.emplace_back([&] {
+            while (!stop.load()) {
+                int temp = memory.create_qregister(1);
+                QRegHandle h = memory.qreg_handle(temp);
+                memory.release_qregister(temp);
+                h->h(0);
+                ++churned;
+            }
+        });
+    }
+    for (int i = 0; i < 4; ++i) threads[i].join();
+    stop = true;
+    for (std::size_t i = 4; i < threads.size(); ++i) threads[i].join();
+    for (int i = 0; i < 4; ++i) {
+        assert(memory.qreg(ids[i]).ops() == 4000);
+        assert(memory.qreg(ids[i]).amp(0) == 1.0);
+    }
+    memory.release_qregisters(ids);
+    assert(churned.load() > 0);
+
+    std::cout << "Register handle test passed." << std::endl;
+    return 0;
+}
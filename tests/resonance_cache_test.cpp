@@ -0,0 +1,167 @@
+#include "../include/runtime_config.h"
+#include "../runtime/memory.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace qpp;
+
+// Whether the mapping that starts at `data` is a cached zone's file.
+static bool maps_zone(const void* data) {
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::uintptr_t start = 0;
+        std::istringstream(line) >> std::hex >> start;
+        if (start == reinterpret_cast<std::uintptr_t>(data))
+            return line.find("qpp_zone") != std::string::npos;
+    }
+    return false;
+}
+
+static bool same(const std::vector<std::complex<double>>& a,
+                 const std::vector<std::complex<double>>& b) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        if (std::abs(a[i] - b[i]) > 1e-12) return false;
+    return true;
+}
+
+int main() {
+    seed_rng(7);
+    // Three 1 MB zones against a 2 MB cache.
+    const std::size_t n = 16;
+    runtime_config.resonance_cache_mb = 2;
+    int id = memory.create_qregister(n);
+    std::vector<std::vector<std::complex<double>>> zones;
+    bool ok = false;
+    for (const char* key : {"a", "b", "c"}) {
+        memory.qreg(id).h(zones.size());
+        memory.qreg(id).t(zones.size());
+        memory.qreg(id).cnot(zones.size(), n - 1);
+        ok = memory.save_resonance_zone(id, key);
+        assert(ok);
+        zones.push_back(memory.export_state(id));
+    }
+    ResonanceCacheStats stats = memory.resonance_stats();
+    assert(stats.entries == 3 && stats.evictions == 1 && stats.spills == 1);
+    assert(stats.memory_bytes == (std::size_t(2) << 20));
+    // Spill files are compressed.
+    assert(stats.disk_bytes > 0 && stats.disk_bytes * 10 < (std::size_t(1) << 20));
+    assert(memory.memory_breakdown().resonance_cache == stats.memory_bytes);
+
+    // A spilled zone comes back from disk and pushes out the oldest.
+    ok = memory.load_resonance_zone(id, "a");
+    assert(ok);
+    assert(same(memory.export_state(id), zones[0]));
+    stats = memory.resonance_stats();
+    assert(stats.disk_hits == 1 && stats.evictions == 2 && stats.spills == 2);
+    ok = memory.load_resonance_zone(id, "b");
+    assert(ok);
+    assert(same(memory.export_state(id), zones[1]));
+
+    // A zone in memory is copied out on base pages, and gates after the
+    // load leave the cached copy alone.
+    ok = memory.load_resonance_zone(id, "c");
+    assert(ok);
+    assert(!maps_zone(memory.qreg(id).wave().state.data()));
+    assert(same(memory.export_state(id), zones[2]));
+    memory.qreg(id).x(3);
+    memory.qreg(id).h(n - 1);
+    assert(!same(memory.export_state(id), zones[2]));
+    ok = memory.load_resonance_zone(id, "c");
+    assert(ok);
+    assert(same(memory.export_state(id), zones[2]));
+    stats = memory.resonance_stats();
+    assert(stats.hits == 1 && stats.disk_hits == 3);
+
+    ok = memory.load_resonance_zone(id, "missing");
+    assert(!ok);
+    assert(memory.resonance_stats().misses == 1);
+
+    // A save/restore loop keeps one copy, whatever the iteration count.
+    for (int iter = 0; iter < 50; ++iter) {
+        memory.qreg(id).ry(iter % n, 0.1 * iter);
+        ok = memory.save_resonance_zone(id, "ref");
+        assert(ok);
+        memory.qreg(id).h(0);
+        ok = memory.load_resonance_zone(id, "ref");
+        assert(ok);
+    }
+    stats = memory.resonance_stats();
+    assert(stats.entries == 4 && stats.memory_bytes <= (std::size_t(2) << 20));
+
+    // A zone larger than the cache goes straight to disk.
+    runtime_config.resonance_cache_mb = 0;
+    ok = memory.save_resonance_zone(id, "big");
+    assert(ok);
+    const auto big = memory.export_state(id);
+    memory.qreg(id).x(0);
+    ok = memory.load_resonance_zone(id, "big");
+    assert(ok);
+    assert(same(memory.export_state(id), big));
+    for (const char* key : {"a", "b", "c", "ref", "big"}) {
+        ok = memory.drop_resonance_zone(key);
+        assert(ok);
+    }
+    stats = memory.resonance_stats();
+    assert(stats.entries == 0 && stats.memory_bytes == 0 && stats.disk_bytes == 0);
+
+    // On explicit huge pages, where the pool has them, a loaded zone is
+    // mapped into the register instead, and reset() gives the register
+    // zeros of its own rather than the zone's pages.
+    runtime_config.huge_pages = HugePages::Explicit;
+    runtime_config.resonance_cache_mb = 8;
+    int wide = memory.create_qregister(n + 1);
+    memory.qreg(wide).h(2);
+    memory.qreg(wide).cnot(2, n);
+    ok = memory.save_resonance_zone(wide, "wide");
+    assert(ok);
+    const auto wide_state = memory.export_state(wide);
+    memory.qreg(wide).reset();
+    ok = memory.load_resonance_zone(wide, "wide");
+    assert(ok);
+    assert(same(memory.export_state(wide), wide_state));
+    memory.qreg(wide).x(0);
+    ok = memory.load_resonance_zone(wide, "wide");
+    assert(ok);
+    assert(same(memory.export_state(wide), wide_state));
+    memory.qreg(wide).reset();
+    const auto& st = memory.qreg(wide).wave().state;
+    assert(!maps_zone(st.data()));
+    assert(st[0] == 1.0);
+    for (std::size_t i = 1; i < st.size(); i += 7) assert(st[i] == 0.0);
+    ok = memory.drop_resonance_zone("wide");
+    assert(ok);
+    memory.release_qregister(wide);
+    runtime_config.huge_pages = HugePages::Off;
+
+    // Without spilling a zone over the limit is refused and evicted zones
+    // are dropped.
+    runtime_config.resonance_cache_mb = 0;
+    runtime_config.resonance_spill = false;
+    ok = memory.save_resonance_zone(id, "refused");
+    assert(!ok);
+    runtime_config.resonance_cache_mb = 1;
+    ok = memory.save_resonance_zone(id, "d");
+    assert(ok);
+    ok = memory.save_resonance_zone(id, "e");
+    assert(ok);
+    ok = memory.load_resonance_zone(id, "d");
+    assert(!ok);
+    ok = memory.load_resonance_zone(id, "e");
+    assert(ok);
+    assert(memory.resonance_stats().entries == 1 && memory.resonance_stats().disk_bytes == 0);
+    ok = memory.drop_resonance_zone("e");
+    assert(ok);
+    memory.release_qregister(id);
+    runtime_config.resonance_spill = true;
+    runtime_config.resonance_cache_mb = 256;
+
+    std::cout << "Resonance cache eviction test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/memory.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <vector>
+
+using namespace qpp;
+
+int main() {
+    seed_rng(17);
+    const std::size_t shots = 20000;
+
+    // Bell pair: only 00 and 11, evenly split, and the state is untouched.
+    Wavefunction<> bell(3);
+    bell.apply_h(0);
+    bell.apply_cnot(0, 1);
+    auto before = bell.state;
+    auto hist = bell.sample({0, 1}, shots);
+    assert(hist.size() == 2 && hist.count(0) && hist.count(3));
+    assert(hist[0] + hist[3] == shots);
+    assert(std::abs(double(hist[0]) / shots - 0.5) < 0.03);
+    for (std::size_t i = 0; i < before.size(); ++i) assert(bell.state[i] == before[i]);
+
+    // Marginal of an uneven superposition; bit j follows qubits[j].
+    Wavefunction<> skew(2);
+    skew.apply_ry(1, 2.0 * std::acos(std::sqrt(0.8)));
+    skew.apply_x(0);
+    hist = skew.sample({1, 0}, shots);
+    assert(hist.size() == 2 && hist.count(2) && hist.count(3));
+    assert(std::abs(double(hist[2]) / shots - 0.8) < 0.03);
+
+    // Sparse and SoA storage draw from the same distribution.
+    Wavefunction<> sparse(3);
+    sparse.apply_h(2);
+    sparse.compress();
+    hist = sparse.sample({2}, shots);
+    assert(std::abs(double(hist[1]) / shots - 0.5) < 0.03);
+    Wavefunction<> soa(3);
+    soa.apply_h(1);
+    soa.to_soa();
+    hist = soa.sample({1, 2}, shots);
+    assert(hist.size() == 2 && std::abs(double(hist[1]) / shots - 0.5) < 0.03);
+
+    // Sampling every qubit of a 17-qubit register has too many outcomes for
+    // a table; the shots are drawn over state indices instead, in dense,
+    // SoA and disk-backed storage alike.
+    const std::size_t wide = 17;
+    std::vector<std::size_t> all;
+    for (std::size_t q = wide; q-- > 0;) all.push_back(q);
+    for (int storage = 0; storage < 3; ++storage) {
+        if (storage == 2) {
+            runtime_config.disk_page_kb = 4;
+            set_disk_limit_mb(1);
+        }
+        Wavefunction<> ghz(wide);
+        assert(ghz.uses_disk() == (storage == 2));
+        ghz.apply_ry(0, 2.0 * std::acos(std::sqrt(0.8)));
+        for (std::size_t q = 1; q < wide; ++q) ghz.apply_cnot(0, q);
+        ghz.apply_h(7);
+        if (storage == 1) ghz.to_soa();
+        hist = ghz.sample(all, shots);
+        std::size_t ones = 0, total = 0;
+        for (const auto& kv : hist) {
+            // Bit j is qubit 16 - j, so qubit 7 is bit 9.
+            const std::size_t rest = kv.first & ~(std::size_t(1) << 9);
+            assert(rest == 0 || rest == ((std::size_t(1) << wide) - 1) - (std::size_t(1) << 9));
+            if (rest) ones += kv.second;
+            total += kv.second;
+        }
+        assert(hist.size() == 4 && total == shots);
+        assert(std::abs(double(ones) / shots - 0.2) < 0.03);
+        set_disk_limit_mb(0);
+        runtime_config.disk_page_kb = 1024;
+    }
+
+    // Stabilizer registers sample from copies of the tableau.
+    QRegister ghz(30);
+    ghz.use_stabilizer();
+    ghz.h(0);
+    for (std::size_t q = 1; q < 30; ++q) ghz.cnot(0, q);
+    hist = ghz.sample({0, 15, 29}, 2000);
+    assert(hist.size() == 2 && hist.count(0) && hist.count(7));
+    assert(hist[0] + hist[7] == 2000);
+
+    std::cout << "Sampling test passed." << std::endl;
+    return 0;
+}
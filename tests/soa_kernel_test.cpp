@@ -0,0 +1,104 @@
+#include "../runtime/soa_kernels.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace qpp;
+
+template<typename Real>
+using Soa = std::vector<Real, AlignedAllocator<Real>>;
+
+template<typename Real>
+static void check(const Wavefunction<Real>& ref, const Soa<Real>& re, const Soa<Real>& im,
+                  double tol) {
+    for (std::size_t i = 0; i < ref.state.size(); ++i)
+        assert(std::abs(ref.state[i] - std::complex<Real>(re[i], im[i])) < tol);
+}
+
+// Every kernel table available on this CPU must agree with the interleaved
+// kernels for all targets, including those inside a single vector.
+template<typename Real>
+static void check_variants(double tol) {
+    const std::size_t n = 6;
+    std::mt19937 gen(21);
+    std::normal_distribution<double> dist(0.0, 1.0);
+    for (const auto* k : soa_kernel_variants<Real>()) {
+        Wavefunction<Real> ref(n);
+        for (auto& a : ref.state) a = {Real(dist(gen)), Real(dist(gen))};
+        Soa<Real> re(ref.state.size()), im(ref.state.size());
+        for (std::size_t i = 0; i < re.size(); ++i) {
+            re[i] = ref.state[i].real();
+            im[i] = ref.state[i].imag();
+        }
+        const Real f = Real(1.0) / std::sqrt(Real(2.0));
+        const std::complex<Real> h[2][2] = {{f, f}, {f, -f}};
+        const Real th = Real(0.7);
+        for (std::size_t a = 0; a < n; ++a) {
+            ref.apply_h(a);
+            k->single_qubit(re.data(), im.data(), re.size(), a, h);
+            ref.apply_rz(a, th);
+            k->diagonal_1q(re.data(), im.data(), re.size(), a,
+                           std::exp(std::complex<Real>(0, -th / 2)),
+                           std::exp(std::complex<Real>(0, th / 2)));
+            ref.apply_t(a);
+            k->phase(re.data(), im.data(), re.size(), 1ULL << a,
+                     std::exp(std::complex<Real>(0, Real(M_PI / 4))));
+            check(ref, re, im, tol);
+            for (std::size_t b = 0; b < n; ++b) {
+                if (a == b) continue;
+                std::size_t ab = 1ULL << a, bb = 1ULL << b;
+                ref.apply_cnot(a, b);
+                k->swap_pairs(re.data(), im.data(), re.size(), ab | bb, ab, ab | bb);
+                ref.apply_swap(a, b);
+                k->swap_pairs(re.data(), im.data(), re.size(), ab | bb, ab, bb);
+                ref.apply_cz(a, b);
+                k->phase(re.data(), im.data(), re.size(), ab | bb, std::complex<Real>(-1, 0));
+                std::size_t c = (b + 1) % n == a ? (b + 2) % n : (b + 1) % n;
+                std::size_t all = ab | bb | (1ULL << c);
+                ref.apply_ccnot(a, b, c);
+                k->swap_pairs(re.data(), im.data(), re.size(), all, ab | bb, all);
+                check(ref, re, im, tol);
+            }
+        }
+    }
+}
+
+int main() {
+    check_variants<double>(1e-9);
+    check_variants<float>(1e-3);
+
+    // A wavefunction in SoA mode behaves like the interleaved one and
+    // converts back on demand.
+    Wavefunction<> soa(5), ref(5);
+    soa.to_soa();
+    assert(soa.using_soa() && soa.state.empty());
+    for (auto* wf : {&soa, &ref}) {
+        wf->apply_h(0);
+        wf->apply_cnot(0, 3);
+        wf->apply_ry(2, 0.4);
+        wf->apply_s(3);
+        wf->apply_ccnot(0, 2, 4);
+        wf->apply_diagonal({{{1}, {1.0, -1.0}}, {{0, 4}, {1.0, 1.0, 1.0, -1.0}}});
+        wf->apply_fused({"H", "T"}, 1);
+    }
+    assert(soa.using_soa());
+    for (std::size_t i = 0; i < ref.state.size(); ++i)
+        assert(std::abs(soa.amplitude(i) - ref.state[i]) < 1e-12);
+    seed_rng(9);
+    int m = soa.measure(3);
+    seed_rng(9);
+    int ref_m = ref.measure(3);
+    assert(ref_m == m);
+    soa.to_aos();
+    assert(!soa.using_soa());
+    for (std::size_t i = 0; i < ref.state.size(); ++i)
+        assert(std::abs(soa.state[i] - ref.state[i]) < 1e-12);
+
+    std::cout << "SoA kernel test passed (" << soa_kernels<double>().isa << ")." << std::endl;
+    return 0;
+}
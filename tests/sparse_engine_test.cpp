@@ -0,0 +1,110 @@
+#include "../runtime/wavefunction.h"
+#include "../runtime/sparse_wavefunction.h"
+#include "../runtime/random.h"
+#include "../runtime/memory.h"
+#include "../runtime/state_file.h"
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+using namespace qpp;
+
+template<typename Real>
+static void check_against_dense(std::mt19937& gen, double tol) {
+    const std::size_t n = 6;
+    for (int trial = 0; trial < 40; ++trial) {
+        Wavefunction<Real> dense(n);
+        SparseWavefunction<Real> sparse(n);
+        for (int step = 0; step < 60; ++step) {
+            std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+            std::size_t c = (b + 1 + gen() % (n - 2)) % n;
+            if (c == a) c = (c + 1) % n;
+            if (c == b) c = (c + 1) % n;
+            Real theta = Real(0.1 * (gen() % 63));
+            switch (gen() % 13) {
+            case 0: dense.apply_h(a); sparse.apply_h(a); break;
+            case 1: dense.apply_x(a); sparse.apply_x(a); break;
+            case 2: dense.apply_y(a); sparse.apply_y(a); break;
+            case 3: dense.apply_z(a); sparse.apply_z(a); break;
+            case 4: dense.apply_s(a); sparse.apply_s(a); break;
+            case 5: dense.apply_t(a); sparse.apply_t(a); break;
+            case 6: dense.apply_rx(a, theta); sparse.apply_rx(a, theta); break;
+            case 7: dense.apply_ry(a, theta); sparse.apply_ry(a, theta); break;
+            case 8: dense.apply_rz(a, theta); sparse.apply_rz(a, theta); break;
+            case 9: dense.apply_cnot(a, b); sparse.apply_cnot(a, b); break;
+            case 10: dense.apply_cz(a, b); sparse.apply_cz(a, b); break;
+            case 11: dense.apply_ccnot(a, b, c); sparse.apply_ccnot(a, b, c); break;
+            default: dense.apply_swap(a, b); sparse.apply_swap(a, b); break;
+            }
+        }
+        for (std::size_t e = 1; e < sparse.indices.size(); ++e)
+            assert(sparse.indices[e - 1] < sparse.indices[e]);
+        for (std::size_t i = 0; i < dense.state.size(); ++i)
+            assert(std::abs(dense.state[i] - sparse.amplitude(i)) < tol);
+    }
+}
+
+int main() {
+    seed_rng(11);
+    std::mt19937 gen(2024);
+    check_against_dense<double>(gen, 1e-10);
+    check_against_dense<float>(gen, 1e-4);
+
+    // Interference that cancels a branch shrinks the support again.
+    SparseWavefunction<> sw(3);
+    sw.apply_h(1);
+    assert(sw.nnz() == 2);
+    sw.apply_h(1);
+    assert(sw.nnz() == 1);
+    assert(std::abs(sw.amplitude(0) - 1.0) < 1e-12);
+
+    // An oracle-style circuit on 48 qubits keeps a handful of entries.
+    SparseWavefunction<> wide(48);
+    for (std::size_t q = 0; q < 3; ++q) wide.apply_h(q);
+    for (std::size_t q = 3; q < 47; ++q) wide.apply_ccnot(q - 3, q - 2, q);
+    wide.apply_t(47);
+    assert(wide.nnz() == 8);
+    int m = wide.measure(0);
+    assert(wide.nnz() == 4);
+    for (auto idx : wide.indices) assert(static_cast<int>(idx & 1) == m);
+
+    // With a threshold the register starts sparse, goes dense once the
+    // superposition fills in and returns to sparse after it is undone.
+    runtime_config.sparse_threshold = 0.25;
+    Wavefunction<> wf(8);
+    assert(wf.using_sparse() && wf.state.empty());
+    wf.apply_x(7);
+    for (std::size_t q = 0; q < 8; ++q) wf.apply_h(q);
+    wf.apply_z(0);
+    assert(!wf.using_sparse());
+    for (std::size_t q = 0; q < 8; ++q) wf.apply_h(q);
+    for (int i = 0; i < 16 && !wf.using_sparse(); ++i) wf.apply_z(3);
+    assert(wf.using_sparse());
+    assert(wf.nnz() == 1);
+    assert(std::abs(std::abs(wf.amplitude(0x81)) - 1.0) < 1e-9);
+    int m7 = wf.measure(7);
+    int m0 = wf.measure(0);
+    assert(m7 == 1 && m0 == 1);
+    auto counts = wf.sample({0, 7}, 20);
+    assert(counts.size() == 1 && counts[3] == 20);
+
+    // A sparse register saves its amplitudes, not its empty dense array,
+    // and stays sparse.
+    int id = memory.create_qregister(4);
+    memory.qreg(id).x(1);
+    bool ok = memory.save_state_to_file(id, "sparse_engine_state.bin");
+    assert(ok);
+    assert(memory.qreg(id).using_sparse());
+    std::vector<std::complex<double>> saved;
+    ok = load_state_file("sparse_engine_state.bin", saved);
+    assert(ok && saved.size() == 16);
+    for (std::size_t i = 0; i < saved.size(); ++i) assert(saved[i] == (i == 2 ? 1.0 : 0.0));
+    std::remove("sparse_engine_state.bin");
+    memory.release_qregister(id);
+    runtime_config.sparse_threshold = 0.0;
+
+    std::cout << "Sparse engine test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "../runtime/stabilizer.h"
+#include "../runtime/wavefunction.h"
+#include "../runtime/memory.h"
+#include "../runtime/random.h"
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+using namespace qpp;
+
+// Project the dense state onto the given outcome and return its probability.
+static double project(Wavefunction<>& wf, std::size_t q, int outcome) {
+    std::size_t bit = 1ULL << q;
+    double p = 0.0;
+    for (std::size_t i = 0; i < wf.state.size(); ++i)
+        if (((i & bit) != 0) == static_cast<bool>(outcome)) p += std::norm(wf.state[i]);
+    if (p < 1e-9) return p;
+    for (std::size_t i = 0; i < wf.state.size(); ++i) {
+        if (((i & bit) != 0) == static_cast<bool>(outcome)) wf.state[i] /= std::sqrt(p);
+        else wf.state[i] = 0.0;
+    }
+    return p;
+}
+
+int main() {
+    seed_rng(7);
+
+    // GHZ on 60 qubits: every measurement must agree with the first.
+    StabilizerState ghz(60);
+    ghz.apply_h(0);
+    for (std::size_t q = 1; q < 60; ++q) ghz.apply_cnot(0, q);
+    int first = ghz.measure(0);
+    for (std::size_t q = 1; q < 60; ++q) {
+        int m = ghz.measure(q);
+        assert(m == first);
+    }
+    assert(ghz.memory_bytes() < 4096);
+
+    StabilizerState flip(2);
+    flip.apply_x(1);
+    int m0 = flip.measure(0);
+    int m1 = flip.measure(1);
+    assert(m0 == 0 && m1 == 1);
+
+    // Random Clifford circuits with mid-circuit measurements against the
+    // dense simulator: each stabilizer outcome must be possible in the dense
+    // state, and deterministic dense outcomes must be reproduced exactly.
+    std::mt19937 gen(1234);
+    const std::size_t n = 5;
+    for (int trial = 0; trial < 200; ++trial) {
+        StabilizerState st(n);
+        Wavefunction<> wf(n);
+        for (int step = 0; step < 40; ++step) {
+            std::size_t a = gen() % n, b = (a + 1 + gen() % (n - 1)) % n;
+            switch (gen() % 10) {
+            case 0: st.apply_h(a); wf.apply_h(a); break;
+            case 1: st.apply_s(a); wf.apply_s(a); break;
+            case 2: st.apply_x(a); wf.apply_x(a); break;
+            case 3: st.apply_y(a); wf.apply_y(a); break;
+            case 4: st.apply_z(a); wf.apply_z(a); break;
+            case 5: st.apply_cnot(a, b); wf.apply_cnot(a, b); break;
+            case 6: st.apply_cz(a, b); wf.apply_cz(a, b); break;
+            case 7: st.apply_swap(a, b); wf.apply_swap(a, b); break;
+            default: {
+                int m = st.measure(a);
+                double p = project(wf, a, m);
+                assert(p > 0.25);
+                if (std::abs(p - 1.0) > 1e-9) assert(std::abs(p - 0.5) < 1e-9);
+            }
+            }
+        }
+        // The tableau's support size matches the dense state's.
+        std::size_t nonzero = 0;
+        for (const auto& a : wf.state) nonzero += std::norm(a) > 1e-12;
+        assert(st.nnz() == nonzero);
+        for (std::size_t q = 0; q < n; ++q) {
+            int m = st.measure(q);
+            assert(project(wf, q, m) > 0.25);
+        }
+    }
+
+    QRegister qr(40);
+    qr.use_stabilizer();
+    qr.h(0);
+    qr.cnot(0, 39);
+    int low = qr.measure(0);
+    int high = qr.measure(39);
+    assert(low == high);
+    assert(!qr.wf);
+    // Sparse-storage queries answer from the tableau without a dense state.
+    qr.h(5);
+    qr.compress();
+    std::size_t support = qr.nnz();
+    assert(support == 2 && !qr.using_sparse());
+    qr.decompress();
+    assert(!qr.wf);
+    QRegister wide(100);
+    wide.use_stabilizer();
+    for (std::size_t q = 0; q < 100; ++q) wide.h(q);
+    support = wide.nnz();
+    assert(support == SIZE_MAX && !wide.wf);
+    // The state helpers turn a stabilizer register down instead of
+    // building its 2^70 amplitudes.
+    int id = memory.create_qregister(70, RegisterForm::Stabilizer);
+    std::vector<std::complex<double>> exported = memory.export_state(id);
+    assert(exported.empty());
+    bool ok = memory.import_state(id, {1.0});
+    assert(!ok);
+    ok = memory.save_state_to_file(id, "stabilizer_state.bin");
+    assert(!ok);
+    ok = memory.load_state_from_file(id, "stabilizer_state.bin");
+    assert(!ok);
+    ok = memory.checkpoint_if_needed(id, 1, 0.0, "stabilizer_checkpoint.bin");
+    assert(!ok);
+    assert(!memory.qreg(id).wf);
+    memory.release_qregister(id);
+    bool threw = false;
+    try { qr.t(0); } catch (const std::logic_error&) { threw = true; }
+    assert(threw);
+
+    std::cout << "Stabilizer simulator test passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "../include/runtime_config.h"
+#include "../runtime/memory.h"
+#include "../runtime/state_allocator.h"
+#include <cassert>
+#include <complex>
+#include <iostream>
+
+using namespace qpp;
+
+int main() {
+    const std::size_t n = 20;
+    const std::size_t block = (std::size_t(1) << n) * sizeof(std::complex<double>);
+
+    // Disabled by default: a freed state is unmapped.
+    {
+        Wavefunction<> wf(n);
+        wf.apply_h(3);
+    }
+    assert(state_pool_stats().held_blocks == 0);
+
+    // Released registers leave their buffers for the next one of the same
+    // size, which still starts in |0...0>.
+    runtime_config.state_pool_mb = 40;
+    int id = memory.create_qregister(n);
+    for (std::size_t q = 0; q < n; ++q) memory.qreg(id).h(q);
+    const void* first = memory.qreg(id).wave().state.data();
+    memory.release_qregister(id);
+    StatePoolStats stats = state_pool_stats();
+    assert(stats.held_blocks == 1 && stats.held_bytes == block);
+    const std::size_t hits = stats.hits;
+
+    id = memory.create_qregister(n);
+    Wavefunction<>& wf = memory.qreg(id).wave();
+    assert(wf.state.data() == first);
+    assert(state_pool_stats().hits == hits + 1 && state_pool_stats().held_blocks == 0);
+    assert(wf.state[0] == 1.0);
+    for (std::size_t i = 1; i < wf.state.size(); ++i) assert(wf.state[i] == 0.0);
+    memory.qreg(id).h(0);
+    assert(std::abs(memory.qreg(id).amp(1) - std::sqrt(0.5)) < 1e-12);
+
+    // Other sizes miss, and the pool stays under its limit by dropping the
+    // oldest blocks.
+    int small = memory.create_qregister(n - 1);
+    memory.qreg(small).x(0);
+    assert(state_pool_stats().misses > stats.misses);
+    int big = memory.create_qregister(n + 1);
+    memory.qreg(big).x(0);
+    memory.release_qregister(id);
+    memory.release_qregister(small);
+    memory.release_qregister(big);
+    stats = state_pool_stats();
+    assert(stats.held_bytes <= runtime_config.state_pool_mb << 20);
+    assert(stats.trimmed >= 1 && stats.held_blocks == 2);
+
+    // Disk-backed registers recycle their pager frames too.
+    trim_state_pool();
+    runtime_config.disk_page_kb = 64;
+    runtime_config.disk_cache_mb = 4;
+    set_disk_limit_mb(1);
+    for (int round = 0; round < 2; ++round) {
+        int disk = memory.create_qregister(n);
+        assert(memory.qreg(disk).wave().uses_disk());
+        memory.qreg(disk).h(n - 1);
+        assert(std::abs(memory.qreg(disk).amp(std::size_t(1) << (n - 1)) - std::sqrt(0.5)) < 1e-12);
+        assert(memory.qreg(disk).amp(1) == 0.0);
+        memory.release_qregister(disk);
+    }
+    assert(state_pool_stats().hits > hits + 1);
+    set_disk_limit_mb(0);
+    runtime_config.disk_page_kb = 1024;
+    runtime_config.disk_cache_mb = 256;
+
+    const std::size_t trimmed = trim_state_pool();
+    assert(trimmed > 0);
+    assert(state_pool_stats().held_blocks == 0 && state_pool_stats().held_bytes == 0);
+    runtime_config.state_pool_mb = 0;
+
+    std::cout << "State pool test passed." << std::endl;
+    return 0;
+}
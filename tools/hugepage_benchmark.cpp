@@ -0,0 +1,66 @@
+#include "../include/runtime_config.h"
+#include "../runtime/wavefunction.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Times single-qubit gates on every target of a dense state under each
+// huge page backing. High targets stride across the whole array, which is
+// where base pages run out of TLB reach.
+static std::string huge_backing() {
+    std::ifstream ifs("/proc/self/smaps_rollup");
+    std::string line, out;
+    while (std::getline(ifs, line))
+        if (line.rfind("AnonHugePages:", 0) == 0) out = line;
+    std::ifstream meminfo("/proc/meminfo");
+    while (std::getline(meminfo, line))
+        if (line.rfind("HugePages_Total:", 0) == 0 || line.rfind("HugePages_Free:", 0) == 0)
+            out += "  " + line;
+    return out;
+}
+
+int main(int argc, char** argv) {
+    using namespace qpp;
+    std::size_t qubits = 26;
+    int rounds = 3;
+    if (argc > 1) qubits = std::stoul(argv[1]);
+    if (argc > 2) rounds = std::stoi(argv[2]);
+    // Plain one-qubit sweeps, so every target is a full pass over memory.
+    runtime_config.fusion_max_qubits = 0;
+    runtime_config.qubit_remap = false;
+
+    const struct { const char* name; HugePages mode; } modes[] = {
+        {"off", HugePages::Off},
+        {"transparent", HugePages::Transparent},
+        {"explicit", HugePages::Explicit},
+    };
+    for (const auto& m : modes) {
+        runtime_config.huge_pages = m.mode;
+        Wavefunction<> wf(qubits);
+        // Fault every page in before timing.
+        for (std::size_t q = 0; q < qubits; ++q) wf.apply_h(q);
+        std::cout << m.name << ": " << huge_backing() << "\n";
+        // X only moves amplitudes, so it is bound by memory and the TLB;
+        // RX adds the arithmetic of a general 2x2 gate.
+        double low[2] = {0.0, 0.0}, high[2] = {0.0, 0.0};
+        for (int r = 0; r < rounds; ++r) {
+            for (std::size_t q = 0; q < qubits; ++q) {
+                for (int g = 0; g < 2; ++g) {
+                    auto start = std::chrono::steady_clock::now();
+                    if (g == 0) wf.apply_x(q);
+                    else wf.apply_rx(q, 0.1);
+                    double ms = std::chrono::duration<double, std::milli>(
+                                    std::chrono::steady_clock::now() - start).count();
+                    (q < qubits / 2 ? low : high)[g] += ms;
+                }
+            }
+        }
+        const double lows = rounds * double(qubits / 2);
+        const double highs = rounds * double(qubits - qubits / 2);
+        std::cout << "  low targets:  X " << low[0] / lows << " ms, RX " << low[1] / lows << " ms\n";
+        std::cout << "  high targets: X " << high[0] / highs << " ms, RX " << high[1] / highs
+                  << " ms\n";
+    }
+    return 0;
+}
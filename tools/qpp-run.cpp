@@ -3,10 +3,14 @@
 #include "../runtime/hardware_api.h"
 #include "../runtime/device.h"
 #include "../runtime/patterns.h"
+#include "../runtime/gate_fusion.h"
+#include "../runtime/page_codec.h"
+#include "../include/runtime_config.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <unordered_map>
+#include <map>
 #include <memory>
 #include <string>
 #include <algorithm>
@@ -17,9 +21,51 @@
 
 using namespace qpp;
 
+// True when every gate in the task, including conditional ones, is Clifford
+// and can therefore run on the stabilizer tableau.
+static bool clifford_only(const std::vector<std::vector<std::string>>& instrs) {
+    for (const auto& ins : instrs) {
+        for (const auto& tok : ins) {
+            if (tok == "T" || tok == "CCX") return false;
+        }
+    }
+    return true;
+}
+
+// Shot count requested by a `SHOTS n` instruction, 0 when absent.
+static std::size_t task_shots(const std::vector<std::vector<std::string>>& instrs) {
+    std::size_t shots = 0;
+    for (const auto& ins : instrs)
+        if (ins.size() == 2 && ins[0] == "SHOTS") shots = std::stoul(ins[1]);
+    return shots;
+}
+
+// True when nothing but further measurements and output follows the first
+// measurement, so one simulation can be sampled for every shot.
+static bool terminal_measurements(const std::vector<std::vector<std::string>>& instrs) {
+    bool measured = false;
+    for (const auto& ins : instrs) {
+        if (ins.empty()) continue;
+        if (ins[0] == "MEASURE") {
+            if (ins.size() == 6 && ins[4] == "VAR") return false;
+            measured = true;
+        } else if (measured && ins[0] != "PRINT" && ins[0] != "EXPLAIN" && ins[0] != "SHOTS") {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::string outcome_bits(std::size_t outcome, std::size_t width) {
+    std::string bits;
+    for (std::size_t j = 0; j < width; ++j) bits += ((outcome >> j) & 1) ? '1' : '0';
+    return bits;
+}
+
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: qpp-run [--device CPU|GPU] [--auto-device]"
+        std::cerr << "Usage: qpp-run [--device CPU|GPU] [--auto-device] [--fuse K] [--soa] [--sparse F] [--quidd] [--disk MB] [--codec NAME]"
+                  << " [--numa first-touch|interleave|partition] [--pin-threads] [--huge-pages off|thp|explicit] [--pool MB] [--memory-budget MB] [--zone-cache MB] [--lazy-collapse]"
                   << " [--use-qiskit|--use-cirq|--use-braket|--use-qsharp|--use-nvidia|--use-psi]"
                   << " <compiled.ir>\n";
         return 1;
@@ -28,6 +74,7 @@ int main(int argc, char** argv) {
     DeviceType device = DeviceType::CPU;
     bool device_explicit = false;
     bool auto_device = false;
+    bool quidd = false;
     while (argi < argc) {
         std::string opt = argv[argi];
         if (opt == "--device" && argi + 1 < argc) {
@@ -40,6 +87,68 @@ int main(int argc, char** argv) {
             if (val == "GPU" || val == "gpu") device = DeviceType::GPU;
             device_explicit = true;
             ++argi;
+        } else if (opt == "--fuse" && argi + 1 < argc) {
+            set_fusion_max_qubits(std::stoul(argv[++argi]));
+            ++argi;
+        } else if (opt == "--soa") {
+            runtime_config.soa_storage = true;
+            ++argi;
+        } else if (opt == "--sparse" && argi + 1 < argc) {
+            runtime_config.sparse_threshold = std::stod(argv[++argi]);
+            ++argi;
+        } else if (opt == "--quidd") {
+            quidd = true;
+            ++argi;
+        } else if (opt == "--disk" && argi + 1 < argc) {
+            set_disk_limit_mb(std::stoul(argv[++argi]));
+            ++argi;
+        } else if (opt == "--codec" && argi + 1 < argc) {
+            // Page encoding for disk-backed states and saved checkpoints.
+            PageCodec codec;
+            if (!parse_page_codec(argv[++argi], codec)) {
+                std::cerr << "Unknown codec " << argv[argi]
+                          << " (raw, lossless, fp16, bf16 or fixed16)\n";
+                return 1;
+            }
+            runtime_config.disk_codec = runtime_config.checkpoint_codec = codec;
+            ++argi;
+        } else if (opt == "--numa" && argi + 1 < argc) {
+            std::string val = argv[++argi];
+            if (val == "interleave") runtime_config.numa_policy = NumaPolicy::Interleave;
+            else if (val == "partition") runtime_config.numa_policy = NumaPolicy::Partition;
+            else if (val == "first-touch") runtime_config.numa_policy = NumaPolicy::FirstTouch;
+            else {
+                std::cerr << "Unknown NUMA policy " << val
+                          << " (first-touch, interleave or partition)\n";
+                return 1;
+            }
+            ++argi;
+        } else if (opt == "--huge-pages" && argi + 1 < argc) {
+            std::string val = argv[++argi];
+            if (val == "thp") runtime_config.huge_pages = HugePages::Transparent;
+            else if (val == "explicit") runtime_config.huge_pages = HugePages::Explicit;
+            else if (val == "off") runtime_config.huge_pages = HugePages::Off;
+            else {
+                std::cerr << "Unknown huge page mode " << val << " (off, thp or explicit)\n";
+                return 1;
+            }
+            ++argi;
+        } else if (opt == "--memory-budget" && argi + 1 < argc) {
+            runtime_config.memory_budget_mb = std::stoul(argv[++argi]);
+            ++argi;
+        } else if (opt == "--zone-cache" && argi + 1 < argc) {
+            runtime_config.resonance_cache_mb = std::stoul(argv[++argi]);
+            ++argi;
+        } else if (opt == "--pool" && argi + 1 < argc) {
+            runtime_config.state_pool_mb = std::stoul(argv[++argi]);
+            ++argi;
+        } else if (opt == "--lazy-collapse") {
+            // Defer measurement collapse into the next gate's sweep.
+            runtime_config.lazy_collapse = true;
+            ++argi;
+        } else if (opt == "--pin-threads") {
+            runtime_config.pin_threads = true;
+            ++argi;
         } else if (opt == "--auto-device") {
             auto_device = true;
             ++argi;
@@ -128,127 +237,244 @@ int main(int argc, char** argv) {
         auto name = t.name;
         auto target = t.target;
         auto hint = t.hint;
-        scheduler.add_task({name, target, hint, 0, [instrs,&logs,name,target,hint,&gate_profile,&branch_profile]() {
-            if (hint == ExecHint::CLIFFORD)
-                std::cout << "[runtime] hint CLIFFORD - using stabilizer path" << std::endl;
+        scheduler.add_task({name, target, hint, 0, [instrs,&logs,name,target,hint,quidd,&gate_profile,&branch_profile]() {
+            // The scheduler runs a task again from the start when the memory
+            // budget turns it away, so output, profile counts and the QPU
+            // submission are held back until the task completes.
+            std::ostringstream note, out;
+            std::vector<std::string> task_logs;
+            std::unordered_map<std::string,int> task_gates, task_branches;
+            bool stabilizer = hint == ExecHint::CLIFFORD && clifford_only(instrs);
+            if (stabilizer)
+                note << "[runtime] hint CLIFFORD - using stabilizer path" << std::endl;
+            else if (hint == ExecHint::CLIFFORD)
+                note << "[runtime] hint CLIFFORD ignored - task has non-Clifford gates, using dense path" << std::endl;
             else if (hint == ExecHint::DENSE)
-                std::cout << "[runtime] hint DENSE - using dense path" << std::endl;
-            if (target == Target::QPU && qpu_backend()) {
-                auto qir = emit_qir(instrs);
-                qpu_backend()->execute_qir(qir);
+                note << "[runtime] hint DENSE - using dense path" << std::endl;
+            auto ops = instrs;
+            // Decision-diagram registers take the gates one at a time.
+            if (!stabilizer && !quidd) {
+                fuse_diagonal_runs(ops);
+                // Fused and blocked matrices need dense interleaved storage,
+                // so SoA and sparse registers keep the individual gates.
+                if (!runtime_config.soa_storage && runtime_config.sparse_threshold <= 0.0) {
+                    fuse_gates(ops, runtime_config.fusion_max_qubits);
+                    // Disk-backed registers run each BLOCK as out-of-core
+                    // phases, so their runs may span a whole disk chunk.
+                    std::size_t block = cache_block_qubits<double>();
+                    for (const auto& ins : ops)
+                        if (ins.size() == 3 && ins[0] == "QALLOC" &&
+                            disk_backed_size<double>(std::stoul(ins[2])))
+                            block = std::max(block, disk_chunk_qubits<double>());
+                    block_low_qubit_runs(ops, block);
+                }
             }
-            std::unordered_map<std::string,int> qmap;
-            std::unordered_map<std::string,int> cmap;
-            std::unordered_map<std::string,int> vars;
+            // SHOTS n: sample the final state n times when all measurements
+            // are terminal, otherwise re-simulate the task once per shot and
+            // tally the measurement record.
+            const std::size_t shots = task_shots(ops);
+            const bool sampled = shots > 0 && terminal_measurements(ops);
+            const std::size_t runs = shots > 0 && !sampled ? shots : 1;
+            std::map<std::string, std::size_t> histogram;
+            std::string measured_label;
+            for (std::size_t run = 0; run < runs; ++run) {
+                std::unordered_map<std::string,int> qmap;
+                std::unordered_map<std::string,int> cmap;
+                // Registers go back however the run ends, so a task turned
+                // away by the memory budget does not keep what it had.
+                struct ReleaseRegisters {
+                    std::unordered_map<std::string,int>& q;
+                    std::unordered_map<std::string,int>& c;
+                    ~ReleaseRegisters() {
+                        for (auto& [name, id] : q) memory.release_qregister(id);
+                        for (auto& [name, id] : c) memory.release_cregister(id);
+                    }
+                } release_registers{qmap, cmap};
+                std::unordered_map<std::string,int> vars;
+                std::map<std::string, std::vector<std::size_t>> to_sample;
+                std::string record;
 
-            auto apply_gate = [&](const std::string& g,
-                                  const std::string& qname,
-                                  const std::string& qidx) {
-                gate_profile[g]++;
-                int id = qmap.at(qname);
-                std::size_t q = std::stoul(qidx);
-                if (g == "H") memory.qreg(id).h(q);
-                else if (g == "X") memory.qreg(id).x(q);
-                else if (g == "Y") memory.qreg(id).y(q);
-                else if (g == "Z") memory.qreg(id).z(q);
-                else if (g == "S") memory.qreg(id).s(q);
-                else if (g == "T") memory.qreg(id).t(q);
-            };
+                auto apply_gate = [&](const std::string& g,
+                                      const std::string& qname,
+                                      const std::string& qidx) {
+                    task_gates[g]++;
+                    int id = qmap.at(qname);
+                    std::size_t q = std::stoul(qidx);
+                    if (g == "H") memory.qreg(id).h(q);
+                    else if (g == "X") memory.qreg(id).x(q);
+                    else if (g == "Y") memory.qreg(id).y(q);
+                    else if (g == "Z") memory.qreg(id).z(q);
+                    else if (g == "S") memory.qreg(id).s(q);
+                    else if (g == "T") memory.qreg(id).t(q);
+                };
 
-            for (const auto& ins : instrs) {
-                if (ins.empty()) continue;
-                if (ins[0] == "QALLOC" && ins.size() == 3) {
-                    int id = memory.create_qregister(std::stoi(ins[2]));
-                    qmap[ins[1]] = id;
-                } else if (ins[0] == "CALLOC" && ins.size() == 3) {
-                    int id = memory.create_cregister(std::stoi(ins[2]));
-                    cmap[ins[1]] = id;
-                } else if (ins[0] == "VAR" && ins.size() == 2) {
-                    vars[ins[1]] = 0;
-                } else if (ins[0] == "H" || ins[0] == "X" || ins[0] == "Y" || ins[0] == "Z" || ins[0] == "S" || ins[0] == "T") {
-                    apply_gate(ins[0], ins[1], ins[2]);
-                } else if (ins[0] == "SWAP" && ins.size() == 5) {
-                    int id1 = qmap.at(ins[1]);
-                    int id2 = qmap.at(ins[3]);
-                    memory.qreg(id1).swap(std::stoul(ins[2]), std::stoul(ins[4]));
-                } else if (ins[0] == "CNOT" && ins.size() == 5) {
-                    int c = qmap.at(ins[1]);
-                    int t = qmap.at(ins[3]);
-                    memory.qreg(c).cnot(std::stoul(ins[2]), std::stoul(ins[4]));
-                } else if (ins[0] == "CZ" && ins.size() == 5) {
-                    int c = qmap.at(ins[1]);
-                    int t = qmap.at(ins[3]);
-                    memory.qreg(c).cz(std::stoul(ins[2]), std::stoul(ins[4]));
-                } else if (ins[0] == "CCX" && ins.size() == 7) {
-                    int c1 = qmap.at(ins[1]);
-                    int c2 = qmap.at(ins[3]);
-                    int targ = qmap.at(ins[5]); // ensure register exists
-                    (void)targ;
-                    memory.qreg(c1).ccnot(std::stoul(ins[2]), std::stoul(ins[4]), std::stoul(ins[6]));
-                } else if (ins[0] == "QFT2" && ins.size() == 4) {
-                    int id = qmap.at(ins[1]);
-                    apply_qft2(memory.qreg(id), std::stoul(ins[2]), std::stoul(ins[3]));
-                } else if (ins[0] == "GROVER2" && ins.size() == 4) {
-                    int id = qmap.at(ins[1]);
-                    apply_grover2(memory.qreg(id), std::stoul(ins[2]), std::stoul(ins[3]));
-                } else if (ins[0] == "CALL" && ins.size() == 2) {
-                    // call support not implemented - ignore
-                    (void)ins[1];
-                } else if (ins[0] == "PRINT" && ins.size() == 2) {
-                    std::cout << ins[1] << std::endl;
-                } else if (ins[0] == "EXPLAIN" && ins.size() == 2) {
-                    std::cout << "[explain] " << ins[1] << std::endl;
-                } else if (ins[0] == "MEASURE") {
-                    int qid = qmap.at(ins[1]);
-                    std::size_t qidx = std::stoul(ins[2]);
-                int result = memory.qreg(qid).measure(qidx);
-                logs.push_back(name + ": measured " + ins[1] + "[" + ins[2] + "] = " + std::to_string(result));
-                if (ins.size() == 6 && ins[3] == "->") {
-                    if (ins[4] == "VAR") {
-                        vars[ins[5]] = result;
+                for (std::size_t pc = 0; pc < ops.size(); ++pc) {
+                    const auto& ins = ops[pc];
+                    if (ins.empty()) continue;
+                    if (ins[0] == "QALLOC" && ins.size() == 3) {
+                        int id = memory.create_qregister(std::stoi(ins[2]),
+                                                         stabilizer ? RegisterForm::Stabilizer
+                                                         : quidd    ? RegisterForm::QuIDD
+                                                                    : RegisterForm::Dense);
+                        qmap[ins[1]] = id;
+                    } else if (ins[0] == "CALLOC" && ins.size() == 3) {
+                        int id = memory.create_cregister(std::stoi(ins[2]));
+                        cmap[ins[1]] = id;
+                    } else if (ins[0] == "VAR" && ins.size() == 2) {
+                        vars[ins[1]] = 0;
+                    } else if (ins[0] == "H" || ins[0] == "X" || ins[0] == "Y" || ins[0] == "Z" || ins[0] == "S" || ins[0] == "T") {
+                        apply_gate(ins[0], ins[1], ins[2]);
+                    } else if (ins[0] == "SWAP" && ins.size() == 5) {
+                        int id1 = qmap.at(ins[1]);
+                        int id2 = qmap.at(ins[3]);
+                        memory.qreg(id1).swap(std::stoul(ins[2]), std::stoul(ins[4]));
+                    } else if (ins[0] == "CNOT" && ins.size() == 5) {
+                        int c = qmap.at(ins[1]);
+                        int t = qmap.at(ins[3]);
+                        memory.qreg(c).cnot(std::stoul(ins[2]), std::stoul(ins[4]));
+                    } else if (ins[0] == "CZ" && ins.size() == 5) {
+                        int c = qmap.at(ins[1]);
+                        int t = qmap.at(ins[3]);
+                        memory.qreg(c).cz(std::stoul(ins[2]), std::stoul(ins[4]));
+                    } else if (ins[0] == "CCX" && ins.size() == 7) {
+                        int c1 = qmap.at(ins[1]);
+                        int c2 = qmap.at(ins[3]);
+                        int targ = qmap.at(ins[5]); // ensure register exists
+                        (void)targ;
+                        memory.qreg(c1).ccnot(std::stoul(ins[2]), std::stoul(ins[4]), std::stoul(ins[6]));
+                    } else if (ins[0] == "DIAG" && ins.size() == 2) {
+                        std::size_t count = std::min<std::size_t>(std::stoul(ins[1]), ops.size() - pc - 1);
+                        std::vector<std::vector<std::string>> run(ops.begin() + pc + 1,
+                                                                  ops.begin() + pc + 1 + count);
+                        for (const auto& g : run)
+                            if (g.size() == 3) task_gates[g[0]]++;
+                        if (!run.empty())
+                            memory.qreg(qmap.at(run.front()[1])).diagonal(diagonal_gates(run));
+                        pc += count;
+                    } else if (ins[0] == "FUSE" && ins.size() == 2) {
+                        std::size_t count = std::min<std::size_t>(std::stoul(ins[1]), ops.size() - pc - 1);
+                        std::vector<std::vector<std::string>> run(ops.begin() + pc + 1,
+                                                                  ops.begin() + pc + 1 + count);
+                        for (const auto& g : run)
+                            if (g.size() == 3) task_gates[g[0]]++;
+                        if (!run.empty())
+                            memory.qreg(qmap.at(run.front()[1])).matrix(fused_matrix(run), run.size());
+                        pc += count;
+                    } else if (ins[0] == "BLOCK" && ins.size() == 2) {
+                        std::size_t count = std::min<std::size_t>(std::stoul(ins[1]), ops.size() - pc - 1);
+                        std::vector<std::vector<std::string>> run(ops.begin() + pc + 1,
+                                                                  ops.begin() + pc + 1 + count);
+                        std::size_t gates = 0;
+                        const std::vector<std::string>* first = nullptr;
+                        for (const auto& g : run) {
+                            if (g.size() < 3) continue;
+                            if (!first) first = &g;
+                            if (g.size() == 3) task_gates[g[0]]++;
+                            ++gates;
+                        }
+                        if (first)
+                            memory.qreg(qmap.at((*first)[1])).blocked(block_matrices(run), gates);
+                        pc += count;
+                    } else if (ins[0] == "QFT2" && ins.size() == 4) {
+                        int id = qmap.at(ins[1]);
+                        apply_qft2(memory.qreg(id), std::stoul(ins[2]), std::stoul(ins[3]));
+                    } else if (ins[0] == "GROVER2" && ins.size() == 4) {
+                        int id = qmap.at(ins[1]);
+                        apply_grover2(memory.qreg(id), std::stoul(ins[2]), std::stoul(ins[3]));
+                    } else if (ins[0] == "CALL" && ins.size() == 2) {
+                        // call support not implemented - ignore
+                        (void)ins[1];
+                    } else if (ins[0] == "PRINT" && ins.size() == 2) {
+                        out << ins[1] << std::endl;
+                    } else if (ins[0] == "EXPLAIN" && ins.size() == 2) {
+                        out << "[explain] " << ins[1] << std::endl;
+                    } else if (ins[0] == "MEASURE") {
+                        int qid = qmap.at(ins[1]);
+                        std::size_t qidx = std::stoul(ins[2]);
+                        if (sampled) {
+                            to_sample[ins[1]].push_back(qidx);
+                            continue;
+                        }
+                        int result = memory.qreg(qid).measure(qidx);
+                        if (shots > 0) {
+                            record += result ? '1' : '0';
+                            if (run == 0) measured_label += " " + ins[1] + "[" + ins[2] + "]";
                         } else {
-                            int cid = cmap.at(ins[4]);
-                            std::size_t cidx = std::stoul(ins[5]);
-                            if (cidx < memory.creg(cid).bits.size())
-                                memory.creg(cid).bits[cidx] = result;
+                            task_logs.push_back(name + ": measured " + ins[1] + "[" + ins[2] + "] = " + std::to_string(result));
+                        }
+                        if (ins.size() == 6 && ins[3] == "->") {
+                            if (ins[4] == "VAR") {
+                                vars[ins[5]] = result;
+                            } else {
+                                int cid = cmap.at(ins[4]);
+                                std::size_t cidx = std::stoul(ins[5]);
+                                if (cidx < memory.creg(cid).bits.size())
+                                    memory.creg(cid).bits[cidx] = result;
+                            }
                         }
+                    } else if (ins[0] == "IFVAR" && ins.size() == 5) {
+                        bool cond = vars[ins[1]];
+                        task_branches[cond ? "IFVAR_T" : "IFVAR_F"]++;
+                        if (shots == 0)
+                            task_logs.push_back(name + ": branch IFVAR " + ins[1] + " -> " +
+                                                (cond ? "taken" : "skipped"));
+                        if (cond)
+                            apply_gate(ins[2], ins[3], ins[4]);
+                    } else if (ins[0] == "IFNVAR" && ins.size() == 5) {
+                        bool cond = !vars[ins[1]];
+                        task_branches[cond ? "IFNVAR_T" : "IFNVAR_F"]++;
+                        if (shots == 0)
+                            task_logs.push_back(name + ": branch IFNVAR " + ins[1] + " -> " +
+                                                (cond ? "taken" : "skipped"));
+                        if (cond)
+                            apply_gate(ins[2], ins[3], ins[4]);
+                    } else if (ins[0] == "IFC" && ins.size() == 6) {
+                        int cid = cmap.at(ins[1]);
+                        std::size_t idx = std::stoul(ins[2]);
+                        bool cond = memory.creg(cid).bits[idx];
+                        task_branches[cond ? "IFC_T" : "IFC_F"]++;
+                        if (shots == 0)
+                            task_logs.push_back(name + ": branch IFC " + ins[1] + "[" + ins[2]
+                                                + "] -> " + (cond ? "taken" : "skipped"));
+                        if (cond)
+                            apply_gate(ins[3], ins[4], ins[5]);
+                    } else if (ins[0] == "IFNC" && ins.size() == 6) {
+                        int cid = cmap.at(ins[1]);
+                        std::size_t idx = std::stoul(ins[2]);
+                        bool cond = !memory.creg(cid).bits[idx];
+                        task_branches[cond ? "IFNC_T" : "IFNC_F"]++;
+                        if (shots == 0)
+                            task_logs.push_back(name + ": branch IFNC " + ins[1] + "[" + ins[2]
+                                                + "] -> " + (cond ? "taken" : "skipped"));
+                        if (cond)
+                            apply_gate(ins[3], ins[4], ins[5]);
                     }
-                } else if (ins[0] == "IFVAR" && ins.size() == 5) {
-                    bool cond = vars[ins[1]];
-                    branch_profile[cond ? "IFVAR_T" : "IFVAR_F"]++;
-                    logs.push_back(name + ": branch IFVAR " + ins[1] + " -> " +
-                                   (cond ? "taken" : "skipped"));
-                    if (cond)
-                        apply_gate(ins[2], ins[3], ins[4]);
-                } else if (ins[0] == "IFNVAR" && ins.size() == 5) {
-                    bool cond = !vars[ins[1]];
-                    branch_profile[cond ? "IFNVAR_T" : "IFNVAR_F"]++;
-                    logs.push_back(name + ": branch IFNVAR " + ins[1] + " -> " +
-                                   (cond ? "taken" : "skipped"));
-                    if (cond)
-                        apply_gate(ins[2], ins[3], ins[4]);
-                } else if (ins[0] == "IFC" && ins.size() == 6) {
-                    int cid = cmap.at(ins[1]);
-                    std::size_t idx = std::stoul(ins[2]);
-                    bool cond = memory.creg(cid).bits[idx];
-                    branch_profile[cond ? "IFC_T" : "IFC_F"]++;
-                    logs.push_back(name + ": branch IFC " + ins[1] + "[" + ins[2]
-                                   + "] -> " + (cond ? "taken" : "skipped"));
-                    if (cond)
-                        apply_gate(ins[3], ins[4], ins[5]);
-                } else if (ins[0] == "IFNC" && ins.size() == 6) {
-                    int cid = cmap.at(ins[1]);
-                    std::size_t idx = std::stoul(ins[2]);
-                    bool cond = !memory.creg(cid).bits[idx];
-                    branch_profile[cond ? "IFNC_T" : "IFNC_F"]++;
-                    logs.push_back(name + ": branch IFNC " + ins[1] + "[" + ins[2]
-                                   + "] -> " + (cond ? "taken" : "skipped"));
-                    if (cond)
-                        apply_gate(ins[3], ins[4], ins[5]);
                 }
+                for (const auto& [reg, qubits] : to_sample) {
+                    std::string label;
+                    for (auto q : qubits) label += " " + reg + "[" + std::to_string(q) + "]";
+                    task_logs.push_back(name + ": " + std::to_string(shots) + " shots" + label);
+                    for (const auto& [outcome, count] : memory.qreg(qmap.at(reg)).sample(qubits, shots))
+                        task_logs.push_back(name + ":   " + outcome_bits(outcome, qubits.size()) + ": " +
+                                            std::to_string(count));
+                }
+                if (shots > 0 && !sampled) histogram[record]++;
+            }
+            if (shots > 0 && !sampled) {
+                task_logs.push_back(name + ": " + std::to_string(shots) + " shots (re-simulated)" +
+                                    measured_label);
+                for (const auto& [bits, count] : histogram)
+                    task_logs.push_back(name + ":   " + bits + ": " + std::to_string(count));
+            }
+            std::cout << note.str();
+            if (target == Target::QPU && qpu_backend()) {
+                auto qir = emit_qir(instrs);
+                qpu_backend()->execute_qir(qir);
             }
-            for (auto& [name, id] : qmap) memory.release_qregister(id);
-            for (auto& [name, id] : cmap) memory.release_cregister(id);
+            std::cout << out.str() << std::flush;
+            logs.insert(logs.end(), task_logs.begin(), task_logs.end());
+            for (const auto& [g, count] : task_gates) gate_profile[g] += count;
+            for (const auto& [b, count] : task_branches) branch_profile[b] += count;
         }});
     };
 
@@ -295,7 +521,12 @@ int main(int argc, char** argv) {
         } else if (tok == "ENGINE") {
             std::string eng; iss >> eng;
             if (eng == "STABILIZER") {
-                std::cout << "stabilizer" << std::endl;
+                std::cout << "[runtime] engine stabilizer" << std::endl;
+                use_stabilizer = true;
+                clifford_specified = true;
+            } else if (eng == "DENSE") {
+                use_stabilizer = false;
+                clifford_specified = true;
             }
         } else if (!tok.empty()) {
             std::vector<std::string> parts;
@@ -0,0 +1,25 @@
+#include "../runtime/quidd.h"
+#include <iostream>
+#include <string>
+
+// Convert a dense checkpoint written by save_state_to_file into the compact
+// diagram format, streaming it so the dense vector is never held in memory.
+int main(int argc, char** argv) {
+    using namespace qpp;
+    if (argc != 3) {
+        std::cerr << "Usage: quidd_pack <checkpoint> <output.qdd>\n";
+        return 1;
+    }
+    QuIDD dd(std::size_t(0));
+    if (!dd.load(argv[1])) {
+        std::cerr << "Failed to read " << argv[1] << "\n";
+        return 1;
+    }
+    if (!dd.save(argv[2])) {
+        std::cerr << "Failed to write " << argv[2] << "\n";
+        return 1;
+    }
+    std::cout << dd.num_qubits() << " qubits, " << dd.node_count() << " nodes, "
+              << dd.memory_bytes() << " bytes\n";
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "../runtime/memory.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Per-gate cost of resolving a register id as qpp-run does, with 1 to 64
+// threads each driving its own register. "locked" repeats the lookup under
+// one shared mutex, as every lookup did before registers moved into slot
+// tables; "lookup" is memory.qreg(); "handle" resolves the id once.
+using namespace qpp;
+
+static std::mutex global_mtx;
+
+template<typename Body>
+static double run(std::size_t threads, std::size_t gates, Body body) {
+    std::vector<int> ids;
+    for (std::size_t t = 0; t < threads; ++t) ids.push_back(memory.create_qregister(1));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (std::size_t t = 0; t < threads; ++t)
+        pool.emplace_back([&, t] { body(ids[t], gates); });
+    for (auto& th : pool) th.join();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    memory.release_qregisters(ids);
+    return ns / double(gates * threads);
+}
+
+// Resolve the register and apply `op` to it `n` times in each of the
+// three ways, printing ns per operation over all threads.
+template<typename Op>
+static void table(const char* title, std::size_t gates, Op op) {
+    std::cout << title << "\nthreads  locked  lookup  handle  (ns per op, all threads)\n";
+    for (std::size_t threads = 1; threads <= 64; threads *= 2) {
+        double locked = run(threads, gates, [&](int id, std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) {
+                QRegister* q;
+                {
+                    std::lock_guard<std::mutex> lock(global_mtx);
+                    q = &memory.qreg(id);
+                }
+                op(*q);
+            }
+        });
+        double lookup = run(threads, gates, [&](int id, std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) op(memory.qreg(id));
+        });
+        double handle = run(threads, gates, [&](int id, std::size_t n) {
+            QRegHandle h = memory.qreg_handle(id);
+            for (std::size_t i = 0; i < n; ++i) op(*h);
+        });
+        std::cout << threads << "\t " << locked << "\t " << lookup << "\t " << handle << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    std::size_t gates = 1000000;
+    if (argc > 1) gates = std::stoul(argv[1]);
+    // The bookkeeping every interpreted gate does, without the gate.
+    // The fence keeps the compiler from folding the loop.
+    table("Lookup and op count", gates * 10, [](QRegister& q) {
+        ++q.op_count;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    });
+    table("Z gate on a 1-qubit register", gates, [](QRegister& q) { q.z(0); });
+    return 0;
+}